@@ -21,9 +21,20 @@
 /*
  * Private definitions: only used within the ARP module
  */
-#define MAX_ARP 			20      // max. number of ARP entries
-#define MAX_ARP_BUFFERS 		50	// max number of entries in message buffer
-#define ARP_CACHE_SIZE                  31      // ARP cache size
+#define DEFAULT_ARP_SIZE 		1024    // neighbor table slots (rounded up to a power of 2)
+#define MIN_ARP_SIZE 			64
+#define ARP_DEFAULT_TIMEOUT 		300     // seconds before an entry expires, 0 to never expire
+#define MAX_ARP_PENDING 		256	// next hops that can wait for resolution at once
+#define ARP_PENDING_QLEN 		16	// packets buffered per next hop (oldest dropped)
+#define ARP_REQUEST_INTERVAL 		1000	// milliseconds between requests for a next hop
+#define ARP_MAX_RETRIES 		3	// requests sent before the waiting packets are dropped
+#define ARP_TIMER_INTERVAL 		100	// milliseconds, granularity of the retransmit timer
+
+#define ARP_STALE 			2       // ARPFindEntry: valid entry, refresh requested
+
+#define ARP_ENTRY_EMPTY 		0       // never used: ends a probe sequence
+#define ARP_ENTRY_VALID 		1
+#define ARP_ENTRY_DELETED 		2       // deleted: probe sequences go past it
 
 /*
  * ARP protocol definitions.. used for ARP processing.
@@ -33,22 +44,52 @@
 
 
 /*
- * TODO: Expand this entry?? Should we not include other parameters such
- * as 
+ * neighbor table entry. the table is open addressed (linear probing) on
+ * the IP address. readers never lock: the writer makes seq odd while it
+ * changes the entry and readers retry if seq changed under them.
  */
 typedef struct _arp_entry_t
 {
-	bool is_empty;                          // entry used or not
+	volatile unsigned int seq;              // seqlock sequence, odd during an update
+	int state;                              // ARP_ENTRY_EMPTY, _VALID or _DELETED
 	uchar ip_addr[4];
 	uchar mac_addr[6];
+	unsigned long long updated;             // time of the last update (ns)
+	volatile int refreshing;                // a refresh request was sent for this entry
 } arp_entry_t;
 
 
-typedef struct _arp_buffer_entry_t
+/*
+ * the entries of the neighbor table. a table is replaced as a whole
+ * when it is rebuilt, so readers load the table pointer once per lookup,
+ * inside an epoch section.
+ */
+typedef struct _arp_table_t
+{
+	int size;                               // slots, a power of 2
+	int used;                               // slots not empty (valid or deleted)
+	arp_entry_t *entry;
+} arp_table_t;
+
+
+/*
+ * packets waiting for the resolution of one next hop. the packets are
+ * kept in a bounded FIFO; one request is outstanding per next hop and
+ * the retransmit timer repeats it until the reply comes or the retries
+ * run out.
+ */
+typedef struct _arp_pending_t
 {
 	bool is_empty;                          // entry used or not
-	gpacket_t *wait_msg;                    // message that is waiting for ARP resolution
-} arp_buffer_entry_t;
+	uchar nxth_ip_addr[4];
+	int interface;                          // interface the requests are sent on
+	gpacket_t *wait_msg[ARP_PENDING_QLEN];  // messages waiting for ARP resolution
+	int head;                               // oldest message
+	int count;
+	int retries;                            // requests sent so far
+	unsigned long long lastreq;             // time the last request was sent (ns)
+	int hnext;                              // next entry in the hash chain or free list
+} arp_pending_t;
 
 
 /*
@@ -71,17 +112,21 @@ typedef struct _arp_packet_t
 int ARPResolve(gpacket_t *in_pkt);
 void ARPProcess(gpacket_t *pkt);
 
-void ARPInitTable();
+void ARPInitTable(int size);
 int ARPFindEntry(uchar *ip_addr, uchar *mac_addr);
+int ARPFindFresh(uchar *ip_addr, uchar *mac_addr, unsigned long long *until);
 void ARPAddEntry(uchar *ip_addr, uchar *mac_addr);
-void ARPPrintTable(void);
-void ARPDeleteEntry(char *ip_addr);
+void ARPPrintTable(uchar *ip_addr);
+void ARPDeleteEntry(uchar *ip_addr);
+void ARPSetTimeout(int seconds);
+int ARPGetTimeout(void);
 void ARPSendRequest(gpacket_t *pkt);
 
 // ARP Buffer functions.. 
 void ARPInitBuffer();
 void ARPAddBuffer(gpacket_t *in_pkt);
-int ARPGetBuffer(gpacket_t **out_pkt, uchar *nexthop);
-void ARPFlushBuffer(char *next_hop, char *mac_addr);
+void ARPFlushBuffer(uchar *next_hop, uchar *mac_addr);
+void ARPPrintBuffer(void);
+void *ARPTimer(void *arg);
 
 #endif
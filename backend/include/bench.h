@@ -0,0 +1,25 @@
+/*
+ * bench.h (include file for the gRouter micro benchmarks)
+ *
+ */
+
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+
+#define BENCH_DEFAULT_PACKETS       1000000
+#define BENCH_FLOWS                 256
+#define BENCH_CKSUM_ITERATIONS      1000000
+#define BENCH_CKSUM_TRIALS          10000   // random buffers checked against the reference
+#define BENCH_CKSUM_MAXLEN          1500
+#define BENCH_CKSUM_KERNELS         3
+#define BENCH_SCHED_QUEUES          256
+#define BENCH_SCHED_DEPTH           8       // packets kept in each queue
+
+
+// Function prototypes
+void benchWorkers(int maxworkers, long npkts);
+void benchChecksum(long niters);
+void benchSched(int nqueues, long npkts);
+
+#endif
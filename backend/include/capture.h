@@ -0,0 +1,80 @@
+/*
+ * capture.h (include file for the packet capture)
+ *
+ * The frames sent and received on the interfaces are copied into a
+ * preallocated ring by the packet path and written out to the console
+ * (the .port FIFO) by a writer thread. See capture.c.
+ */
+
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+
+#include <pthread.h>
+#include <sys/uio.h>
+#include "grouter.h"
+#include "message.h"
+#include "classifier.h"
+#include "ringbuffer.h"
+
+
+#define CAPTURE_RING_SIZE           1024               // records in the capture ring (power of two)
+#define MAX_CAPTURE_LEN             (ETHER_HEADER_LEN + DEFAULT_MTU) // most bytes of a frame recorded
+#define CAPTURE_WRITE_BUF           65536              // bytes gathered for one write()
+#define CAPTURE_IDLE_US             1000               // writer sleep when the ring is empty
+
+#define CAPTURE_RX                  1                  // direction of a frame (pcapng epb_flags)
+#define CAPTURE_TX                  2
+
+#define CAPTURE_PCAP                0                  // output formats
+#define CAPTURE_PCAPNG              1
+
+
+typedef struct _caprec_t
+{
+	volatile unsigned long seq;           // same protocol as the ring buffer slots
+	unsigned long long ts;                // nanoseconds since the epoch
+	int caplen;
+	int origlen;
+	int dir;
+	uchar data[MAX_CAPTURE_LEN];
+} caprec_t;
+
+
+typedef struct _capture_t
+{
+	caprec_t *ring;
+	unsigned long mask;
+	char pad0[CACHE_LINE_SIZE];
+	volatile unsigned long head;          // next record claimed by the packet path
+	char pad1[CACHE_LINE_SIZE];
+	unsigned long tail;                   // next record read by the writer
+	char pad2[CACHE_LINE_SIZE];
+	volatile int enabled;
+	volatile int snaplen;
+	volatile int sample;                  // record one frame in sample
+	int format;
+	char filtername[MAX_NAME_LEN];        // class of the frames recorded, empty for all
+	cls_table_t * volatile filter;        // compiled filter class (epoch.h)
+	volatile int fd;                      // output, -1 if none
+	volatile int newfile;                 // the writer must start the file with a header
+	pthread_t writer;
+	unsigned long captured;               // frames put in the ring
+	unsigned long dropped;                // frames lost because the ring was full
+	unsigned long written;                // records written out
+	unsigned long errors;                 // failed writes
+} capture_t;
+
+
+// Function prototypes
+void captureInit(void);
+void captureFrame(struct iovec *iov, int niov, int len, int dir);
+void captureSetFile(int fd);
+void captureSetState(int on);
+int captureSetSnaplen(int snaplen);
+int captureSetSample(int sample);
+int captureSetFilter(char *cname);
+void captureRebuildFilter(void);
+int captureSetFormat(char *format);
+void capturePrint(void);
+
+#endif
@@ -0,0 +1,26 @@
+/*
+ * checksum.h (include file for the Internet checksum routines)
+ *
+ * checksum() (declared in grouter.h) computes the one's complement
+ * checksum of a buffer with the fastest kernel available; the others
+ * are exposed for the checksum benchmark (bench checksum).
+ */
+
+#ifndef __CHECKSUM_H__
+#define __CHECKSUM_H__
+
+#include "grouter.h"
+
+
+#define CKSUM_SIMD_MIN              256     // shorter buffers are summed with the 64-bit kernel
+
+
+// Function prototypes
+ushort checksumRef(uchar *buf, int iwords);
+ushort checksum64(uchar *buf, int iwords);
+#ifdef __SSE2__
+ushort checksumSSE2(uchar *buf, int iwords);
+#endif
+ushort checksumAdjust(ushort cksum, ushort oldval, ushort newval);
+
+#endif
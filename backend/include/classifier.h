@@ -8,9 +8,11 @@
 #define __CLASSIFIER_H__
 
 #include <slack/list.h>
+#include <stdint.h>
 #include "grouter.h"
 #include "classspec.h"
 #include "message.h"
+#include "ip.h"
 
 typedef struct _classdef_t
 {
@@ -32,6 +34,59 @@ typedef struct _classlist_t
 } classlist_t;
 
 
+/*
+ * Compiled form of a set of class definitions (tuple space search).
+ * Rules with the same source and destination prefix lengths form a
+ * tuple; each tuple hashes the masked address pair to a chain of
+ * rules. A lookup probes one bucket per tuple, and stops as soon as
+ * no remaining tuple holds a rule that would win over the best match.
+ * Rules belong to one of CLS_MAX_GROUPS groups and one lookup returns
+ * the best match of every group (e.g. a filter rule and a queue).
+ * The table is never modified after it is built: a change to classes
+ * or queues builds a new table and swaps the pointer.
+ */
+#define CLS_MAX_GROUPS              2
+
+typedef struct _cls_rule_t
+{
+	uint32_t src, dst;                  // masked prefixes, host order
+	ushort sport_lo, sport_hi;
+	ushort dport_lo, dport_hi;
+	uchar ports;                        // TRUE if a port range is given
+	uchar prot;                         // 0 matches all
+	uchar tos;                          // 0 matches all
+	int prio;                           // index in the name list, lower wins
+	int group;
+	int next;                           // next rule in the bucket, -1 ends
+} cls_rule_t;
+
+
+typedef struct _cls_tuple_t
+{
+	uint32_t srcmask, dstmask;
+	int minprio;                        // best rule in this tuple
+	int groupprio[CLS_MAX_GROUPS];      // best rule of each group in this tuple
+	int hashmask;
+	int *bucket;                        // first rule of each chain, sorted by prio
+} cls_tuple_t;
+
+
+typedef struct _cls_table_t
+{
+	int nrules;
+	cls_rule_t *rules;
+	int ntuples;
+	cls_tuple_t *tuples;                // sorted by minprio
+	int catchall[CLS_MAX_GROUPS];       // best rules matching non IP packets
+	int groupsize[CLS_MAX_GROUPS];      // number of rules in each group
+	int ngroups;
+	int nnames;
+	char (*names)[MAX_NAME_LEN];        // class name of each prio
+	int *values;                        // value given by the caller for each prio
+} cls_table_t;
+
+
+
 
 // Function prototypes
 
@@ -48,6 +103,12 @@ int insertPortRangeSpec(classlist_t *clas, char *cnarm, int srcside, port_range_
 int insertProtSpec(classlist_t *clas, char *cname, int prot);
 int insertTOSSpec(classlist_t *clas, char *cname, int tos);
 
+int getPacketPorts(ip_packet_t *ip_pkt, int *sport, int *dport);
 int isRuleMatching(classdef_t *cdef, gpacket_t *in_pkt);
 
+cls_table_t *compileClassTable(classlist_t *clas, char **cnames, int *groups, int *values, int n);
+void lookupClassTable(cls_table_t *ct, pkt_data_t *frame, int *match);
+void freeClassTable(cls_table_t *ct);
+void printClassTable(cls_table_t *ct);
+
 #endif
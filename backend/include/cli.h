@@ -73,6 +73,14 @@ void qdiscCmd();
 void spolicyCmd();
 void classCmd();
 void filterCmd();
+void poolCmd();
+void workerCmd();
+void benchCmd();
+void traceCmd();
+void fragCmd();
+void flowCmd();
+void cpuCmd();
+void snapshotCmd();
 
 
 
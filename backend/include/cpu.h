@@ -0,0 +1,76 @@
+/*
+ * cpu.h (include file for the thread placement of the gRouter)
+ *
+ * Every thread of the router has a role: the receive thread of an
+ * interface, a reactor thread, the scheduler, a packet worker, the GNET
+ * handler, the transmit thread of an interface, or a control thread
+ * (CLI, info). A role can be given a set of CPUs and a scheduling
+ * policy. In a role that spreads, thread i of the role runs on the i-th
+ * CPU of the set (round robin): the workers or the receive threads of
+ * several interfaces get a CPU each. A single thread of a role (e.g.
+ * rx:2, the receive thread of interface 2) can be given a placement of
+ * its own. Threads register when they start and are moved whenever the
+ * placement of their role changes.
+ *
+ * The ring of a queue is moved to the NUMA node of the thread that
+ * drains it: the work queue of a worker, the class queues of the
+ * scheduler, the output queue of the GNET handler, the transmit queue
+ * of an interface.
+ */
+
+#ifndef __CPU_H__
+#define __CPU_H__
+
+#include <sys/types.h>
+#include "grouter.h"
+#include "simplequeue.h"
+
+
+#define CPU_ROLE_RX                 0               // index: interface
+#define CPU_ROLE_REACTOR            1               // index: reactor thread
+#define CPU_ROLE_SCHED              2
+#define CPU_ROLE_WORKER             3               // index: worker
+#define CPU_ROLE_GNET               4
+#define CPU_ROLE_TX                 5               // index: interface
+#define CPU_ROLE_CONTROL            6
+#define CPU_MAX_ROLES               7
+
+#define CPU_MAX_THREADS             64
+#define CPU_MAX_QUEUES              128
+#define CPU_MAX_OVERRIDES           32
+#define CPU_MAX_NODES               64
+#define CPU_NAME_LEN                32
+
+#define CPU_POLICY_DEFAULT          -1              // leave the policy alone
+
+
+typedef struct _cputhread_t
+{
+	char name[CPU_NAME_LEN];
+	int role, index;
+	pid_t tid;                          // 0 if the slot is free
+} cputhread_t;
+
+
+typedef struct _cpuqueue_t
+{
+	simplequeue_t *q;                   // NULL if the slot is free
+	int role, index;                    // of the thread draining it
+	int node;                           // where it was moved, -1 if not moved
+} cpuqueue_t;
+
+
+// Function prototypes
+void cpuInit(void);
+int cpuRoleByName(char *name);
+char *cpuRoleName(int role);
+int cpuNode(int cpu);
+int cpuSetPlacement(int role, int index, char *cpulist, int spread, int policy, int prio);
+int cpuClearPlacement(int role, int index);
+void cpuThreadRegister(int role, int index, char *name);
+void cpuQueueRegister(simplequeue_t *q, int role, int index);
+void cpuQueueUnregister(simplequeue_t *q);
+char *cpuThreadPlacement(char *buf, int role, int index);
+void cpuPrint(void);
+
+#endif
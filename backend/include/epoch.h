@@ -0,0 +1,61 @@
+/*
+ * epoch.h (include file for the epoch based reclamation)
+ *
+ * The configuration read on the packet path -- the route and MTU
+ * tables, the compiled class table (classes, filter rules and queues)
+ * and the interface table -- is published as immutable snapshots. The
+ * ARP table and the flow cache are changed in place, but a rebuilt or
+ * resized table is swapped in and retired the same way. A writer (the
+ * CLI, or a packet worker that rebuilds the ARP table) builds a new
+ * snapshot off to the side, swaps the pointer to it in with
+ * epochPublish() and hands the old one to epochRetire(). A reader
+ * brackets the code that uses a snapshot with epochEnter()/epochExit():
+ * no lock, only a store to a record of its own. An object retired in
+ * epoch e is freed once no reader is still in a section it entered in
+ * epoch e or before, so a reader never sees a snapshot change or go
+ * away under it and never waits for a writer.
+ *
+ * Sections nest and must not block (no blocking queue reads or waits
+ * inside them): a writer that waits for a grace period waits for every
+ * reader to leave its section.
+ */
+
+#ifndef __EPOCH_H__
+#define __EPOCH_H__
+
+#include <sys/types.h>
+#include "grouter.h"
+#include "ringbuffer.h"
+
+
+#define EPOCH_MAX_THREADS   128     // readers with a record of their own
+
+
+// one per reader thread, on a cache line of its own
+typedef struct _epoch_thread_t
+{
+	volatile unsigned long epoch;       // epoch of the section entry, 0 outside
+	volatile int used;
+	pid_t tid;
+} __attribute__((aligned(CACHE_LINE_SIZE))) epoch_thread_t;
+
+
+typedef struct _epoch_retired_t
+{
+	void (*release)(void *);
+	void *obj;
+	unsigned long epoch;                // retired in
+	struct _epoch_retired_t *next;
+} epoch_retired_t;
+
+
+// Function prototypes
+void epochEnter(void);
+void epochExit(void);
+void *epochPublish(void * volatile *ptr, void *obj);
+void epochRetire(void (*release)(void *), void *obj);
+int epochReclaim(void);
+void epochSynchronize(void);
+void epochPrint(void);
+
+#endif
@@ -7,11 +7,32 @@
 
 
 
+#include "gnet.h"
+#include "message.h"
+#include "packetpool.h"
+
+
+#define RX_COPYBREAK                PKT_SMALL_FRAME     // received frames copied to a small buffer
+
+
+// packets allocated ahead of a receive; the ones not filled are kept.
+// with a jumbo MTU, the rest of a frame that does not fit in its packet
+// goes to the spare buffer of its slot.
+typedef struct _rxbatch_t
+{
+	gpacket_t *pkts[VPL_MAX_BATCH];
+	gpacket_t *spares[VPL_MAX_BATCH];
+	int nalloc;
+} rxbatch_t;
+
+
 /*
  * function prototypes
  */
 
-int findPacketSize(pkt_data_t *pkt);
+int findPacketSize(gpacket_t *pkt);
 
 void *toEthernetDev(void *arg);
+void toEthernetDevBatch(interface_t *iface, gpacket_t **pkts, int npkts);
 void* fromEthernetDev(void *arg);
+int pollEthernetDev(interface_t *iface, rxbatch_t *rx, int budget);
@@ -14,24 +14,37 @@
 #include "classspec.h"
 #include "message.h"
 #include "classifier.h"
+#include "ringbuffer.h"
 
 #define MAX_FILTER_RULES                   64
+#define MAX_FILTER_SLOTS                   16     // threads counting without atomics
 
 typedef struct _filterrule_t
 {
 	int type;                           // deny or allow
 	char cname[MAX_NAME_LEN];
-	int passes;
-	int failures;
+	int id;                             // counter index, kept while the rule moves
 } filterrule_t;
 
 
+// hit counters of one thread, indexed by rule id: passes are packets
+// allowed by the rule, failures packets denied by it
+typedef struct _filtercount_t
+{
+	unsigned long passes[MAX_FILTER_RULES];
+	unsigned long failures[MAX_FILTER_RULES];
+	char pad[CACHE_LINE_SIZE];
+} filtercount_t;
+
+
 typedef struct _filtertab_t
 {
 	filterrule_t *ruletab[MAX_FILTER_RULES];
 	int rulecnt;
 	int filteron;
 	classlist_t *clist;
+	int nslots;                         // counter slots handed out to threads
+	filtercount_t count[MAX_FILTER_SLOTS];
 } filtertab_t;
 
 
@@ -48,6 +61,7 @@ void moveRule(filtertab_t *ft, int rulenum, char *dir);
 void delFilterRule(filtertab_t *ft, int rulenum);
 int addFilterRule(filtertab_t *ft, int type, char *cname);
 
-int filteredPacket(filtertab_t *ft, gpacket_t *in_pkt);
+void countFilterRule(filtertab_t *ft, int id, int type);
+void getFilterRuleCount(filtertab_t *ft, int id, unsigned long *passes, unsigned long *failures);
 
 #endif
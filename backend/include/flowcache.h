@@ -0,0 +1,108 @@
+/*
+ * flowcache.h (include file for the flow cache)
+ *
+ * The flow cache remembers the decisions made for the first packet of
+ * a flow -- (source, destination, protocol, TOS, ports, ingress
+ * interface) -- so that the packets after it take one hash probe
+ * instead of the classifier, the route and MTU tables, the interface
+ * scan and the ARP table. The ingress classification caches the matches
+ * of the class table; the IP module caches the forwarding decision
+ * (egress interface, next hop and its MAC, MTU) or the fact that the
+ * packet is for the router.
+ *
+ * Nothing is ever removed from the cache: a decision is made under a
+ * generation number and is used while the generation is current. Any
+ * change to the routes, the MTU table (interfaces) or the ARP table
+ * bumps the forwarding generation; rebuilding the class table bumps
+ * the class generation. A next hop MAC is only used until its ARP entry
+ * is due for a refresh.
+ */
+
+#ifndef __FLOWCACHE_H__
+#define __FLOWCACHE_H__
+
+#include <stdint.h>
+#include "grouter.h"
+#include "message.h"
+#include "classifier.h"
+#include "ringbuffer.h"
+
+
+#define FLOW_DEFAULT_SIZE           4096            // entries, a power of two
+#define FLOW_MIN_SIZE               64
+#define FLOW_MAX_SIZE               (1 << 20)
+#define FLOW_MAX_SLOTS              64              // threads with counters of their own
+
+#define FLOW_MISS                   0               // flowLookup: no valid decision
+#define FLOW_LOCAL                  1               //  the packet is for the router
+#define FLOW_FORWARD                2               //  the packet is forwarded
+
+
+// 16 bytes, compared as a whole; the addresses in network byte order
+typedef struct _flow_key_t
+{
+	uchar src[4];
+	uchar dst[4];
+	ushort sport, dport;                // 0 unless ports is set
+	uchar prot;
+	uchar tos;
+	uchar ports;                        // TRUE if the packet carries the TCP/UDP ports
+	uchar iface;                        // ingress interface
+} flow_key_t;
+
+
+/*
+ * an entry is written under a sequence count: odd while a writer holds
+ * it. a reader copies the entry and takes the slow path if the count
+ * was odd or changed meanwhile.
+ */
+typedef struct _flow_entry_t
+{
+	volatile unsigned int seq;
+	unsigned int fgen;                  // forwarding generation of the decision, 0 if none
+	unsigned int cgen;                  // class generation of the matches, 0 if none
+	flow_key_t key;
+	short match[CLS_MAX_GROUPS];        // best rule of each class group (lookupClassTable)
+	cls_table_t *ctable;                // .. in this class table
+	unsigned long long until;           // the next hop MAC is used until then (getTimeNanos)
+	uchar nxth_ip_addr[4];
+	uchar mac_addr[6];
+	uchar action;                       // FLOW_LOCAL or FLOW_FORWARD
+	uchar redirect;                     // the source is on the next hop network (ICMP redirect)
+	uchar dst_interface;
+	uchar pad;
+	ushort mtu;
+} __attribute__((aligned(CACHE_LINE_SIZE))) flow_entry_t;
+
+
+typedef struct _flow_table_t
+{
+	int size;
+	flow_entry_t *entry;
+} flow_table_t;
+
+
+// counters of one thread
+typedef struct _flow_count_t
+{
+	unsigned long fhits, fmisses;       // forwarding decisions
+	unsigned long chits, cmisses;       // class lookups
+	unsigned long stores, collisions;   // entries written, .. over another flow
+} __attribute__((aligned(CACHE_LINE_SIZE))) flow_count_t;
+
+
+// Function prototypes
+void flowInit(int size);
+int flowSetSize(int size);
+void flowEnable(int on);
+void flowInvalidate(void);
+void flowInvalidateClasses(void);
+int flowLookup(gpacket_t *pkt, flow_entry_t *flow);
+void flowCacheLocal(flow_entry_t *flow);
+void flowCacheForward(flow_entry_t *flow, gpacket_t *pkt, int mtu, uchar *mac_addr,
+		      unsigned long long until, int redirect);
+int flowLookupClass(gpacket_t *pkt, cls_table_t *ctable, int *match, flow_entry_t *flow);
+void flowCacheClass(flow_entry_t *flow, cls_table_t *ctable, int *match);
+void flowPrint(int count);
+
+#endif
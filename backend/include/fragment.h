@@ -1,6 +1,82 @@
-
 #ifndef __FRAGMENT_H__
 #define __FRAGMENT_H__
 
+#include "message.h"
+
+#define REASM_HASH_SIZE             64
+#define MAX_REASM_PENDING           64        // datagrams being reassembled at a time
+#define MAX_REASM_FRAGS             64        // fragments held for one datagram
+#define MAX_REASM_HOLES             16        // holes in the data of one datagram
+#define DEFAULT_REASM_TIMEOUT       30        // seconds a datagram may take to arrive
+#define DEFAULT_REASM_MEMORY        (1024 * 1024)   // bytes of buffers the fragments may hold
+#define REASM_TIMER_INTERVAL        1000      // milliseconds between timeout checks
+#define REASM_MAX_LEN               65535     // largest IP datagram
+
+
+// the counters of the ipFrag and ipReasm objects of the IP MIB (RFC 2011) and a few more
+typedef struct _frag_stats_t
+{
+	unsigned long fragoks;           // datagrams fragmented
+	unsigned long fragcreates;       // fragments made
+	unsigned long fragshared;        // .. that share the data of their datagram
+	unsigned long fragfails;         // datagrams not fragmented (DF, no buffers)
+	unsigned long reqds;             // fragments received for reassembly
+	unsigned long oks;               // datagrams reassembled
+	unsigned long fails;             // datagrams given up; one of the following:
+	unsigned long timeouts;          //   not complete in time
+	unsigned long evicted;           //   dropped over the memory limit or for a new datagram
+	unsigned long toobig;            //   larger than the largest buffer
+	unsigned long invalid;           //   bad offset or length, too many fragments or holes
+	unsigned long duplicates;        // fragments with no new data
+	unsigned long overlaps;          // fragments with some data already received
+} frag_stats_t;
+
+
+// a hole in the data of a datagram being reassembled (RFC 815): bytes first to last
+typedef struct _reasm_hole_t
+{
+	int first;
+	int last;
+} reasm_hole_t;
+
+typedef struct _reasm_frag_t
+{
+	gpacket_t *pkt;                  // holds a reference
+	int off;                         // of its data in the datagram
+	int len;
+} reasm_frag_t;
+
+// a datagram being reassembled: (src, dst, id, prot) is its key
+typedef struct _reasm_entry_t
+{
+	int is_empty;
+	int hnext;                       // hash chain or free list
+	uchar src[4];                    // as in the header
+	uchar dst[4];
+	ushort id;
+	uchar prot;
+	int total;                       // data bytes, -1 until the last fragment arrives
+	int maxend;                      // end of the data received so far
+	int mem;                         // bytes of buffers held
+	unsigned long long created;      // getTimeNanos
+	int nholes;
+	reasm_hole_t holes[MAX_REASM_HOLES];
+	int nfrags;
+	reasm_frag_t frags[MAX_REASM_FRAGS];
+} reasm_entry_t;
+
+
+extern frag_stats_t fragstats;
+
+int needFragmentation(gpacket_t *pkt);
+int fragmentIPPacket(gpacket_t *pkt, gpacket_t **frags);
+void deallocateFragments(gpacket_t **pkt_frags, int num_frags);
+
+void reassemblyInit(void);
+gpacket_t *reassembleIPPacket(gpacket_t *in_pkt);
+void *reassemblyTimer(void *arg);
+int setReassemblyTimeout(int secs);
+int setReassemblyMemory(int bytes);
+void printFragStats(void);
 
 #endif
@@ -12,11 +12,14 @@
 #include "vpl.h"
 #include "device.h"
 #include "message.h"
+#include "simplequeue.h"
 #include <pthread.h>
 
 
 
 #define	MAX_INTERFACES					20      // max number of interfaces supported
+#define TX_QUEUE_SIZE                   512     // packets waiting for the transmit thread of an interface
+#define DEFAULT_TX_BURST                15000   // shaper bucket (bytes) if none is given
 
 
 #define INTERFACE_DOWN                  'D'     // the down state of the interface
@@ -47,9 +50,20 @@ typedef struct _interface_t
 	int iface_fd;						// file descriptor for ??
 	vpl_data_t *vpl_data;				// vpl library structure
 	pthread_t threadid;					// thread ID assigned to this interface
+	void *reactor;                      // reactor_t reading the interface in reactor mode, NULL otherwise
 	pthread_t sdwthread;
 	device_t *devdriver;				// the device driver that include toXDev and fromXDev functions
 	void *iarray;                       // pointer to interface array type
+	simplequeue_t *txq;                 // egress queue drained by the transmit thread
+	pthread_t txthread;                 // transmit thread of this interface
+	volatile int txstop;                // tells the transmit thread to exit
+	unsigned long tx_queued;            // packets put in txq
+	unsigned long tx_dropped;           // packets dropped because txq was full or the interface down
+	unsigned long tx_sent;              // packets handed to the device
+	int tx_rate;                        // egress shaper rate (kbit/s), 0 if not shaped
+	int tx_burst;                       // shaper bucket size (bytes)
+	double tx_tokens;                   // bytes the shaper lets through now
+	struct timeval tx_last;             // last refill of the shaper bucket
 } interface_t;
 
 
@@ -77,5 +91,8 @@ interface_t *GNETMakeTapInterface(char *device, uchar *mac_addr, uchar *nw_addr)
 interface_t *findInterface(int indx);
 void *delayedServerCall(void *arg);
 void *GNETHandler(void *outq);
+void *GNETTransmitter(void *arg);
+int changeInterfaceRate(int index, int rate, int burst);
+int changeInterfaceMTU(int index, int new_mtu);
 
 #endif //__GNET_H__
@@ -21,3 +21,68 @@ typedef struct pcaprec_hdr_s {
         uint32_t incl_len;       /* number of octets of packet saved in file */
         uint32_t orig_len;       /* actual length of packet */
 } pcaprec_hdr_t;
+
+
+#define PCAP_MAGIC               0xa1b2c3d4   /* microsecond timestamps */
+#define PCAP_NSEC_MAGIC          0xa1b23c4d   /* nanosecond timestamps */
+#define LINKTYPE_ETHERNET        1
+
+
+// pcapng (the next generation format) blocks used by the capture writer.
+// every block starts with its type and total length and ends with the
+// total length again.
+#define PCAPNG_SHB_TYPE          0x0A0D0D0A   /* section header block */
+#define PCAPNG_IDB_TYPE          0x00000001   /* interface description block */
+#define PCAPNG_EPB_TYPE          0x00000006   /* enhanced packet block */
+#define PCAPNG_BYTE_ORDER        0x1A2B3C4D
+
+#define PCAPNG_OPT_ENDOFOPT      0
+#define PCAPNG_OPT_IF_TSRESOL    9
+#define PCAPNG_OPT_EPB_FLAGS     2
+
+typedef struct pcapng_shb_s {
+        uint32_t block_type;
+        uint32_t block_len;
+        uint32_t byte_order;
+        uint16_t version_major;
+        uint16_t version_minor;
+        int64_t section_len;     /* -1: not specified */
+        uint32_t block_len2;
+} __attribute__((packed)) pcapng_shb_t;
+
+
+typedef struct pcapng_idb_s {
+        uint32_t block_type;
+        uint32_t block_len;
+        uint16_t linktype;
+        uint16_t reserved;
+        uint32_t snaplen;
+        uint16_t tsresol_code;   /* if_tsresol option: 10^-9 s */
+        uint16_t tsresol_len;
+        uint8_t tsresol;
+        uint8_t tsresol_pad[3];
+        uint32_t endofopt;
+        uint32_t block_len2;
+} __attribute__((packed)) pcapng_idb_t;
+
+
+// the enhanced packet block is followed by the packet data (padded to
+// 32 bits) and pcapng_epb_trailer_t
+typedef struct pcapng_epb_s {
+        uint32_t block_type;
+        uint32_t block_len;
+        uint32_t interface_id;
+        uint32_t ts_high;
+        uint32_t ts_low;
+        uint32_t incl_len;
+        uint32_t orig_len;
+} __attribute__((packed)) pcapng_epb_t;
+
+
+typedef struct pcapng_epb_trailer_s {
+        uint16_t flags_code;     /* epb_flags option: direction */
+        uint16_t flags_len;
+        uint32_t flags;
+        uint32_t endofopt;
+        uint32_t block_len2;
+} __attribute__((packed)) pcapng_epb_trailer_t;
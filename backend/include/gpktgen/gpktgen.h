@@ -0,0 +1,117 @@
+/*
+ * gpktgen.h (include file for the gRouter packet generator)
+ *
+ * gpktgen attaches to the interfaces of a gRouter over the VPL (the
+ * sockets a uswitch or a UML host would use), sends IP, UDP or TCP
+ * flows into one interface at given rates and receives them on
+ * another, to measure the forwarding throughput, loss, reordering and
+ * latency of the router on a single machine.
+ */
+
+#ifndef __GPKTGEN_H__
+#define __GPKTGEN_H__
+
+#include <stdint.h>
+#include <pthread.h>
+#include "vpl.h"
+#include "histogram.h"
+
+
+#define MAX_FLOWS                   1024
+#define MAX_FRAME_SIZE              9216           // a jumbo frame, like the gRouter
+#define MAX_HEADER_SIZE             54             // Ethernet, IP, TCP
+#define ETHER_HEADER_SIZE           14
+#define IP_HEADER_SIZE              20
+
+#define DEFAULT_DURATION            10             // seconds
+#define DEFAULT_BATCH               32             // frames per sendmmsg
+#define DEFAULT_DRAIN               1000           // ms to wait for late packets
+#define DEFAULT_FRAME_SIZE          128
+#define DEFAULT_RATE                1000.0         // packets per second
+#define DEFAULT_DPORT               5001
+#define ARP_RETRY                   500            // ms between ARP requests for the router
+#define ARP_TIMEOUT                 10             // seconds before giving up on the router
+#define RX_POLL                     100            // ms an rx thread waits before checking for the end
+#define TX_CATCHUP                  10000000ULL    // ns a flow may fall behind before its missed packets are skipped
+#define TX_SPIN                     200000ULL      // ns below which the tx thread spins instead of sleeping
+
+#define min(A,B)                    ( (A) < (B) ? (A):(B))
+
+#define GPKT_PROTO_RAW              253            // "IP" flows: experimental protocol (RFC 3692)
+#define PROBE_MAGIC                 0x47504b54     // "GPKT"
+
+
+// carried at the start of the payload of every packet sent
+typedef struct _probe_t
+{
+	uint32_t magic;
+	uint32_t flow;
+	uint64_t seq;
+	uint64_t ts;                          // CLOCK_MONOTONIC ns when sent
+} __attribute__((packed)) probe_t;
+
+
+// a port: one VPL connection to an interface of the router
+typedef struct _port_t
+{
+	char *sock;
+	vpl_data_t *vpl;
+	uint8_t mac[6];
+	uint32_t ip;                          // network byte order
+	uint32_t peerip;                      // the router on this link
+	uint8_t peermac[6];
+	volatile int resolved;                // peermac is known
+	pthread_t rxthread;
+	int counts;                           // the rx thread counts the probes
+	volatile uint64_t rxframes, rxother, arpreplies;
+} port_t;
+
+
+typedef struct _flow_t
+{
+	int id;
+	int proto;                            // IPPROTO_UDP, IPPROTO_TCP or GPKT_PROTO_RAW
+	uint32_t src, dst;                    // network byte order
+	uint16_t sport, dport;
+	int size;                             // frame size, without the FCS
+	double pps;                           // 0 sends as fast as possible
+	uint64_t interval, next;              // ns between packets, when the next is due
+	int hdrlen;
+	uint8_t hdr[MAX_HEADER_SIZE];         // Ethernet, IP and L4 header template
+
+	// written by the tx thread
+	uint64_t seq;                         // of the next packet
+	volatile uint64_t sent, sentbytes, txerrors;
+	// written by the rx thread of the out port
+	volatile uint64_t received, rcvbytes, reordered, expected;
+	uint64_t latsum, latmax;
+	uint64_t hist[HIST_BUCKETS];          // latencies (ns), see histogram.h
+} flow_t;
+
+
+typedef struct _gpktgen_config_t
+{
+	port_t in, out;                       // out is in if there is a single port
+	port_t *outp;
+	flow_t *flows;
+	int nflows;
+	int duration, batch, drain, interval;
+	volatile int running;                 // rx threads stop when cleared
+	volatile int sending;                 // the tx thread stops when cleared
+	uint64_t started, stopped;            // ns, first and last transmission
+} gpktgen_config_t;
+
+
+extern int debug_flag;
+extern gpktgen_config_t gconf;
+
+// Function prototypes
+void verbose(int level, char *fmt, ...);
+uint64_t nowNanos(void);
+
+void buildFlowHeader(flow_t *f, port_t *p);
+void *txThread(void *arg);
+void *rxThread(void *arg);
+int resolvePeer(port_t *p, uint32_t ip);
+
+#endif
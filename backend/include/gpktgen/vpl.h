@@ -0,0 +1,72 @@
+/*
+ * vpl.h (virtual physical layer of the packet generator)
+ *
+ * The same wire protocol as the gRouter (src/grouter/vpl.c): a stream
+ * control socket to exchange the addresses of the data sockets, then
+ * one Ethernet frame per datagram.
+
+ * This code is based on code borrowed from different portions
+ * of the UML source code. The original code is copyrighted as follows:
+
+ * Copyright (C) 2001 Lennert Buytenhek (buytenh@gnu.org) and
+ * James Leu (jleu@mindspring.net).
+ * Copyright (C) 2001 by various other people who didn't put their name here.
+ * Licensed under the GPL.
+ */
+
+#ifndef __VPL_H__
+#define __VPL_H__
+
+
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/time.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define SWITCH_VERSION           3
+#define VPL_MAX_BATCH            64                // most frames moved by one recvmmsg/sendmmsg
+
+typedef struct _vpl_data_t {
+	char *sock_type;
+	char *ctl_sock;
+	void *ctl_addr;
+	void *data_addr;
+	void *local_addr;
+	int data;
+	int control;
+} vpl_data_t;
+
+
+
+enum request_type { REQ_NEW_CONTROL };
+
+#define SWITCH_MAGIC 0xfeedface
+
+struct request_v3 {
+	uint32_t magic;
+	uint32_t version;
+	enum request_type type;
+	struct sockaddr_un sock;
+};
+
+
+/* function prototypes for internal routines */
+int __vpl_sendto(int fd, void *buf, int len, void *to, int sock_len);
+
+
+/* function prototypes for external routines */
+struct sockaddr_un *new_addr(void *name, int len);
+struct sockaddr_un *dup_addr(struct sockaddr_un *sock);
+vpl_data_t *vpl_connect(char *sock_name);
+vpl_data_t *vpl_create_server(char *name);
+int vpl_accept_connect(vpl_data_t *v);
+int vpl_sendto(vpl_data_t *vpl, void *buf, int len);
+int vpl_recvmmsg(vpl_data_t *vpl, struct iovec *iovs, int *lens, int nbufs, int timeout_ms);
+int vpl_sendmmsg(vpl_data_t *vpl, struct iovec *iovs, int nbufs);
+
+#endif
@@ -32,7 +32,7 @@
 #define MAX_DNAME_LEN		    	32
 #define MAX_TYPES_PER_MODULE        8
 #define MAX_TMPBUF_LEN              256
-#define MAX_FRAGMENTS               16
+#define MAX_FRAGMENTS               192           // a jumbo datagram at the smallest MTU
 
 #define BIG_PACKET_LEN              2500
 
@@ -44,13 +44,16 @@
 #define LARGE_REAL_NUMBER           99.0E7
 #define SMALL_REAL_NUMBER           0.99E-6
 #define INFINITE_Q_SIZE             99999999
+#define WORK_Q_SIZE                 4096
 
 #define TRUE                        1
 #define FALSE                       0
 
 #define MAX_DOUBLE 		    		(double)LONG_MAX
 #define MSG_TYPE_MAX     	    	20                  // max number of message types accepted by a module??
-#define DEFAULT_MTU	            	1500		// max MTU size for the router's interfaces
+#define DEFAULT_MTU	            	1500		// MTU of the router's interfaces unless set
+#define MAX_JUMBO_MTU               9000        // largest MTU of an interface (jumbo frames)
+#define MIN_MTU                     68          // smallest MTU of an interface (RFC 791)
 
 #define max(A,B)                    ( (A) > (B) ? (A):(B))
 #define min(A,B)                    ( (A) < (B) ? (A):(B))
@@ -88,7 +91,13 @@ typedef struct _router_config
 	pthread_t clihandler;
 	pthread_t scheduler;
 	pthread_t worker;
-	int schedcycle;
+	int schedrate;                     // aggregate egress rate (kbps), 0 is unlimited
+	int schedburst;                    // burst allowance of the egress rate (bytes)
+	int poolsize;                      // number of packet buffers in the packet pool
+	int nworkers;                      // number of packet worker threads
+	int arpsize;                       // number of slots in the neighbor (ARP) table
+	int iobatch;                       // frames per system call on the interfaces, 1 is unbatched
+	int iothreads;                     // reactor threads reading the interfaces, 0 for a thread per interface
 	char schedpolicy[MAX_NAME_LEN];
 } router_config;
 
@@ -102,12 +111,13 @@ int Colon2MAC(char *buf, uchar mac_addr[]);
 char *MAC2Colon(char *buf, uchar mac_addr[]);
 double subTimeVal(struct timeval *v2, struct timeval *v1);
 void printTimeVal(struct timeval *v);
+unsigned long long getTimeNanos();
 char *getCurrentTimeVal();
 int gAtoi(char *str);
 
 unsigned char *gHtonl(uchar tval[], uchar val[]);
 unsigned char *gNtohl(uchar tval[], uchar val[]);
-ushort checksum(uchar *buf, int iwords);
+ushort checksum(uchar *buf, int iwords);                  // see checksum.c
 
 
 // function prototypes for code in router.c
@@ -12,14 +12,22 @@
 #define USAGE_ROUTE         "route action [action specific options]"
 #define USAGE_ARP           "arp action [action specific options]"
 #define USAGE_PING          "ping [options] target"
-#define USAGE_CONSOLE    	"port (type) [restart]"
+#define USAGE_CONSOLE    	"console [show | restart | on | off | snaplen bytes | sample N | filter class | none | format pcap | pcapng]"
 #define USAGE_HALT          "halt"
 #define USAGE_EXIT          "exit"
 #define USAGE_QUEUE   	    "queue action [action specific options]"
-#define USAGE_QDISC			"qdisc qname tspec"
-#define USAGE_SPOLICY		"spolicy action [action specific options]"
+#define USAGE_QDISC			"qdisc [show [qname] | set qname disc [-param value ...]]"
+#define USAGE_SPOLICY		"spolicy [show | activate rr|drr|wfq|prio]"
 #define USAGE_CLASS		    "class cname [-src ip_spec [<min_port--max_port>]] [-dst ip_spec [<min_port--max_port>]] [-prot num] [-tos tos_spec]"
 #define USAGE_FILTER     	"filter action [action specific options]"
+#define USAGE_POOL          "pool show"
+#define USAGE_WORKER        "worker show"
+#define USAGE_BENCH         "bench (workers [max_workers] [num_packets] | checksum [num_calls] | sched [num_queues] [num_packets])"
+#define USAGE_TRACE         "trace (show [count] | on event|all | off event|all | list | clear | dump file | decode file [count])"
+#define USAGE_FRAG          "frag [show | timeout seconds | memory kbytes]"
+#define USAGE_FLOW          "flow [show [count] | on | off | flush | size entries]"
+#define USAGE_CPU           "cpu [show] | cpu set role[:index] cpulist [-spread|-share] [-fifo prio|-other] | cpu clear role[:index]"
+#define USAGE_SNAPSHOT      "snapshot [show]"
 
 
 #define SHELP_HELP          "display help information on given command"
@@ -31,14 +39,22 @@
 #define SHELP_ROUTE         "add, del, and modify the route information"
 #define SHELP_ARP           "add, del, and modify ARP table information"
 #define SHELP_PING          "ping another router or machine"
-#define SHELP_CONSOLE       "manage port (FIFO) used to interact with wireshark and visualizer"
+#define SHELP_CONSOLE       "manage port (FIFO) and packet capture used by wireshark and visualizer"
 #define SHELP_HALT          "halt the router"
 #define SHELP_EXIT          "exit the command shell"
 #define SHELP_QUEUE			"create, add, del, and view queues with given names"
-#define SHELP_QDISC			"create a queuing discipline"
+#define SHELP_QDISC			"show and set the queuing discipline (fifo, red, codel, pie, fq_codel) of a queue"
 #define SHELP_SPOLICY		"set the inter queue scheduler"
 #define SHELP_CLASS		    "create add, del, and view classifier information"
 #define SHELP_FILTER		"create add, del, and view filtering rules; this uses class rules to group packets"
+#define SHELP_POOL          "view the packet buffer pool usage"
+#define SHELP_WORKER        "view the packet worker statistics"
+#define SHELP_BENCH         "run a forwarding, checksum or scheduler micro benchmark"
+#define SHELP_TRACE         "record and decode binary trace events of the packet path"
+#define SHELP_FRAG          "view and set the IP fragmentation and reassembly limits and counters"
+#define SHELP_FLOW          "view and control the flow cache of forwarding and class decisions"
+#define SHELP_CPU           "place the router threads on CPUs and NUMA nodes"
+#define SHELP_SNAPSHOT      "show the versions of the configuration snapshots read by the packet threads"
 
 
 /*
@@ -76,5 +92,13 @@ absolute path (e.g., /sbin/ifconfig). \n"
 #define LHELP_SPOLICY		"spolicy.hlp"
 #define LHELP_CLASS			"class.hlp"
 #define LHELP_FILTER		"filter.hlp"
+#define LHELP_POOL          "pool.hlp"
+#define LHELP_WORKER        "worker.hlp"
+#define LHELP_BENCH         "bench.hlp"
+#define LHELP_TRACE         "trace.hlp"
+#define LHELP_FRAG          "frag.hlp"
+#define LHELP_FLOW          "flow.hlp"
+#define LHELP_CPU           "cpu.hlp"
+#define LHELP_SNAPSHOT      "snapshot.hlp"
 
 #endif
@@ -0,0 +1,71 @@
+/*
+ * histogram.h (log-linear latency histograms)
+ *
+ * Shared by the gRouter statistics segment and gpktgen. Values (ns)
+ * below 2^HIST_SUB_BITS have a bucket each, above that every power of
+ * two is split into 2^(HIST_SUB_BITS-1) buckets, so a bucket is at most
+ * 1/16th of its value wide. Values from 2^HIST_MAX_BITS (about 68 s) on
+ * go to the last bucket.
+ */
+
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+#include <stdint.h>
+
+
+#define HIST_SUB_BITS               5
+#define HIST_MAX_BITS               36
+#define HIST_BUCKETS                ((1 << HIST_SUB_BITS) + \
+				     (HIST_MAX_BITS - HIST_SUB_BITS) * (1 << (HIST_SUB_BITS - 1)))
+
+
+// the bucket counting value v
+static inline int histIndex(uint64_t v)
+{
+	int e;
+
+	if (v < (1ULL << HIST_SUB_BITS))
+		return (int)v;
+	if (v >= (1ULL << HIST_MAX_BITS))
+		return HIST_BUCKETS - 1;
+
+	// e: position of the top bit, the next SUB_BITS-1 bits pick the bucket
+	e = 63 - __builtin_clzll(v);
+	return (1 << HIST_SUB_BITS) + (e - HIST_SUB_BITS) * (1 << (HIST_SUB_BITS - 1)) +
+		(int)((v >> (e - HIST_SUB_BITS + 1)) - (1 << (HIST_SUB_BITS - 1)));
+}
+
+
+// the largest value counted in bucket i
+static inline uint64_t histValue(int i)
+{
+	int e, sub;
+
+	if (i < (1 << HIST_SUB_BITS))
+		return i;
+	i -= (1 << HIST_SUB_BITS);
+	e = HIST_SUB_BITS + (i >> (HIST_SUB_BITS - 1));
+	sub = (i & ((1 << (HIST_SUB_BITS - 1)) - 1)) + (1 << (HIST_SUB_BITS - 1));
+	return ((uint64_t)(sub + 1) << (e - HIST_SUB_BITS + 1)) - 1;
+}
+
+
+// the value below which pct percent of the count values in hist fall
+static inline uint64_t histPercentile(uint64_t *hist, uint64_t count, double pct)
+{
+	uint64_t rank, seen = 0;
+	int i;
+
+	if (count == 0)
+		return 0;
+	rank = (uint64_t)(pct / 100.0 * count + 0.999999);
+	if (rank < 1)
+		rank = 1;
+	for (i = 0; i < HIST_BUCKETS; i++)
+		if ((seen += hist[i]) >= rank)
+			return histValue(i);
+	return histValue(HIST_BUCKETS - 1);
+}
+
+#endif
@@ -89,4 +89,6 @@ typedef struct _pingstat_t
 void ICMPSendPingPacket(uchar *dst_ip, int size, int seq);
 void ICMPProcessEchoRequest(gpacket_t *in_pkt);
 void ICMPProcessEchoReply(gpacket_t *in_pkt);
+void ICMPProcessFragNeeded(gpacket_t *in_pkt, int interface_mtu);
+void ICMPProcessFragTimeExceeded(gpacket_t *in_pkt);
 #endif
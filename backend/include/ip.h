@@ -55,19 +55,28 @@ typedef struct _ip_packet_t
 #define RESET_DF_BITS(X)                X = ( X & (~(0x00001 << 14)) )
 #define RESET_MF_BITS(X)                X = ( X & (~(0x00001 << 13)) )
 
+#define IP_OPT_EOL                      0       // end of the option list
+#define IP_OPT_NOP                      1       // no operation (padding)
+#define IP_OPT_COPIED(X)                ((X) & 0x80)   // copied into every fragment
+
 
 // function prototypes...
 
+struct _flow_entry_t;
+
 void IPInit();
 void IPIncomingPacket(gpacket_t *in_pkt);
 int IPCheckPacket4Me(gpacket_t *in_pkt);
 int IPProcessBcastPacket(gpacket_t *in_pkt);
-int IPProcessForwardingPacket(gpacket_t *in_pkt);
+int IPForwardFlowPacket(gpacket_t *in_pkt, struct _flow_entry_t *flow);
+int IPProcessForwardingPacket(gpacket_t *in_pkt, struct _flow_entry_t *flow);
 int IPCheck4Errors(gpacket_t *in_pkt);
+int IPDecrementTTL(ip_packet_t *ip_pkt);
 int IPCheck4Fragmentation(gpacket_t *in_pkt);
 int IPCheck4Redirection(gpacket_t *in_pkt);
 int IPProcessMyPacket(gpacket_t *in_pkt);
 int UDPProcess(gpacket_t *in_pkt);
+int IPSendFragments(gpacket_t *pkt);
 int IPOutgoingPacket(gpacket_t *pkt, uchar *dst_ip, int size, int newflag, int src_prot);
 int send2Output(gpacket_t *pkt);
 int IPVerifyPacket(ip_packet_t *ip_pkt);
@@ -10,18 +10,23 @@
 #define __MESSAGE_H__
 
 #include <sys/types.h>
+#include <sys/uio.h>
 #include "grouter.h"
 
 
 #define MAX_IPREVLENGTH_ICMP            50       // maximum previous header sent back
 
 
-#define MAX_MESSAGE_SIZE                sizeof(gpacket_t)
+#define ETHER_HEADER_LEN                14       // destination, source, protocol
+#define MAX_FRAME_LEN                   (ETHER_HEADER_LEN + MAX_JUMBO_MTU)
+#define PKT_HEADROOM                    66       // room for headers in front of the frame; 64 + 2
+                                                 // puts the IP header on a 4-byte boundary
+#define PKT_MAX_SEGS                    4        // segments chained after the head buffer
 
 
-
-// this is just an ethernet frame with
-// a maximum payload definition.
+// a view of an Ethernet frame: the header and a payload of up to
+// the largest MTU. it overlays the data of a packet (GPKT_ETH);
+// only the bytes of the frame are there.
 // (TODO: revise it to use standard structures)
 typedef struct _pkt_data_t
 {
@@ -31,7 +36,7 @@ typedef struct _pkt_data_t
 		uchar src[6];                // source host's MAC address (filled by gnet)
 		ushort prot;                // protocol field
 	} header;
-	uchar data[DEFAULT_MTU];             // payload (limited to maximum MTU)
+	uchar data[MAX_JUMBO_MTU];           // payload
 } pkt_data_t;
 
 
@@ -45,17 +50,57 @@ typedef struct _pkt_frame_t
 	uchar nxth_ip_addr[4];           // destination interface IP address; required by ARP, filled IP
 	int arp_valid;
 	int arp_bcast;
+	int refcnt;                      // references held on the packet (see packetpool.c)
+	unsigned long long qtime;        // when it entered its class queue (getTimeNanos), see qdisc.c
 } pkt_frame_t;
 
 
+struct _gpacket_t;
+
+// bytes of a frame held in the buffer of another packet
+typedef struct _pktseg_t
+{
+	struct _gpacket_t *owner;        // holds a reference on the buffer
+	uchar *data;
+	int len;
+} pktseg_t;
+
+
+/*
+ * a packet: the GINI frame and a buffer from the packet pool (see
+ * packetpool.c). the Ethernet frame starts at data, PKT_HEADROOM bytes
+ * into the buffer, and its first len bytes are in the buffer; a frame
+ * that does not fit goes on in segments. the headers of a frame are
+ * always in the buffer. use the GPKT_ macros and the gpkt routines
+ * rather than offsets into the buffer.
+ */
 typedef struct _gpacket_t 
 {
 	pkt_frame_t frame;
-	pkt_data_t data;
+	uchar *data;                     // start of the frame
+	int len;                         // bytes of the frame in the buffer
+	int size;                        // bytes of the buffer
+	int sclass;                      // size class of the buffer in the pool
+	int nsegs;
+	pktseg_t segs[PKT_MAX_SEGS];
+	uchar buf[0];                    // headroom, frame, tailroom
 } gpacket_t;
 
 
+#define GPKT_ETH(P)                     ((pkt_data_t *)((P)->data))          // Ethernet header and payload
+#define GPKT_PAYLOAD(P)                 ((P)->data + ETHER_HEADER_LEN)       // IP or ARP packet
+#define GPKT_TAILROOM(P)                ((int)((P)->buf + (P)->size - ((P)->data + (P)->len)))
+#define GPKT_ROOM(P)                    ((int)((P)->buf + (P)->size - (P)->data))   // frame bytes the buffer takes
+
+
+int gpktLength(gpacket_t *pkt);
+void gpktSetLength(gpacket_t *pkt, int len);
+uchar *gpktPut(gpacket_t *pkt, int len);
+int gpktAddSeg(gpacket_t *pkt, gpacket_t *owner, uchar *data, int len);
+int gpktCopyOut(gpacket_t *pkt, int off, uchar *dst, int len);
+int gpktIovec(gpacket_t *pkt, struct iovec *iov, int len);
 gpacket_t *duplicatePacket(gpacket_t *inpkt);
+gpacket_t *duplicatePacketHead(gpacket_t *inpkt, int len);
 void printSepLine(char *start, char *end, int count, char sep);
 void printGPktFrame(gpacket_t *msg, char *routine);
 void printGPacket(gpacket_t *msg, int level, char *routine);
@@ -10,6 +10,7 @@
 #define _MTU_H_
 
 #include "grouter.h"
+#include <pthread.h>
 
 
 #define MAX_MTU                         20  // maximum mtu table size, better to be equal to CONN_MAX
@@ -31,6 +32,33 @@ typedef struct _mtu_entry_t
 	uchar ip_addr[4];
 } mtu_entry_t;
 
-void MTUTableInit(mtu_entry_t mtable[]);
+
+// a published snapshot of the table, never changed
+typedef struct _mtu_snapshot_t
+{
+	mtu_entry_t entry[MAX_MTU];
+} mtu_snapshot_t;
+
+
+/*
+ * the MTU table: read through the current snapshot inside an epoch
+ * section (epoch.h), changed by swapping in a changed copy
+ */
+typedef struct _mtu_table_t
+{
+	pthread_mutex_t lock;              // serialises the writers
+	mtu_snapshot_t * volatile snap;
+	unsigned long version;             // snapshots published so far
+} mtu_table_t;
+
+
+mtu_table_t *createMTUTable(void);
+void printMTUTable(mtu_table_t *mtbl);
+void printMTUTableVersion(mtu_table_t *mtbl);
+int findMTU(mtu_table_t *mtbl, int index);
+int findInterfaceIP(mtu_table_t *mtbl, int index, uchar *ip_addr);
+int findAllInterfaceIPs(mtu_table_t *mtbl, uchar buf[][4]);
+void deleteMTUEntry(mtu_table_t *mtbl, int index);
+void addMTUEntry(mtu_table_t *mtbl, int index, int mtu, uchar *ip_addr);
 
 #endif //_MTU_H_
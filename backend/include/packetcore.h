@@ -17,6 +17,9 @@
 #include "message.h"
 #include "grouter.h"
 #include "simplequeue.h"
+#include "tokenbucket.h"
+#include "classifier.h"
+#include "pktsched.h"
 
 
 typedef struct _pktcorecnamecache_t
@@ -26,21 +29,45 @@ typedef struct _pktcorecnamecache_t
 } pktcorecnamecache_t;
 
 
+#define MAX_WORKERS                 32
+
+// rule groups of the compiled class table
+#define CLS_GROUP_FILTER            0
+#define CLS_GROUP_QUEUE             1
+
+
+// a packet worker runs packetProcessor() on its own work queue. its
+// counters are in the statistics segment (stats.c), written only by
+// the worker thread itself.
+typedef struct _pktworker_t
+{
+	int id;
+	pthread_t threadid;
+	simplequeue_t *workQ;
+	struct _pktcore_t *pcore;
+	struct _statsthread_t *stats;
+} pktworker_t;
+
+
 typedef struct _pktcore_t
 {
 	char name[MAX_NAME_LEN];
 	char spolicy[MAX_NAME_LEN];
-	pthread_cond_t schwaiting;
+	pthread_cond_t schwaiting;            // CLOCK_MONOTONIC, for the release of delayed queues
+	int schsleeping;                      // the scheduler waits on schwaiting, under qlock
 	pthread_mutex_t qlock;                // lock for the main queue
 	pthread_mutex_t wqlock;               // lock for work queue
 	simplequeue_t *outputQ;
-	simplequeue_t *workQ;
+	simplequeue_t *workQ;                 // work queue of worker 0
+	int nworkers;
+	pktworker_t workers[MAX_WORKERS];
 	Map *queues;
-	int lastqid;
-	int packetcnt;
+	sched_t *sched;                       // scheduler of the queues, under qlock
 	int maxqsize;
-	double vclock;
+	tokenbucket_t egress;                 // aggregate rate limit on the scheduler output
 	pktcorecnamecache_t *pcache;
+	cls_table_t * volatile ctable;        // compiled classes of the filter and the queues (epoch.h)
+	unsigned long cversion;               // class tables published so far
 } pktcore_t;
 
 
@@ -53,17 +80,29 @@ void printAllQueues(pktcore_t *pcore);
 void printQueueStats(pktcore_t *pcore);
 void printOneQueue(pktcore_t *pcore, char *qname);
 void modifyQueueWeight(pktcore_t *pcore, char *qname, double weight);
-void modifyQueueDiscipline(pktcore_t *pcore, char *qname, char *qdisc);
+int modifyQueueDiscipline(pktcore_t *pcore, char *qname, char *qdisc);
+void modifyQueueDelay(pktcore_t *pcore, char *qname, double delay_us);
+int modifyQueueShaper(pktcore_t *pcore, char *qname, double ratekbps, double ceilkbps, int burst);
+int modifyQueueParent(pktcore_t *pcore, char *qname, char *pname);
+int getPktCoreClassStats(pktcore_t *pcore, schedclassstats_t *stats, int max);
+int setPktCoreQdiscParam(pktcore_t *pcore, char *qname, char *param, double value);
+void printPktCoreQdiscs(pktcore_t *pcore, char *qname);
+void modifyQueuePriority(pktcore_t *pcore, char *qname, int prio);
+int setPktCoreSchedPolicy(pktcore_t *pcore, char *policy);
+void printPktCoreSched(pktcore_t *pcore);
 int delPktCoreQueue(pktcore_t *pcore, char *qname);
+void rebuildPktCoreClassTable(pktcore_t *pcore);
+int classifyPacket(pktcore_t *pcore, gpacket_t *in_pkt, char **pkttag);
 
 pthread_t PktCoreSchedulerInit(pktcore_t *pcore);
+int PktCoreEnqueue(pktcore_t *pcore, gpacket_t *in_pkt, char *qkey);
+void *PktCoreScheduler(void *pc);
 int PktCoreWorkerInit(pktcore_t *pcore);
-void *packetProcessor(void *pc);
-
+void PktCoreWorkerHalt(pktcore_t *pcore);
+void *packetProcessor(void *arg);
+unsigned int flowHash(gpacket_t *pkt);
+int dispatchPacket(pktcore_t *pcore, gpacket_t *pkt, int pktsize);
+void printWorkers(pktcore_t *pcore);
+void printPktCoreClassVersion(pktcore_t *pcore);
 
-// Function prototypes from roundrobin.c and wfq.c??
-void *weightedFairScheduler(void *pc);
-int weightedFairQueuer(pktcore_t *pcore, gpacket_t *in_pkt, int pktsize, char *qkey);
-int roundRobinQueuer(pktcore_t *pcore, gpacket_t *in_pkt, int pktsize, char *qkey);
-void *roundRobinScheduler(void *pc);
 #endif
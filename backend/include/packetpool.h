@@ -0,0 +1,52 @@
+/*
+ * packetpool.h (include file for the packet buffer pool)
+ *
+ */
+
+#ifndef __PACKET_POOL_H__
+#define __PACKET_POOL_H__
+
+#include "message.h"
+
+
+#define DEFAULT_POOL_SIZE           4096          // standard buffers in the pool
+#define POOL_CACHE_SIZE             64            // buffers held in a thread cache
+#define POOL_CACHE_BATCH            32            // buffers moved between cache and pool
+
+// size classes of the buffers: bytes of a buffer (headroom, frame and tailroom)
+#define PKT_CLASS_SMALL             0             // ARP, TCP ACKs, ...
+#define PKT_CLASS_STD               1             // up to a full frame at the default MTU
+#define PKT_CLASS_JUMBO             2             // up to a full frame at MAX_JUMBO_MTU
+#define PKT_NCLASSES                3
+
+#define PKT_SMALL_SIZE              256
+#define PKT_STD_SIZE                1600
+#define PKT_JUMBO_SIZE              9216
+#define PKT_SMALL_FRAME             (PKT_SMALL_SIZE - PKT_HEADROOM)   // largest frame in a small buffer
+
+
+typedef struct _pktpoolstats_t
+{
+	int bufsize;                          // bytes of a buffer (0 for all classes)
+	int total;                            // buffers in the pre-allocated slab
+	int free;                             // buffers in the shared free stack
+	int cached;                           // buffers parked in thread caches
+	int inuse;                            // slab buffers held by the router
+	unsigned long allocs;                 // packets handed out
+	unsigned long releases;               // packets given back
+	unsigned long exhausted;              // allocations served from the heap (pool empty)
+	int heapinuse;                        // heap packets currently alive
+} pktpoolstats_t;
+
+
+// Function prototypes
+int PacketPoolInit(int npkts);
+gpacket_t *newPacket();
+gpacket_t *newPacketSize(int len);
+gpacket_t *holdPacket(gpacket_t *pkt);
+void releasePacket(gpacket_t *pkt);
+void getPacketPoolStats(pktpoolstats_t *pstats);
+void getPacketClassStats(int sclass, pktpoolstats_t *pstats);
+void printPacketPool();
+
+#endif
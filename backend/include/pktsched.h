@@ -0,0 +1,182 @@
+/*
+ * pktsched.h (include file for the packet scheduler engine)
+ *
+ * The scheduler decides which class queue of the packet core sends
+ * next. The per queue state is kept in one array (indexed by the
+ * schedid of the queue) and the policies keep the backlogged queues in
+ * a min-heap or a list of that array, so picking the next packet is
+ * O(log Q) or O(1) however many queues are defined. See sched.c.
+ *
+ * A queue with a delay (delay_us) only goes to the policy once its head
+ * packet has been queued that long; until then it waits on the timer
+ * heap and schedNextRelease tells when the next one is due. The same
+ * heap holds the queues the shaper (htb.c) keeps back until their class
+ * has tokens again.
+ *
+ * The engine does no locking: the packet core calls it with its qlock
+ * held (PktCoreEnqueue, PktCoreScheduler), the benchmark from a single
+ * thread.
+ */
+
+#ifndef __PKTSCHED_H__
+#define __PKTSCHED_H__
+
+#include "grouter.h"
+#include "message.h"
+#include "simplequeue.h"
+
+
+#define MAX_SCHED_QUEUES            1024
+#define SCHED_QUANTUM               1514    // DRR bytes per round of a queue of weight 1
+#define SCHED_MIN_QUANTUM           64
+#define SCHED_MAX_PRIO              7       // priorities are 0 (highest) .. SCHED_MAX_PRIO
+
+// heap a queue is on
+#define SCHED_HEAP_NONE             0
+#define SCHED_HEAP_READY            1       // WF2Q+ eligible queues (by finish time), prio queues
+#define SCHED_HEAP_WAIT             2       // WF2Q+ queues not yet eligible (by start time)
+#define SCHED_HEAP_TIMER            3       // queues held by their delay or shaper (by release time)
+#define SCHED_NHEAPS                3
+
+// state of a queue in the engine
+#define SCHED_Q_IDLE                0       // empty
+#define SCHED_Q_READY               1       // with the policy
+#define SCHED_Q_GATED               2       // its head packet is not due yet (delay_us, shaper)
+
+// hierarchical token bucket shaper (htb.c)
+#define HTB_MAX_DEPTH               8       // classes from a queue up to its root
+#define HTB_MIN_BURST               1514    // a bucket always holds a full frame
+#define HTB_EST_INTERVAL_NS         250000000ULL    // rate estimator sample
+#define HTB_EST_WEIGHT              0.25    // of a sample in the estimated rate
+
+// what a class may do at a given time
+#define HTB_CAN_SEND                0       // below its rate
+#define HTB_MAY_BORROW              1       // above its rate, below its ceil
+#define HTB_CANT_SEND               2       // above its ceil
+
+
+// the shaper of a class queue. the tokens are bytes, refilled from the
+// time of the last update when the class is looked at; a class sends
+// while its tokens are not negative and goes into debt by the packet.
+typedef struct _htbclass_t
+{
+	double rate, ceil;                    // bytes/s; ceil 0 is the rate, neither: not shaped
+	double burst;                         // depth of both buckets (bytes)
+	int burstset;                         // burst given, 0 for 10 ms at the ceil
+	double tokens, ctokens;               // at rate, at ceil
+	unsigned long long last;              // tokens up to date at this time
+	int parent;                           // slot of the parent class, -1 for a root
+	int nchildren;
+	unsigned long borrowed;               // bytes sent on the tokens of an ancestor
+	unsigned long lent;                   // bytes of descendants sent on its tokens
+	unsigned long nheld;                  // times the queue waited for tokens
+	double estrate;                       // estimated rate sent (bytes/s)
+	unsigned long estbytes;               // bytes sent in the current sample
+	unsigned long long eststamp;          // start of the current sample
+} htbclass_t;
+
+
+typedef struct _schedq_t
+{
+	simplequeue_t *q;                     // NULL if the slot is free
+	double weight;                        // weight when the queue became backlogged
+	double stime, ftime;                  // WF2Q+ virtual start and finish of the head packet
+	unsigned long epoch;                  // busy period of stime/ftime
+	double key;                           // heap key (finish, start, release time or priority)
+	unsigned long seq;                    // heap tie break: order of insertion
+	unsigned long waitseq;                // seq + 1 when it was first held since it last borrowed, 0 if not
+	int heap, hindex;                     // heap the queue is on and its position
+	int deficit;                          // DRR credit (bytes)
+	int fresh;                            // DRR: credit given for this turn
+	int prev, next;                       // DRR active list
+	int state;                            // SCHED_Q_*
+	int qlen;                             // packets in the queue as last counted in backlog
+	unsigned long npackets, nbytes;       // served
+	htbclass_t htb;
+} schedq_t;
+
+
+// a class as the .info port reports it (schedClassStats)
+typedef struct _schedclassstats_t
+{
+	char name[MAX_NAME_LEN];
+	char parent[MAX_NAME_LEN];            // empty for a root
+	double rate, ceil;                    // bytes/s, 0 if not set
+	double sendrate;                      // estimated
+	int backlog, backlogbytes;
+	double tokens, ctokens;
+	unsigned long npackets, nbytes, borrowed;
+} schedclassstats_t;
+
+
+typedef struct _sched_t sched_t;
+
+// a scheduling policy. activate is called when a queue becomes
+// backlogged (len is its head packet), select returns the queue to
+// serve (never called with no backlog) and served is called when the
+// packet of len bytes left it (nextlen is the new head, 0 if empty).
+// remove takes out a backlogged queue (queue deleted, policy changed).
+typedef struct _schedpolicy_t
+{
+	char *name;
+	char *desc;
+	void (*activate)(sched_t *s, schedq_t *sq, int len);
+	schedq_t *(*select)(sched_t *s);
+	void (*served)(sched_t *s, schedq_t *sq, int len, int nextlen);
+	void (*remove)(sched_t *s, schedq_t *sq);
+} schedpolicy_t;
+
+
+struct _sched_t
+{
+	schedpolicy_t *policy;
+	schedq_t queues[MAX_SCHED_QUEUES];
+	int nslots;                           // slots used so far (free ones have q == NULL)
+	int backlog;                          // packets in all queues
+	int nready;                           // queues with the policy
+	int heap[SCHED_NHEAPS][MAX_SCHED_QUEUES];
+	int heapsize[SCHED_NHEAPS];
+	unsigned long seq;
+	int drrhead;                          // DRR active list, -1 if empty
+	double vtime;                         // WF2Q+ system virtual time
+	double bweight;                       // WF2Q+ weight of the backlogged queues
+	unsigned long epoch;                  // busy periods; virtual times restart with each
+};
+
+
+// Function prototypes
+sched_t *createScheduler(char *policy);
+schedpolicy_t *findSchedPolicy(char *name);
+int schedSetPolicy(sched_t *s, char *name);
+int schedAddQueue(sched_t *s, simplequeue_t *q);
+void schedDelQueue(sched_t *s, simplequeue_t *q);
+int schedEnqueue(sched_t *s, simplequeue_t *q, gpacket_t *pkt, int len, unsigned long long now);
+gpacket_t *schedDequeue(sched_t *s, int *len, unsigned long long now);
+unsigned long long schedNextRelease(sched_t *s);
+void schedQueueChanged(sched_t *s, simplequeue_t *q, unsigned long long now);
+int schedSetShaper(sched_t *s, simplequeue_t *q, double ratekbps, double ceilkbps, int burst, unsigned long long now);
+int schedSetParent(sched_t *s, simplequeue_t *q, simplequeue_t *parent, unsigned long long now);
+int schedClassStats(sched_t *s, schedclassstats_t *stats, int max, unsigned long long now);
+void schedPrint(sched_t *s);
+void schedPrintPolicies(sched_t *s);
+
+// helpers for the policies
+int schedHeadLen(schedq_t *sq);
+void schedHeapPush(sched_t *s, int heap, schedq_t *sq, double key);
+schedq_t *schedHeapTop(sched_t *s, int heap);
+void schedHeapRemove(sched_t *s, schedq_t *sq);
+
+// shaper (htb.c)
+void htbInitClass(htbclass_t *hc);
+int htbSetRate(sched_t *s, schedq_t *sq, double ratekbps, double ceilkbps, int burst, unsigned long long now);
+int htbSetParent(sched_t *s, schedq_t *sq, int parent);
+void htbDelClass(sched_t *s, schedq_t *sq);
+unsigned long long htbRelease(sched_t *s, schedq_t *sq, unsigned long long now);
+int htbCharge(sched_t *s, schedq_t *sq, int len, unsigned long long now);
+double htbEstRate(htbclass_t *hc, unsigned long long now);
+void htbPrint(sched_t *s, unsigned long long now);
+
+// policies (roundrobin.c, wfq.c, sched.c)
+extern schedpolicy_t sched_rr, sched_drr, sched_wf2q, sched_prio;
+
+#endif
@@ -0,0 +1,88 @@
+/*
+ * qdisc.h (include file for the queuing disciplines)
+ *
+ * A queuing discipline decides which packets a class queue of the
+ * packet core admits, keeps and drops. Every simplequeue_t of the
+ * packet core has one (qops) with its state in qdata. fifo, red, codel
+ * and pie keep the packets in the ring of the queue; fq_codel keeps
+ * flow queues of its own. All of them keep cursize and bytesleft of
+ * the queue up to date. See qdisc.c.
+ *
+ * Like the scheduler engine, the disciplines do no locking: the packet
+ * core calls them with its qlock held.
+ */
+
+#ifndef __QDISC_H__
+#define __QDISC_H__
+
+#include "grouter.h"
+#include "message.h"
+#include "simplequeue.h"
+
+
+#define QDISC_MAXPACKET             1514    // bytes of a full size frame
+#define QDISC_DEFAULT               "fifo"
+
+// CoDel (RFC 8289) and fq_codel (RFC 8290)
+#define CODEL_TARGET_US             5000
+#define CODEL_INTERVAL_US           100000
+#define FQ_CODEL_FLOWS              1024
+#define FQ_CODEL_QUANTUM            1514
+
+// RED (Floyd and Jacobson), thresholds in packets
+#define RED_WEIGHT                  0.002   // of the instantaneous length in the average
+#define RED_MAXP                    0.1
+#define RED_IDLE_PKT_NS             12000   // time to send a packet, ages the average while idle
+
+// PIE (RFC 8033)
+#define PIE_TARGET_US               15000
+#define PIE_TUPDATE_US              15000
+#define PIE_MAX_BURST_US            150000
+#define PIE_ALPHA                   0.125
+#define PIE_BETA                    1.25
+
+
+// the CoDel state of a queue (or of a flow of fq_codel)
+typedef struct _codel_t
+{
+	unsigned long long first_above;       // when the sojourn time went above target (+ interval)
+	unsigned long long drop_next;
+	unsigned int count, lastcount;
+	int dropping;
+} codel_t;
+
+
+typedef struct _qdisc_t
+{
+	char *name;
+	char *desc;
+	int (*init)(simplequeue_t *q);
+	void (*free)(simplequeue_t *q);
+	// admit a packet of len bytes at time now; now is 0 for a packet
+	// moved from another discipline. EXIT_FAILURE if it was dropped.
+	int (*enqueue)(simplequeue_t *q, gpacket_t *pkt, int len, unsigned long long now);
+	// the next packet to send, NULL if none is left. packets it drops
+	// on the way are released.
+	gpacket_t *(*dequeue)(simplequeue_t *q, int *len, unsigned long long now);
+	// the next packet without the AQM (flush, change of discipline)
+	gpacket_t *(*pop)(simplequeue_t *q, int *len);
+	// length and enqueue time of the packet dequeue would look at first
+	int (*peek)(simplequeue_t *q, int *len, unsigned long long *qtime);
+	int (*setparam)(simplequeue_t *q, char *param, double value);
+	void (*print)(simplequeue_t *q);
+} qdisc_t;
+
+
+// Function prototypes
+qdisc_t *findQdisc(char *name);
+int qdiscAttach(simplequeue_t *q, char *name);
+int qdiscChange(simplequeue_t *q, char *name);
+void qdiscDetach(simplequeue_t *q);
+int qdiscSetParam(simplequeue_t *q, char *param, double value);
+void qdiscPrint(simplequeue_t *q);
+void qdiscPrintAll(void);
+
+unsigned long long qdiscSojourn(simplequeue_t *q, gpacket_t *pkt, unsigned long long now);
+void qdiscDrop(simplequeue_t *q, gpacket_t *pkt, int reason);
+
+#endif
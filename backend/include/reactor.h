@@ -0,0 +1,38 @@
+/*
+ * reactor.h (include file for the I/O reactor)
+ *
+ * In reactor mode (set io-threads N) a fixed pool of I/O threads reads
+ * the Ethernet interfaces with epoll instead of one blocking receive
+ * thread per interface. See reactor.c.
+ */
+
+#ifndef __REACTOR_H__
+#define __REACTOR_H__
+
+#include <pthread.h>
+#include "gnet.h"
+
+
+#define MAX_REACTOR_THREADS         16
+#define REACTOR_TIMEOUT_MS          100     // longest epoll wait, bounds the time to remove an interface
+#define REACTOR_BUDGET              4       // batches read from an interface before serving the next one
+
+
+typedef struct _reactor_t
+{
+	int id;
+	int epfd;                             // epoll instance of the thread
+	pthread_t threadid;
+	volatile unsigned long rounds;        // epoll rounds completed
+	int ninterfaces;                      // interfaces served by the thread
+	unsigned long wakeups;                // rounds with events
+	unsigned long polls;                  // interface reads
+} reactor_t;
+
+
+// Function prototypes
+int reactorAdd(interface_t *iface);
+int reactorDel(interface_t *iface);
+void reactorPrint(void);
+
+#endif
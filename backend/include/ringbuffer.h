@@ -0,0 +1,47 @@
+/*
+ * ringbuffer.h (include file for the lock-free ring buffer)
+ *
+ */
+
+#ifndef __RING_BUFFER_H__
+#define __RING_BUFFER_H__
+
+
+#define CACHE_LINE_SIZE             64
+#define MAX_RING_SIZE               65536
+
+
+typedef struct _ringslot_t
+{
+	volatile unsigned long seq;           // sequence number of the slot (see ringbuffer.c)
+	int size;
+	void *data;
+} ringslot_t;
+
+
+// the producer and consumer positions are kept on separate cache lines so
+// that the threads writing to the ring do not invalidate the line read by
+// the threads draining it (and vice versa)
+typedef struct _ringbuffer_t
+{
+	ringslot_t *slots;                    // follow the ring in the same block
+	unsigned long mask;                   // number of slots - 1 (power of two)
+	unsigned long memsize;                // bytes of the block, whole pages
+	char pad0[CACHE_LINE_SIZE - sizeof(ringslot_t *) - 2 * sizeof(unsigned long)];
+	volatile unsigned long head;          // next position to write
+	char pad1[CACHE_LINE_SIZE - sizeof(unsigned long)];
+	volatile unsigned long tail;          // next position to read
+	char pad2[CACHE_LINE_SIZE - sizeof(unsigned long)];
+} ringbuffer_t;
+
+
+// Function prototypes
+ringbuffer_t *createRingBuffer(int nslots);
+void destroyRingBuffer(ringbuffer_t *rb);
+int ringPush(ringbuffer_t *rb, void *data, int size);
+int ringPop(ringbuffer_t *rb, void **data, int *size);
+int ringPeek(ringbuffer_t *rb, void **data, int *size);
+int ringCapacity(ringbuffer_t *rb);
+int ringCount(ringbuffer_t *rb);
+
+#endif
@@ -15,8 +15,15 @@
  */
 
 #include "grouter.h"
+#include <stdint.h>
+#include <pthread.h>
 
-#define MAX_ROUTES                      20	// maximum route table size
+#define MIN_ROUTES                      32	// initial route table size, grows as needed
+
+#define RT_L1_BITS                      16      // stride of the first trie level
+#define RT_L1_SIZE                      (1 << RT_L1_BITS)
+#define RT_CHUNK_SIZE                   256     // second and third levels: 8 bit strides
+#define RT_CHUNK_FLAG                   0x80000000
 
 
 /*
@@ -29,9 +36,72 @@ typedef struct _route_entry_t
 	uchar netmask[4];			// Netmask
 	uchar nexthop[4];			// Nexthop IP address
 	int  interface;			        // output interface
+	int prefixlen;                          // length of the netmask
+	int hnext;                              // next entry in the prefix hash chain or free list
 } route_entry_t;
 
+
+/*
+ * a trie chunk covers 8 bits of the address. each slot holds either a
+ * route (index + 1, 0 for no route) or RT_CHUNK_FLAG | index of the
+ * next level chunk. depth is the prefix length that owns the slot.
+ */
+typedef struct _rt_chunk_t
+{
+	uint32_t val[RT_CHUNK_SIZE];
+	uchar depth[RT_CHUNK_SIZE];
+} rt_chunk_t;
+
+
+/*
+ * a snapshot of the route table: the routes are kept in an array (the
+ * index is the route number used by the CLI) and the forwarding lookups
+ * go through a 16-8-8 multibit trie built with controlled prefix
+ * expansion. a published snapshot is never changed.
+ */
+typedef struct _rt_snapshot_t
+{
+	route_entry_t *entries;
+	int size;                               // allocated entries
+	int nroutes;                            // entries in use
+	int freelist;                           // first free entry, -1 if none
+	int *hash;                              // exact prefix lookup, chained through hnext
+	int hashsize;
+	uint32_t *l1val;                        // first level, indexed by the top 16 bits
+	uchar *l1depth;
+	rt_chunk_t *chunks;
+	int nchunks;                            // allocated chunks
+	int freechunk;                          // first free chunk, chained through val[0]
+	int usedchunks;
+} rt_snapshot_t;
+
+
+/*
+ * the route table: lookups read the current snapshot inside an epoch
+ * section (epoch.h). a change is made to a copy of the snapshot, which
+ * is then swapped in; the replaced snapshot is freed once the readers
+ * are done with it.
+ */
+typedef struct _route_table_t
+{
+	pthread_mutex_t lock;                   // serialises the writers
+	rt_snapshot_t * volatile snap;
+	unsigned long version;                  // snapshots published so far
+} route_table_t;
+
+
 // prototypes of the functions provided for the route table handling..
 
-void RouteTableInit(route_entry_t route_tbl[]);
+route_table_t *createRouteTable(void);
+int findRouteEntry(route_table_t *rtbl, uchar *ip_addr, uchar *nhop, int *ixface);
+int findRoute(route_table_t *rtbl, uchar *ip_addr, route_entry_t *rentry);
+int getRouteEntry(route_table_t *rtbl, int indx, route_entry_t *rentry);
+int getRouteTableSize(route_table_t *rtbl);
+int addRouteEntry(route_table_t *rtbl, uchar *nwork, uchar *nmask, uchar *nhop, int interface);
+void deleteRouteEntryByIndex(route_table_t *rtbl, int i);
+void deleteRouteEntryByInterface(route_table_t *rtbl, int interface);
+int loadRouteFile(route_table_t *rtbl, char *fname);
+void printRouteTable(route_table_t *rtbl);
+void printRouteTableVersion(route_table_t *rtbl);
+
 #endif
@@ -14,6 +14,7 @@
 #include <slack/list.h>
 
 #include "grouter.h"
+#include "ringbuffer.h"
 
 
 typedef struct _simplewrapper_t
@@ -27,21 +28,29 @@ typedef struct _simplewrapper_t
 typedef struct _simplequeue_t
 {
 	char name[MAX_NAME_LEN];
-	List *queue;
+	List *queue;                          // list backend (unbounded queues)
+	ringbuffer_t *ring;                   // ring backend (bounded queues), NULL otherwise
 	pthread_cond_t qfull, qempty;
 	pthread_mutex_t qlock;
-	int maxsize, cursize, bytesleft;
+	volatile int rwaiting, wwaiting;      // threads sleeping on qempty, qfull (ring backend)
+	volatile int maxsize, cursize, bytesleft;
 	int blockonwrite;
 	int blockonread;
 	// following parameters are useful for statistics keeping
-	double prevaccesstime;
+	volatile unsigned long long nbytesread;  // bytes taken out so far
+	unsigned long long prevaccesstime;    // monotonic ns of the last rate update
+	unsigned long long prevbytesread;     // nbytesread at that time
 	double avgbyterate;
+	struct _statsqueue_t *qstats;         // published counters (stats.c), NULL if none
 	// following parameters are useful for queueing discipline
 	char qdisc[MAX_NAME_LEN];
-	double delay_us;
+	struct _qdisc_t *qops;                // discipline of a packet core queue (qdisc.c), NULL otherwise
+	void *qdata;                          // its state
+	double delay_us;                      // packets are held this long before they can leave
 	// following parameters are useful for scheduling algorithms
 	double weight;
-	double stime, ftime;
+	int prio;                             // strict priority, 0 is served first
+	int schedid;                          // slot in the scheduler (sched.c), -1 if none
 } simplequeue_t;
 
 
@@ -51,10 +60,10 @@ int destroySimpleQueue(simplequeue_t *msgqueue);
 void printSimpleQueue(simplequeue_t *msgqueue);
 int writeQueue(simplequeue_t *msgqueue, void *data, int size);
 int copy2Queue(simplequeue_t *msgqueue, void *data, int size);
-void computeAvgByteRate(simplequeue_t *sq, int size);
 double getAvgByteRate(simplequeue_t *sq);
 
 int readQueue(simplequeue_t *msgqueue, void **data, int *size);
+int tryReadQueue(simplequeue_t *msgqueue, void **data, int *size);
 int peekQueue(simplequeue_t *msgqueue, void **data, int *size);
 
 #endif
@@ -0,0 +1,109 @@
+/*
+ * stats.h (include file for the statistics segment)
+ *
+ * The counters of the router threads and of the packet core queues live
+ * in a file mapped into memory (<config dir>/<router>.stats), so that an
+ * external program can map it read-only and poll it as often as it
+ * likes without talking to the router. Every counter has exactly one
+ * writer -- the thread owning a thread block, or the thread holding the
+ * packet core lock for a queue block -- so the datapath updates them
+ * with plain stores; readers see each 64 bit word whole.
+ *
+ * Layout of the segment (all offsets from its start):
+ *   stats_header_t
+ *   statsthread_t[max_threads]      at thread_offset
+ *   statsqueue_t[max_queues]        at queue_offset
+ *
+ * A block is in use while its name is not empty. The header magic is
+ * written last, once the segment is laid out.
+ */
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdint.h>
+#include "grouter.h"
+#include "ringbuffer.h"
+#include "histogram.h"
+
+
+#define STATS_MAGIC                 0x47535431      // "GST1"
+#define STATS_VERSION               1
+#define STATS_NAME_LEN              32
+#define STATS_MAX_THREADS           64
+#define STATS_MAX_QUEUES            64
+
+// sojourn times (ns) are kept in a log-linear histogram (see histogram.h)
+#define STATS_HIST_SUB_BITS         HIST_SUB_BITS
+#define STATS_HIST_MAX_BITS         HIST_MAX_BITS
+#define STATS_HIST_BUCKETS          HIST_BUCKETS
+
+
+typedef struct _stats_header_t
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t size;                        // of the whole segment
+	uint32_t hist_sub_bits;
+	uint32_t hist_max_bits;
+	uint32_t hist_buckets;
+	uint32_t max_threads;
+	uint32_t max_queues;
+	uint32_t thread_size;                 // sizeof(statsthread_t)
+	uint32_t queue_size;                  // sizeof(statsqueue_t)
+	uint32_t pid;
+	uint64_t thread_offset;
+	uint64_t queue_offset;
+	uint64_t started;                     // wall clock (s) when the router started
+	char router[STATS_NAME_LEN];
+} __attribute__((aligned(CACHE_LINE_SIZE))) stats_header_t;
+
+
+// counters of a thread of the datapath
+typedef struct _statsthread_t
+{
+	char name[STATS_NAME_LEN];
+	volatile uint64_t packets;
+	volatile uint64_t bytes;
+	volatile uint64_t drops;
+	volatile uint32_t tid;                // kernel thread id
+	uint32_t pad;
+} __attribute__((aligned(CACHE_LINE_SIZE))) statsthread_t;
+
+
+// counters of a packet core queue, written under the packet core lock
+typedef struct _statsqueue_t
+{
+	char name[STATS_NAME_LEN];
+	volatile uint64_t enqueued;
+	volatile uint64_t enqbytes;
+	volatile uint64_t dequeued;
+	volatile uint64_t deqbytes;
+	volatile uint64_t drops;
+	volatile uint64_t backlog;            // packets in the queue
+	volatile uint64_t sojourn_sum;        // ns, of the dequeued packets
+	volatile uint64_t sojourn_max;
+	volatile uint64_t hist[STATS_HIST_BUCKETS];
+} __attribute__((aligned(CACHE_LINE_SIZE))) statsqueue_t;
+
+
+// counters of the calling thread, NULL if it has none
+extern __thread statsthread_t *tstats;
+
+#define STATS_COUNT(P, B)	do { if (tstats != NULL) { tstats->packets += (P); tstats->bytes += (B); } } while (0)
+#define STATS_DROP(N)		do { if (tstats != NULL) tstats->drops += (N); } while (0)
+
+
+// Function prototypes
+void statsInit(char *rpath, char *rname);
+statsthread_t *statsThreadAlloc(char *name);
+void statsThreadSet(statsthread_t *st);
+statsthread_t *statsThreadRegister(char *name);
+statsqueue_t *statsQueueAlloc(char *name);
+void statsQueueFree(statsqueue_t *qs);
+void statsQueueEnqueue(statsqueue_t *qs, int len, int backlog);
+void statsQueueDequeue(statsqueue_t *qs, int len, unsigned long long sojourn, int backlog);
+void statsPrintQueue(statsqueue_t *qs);
+void statsPrintThreads(void);
+
+#endif
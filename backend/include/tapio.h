@@ -13,5 +13,5 @@
 
 vpl_data_t *tap_connect(char *sock_name);
 int tap_recvfrom(vpl_data_t *vpl, void *buf, int len);
-int tap_sendto(vpl_data_t *vpl, void *buf, int len);
+int tap_sendv(vpl_data_t *vpl, struct iovec *iov, int niov);
 
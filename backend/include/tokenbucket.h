@@ -0,0 +1,28 @@
+/*
+ * tokenbucket.h (include file for the token bucket rate limiter)
+ *
+ */
+
+#ifndef __TOKEN_BUCKET_H__
+#define __TOKEN_BUCKET_H__
+
+#include <pthread.h>
+
+
+typedef struct _tokenbucket_t
+{
+	pthread_mutex_t tblock;
+	double rate;                          // bytes per second, 0 means unlimited
+	double burst;                         // maximum number of tokens (bytes)
+	double tokens;                        // tokens currently available (bytes)
+	unsigned long long last;              // last refill time (nanoseconds)
+} tokenbucket_t;
+
+
+// Function prototypes
+void initTokenBucket(tokenbucket_t *tb, int ratekbps, int burst);
+void setTokenBucket(tokenbucket_t *tb, int ratekbps, int burst);
+long tokenBucketDelay(tokenbucket_t *tb, int size);
+void tokenBucketWait(tokenbucket_t *tb, int size);
+
+#endif
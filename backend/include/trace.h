@@ -0,0 +1,133 @@
+/*
+ * trace.h (include file for the tracing framework)
+ *
+ * Two kinds of trace points for the packet path, both cheap when they
+ * are off and both removed by building with -DNO_TRACE:
+ *
+ * VERBOSE(level, fmt, ...) prints like verbose() but checks the level
+ * first, so the arguments (IP2Dot, gNtohl, ...) are only evaluated
+ * when the message is printed.
+ *
+ * TRACE(event, a0, a1, a2) records a binary record (time stamp, event
+ * and three 32-bit arguments) into a ring of the calling thread when
+ * the event is enabled (trace on). The rings are decoded by the trace
+ * command; trace dump writes them to a file that trace decode reads
+ * back, so a trace can be taken on one router and read elsewhere.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <slack/err.h>
+#include "grouter.h"
+
+
+#define TRACE_RING_SIZE             4096    // records per thread (power of two)
+#define MAX_TRACE_RINGS             64      // threads that can record
+#define TRACE_DEFAULT_SHOW          50      // records printed by trace show
+#define TRACE_FILE_MAGIC            0x43525447  // "GTRC"
+#define TRACE_FILE_VERSION          1
+#define TRACE_MAX_ARGS              3
+
+// trace events (at most 32)
+#define TRACE_RX                    0       // iface, length
+#define TRACE_TX                    1       // iface, packets
+#define TRACE_DROP                  2       // reason, iface
+#define TRACE_ROUTE                 3       // destination, next hop, iface
+#define TRACE_NOROUTE               4       // destination
+#define TRACE_ARP_HIT               5       // IP, slot, status
+#define TRACE_ARP_MISS              6       // IP
+#define TRACE_IP_LOCAL              7       // destination (network order)
+#define TRACE_IP_FORWARD            8       // source, destination (network order), TTL
+#define TRACE_NEVENTS               9
+
+// reasons of TRACE_DROP
+#define TRACE_DROP_FILTER           1       // denied by a filter rule
+#define TRACE_DROP_TXQ              2       // transmit queue of the interface full
+#define TRACE_DROP_TTL              3       // TTL expired
+#define TRACE_DROP_QUEUE            4       // class queue of the packet core full
+#define TRACE_DROP_AQM              5       // dropped by the queuing discipline (qdisc.c)
+
+// how the decoder prints an argument
+#define TRACE_ARG_NONE              0
+#define TRACE_ARG_INT               1
+#define TRACE_ARG_IP                2       // uchar[4] in the router's internal order
+#define TRACE_ARG_NIP               3       // uchar[4] in network order (packet headers)
+#define TRACE_ARG_HEX               4
+
+#define TRACE_BIT(ev)               (1UL << (ev))
+
+
+typedef struct _tracerec_t
+{
+	unsigned long long ts;                // getTimeNanos()
+	uint16_t event;
+	uint16_t ring;                        // thread that recorded it
+	uint32_t arg[TRACE_MAX_ARGS];
+} tracerec_t;
+
+
+typedef struct _tracering_t
+{
+	int id;
+	pthread_t threadid;
+	volatile unsigned long head;          // records written (the last TRACE_RING_SIZE are kept)
+	volatile unsigned long start;         // records before this one were cleared
+	tracerec_t rec[TRACE_RING_SIZE];
+} tracering_t;
+
+
+typedef struct _traceevent_t
+{
+	char name[16];
+	int kind[TRACE_MAX_ARGS];
+} traceevent_t;
+
+
+// header of a trace dump: the event table and the records follow
+typedef struct _tracefile_t
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nevents;
+	uint32_t nrecs;
+} tracefile_t;
+
+
+extern volatile long trace_level;             // copy of the verbosity level
+extern volatile unsigned long trace_mask;     // events recorded
+
+
+static inline uint32_t traceIP(uchar *ip)
+{
+	uint32_t v;
+
+	memcpy(&v, ip, 4);
+	return v;
+}
+
+
+#ifndef NO_TRACE
+#define VERBOSE(level, ...)     do { if (trace_level >= (level)) verbose(level, __VA_ARGS__); } while (0)
+#define TRACE(ev, a0, a1, a2)   do { if (trace_mask & TRACE_BIT(ev)) \
+					traceRecord(ev, (uint32_t)(a0), (uint32_t)(a1), (uint32_t)(a2)); } while (0)
+#else
+#define VERBOSE(level, ...)     do { } while (0)
+#define TRACE(ev, a0, a1, a2)   do { } while (0)
+#endif
+
+
+// Function prototypes
+void traceSetVerbosity(long level);
+void traceRecord(int event, uint32_t a0, uint32_t a1, uint32_t a2);
+int traceSetEvent(char *name, int on);
+void traceClear(void);
+void traceShow(int count);
+void traceList(void);
+int traceDump(char *fname);
+int traceDecode(char *fname, int count);
+
+#endif
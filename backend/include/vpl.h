@@ -22,12 +22,15 @@
 #include <stdint.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
 #include <sys/time.h>
 #include <stdlib.h>
 #include <stdio.h>
 
 #define SWITCH_VERSION           3
 #define CONSOLE_PACKET           269               // arbitary number .. least likely to clash!
+#define VPL_MAX_BATCH            64                // most frames moved by one recvmmsg/sendmmsg
+#define VPL_MAX_IOV              8                 // most pieces of one frame
 
 typedef struct _vpl_data_t {
 	char *sock_type;
@@ -37,6 +40,10 @@ typedef struct _vpl_data_t {
 	void *local_addr;
 	int data;
 	int control;
+	// frames and system calls on the data socket, for the I/O statistics.
+	// rx counters are written by the interface thread, tx by the GNET handler
+	unsigned long rx_frames, rx_calls;
+	unsigned long tx_frames, tx_calls;
 } vpl_data_t;
 
 
@@ -61,11 +68,13 @@ int __vpl_sendto(int fd, void *buf, int len, void *to, int sock_len);
 struct sockaddr_un *new_addr(void *name, int len);
 struct sockaddr_un *dup_addr(struct sockaddr_un *sock);
 void vpl_init(char *rpath, char *rname);
-void consoleHandler(void *ptr);
 vpl_data_t *vpl_connect(char *sock_name);
 vpl_data_t *vpl_create_server(char *name);
 int vpl_accept_connect(vpl_data_t *v);
 int vpl_recvfrom(vpl_data_t *vpl, void *buf, int len);
 int vpl_sendto(vpl_data_t *vpl, void *buf, int len);
+int vpl_recvmmsg(vpl_data_t *vpl, struct iovec *iovs, int niov, int *lens, int nbufs);
+int vpl_tryrecvmmsg(vpl_data_t *vpl, struct iovec *iovs, int niov, int *lens, int nbufs);
+int vpl_sendmmsg(vpl_data_t *vpl, struct iovec *iovs, int *niovs, int nbufs);
 
 #endif
@@ -0,0 +1,439 @@
+/*
+ * gpktgen.c (packet generator and forwarding benchmark for the gRouter)
+ *
+ * gpktgen plays the hosts on two links of a router: it sends flows into
+ * the router through the in port and receives them back on the out
+ * port, then reports what the router did to them.
+ *
+ *   gpktgen -i r1.eth1 --in-ip 10.0.1.2 -g 10.0.1.1 \
+ *           -o r1.eth2 --out-ip 10.0.2.2 \
+ *           -f udp,dst=10.0.2.2,rate=50000,size=512,count=8 -t 10
+ *
+ * A port connects to the socket of a router interface if the router
+ * listens on it (the router was started first) and otherwise listens
+ * on it until the router connects, just like a router interface. The
+ * generator answers the ARP requests of the router for its address and,
+ * on the out port, for the destinations of the flows, and finds the
+ * address of the router (the gateway) on the in port with ARP.
+ *
+ * A flow is a comma separated list: the protocol (udp, tcp or ip) and
+ *   dst=addr    destination (the out port address by default)
+ *   port=n      destination port (5001), the source ports are 1024 and up
+ *   rate=pps    packets per second (1000), 0 for as fast as possible
+ *   mbps=r      the rate in Mbit/s instead (frame bytes)
+ *   size=bytes  frame size without the FCS (128), at most 9216
+ *   count=n     n such flows, with different source ports
+ * Without --out the flows come back on the in port.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <getopt.h>
+#include <signal.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <netinet/tcp.h>
+#include "gpktgen.h"
+
+
+int debug_flag = 0;
+gpktgen_config_t gconf;
+
+static struct option long_options[] =
+{
+	{"in",		required_argument,	NULL, 'i'},
+	{"in-ip",	required_argument,	NULL, 'I'},
+	{"in-mac",	required_argument,	NULL, 'M'},
+	{"gateway",	required_argument,	NULL, 'g'},
+	{"gateway-mac",	required_argument,	NULL, 'G'},
+	{"out",		required_argument,	NULL, 'o'},
+	{"out-ip",	required_argument,	NULL, 'O'},
+	{"out-mac",	required_argument,	NULL, 'N'},
+	{"flow",	required_argument,	NULL, 'f'},
+	{"duration",	required_argument,	NULL, 't'},
+	{"batch",	required_argument,	NULL, 'b'},
+	{"drain",	required_argument,	NULL, 'w'},
+	{"report",	required_argument,	NULL, 'r'},
+	{"debug",	no_argument,		NULL, 'd'},
+	{"help",	no_argument,		NULL, 'h'},
+	{0, 0, 0, 0}
+};
+
+
+void verbose(int level, char *fmt, ...)
+{
+	va_list args;
+
+	if (level > debug_flag)
+		return;
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	fprintf(stderr, "\n");
+}
+
+
+static void usage(char *cmd, int status)
+{
+	fprintf(stderr, "Usage: %s -i sock --in-ip addr (-g addr | --gateway-mac mac) [-o sock --out-ip addr]\n"
+		"\t[-f proto,dst=addr,port=n,rate=pps|mbps=r,size=bytes,count=n]...\n"
+		"\t[-t seconds] [-b batch] [-w drain_ms] [-r report_seconds] [-d]... \n", cmd);
+	exit(status);
+}
+
+
+static int parseMAC(char *str, uint8_t *mac)
+{
+	return (sscanf(str, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", &mac[0], &mac[1], &mac[2],
+		       &mac[3], &mac[4], &mac[5]) == 6) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+static int parseIP(char *str, uint32_t *ip)
+{
+	struct in_addr a;
+
+	if (inet_aton(str, &a) == 0)
+		return EXIT_FAILURE;
+	*ip = a.s_addr;
+	return EXIT_SUCCESS;
+}
+
+
+// the smallest frame of a protocol that still carries the probe
+static int minFrameSize(int proto)
+{
+	int size = ETHER_HEADER_SIZE + IP_HEADER_SIZE + sizeof(probe_t);
+
+	if (proto == IPPROTO_UDP)
+		size += sizeof(struct udphdr);
+	else if (proto == IPPROTO_TCP)
+		size += sizeof(struct tcphdr);
+	return (size < 60) ? 60 : size;
+}
+
+
+/*
+ * add the flows of a flow specification (see above); the addresses of
+ * the ports are filled in once they are known.
+ */
+static int addFlows(char *spec)
+{
+	char *tok, *val, *saveptr;
+	flow_t proto;
+	double mbps = -1.0;
+	int count = 1, i;
+
+	bzero(&proto, sizeof(flow_t));
+	proto.proto = IPPROTO_UDP;
+	proto.dport = DEFAULT_DPORT;
+	proto.pps = DEFAULT_RATE;
+	proto.size = DEFAULT_FRAME_SIZE;
+
+	for (tok = strtok_r(spec, ",", &saveptr); tok != NULL; tok = strtok_r(NULL, ",", &saveptr))
+	{
+		if ((val = strchr(tok, '=')) != NULL)
+			*val++ = 0;
+		if (!strcmp(tok, "udp"))
+			proto.proto = IPPROTO_UDP;
+		else if (!strcmp(tok, "tcp"))
+			proto.proto = IPPROTO_TCP;
+		else if (!strcmp(tok, "ip"))
+			proto.proto = GPKT_PROTO_RAW;
+		else if (val == NULL)
+			return EXIT_FAILURE;
+		else if (!strcmp(tok, "dst"))
+		{
+			if (parseIP(val, &(proto.dst)) == EXIT_FAILURE)
+				return EXIT_FAILURE;
+		} else if (!strcmp(tok, "port"))
+			proto.dport = atoi(val);
+		else if (!strcmp(tok, "rate"))
+			proto.pps = atof(val);
+		else if (!strcmp(tok, "mbps"))
+			mbps = atof(val);
+		else if (!strcmp(tok, "size"))
+			proto.size = atoi(val);
+		else if (!strcmp(tok, "count"))
+			count = atoi(val);
+		else
+			return EXIT_FAILURE;
+	}
+
+	if (proto.size < minFrameSize(proto.proto))
+		proto.size = minFrameSize(proto.proto);
+	if (proto.size > MAX_FRAME_SIZE)
+		proto.size = MAX_FRAME_SIZE;
+	if (mbps >= 0.0)
+		proto.pps = mbps * 1000000.0 / (proto.size * 8);
+	if ((count < 1) || (proto.pps < 0.0) || (gconf.nflows + count > MAX_FLOWS))
+		return EXIT_FAILURE;
+	proto.interval = (proto.pps > 0.0) ? (uint64_t)(1000000000.0 / proto.pps) : 0;
+
+	for (i = 0; i < count; i++)
+	{
+		memcpy(&(gconf.flows[gconf.nflows]), &proto, sizeof(flow_t));
+		gconf.flows[gconf.nflows].id = gconf.nflows;
+		gconf.flows[gconf.nflows].sport = 1024 + gconf.nflows;
+		gconf.nflows++;
+	}
+	return EXIT_SUCCESS;
+}
+
+
+/*
+ * attach a port: as a client if the router listens on the socket,
+ * otherwise listen on it and wait for the router
+ */
+static int openPort(port_t *p)
+{
+	if ((p->vpl = vpl_connect(p->sock)) != NULL)
+	{
+		printf("gpktgen: connected to %s \n", p->sock);
+		return EXIT_SUCCESS;
+	}
+	if ((p->vpl = vpl_create_server(p->sock)) == NULL)
+	{
+		fprintf(stderr, "gpktgen: unable to connect to or listen on %s \n", p->sock);
+		return EXIT_FAILURE;
+	}
+	printf("gpktgen: waiting for the router to connect to %s .. \n", p->sock);
+	fflush(stdout);
+	if (vpl_accept_connect(p->vpl) < 0)
+	{
+		fprintf(stderr, "gpktgen: connection on %s failed \n", p->sock);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+
+static void stopSending(int sig)
+{
+	gconf.sending = 0;
+}
+
+
+// totals of all the flows
+static void sumFlows(uint64_t *sent, uint64_t *received, uint64_t *rcvbytes)
+{
+	int i;
+
+	*sent = *received = *rcvbytes = 0;
+	for (i = 0; i < gconf.nflows; i++)
+	{
+		*sent += gconf.flows[i].sent;
+		*received += gconf.flows[i].received;
+		*rcvbytes += gconf.flows[i].rcvbytes;
+	}
+}
+
+
+// a percentile is the top of its bucket, never more than the largest latency seen
+#define PCT(P)	(min(histPercentile(hist, received, P), latmax) / 1000.0)
+
+static void printFlowLine(char *name, char *dst, uint64_t sent, uint64_t received, uint64_t reordered,
+			  uint64_t rcvbytes, uint64_t latsum, uint64_t latmax, uint64_t *hist, double secs)
+{
+	printf("%-6s %-15s %11llu %11llu %7.3f %8llu %9.1f %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f\n",
+	       name, dst, (unsigned long long)sent, (unsigned long long)received,
+	       (sent > 0) ? 100.0 * ((sent > received) ? sent - received : 0) / sent : 0.0,
+	       (unsigned long long)reordered, received / secs / 1000.0, rcvbytes * 8.0 / secs / 1000000.0,
+	       (received > 0) ? latsum / 1000.0 / received : 0.0,
+	       PCT(50.0), PCT(90.0), PCT(99.0), PCT(99.9), latmax / 1000.0);
+}
+
+
+static void printReport(void)
+{
+	static uint64_t hist[HIST_BUCKETS];
+	uint64_t sent = 0, received = 0, reordered = 0, rcvbytes = 0, latsum = 0, latmax = 0, txerrors = 0;
+	char name[16], dst[INET_ADDRSTRLEN];
+	double secs;
+	flow_t *f;
+	int i, j;
+
+	secs = (gconf.stopped - gconf.started) / 1e9;
+	if (secs <= 0.0)
+		secs = 1.0;
+
+	printf("\n%62s%-38s%s\n", "", "received", "latency (us)");
+	printf("Flow   Destination            Sent    Received   Loss%%  Reorder      kpps   Mbit/s     mean      p50      p90      p99    p99.9      max\n");
+	for (i = 0; i < gconf.nflows; i++)
+	{
+		f = &(gconf.flows[i]);
+		sprintf(name, "%d", i);
+		inet_ntop(AF_INET, &(f->dst), dst, sizeof(dst));
+		if (gconf.nflows <= 64)
+			printFlowLine(name, dst, f->sent, f->received, f->reordered, f->rcvbytes,
+				      f->latsum, f->latmax, f->hist, secs);
+		sent += f->sent;
+		received += f->received;
+		reordered += f->reordered;
+		rcvbytes += f->rcvbytes;
+		latsum += f->latsum;
+		txerrors += f->txerrors;
+		if (f->latmax > latmax)
+			latmax = f->latmax;
+		for (j = 0; j < HIST_BUCKETS; j++)
+			hist[j] += f->hist[j];
+	}
+	printFlowLine("Total", "", sent, received, reordered, rcvbytes, latsum, latmax, hist, secs);
+
+	printf("\nSent for %.3f s, %.1f kpps offered, %llu send errors \n", secs, sent / secs / 1000.0,
+	       (unsigned long long)txerrors);
+	printf("In port %s: %llu frames received, %llu other, %llu ARP replies \n", gconf.in.sock,
+	       (unsigned long long)gconf.in.rxframes, (unsigned long long)gconf.in.rxother,
+	       (unsigned long long)gconf.in.arpreplies);
+	if (gconf.outp != &(gconf.in))
+		printf("Out port %s: %llu frames received, %llu other, %llu ARP replies \n", gconf.out.sock,
+		       (unsigned long long)gconf.out.rxframes, (unsigned long long)gconf.out.rxother,
+		       (unsigned long long)gconf.out.arpreplies);
+}
+
+
+int main(int argc, char *argv[])
+{
+	char *specs[MAX_FLOWS];
+	uint64_t sent, received, rcvbytes, psent = 0, preceived = 0, pbytes = 0;
+	uint32_t gateway = 0;
+	pthread_t txthread;
+	int c, i, nspecs = 0, elapsed;
+
+	bzero(&gconf, sizeof(gconf));
+	gconf.duration = DEFAULT_DURATION;
+	gconf.batch = DEFAULT_BATCH;
+	gconf.drain = DEFAULT_DRAIN;
+	gconf.interval = 1;
+	parseMAC("02:00:00:47:50:01", gconf.in.mac);
+	parseMAC("02:00:00:47:50:02", gconf.out.mac);
+
+	while ((c = getopt_long(argc, argv, "i:g:o:f:t:b:w:r:dh", long_options, NULL)) != -1)
+	{
+		switch (c)
+		{
+		case 'i': gconf.in.sock = optarg; break;
+		case 'o': gconf.out.sock = optarg; break;
+		case 'I':
+			if (parseIP(optarg, &(gconf.in.ip)) == EXIT_FAILURE)
+				usage(argv[0], EXIT_FAILURE);
+			break;
+		case 'O':
+			if (parseIP(optarg, &(gconf.out.ip)) == EXIT_FAILURE)
+				usage(argv[0], EXIT_FAILURE);
+			break;
+		case 'g':
+			if (parseIP(optarg, &gateway) == EXIT_FAILURE)
+				usage(argv[0], EXIT_FAILURE);
+			break;
+		case 'M':
+			if (parseMAC(optarg, gconf.in.mac) == EXIT_FAILURE)
+				usage(argv[0], EXIT_FAILURE);
+			break;
+		case 'N':
+			if (parseMAC(optarg, gconf.out.mac) == EXIT_FAILURE)
+				usage(argv[0], EXIT_FAILURE);
+			break;
+		case 'G':
+			if (parseMAC(optarg, gconf.in.peermac) == EXIT_FAILURE)
+				usage(argv[0], EXIT_FAILURE);
+			gconf.in.resolved = 1;
+			break;
+		case 'f':
+			if (nspecs < MAX_FLOWS)
+				specs[nspecs++] = optarg;
+			break;
+		case 't': gconf.duration = atoi(optarg); break;
+		case 'b': gconf.batch = atoi(optarg); break;
+		case 'w': gconf.drain = atoi(optarg); break;
+		case 'r': gconf.interval = atoi(optarg); break;
+		case 'd': debug_flag++; break;
+		case 'h': usage(argv[0], EXIT_SUCCESS);
+		default: usage(argv[0], EXIT_FAILURE);
+		}
+	}
+	if ((gconf.in.sock == NULL) || (gconf.in.ip == 0) || ((gateway == 0) && !gconf.in.resolved) ||
+	    ((gconf.out.sock != NULL) && (gconf.out.ip == 0)))
+		usage(argv[0], EXIT_FAILURE);
+	if ((gconf.batch < 1) || (gconf.batch > VPL_MAX_BATCH))
+		gconf.batch = (gconf.batch < 1) ? 1 : VPL_MAX_BATCH;
+	gconf.outp = (gconf.out.sock != NULL) ? &(gconf.out) : &(gconf.in);
+	gconf.outp->counts = 1;
+
+	if ((gconf.flows = calloc(MAX_FLOWS, sizeof(flow_t))) == NULL)
+	{
+		fprintf(stderr, "gpktgen: unable to allocate the flows \n");
+		return EXIT_FAILURE;
+	}
+	for (i = 0; i < nspecs; i++)
+		if (addFlows(specs[i]) == EXIT_FAILURE)
+		{
+			fprintf(stderr, "gpktgen: bad flow %s \n", specs[i]);
+			return EXIT_FAILURE;
+		}
+	if (gconf.nflows == 0)
+	{
+		specs[0] = strdup("udp");
+		addFlows(specs[0]);
+	}
+
+	if ((openPort(&(gconf.in)) == EXIT_FAILURE) ||
+	    ((gconf.outp != &(gconf.in)) && (openPort(&(gconf.out)) == EXIT_FAILURE)))
+		return EXIT_FAILURE;
+
+	gconf.running = 1;
+	pthread_create(&(gconf.in.rxthread), NULL, rxThread, &(gconf.in));
+	if (gconf.outp != &(gconf.in))
+		pthread_create(&(gconf.out.rxthread), NULL, rxThread, &(gconf.out));
+
+	if (!gconf.in.resolved && (resolvePeer(&(gconf.in), gateway) == EXIT_FAILURE))
+	{
+		fprintf(stderr, "gpktgen: no ARP reply from the gateway %s \n", inet_ntoa(*(struct in_addr *)&gateway));
+		return EXIT_FAILURE;
+	}
+	for (i = 0; i < gconf.nflows; i++)
+	{
+		gconf.flows[i].src = gconf.in.ip;
+		if (gconf.flows[i].dst == 0)
+			gconf.flows[i].dst = gconf.outp->ip;
+		buildFlowHeader(&(gconf.flows[i]), &(gconf.in));
+	}
+
+	printf("gpktgen: sending %d flows for %d s \n", gconf.nflows, gconf.duration);
+	gconf.sending = 1;
+	signal(SIGINT, stopSending);
+	pthread_create(&txthread, NULL, txThread, &(gconf.in));
+
+	// interval reports while sending
+	if (gconf.interval > 0)
+		printf("\n   Time    Sent kpps   Recvd kpps    Mbit/s          Lost \n");
+	for (elapsed = 0; gconf.sending && (elapsed < gconf.duration); )
+	{
+		sleep((gconf.interval > 0) ? gconf.interval : 1);
+		elapsed += (gconf.interval > 0) ? gconf.interval : 1;
+		if (gconf.interval <= 0)
+			continue;
+		sumFlows(&sent, &received, &rcvbytes);
+		printf("%7d %12.1f %12.1f %9.1f %13lld \n", elapsed, (sent - psent) / 1000.0 / gconf.interval,
+		       (received - preceived) / 1000.0 / gconf.interval,
+		       (rcvbytes - pbytes) * 8.0 / 1000000.0 / gconf.interval, (long long)(sent - received));
+		fflush(stdout);
+		psent = sent;
+		preceived = received;
+		pbytes = rcvbytes;
+	}
+	pthread_join(txthread, NULL);
+
+	// the packets still in the router
+	usleep(gconf.drain * 1000);
+	gconf.running = 0;
+	pthread_join(gconf.in.rxthread, NULL);
+	if (gconf.outp != &(gconf.in))
+		pthread_join(gconf.out.rxthread, NULL);
+
+	printReport();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,384 @@
+/*
+ * traffic.c (packets of the gRouter packet generator)
+ *
+ * The tx thread paces every flow at its own rate: a flow is due every
+ * 1/rate seconds and all the packets that are due are sent with one
+ * sendmmsg() call, at most a batch at a time. A flow that cannot be
+ * kept up with skips what it missed rather than bursting to catch up,
+ * so the offered rate is the rate that was reached.
+ *
+ * Every packet carries a probe (flow, sequence number and the time it
+ * was sent). The rx thread of the out port matches the probes to the
+ * flows for the loss, reordering and latency; the rx threads also
+ * answer the ARP requests of the router and learn its address.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <netinet/tcp.h>
+#include <netinet/if_ether.h>
+#include "gpktgen.h"
+
+
+uint64_t nowNanos(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static uint32_t sum16(void *buf, int len, uint32_t sum)
+{
+	uint8_t *b = (uint8_t *)buf;
+
+	for (; len > 1; len -= 2, b += 2)
+		sum += (b[0] << 8) | b[1];
+	if (len > 0)
+		sum += b[0] << 8;
+	return sum;
+}
+
+
+static uint16_t fold16(uint32_t sum)
+{
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return htons(~sum & 0xffff);
+}
+
+
+/*
+ * the headers of every packet of flow f sent out of port p: only the
+ * IP identification, the checksums and the probe change per packet
+ */
+void buildFlowHeader(flow_t *f, port_t *p)
+{
+	struct ether_header *eh = (struct ether_header *)f->hdr;
+	struct iphdr *ip = (struct iphdr *)(f->hdr + ETHER_HEADER_SIZE);
+	struct udphdr *udp = (struct udphdr *)(ip + 1);
+	struct tcphdr *tcp = (struct tcphdr *)(ip + 1);
+
+	bzero(f->hdr, MAX_HEADER_SIZE);
+	memcpy(eh->ether_dhost, p->peermac, 6);
+	memcpy(eh->ether_shost, p->mac, 6);
+	eh->ether_type = htons(ETHERTYPE_IP);
+
+	ip->version = 4;
+	ip->ihl = IP_HEADER_SIZE / 4;
+	ip->tot_len = htons(f->size - ETHER_HEADER_SIZE);
+	ip->ttl = 64;
+	ip->protocol = f->proto;
+	ip->saddr = f->src;
+	ip->daddr = f->dst;
+	f->hdrlen = ETHER_HEADER_SIZE + IP_HEADER_SIZE;
+
+	if (f->proto == IPPROTO_UDP)
+	{
+		udp->source = htons(f->sport);
+		udp->dest = htons(f->dport);
+		udp->len = htons(f->size - ETHER_HEADER_SIZE - IP_HEADER_SIZE);
+		udp->check = 0;                              // none, allowed over IPv4
+		f->hdrlen += sizeof(struct udphdr);
+	} else if (f->proto == IPPROTO_TCP)
+	{
+		tcp->source = htons(f->sport);
+		tcp->dest = htons(f->dport);
+		tcp->doff = sizeof(struct tcphdr) / 4;
+		tcp->ack = tcp->psh = 1;
+		tcp->window = htons(65535);
+		f->hdrlen += sizeof(struct tcphdr);
+	}
+}
+
+
+// write the next packet of flow f, sent at now, into frame
+static void fillFrame(flow_t *f, uint8_t *frame, uint64_t now)
+{
+	struct iphdr *ip = (struct iphdr *)(frame + ETHER_HEADER_SIZE);
+	struct tcphdr *tcp = (struct tcphdr *)(ip + 1);
+	probe_t *probe = (probe_t *)(frame + f->hdrlen);
+	uint32_t sum;
+	int l4len;
+
+	memcpy(frame, f->hdr, f->hdrlen);
+	probe->magic = htonl(PROBE_MAGIC);
+	probe->flow = f->id;
+	probe->seq = f->seq;
+	probe->ts = now;
+
+	ip->id = htons((uint16_t)f->seq);
+	ip->check = 0;
+	ip->check = fold16(sum16(ip, IP_HEADER_SIZE, 0));
+
+	if (f->proto == IPPROTO_TCP)
+	{
+		l4len = f->size - ETHER_HEADER_SIZE - IP_HEADER_SIZE;
+		tcp->seq = htonl((uint32_t)(f->seq * (l4len - sizeof(struct tcphdr))));
+		sum = sum16(&(ip->saddr), 8, IPPROTO_TCP + l4len);
+		tcp->check = fold16(sum16(tcp, l4len, sum));
+	}
+	f->seq++;
+}
+
+
+void *txThread(void *arg)
+{
+	port_t *p = (port_t *)arg;
+	uint8_t *frames;
+	struct iovec iovs[VPL_MAX_BATCH];
+	flow_t *owner[VPL_MAX_BATCH], *f;
+	struct timespec ts;
+	uint64_t now, end, earliest;
+	int i, k, n, sent, rr = 0;
+
+	if ((frames = calloc(gconf.batch, MAX_FRAME_SIZE)) == NULL)
+	{
+		fprintf(stderr, "gpktgen: unable to allocate the transmit buffers \n");
+		return NULL;
+	}
+
+	gconf.started = now = nowNanos();
+	end = now + gconf.duration * 1000000000ULL;
+	for (i = 0; i < gconf.nflows; i++)
+		gconf.flows[i].next = now;
+
+	while (gconf.sending && ((now = nowNanos()) < end))
+	{
+		// all the packets due, the flows take turns to start the batch
+		n = 0;
+		earliest = end;
+		for (k = 0; (k < gconf.nflows) && (n < gconf.batch); k++)
+		{
+			f = &(gconf.flows[(rr + k) % gconf.nflows]);
+			if (f->next + TX_CATCHUP < now)
+				f->next = now;
+			while ((n < gconf.batch) && (f->next <= now))
+			{
+				fillFrame(f, frames + n * MAX_FRAME_SIZE, now);
+				iovs[n].iov_base = frames + n * MAX_FRAME_SIZE;
+				iovs[n].iov_len = f->size;
+				owner[n++] = f;
+				f->next += f->interval;
+				if (f->interval == 0)
+					break;
+			}
+			if (f->next < earliest)
+				earliest = f->next;
+		}
+		rr = (rr + 1) % gconf.nflows;
+
+		if (n == 0)
+		{
+			// nothing due: sleep if the next packet is far enough away
+			if (earliest - now > TX_SPIN)
+			{
+				ts.tv_sec = (earliest - now - TX_SPIN / 2) / 1000000000ULL;
+				ts.tv_nsec = (earliest - now - TX_SPIN / 2) % 1000000000ULL;
+				nanosleep(&ts, NULL);
+			}
+			continue;
+		}
+
+		if ((sent = vpl_sendmmsg(p->vpl, iovs, n)) < 0)
+		{
+			verbose(1, "[txThread]:: sendmmsg failed, error = %s ", strerror(-sent));
+			sent = 0;
+		}
+		for (i = 0; i < n; i++)
+			if (i < sent)
+			{
+				owner[i]->sent++;
+				owner[i]->sentbytes += iovs[i].iov_len;
+			} else
+				owner[i]->txerrors++;
+	}
+	gconf.stopped = nowNanos();
+	free(frames);
+	return NULL;
+}
+
+
+static void sendArp(port_t *p, int op, uint8_t *dmac, uint32_t sip, uint8_t *tmac, uint32_t tip)
+{
+	uint8_t frame[ETH_ZLEN];                         // padded to the smallest frame
+	struct ether_header *eh = (struct ether_header *)frame;
+	struct ether_arp *arp = (struct ether_arp *)(frame + ETHER_HEADER_SIZE);
+
+	bzero(frame, sizeof(frame));
+	memcpy(eh->ether_dhost, dmac, 6);
+	memcpy(eh->ether_shost, p->mac, 6);
+	eh->ether_type = htons(ETHERTYPE_ARP);
+	arp->arp_hrd = htons(ARPHRD_ETHER);
+	arp->arp_pro = htons(ETHERTYPE_IP);
+	arp->arp_hln = 6;
+	arp->arp_pln = 4;
+	arp->arp_op = htons(op);
+	memcpy(arp->arp_sha, p->mac, 6);
+	memcpy(arp->arp_spa, &sip, 4);
+	memcpy(arp->arp_tha, tmac, 6);
+	memcpy(arp->arp_tpa, &tip, 4);
+	vpl_sendto(p->vpl, frame, sizeof(frame));
+}
+
+
+// an address the router may ask for on port p: its own or a destination of the flows
+static int ownsAddress(port_t *p, uint32_t ip)
+{
+	int i;
+
+	if (ip == p->ip)
+		return 1;
+	if (p != gconf.outp)
+		return 0;
+	for (i = 0; i < gconf.nflows; i++)
+		if (gconf.flows[i].dst == ip)
+			return 1;
+	return 0;
+}
+
+
+static void arpInput(port_t *p, uint8_t *frame, int len)
+{
+	struct ether_arp *arp = (struct ether_arp *)(frame + ETHER_HEADER_SIZE);
+	uint32_t sip, tip;
+
+	if (len < ETHER_HEADER_SIZE + sizeof(struct ether_arp))
+		return;
+	memcpy(&sip, arp->arp_spa, 4);
+	memcpy(&tip, arp->arp_tpa, 4);
+
+	// a request or a reply from the router tells us where it is
+	if ((p->peerip != 0) && (sip == p->peerip) && !p->resolved)
+	{
+		memcpy(p->peermac, arp->arp_sha, 6);
+		p->resolved = 1;
+		verbose(1, "[arpInput]:: router at %02x:%02x:%02x:%02x:%02x:%02x on %s ", p->peermac[0],
+			p->peermac[1], p->peermac[2], p->peermac[3], p->peermac[4], p->peermac[5], p->sock);
+	}
+	if ((ntohs(arp->arp_op) == ARPOP_REQUEST) && ownsAddress(p, tip))
+	{
+		sendArp(p, ARPOP_REPLY, arp->arp_sha, tip, arp->arp_sha, sip);
+		p->arpreplies++;
+	}
+}
+
+
+// account for a probe received at now
+static void probeInput(port_t *p, uint8_t *frame, int len, uint64_t now)
+{
+	struct iphdr *ip = (struct iphdr *)(frame + ETHER_HEADER_SIZE);
+	struct tcphdr *tcp;
+	probe_t *probe;
+	flow_t *f;
+	uint64_t lat;
+	int off;
+
+	off = ETHER_HEADER_SIZE + ip->ihl * 4;
+	if (ip->protocol == IPPROTO_UDP)
+		off += sizeof(struct udphdr);
+	else if (ip->protocol == IPPROTO_TCP)
+	{
+		tcp = (struct tcphdr *)(frame + off);
+		if (off + sizeof(struct tcphdr) > len)
+			goto other;
+		off += tcp->doff * 4;
+	}
+	if (off + sizeof(probe_t) > len)
+		goto other;
+	probe = (probe_t *)(frame + off);
+	if ((ntohl(probe->magic) != PROBE_MAGIC) || (probe->flow >= gconf.nflows))
+		goto other;
+
+	f = &(gconf.flows[probe->flow]);
+	f->received++;
+	f->rcvbytes += len;
+	if (probe->seq < f->expected)
+		f->reordered++;
+	else
+		f->expected = probe->seq + 1;
+	lat = (now > probe->ts) ? now - probe->ts : 0;
+	f->latsum += lat;
+	if (lat > f->latmax)
+		f->latmax = lat;
+	f->hist[histIndex(lat)]++;
+	return;
+
+other:
+	p->rxother++;
+}
+
+
+void *rxThread(void *arg)
+{
+	port_t *p = (port_t *)arg;
+	struct iovec iovs[VPL_MAX_BATCH];
+	int lens[VPL_MAX_BATCH];
+	struct ether_header *eh;
+	uint8_t *frames;
+	uint64_t now;
+	int i, n;
+
+	if ((frames = malloc(VPL_MAX_BATCH * MAX_FRAME_SIZE)) == NULL)
+	{
+		fprintf(stderr, "gpktgen: unable to allocate the receive buffers \n");
+		return NULL;
+	}
+	for (i = 0; i < VPL_MAX_BATCH; i++)
+	{
+		iovs[i].iov_base = frames + i * MAX_FRAME_SIZE;
+		iovs[i].iov_len = MAX_FRAME_SIZE;
+	}
+
+	while (gconf.running)
+	{
+		if ((n = vpl_recvmmsg(p->vpl, iovs, lens, VPL_MAX_BATCH, RX_POLL)) < 0)
+		{
+			verbose(1, "[rxThread]:: receive failed on %s, error = %s ", p->sock, strerror(-n));
+			break;
+		}
+		now = nowNanos();
+		for (i = 0; i < n; i++)
+		{
+			p->rxframes++;
+			eh = (struct ether_header *)iovs[i].iov_base;
+			if (lens[i] < ETHER_HEADER_SIZE + IP_HEADER_SIZE)
+				p->rxother++;
+			else if (ntohs(eh->ether_type) == ETHERTYPE_ARP)
+				arpInput(p, iovs[i].iov_base, lens[i]);
+			else if ((ntohs(eh->ether_type) == ETHERTYPE_IP) && p->counts)
+				probeInput(p, iovs[i].iov_base, lens[i], now);
+			else
+				p->rxother++;
+		}
+	}
+	free(frames);
+	return NULL;
+}
+
+
+/*
+ * find the Ethernet address of the router (ip) on port p. the rx thread
+ * of the port takes the reply. returns EXIT_FAILURE on timeout.
+ */
+int resolvePeer(port_t *p, uint32_t ip)
+{
+	uint8_t bcast[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff}, zero[6] = {0, 0, 0, 0, 0, 0};
+	int tries, waited;
+
+	p->peerip = ip;
+	for (tries = 0; !p->resolved && (tries < ARP_TIMEOUT * 1000 / ARP_RETRY); tries++)
+	{
+		sendArp(p, ARPOP_REQUEST, bcast, p->ip, zero, ip);
+		for (waited = 0; !p->resolved && (waited < ARP_RETRY); waited += 10)
+			usleep(10000);
+	}
+	return p->resolved ? EXIT_SUCCESS : EXIT_FAILURE;
+}
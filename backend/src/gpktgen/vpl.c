@@ -0,0 +1,348 @@
+/*
+ * vpl.c (virtual physical layer of the packet generator)
+ *
+ * A port of the generator attaches to a gRouter interface (or to a
+ * uswitch) the way a gRouter interface does: it connects as a client
+ * if somebody is listening on the socket and otherwise listens on it
+ * until the other side connects. Frames are moved in batches with
+ * recvmmsg()/sendmmsg().
+
+ * This code is based on code borrowed from different portions
+ * of the UML source code. The original code is copyrighted as follows:
+
+ * Copyright (C) 2001 Lennert Buytenhek (buytenh@gnu.org) and
+ * James Leu (jleu@mindspring.net).
+ * Copyright (C) 2001 by various other people who didn't put their name here.
+ * Licensed under the GPL.
+ */
+
+#define _GNU_SOURCE                   // recvmmsg, sendmmsg
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include "vpl.h"
+#include "gpktgen.h"
+
+static int vpl_nsocks = 0;            // data sockets bound, to tell our ports apart
+
+
+int __vpl_sendto(int fd, void *buf, int len, void *to, int sock_len)
+{
+	int n;
+
+	while(((n = sendto(fd, buf, len, 0, (struct sockaddr *) to,
+                           sock_len)) < 0) && (errno == EINTR)) ;
+	if(n < 0)
+	{
+		if(errno == EAGAIN) return(0);
+        	return(-errno);
+	}
+	else if(n == 0) return(-ENOTCONN);
+	return(n);
+}
+
+
+/*
+ * connect to the HUB, switch or router listening on vsock_name.
+ * returns non NULL pointer if success. Otherwise returns NULL.
+ */
+vpl_data_t *vpl_connect(char *vsock_name)
+{
+	struct timeval temp_wtime;
+	struct sockaddr_un *sun;
+	struct request_v3 req;
+	vpl_data_t *pri;
+	int n, fd;
+
+	struct name_t  		// temporary structure for providing local address
+	{
+		char zero;
+		int pid;
+		int usecs;
+		int seq;
+	} name;
+
+	verbose(2, "[vpl_connect]:: starting connection to %s.. ", vsock_name);
+	if ((pri = (vpl_data_t *)malloc(sizeof(vpl_data_t))) == NULL)
+		return NULL;
+	bzero(pri, sizeof(vpl_data_t));
+	pri->sock_type = "unix";
+	pri->ctl_sock = strdup(vsock_name);
+	pri->ctl_addr = new_addr(pri->ctl_sock, strlen(pri->ctl_sock) + 1);
+	pri->data_addr = NULL;
+	pri->data = -1;
+	pri->control = -1;
+	name.zero = 0;
+	name.pid = getpid();
+	gettimeofday(&temp_wtime, NULL);
+	name.usecs = temp_wtime.tv_usec;
+	name.seq = vpl_nsocks++;
+	pri->local_addr = new_addr(&name, sizeof(struct name_t));
+
+	if ((pri->control = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+	{
+		verbose(2, "[vpl_connect]:: control socket failed, error = %s", strerror(errno));
+		return NULL;
+	}
+
+	if (connect(pri->control, (struct sockaddr *) pri->ctl_addr, sizeof(struct sockaddr_un)) < 0)
+	{
+		verbose(2, "[vpl_connect]:: control connect failed, error = %s", strerror(errno));
+		close(pri->control);
+		return NULL;
+	}
+
+	if ((fd = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0)
+	{
+		verbose(2, "[vpl_connect]:: data socket failed, error = %s", strerror(errno));
+		close(pri->control);
+		return NULL;
+	}
+	if (bind(fd, (struct sockaddr *) pri->local_addr, sizeof(struct sockaddr_un)) < 0)
+	{
+		verbose(2, "[vpl_connect]:: data bind failed, error = %s", strerror(errno));
+		close(fd);
+		close(pri->control);
+		return NULL;
+	}
+
+	if ((sun = malloc(sizeof(struct sockaddr_un))) == NULL)
+	{
+		close(fd);
+		close(pri->control);
+		return NULL;
+	}
+
+	req.magic = SWITCH_MAGIC;
+	req.version = SWITCH_VERSION;
+	req.type = REQ_NEW_CONTROL;
+	memcpy(&(req.sock), pri->local_addr, sizeof(struct sockaddr_un));
+	n = write(pri->control, &req, sizeof(req));
+	if (n != sizeof(req))
+	{
+		verbose(2, "[vpl_connect]:: control setup request returned %d, error = %s", n, strerror(errno));
+		close(fd);
+		close(pri->control);
+		return NULL;
+	}
+
+	n = read(pri->control, sun, sizeof(*sun));
+	if (n != sizeof(*sun))
+	{
+		verbose(2, "[vpl_connect]:: read of data socket returned %d, error = %s", n, strerror(errno));
+		close(fd);
+		close(pri->control);
+		return NULL;
+	}
+	pri->data_addr = sun;
+	pri->data = fd;
+
+	return pri;
+}
+
+
+/*
+ * create a vpl server socket called name. data_addr is set by
+ * vpl_accept_connect once the other side connects.
+ */
+vpl_data_t *vpl_create_server(char *name)
+{
+	struct timeval temp_wtime;
+	vpl_data_t *vdata;
+	int one = 1;
+	struct name_t  					// temporary structure for providing local address
+	{
+		char zero;
+		int pid;
+		int usecs;
+		int seq;
+	} sname;
+
+	if ((vdata = (vpl_data_t *)malloc(sizeof(vpl_data_t))) == NULL)
+		return NULL;
+	bzero(vdata, sizeof(vpl_data_t));
+	vdata->sock_type = "unix";
+	vdata->ctl_sock = strdup(name);
+	vdata->data_addr = NULL;
+
+	if ((vdata->control = socket(PF_UNIX, SOCK_STREAM, 0)) < 0)
+	{
+		verbose(1, "[vpl_create_server]:: cannot create a socket ");
+		return NULL;
+	}
+	setsockopt(vdata->control, SOL_SOCKET, SO_REUSEADDR, (char *) &one, sizeof(one));
+
+	// a socket left behind by a previous run is in the way
+	unlink(name);
+	vdata->ctl_addr = new_addr(name, strlen(name) + 1);
+	if (bind(vdata->control, (struct sockaddr *)vdata->ctl_addr, sizeof(struct sockaddr_un)) < 0)
+	{
+		verbose(1, "[vpl_create_server]:: error binding socket %s, error = %s", name, strerror(errno));
+		close(vdata->control);
+		return NULL;
+	}
+	if (listen(vdata->control, 15) < 0)
+		verbose(1, "[vpl_create_server]:: error executing listen");
+
+	if ((vdata->data = socket(PF_UNIX, SOCK_DGRAM, 0)) < 0)
+	{
+		verbose(1, "[vpl_create_server]:: unable to create socket ");
+		return NULL;
+	}
+
+	sname.zero = 0;
+	sname.pid = getpid();
+	gettimeofday(&temp_wtime, NULL);
+	sname.usecs = temp_wtime.tv_usec;
+	sname.seq = vpl_nsocks++;
+	vdata->local_addr = new_addr(&sname, sizeof(struct name_t));
+
+	if (bind(vdata->data, (struct sockaddr *)vdata->local_addr, sizeof(struct sockaddr_un)) < 0)
+	{
+		verbose(1, "[vpl_create_server]:: bind error, error = %s", strerror(errno));
+		return NULL;
+	}
+	return vdata;
+}
+
+
+/*
+ * wait for the other side to connect to a server socket and set the
+ * address its frames go to. returns -1 on failure.
+ */
+int vpl_accept_connect(vpl_data_t *v)
+{
+	struct request_v3 req;
+	int insock, rbytes;
+
+	if ((insock = accept(v->control, NULL, NULL)) < 0)
+	{
+		verbose(1, "[vpl_accept_connect]:: ERROR!! %s ", strerror(errno));
+		return -1;
+	}
+
+	// send the local address to the remote side, read the address of its data socket
+	write(insock, v->local_addr, sizeof(struct sockaddr_un));
+	rbytes = read(insock, &req, sizeof(struct request_v3));
+	if ((rbytes < sizeof(struct request_v3)) || (req.magic != SWITCH_MAGIC) ||
+	    (req.type != REQ_NEW_CONTROL))
+	{
+		verbose(1, "[vpl_accept_connect]:: malformed request packet ");
+		close(insock);
+		return -1;
+	}
+	v->data_addr = dup_addr(&req.sock);
+	return 1;
+}
+
+
+int vpl_sendto(vpl_data_t *vpl, void *buf, int len)
+{
+	struct sockaddr_un *data_addr = vpl->data_addr;
+
+	return(__vpl_sendto(vpl->data, buf, len, data_addr, sizeof(*data_addr)));
+}
+
+
+/*
+ * Receive up to nbufs frames, frame i into iovs[i]; lens gets the size
+ * of each. Waits at most timeout_ms for the first frame. Returns the
+ * number of frames received, 0 on timeout or -errno.
+ */
+int vpl_recvmmsg(vpl_data_t *vpl, struct iovec *iovs, int *lens, int nbufs, int timeout_ms)
+{
+	struct mmsghdr msgs[VPL_MAX_BATCH];
+	struct pollfd pfd;
+	int i, n;
+
+	pfd.fd = vpl->data;
+	pfd.events = POLLIN;
+	if ((n = poll(&pfd, 1, timeout_ms)) <= 0)
+		return ((n < 0) && (errno != EINTR)) ? -errno : 0;
+
+	if (nbufs > VPL_MAX_BATCH)
+		nbufs = VPL_MAX_BATCH;
+	bzero(msgs, nbufs * sizeof(struct mmsghdr));
+	for (i = 0; i < nbufs; i++)
+	{
+		msgs[i].msg_hdr.msg_iov = &(iovs[i]);
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	while (((n = recvmmsg(vpl->data, msgs, nbufs, MSG_DONTWAIT, NULL)) < 0) && (errno == EINTR))
+		;
+	if (n < 0)
+		return (errno == EAGAIN) ? 0 : -errno;
+
+	for (i = 0; i < n; i++)
+		lens[i] = msgs[i].msg_len;
+	return n;
+}
+
+
+/*
+ * Send nbufs frames, frame i from iovs[i], with as few system calls as
+ * possible. Returns the number of frames sent, or -errno if the first
+ * call fails.
+ */
+int vpl_sendmmsg(vpl_data_t *vpl, struct iovec *iovs, int nbufs)
+{
+	struct mmsghdr msgs[VPL_MAX_BATCH];
+	struct sockaddr_un *data_addr = vpl->data_addr;
+	int i, n, sent = 0;
+
+	if (nbufs > VPL_MAX_BATCH)
+		nbufs = VPL_MAX_BATCH;
+	bzero(msgs, nbufs * sizeof(struct mmsghdr));
+	for (i = 0; i < nbufs; i++)
+	{
+		msgs[i].msg_hdr.msg_name = data_addr;
+		msgs[i].msg_hdr.msg_namelen = sizeof(*data_addr);
+		msgs[i].msg_hdr.msg_iov = &(iovs[i]);
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	// a datagram socket may take fewer messages than given; send the rest
+	while (sent < nbufs)
+	{
+		while (((n = sendmmsg(vpl->data, msgs + sent, nbufs - sent, 0)) < 0) && (errno == EINTR))
+			;
+		if (n <= 0)
+		{
+			if (sent > 0) break;
+			if ((n < 0) && (errno != EAGAIN)) return -errno;
+			return 0;
+		}
+		sent += n;
+	}
+	return sent;
+}
+
+
+/*
+ * Cast the address in appropriate format for the socket.
+ */
+struct sockaddr_un *new_addr(void *name, int len)
+{
+	struct sockaddr_un *sun;
+
+	if ((sun = malloc(sizeof(struct sockaddr_un))) == NULL)
+		return NULL;
+	bzero(sun, sizeof(struct sockaddr_un));
+	sun->sun_family = AF_UNIX;
+	memcpy(sun->sun_path, name, len);
+	return sun;
+}
+
+
+struct sockaddr_un *dup_addr(struct sockaddr_un *sock)
+{
+	struct sockaddr_un *sun;
+
+	if ((sun = malloc(sizeof(struct sockaddr_un))) == NULL)
+		return NULL;
+	memcpy(sun, sock, sizeof(struct sockaddr_un));
+	return sun;
+}
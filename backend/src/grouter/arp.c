@@ -8,6 +8,10 @@
  */
 
 #include <slack/err.h>
+#include <slack/prog.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <unistd.h>
 #include <netinet/in.h>
 #include "protocols.h"
 #include "arp.h"
@@ -15,15 +19,25 @@
 #include "moduledefs.h"
 #include "grouter.h"
 #include "packetcore.h"
+#include "packetpool.h"
+#include "trace.h"
+#include "flowcache.h"
+#include "epoch.h"
 
 
-int tbl_replace_indx;            // overwrite this element if no free space in ARP table
-int buf_replace_indx;            // overwrite this element if no free space in ARP buffer
-arp_entry_t ARPtable[MAX_ARP];		                // ARP table
-arp_buffer_entry_t ARPbuffer[MAX_ARP_BUFFERS];   	// ARP buffer for unresolved packets
+arp_table_t * volatile ARPtable;                        // ARP (neighbor) table
+int arp_timeout = ARP_DEFAULT_TIMEOUT;                  // entry lifetime in seconds, 0 never expires
+arp_pending_t ARPbuffer[MAX_ARP_PENDING];   		// packets waiting for resolution, per next hop
+int arp_buf_hash[MAX_ARP_PENDING];                      // next hop -> ARPbuffer entry, chained
+int arp_buf_free;                                       // first free ARPbuffer entry
+unsigned long arp_requests, arp_suppressed, arp_dropped;  // requests sent, not sent, packets dropped
+pthread_t arp_timer;
+pthread_mutex_t arp_tbl_lock = PTHREAD_MUTEX_INITIALIZER;      // writers only, readers use seqlocks
+pthread_mutex_t arp_buf_lock = PTHREAD_MUTEX_INITIALIZER;
 
 
 extern pktcore_t *pcore;
+extern router_config rconfig;
 
 
 void ARPInit()
@@ -33,7 +47,7 @@ void ARPInit()
 
 	verbose(2, "[initARP]:: Initializing the ARP table and buffer ");
 
-	ARPInitTable();                    // initialize APR table
+	ARPInitTable(rconfig.arpsize);     // initialize APR table
 	ARPInitBuffer();                   // initialize ARP buffer
 
 }
@@ -57,11 +71,18 @@ int ARPSend2Output(gpacket_t *pkt)
 		return EXIT_FAILURE;
 	}
 
-	vlevel = prog_verbosity_level();
-	if (vlevel >= 3)
+	if ((vlevel = trace_level) >= 3)
 		printGPacket(pkt, vlevel, "ARP_ROUTINE");
 
-	return writeQueue(pcore->outputQ, (void *)pkt, sizeof(gpacket_t));
+	// the output queue holds its own reference until the packet is sent
+	holdPacket(pkt);
+	if (writeQueue(pcore->outputQ, (void *)pkt, sizeof(gpacket_t)) == EXIT_FAILURE)
+	{
+		verbose(2, "[ARPSend2Output]:: output queue full.. packet dropped ");
+		releasePacket(pkt);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
 }
 
 
@@ -76,22 +97,25 @@ int ARPResolve(gpacket_t *in_pkt)
 {
 	uchar mac_addr[6];
 	char tmpbuf[MAX_TMPBUF_LEN];
+	int status;
 
-	in_pkt->data.header.prot = htons(IP_PROTOCOL);
+	GPKT_ETH(in_pkt)->header.prot = htons(IP_PROTOCOL);
 	// lookup the ARP table for the MAC for next hop
-	if (ARPFindEntry(in_pkt->frame.nxth_ip_addr, mac_addr) == EXIT_FAILURE)
+	if ((status = ARPFindEntry(in_pkt->frame.nxth_ip_addr, mac_addr)) == EXIT_FAILURE)
 	{
-		// no ARP match, buffer and send ARP request for next
-		verbose(2, "[ARPResolve]:: buffering packet, sending ARP request");
+		// no ARP match, buffer the packet. a request is sent for the
+		// first packet to this next hop, the timer repeats it if needed
+		verbose(2, "[ARPResolve]:: buffering packet, waiting for ARP reply");
 		ARPAddBuffer(in_pkt);
-		in_pkt->frame.arp_bcast = TRUE;                        // tell gnet this is bcast to prevent recursive ARP lookup!
-		// create a new message for ARP request
-		ARPSendRequest(in_pkt);
-		return EXIT_SUCCESS;;
+		return EXIT_SUCCESS;
 	}
 
+	// the entry is about to expire: refresh it while it is still in use
+	if (status == ARP_STALE)
+		ARPSendRequest(in_pkt);
+
 	verbose(2, "[ARPResolve]:: sent packet to MAC %s", MAC2Colon(tmpbuf, mac_addr));
-	COPY_MAC(in_pkt->data.header.dst, mac_addr);
+	COPY_MAC(GPKT_ETH(in_pkt)->header.dst, mac_addr);
 	in_pkt->frame.arp_valid = TRUE;
 	ARPSend2Output(in_pkt);
 
@@ -111,7 +135,7 @@ void ARPProcess(gpacket_t *pkt)
 {
 	char tmpbuf[MAX_TMPBUF_LEN];
 
-	arp_packet_t *apkt = (arp_packet_t *) pkt->data.data;
+	arp_packet_t *apkt = (arp_packet_t *)GPKT_PAYLOAD(pkt);
 
 	// check packet is ethernet and addresses of IP type.. otherwise throw away
 	if ((ntohs(apkt->hw_addr_type) != ETHERNET_PROTOCOL) || (ntohs(apkt->arp_prot) != IP_PROTOCOL))
@@ -141,7 +165,7 @@ void ARPProcess(gpacket_t *pkt)
 	{
 		apkt->arp_opcode = htons(ARP_REPLY);
 		COPY_MAC(apkt->src_hw_addr, pkt->frame.src_hw_addr);
-		COPY_MAC(apkt->dst_hw_addr, pkt->data.header.src);
+		COPY_MAC(apkt->dst_hw_addr, GPKT_ETH(pkt)->header.src);
 		COPY_IP(apkt->dst_ip_addr, apkt->src_ip_addr);
 		COPY_IP(apkt->src_ip_addr, gHtonl((uchar *)tmpbuf, pkt->frame.src_ip_addr));
 
@@ -152,12 +176,12 @@ void ARPProcess(gpacket_t *pkt)
 
 		pkt->frame.dst_interface = pkt->frame.src_interface;
 
-		COPY_MAC(pkt->data.header.dst, pkt->data.header.src);
-		COPY_MAC(pkt->data.header.src,  pkt->frame.src_hw_addr);
+		COPY_MAC(GPKT_ETH(pkt)->header.dst, GPKT_ETH(pkt)->header.src);
+		COPY_MAC(GPKT_ETH(pkt)->header.src,  pkt->frame.src_hw_addr);
 		COPY_IP(pkt->frame.nxth_ip_addr, gNtohl((uchar *)tmpbuf, apkt->dst_ip_addr));
 		pkt->frame.arp_valid = TRUE;
 
-		pkt->data.header.prot = htons(ARP_PROTOCOL);
+		GPKT_ETH(pkt)->header.prot = htons(ARP_PROTOCOL);
 
 		ARPSend2Output(pkt);
 	}
@@ -180,95 +204,351 @@ void ARPProcess(gpacket_t *pkt)
  *-------------------------------------------------------------------------*/
 
 /*
- * initialize the ARP table
+ * The ARP table is the single neighbor table of the router: the packet
+ * workers (ARPResolve) and the GNET handler both look up the next hop MAC
+ * here. It is an open addressed hash on the full IPv4 address. Lookups
+ * take no lock; each entry carries a sequence count (seqlock) and a
+ * reader copies the entry and retries if a writer changed it meanwhile.
+ * Writers (ARP replies, CLI) are serialized by arp_tbl_lock. The table
+ * itself is replaced when it is rebuilt, so lookups run inside an epoch
+ * section and the old table is freed after a grace period (epoch.h).
+ *
+ * Entries age: an entry older than arp_timeout is no longer used. When an
+ * entry is used in the last quarter of its lifetime the lookup returns
+ * ARP_STALE once, so that the caller sends a refresh request while the
+ * entry is still valid.
  */
-void ARPInitTable()
+
+static inline int ARPHash(arp_table_t *tbl, uchar *ip_addr)
 {
-	int i;
+	unsigned int h = ip_addr[0] | (ip_addr[1] << 8) | (ip_addr[2] << 16) | (ip_addr[3] << 24);
+
+	h *= 0x9e3779b1;
+	h ^= h >> 16;
+	return h & (tbl->size - 1);
+}
+
+
+static void ARPReadEntry(arp_entry_t *entry, arp_entry_t *copy)
+{
+	unsigned int seq;
+
+	do
+	{
+		while ((seq = entry->seq) & 1)
+			sched_yield();
+		__sync_synchronize();
+		copy->state = entry->state;
+		COPY_IP(copy->ip_addr, entry->ip_addr);
+		COPY_MAC(copy->mac_addr, entry->mac_addr);
+		copy->updated = entry->updated;
+		__sync_synchronize();
+	} while (entry->seq != seq);
+}
+
+
+static inline void ARPWriteBegin(arp_entry_t *entry)
+{
+	entry->seq++;
+	__sync_synchronize();
+}
+
+
+static inline void ARPWriteEnd(arp_entry_t *entry)
+{
+	__sync_synchronize();
+	entry->seq++;
+}
+
+
+static inline int ARPExpired(arp_entry_t *entry, unsigned long long now)
+{
+	return (arp_timeout > 0) && (now - entry->updated > arp_timeout * 1000000000ULL);
+}
+
+
+static arp_table_t *ARPAllocTable(int slots)
+{
+	arp_table_t *tbl;
+
+	if ((tbl = malloc(sizeof(arp_table_t))) == NULL)
+		return NULL;
+	if ((tbl->entry = calloc(slots, sizeof(arp_entry_t))) == NULL)
+	{
+		free(tbl);
+		return NULL;
+	}
+	tbl->size = slots;
+	tbl->used = 0;
+	return tbl;
+}
+
+
+static void ARPFreeTable(void *arg)
+{
+	arp_table_t *tbl = (arp_table_t *)arg;
+
+	free(tbl->entry);
+	free(tbl);
+}
+
+
+/*
+ * rebuild the table once three quarters of the slots are used (by valid
+ * or deleted entries): expired and deleted entries are dropped and, if
+ * more than half the slots would still be valid, the table doubles in
+ * size so that no live neighbor is lost. the new table replaces the old
+ * one in a single store; the old table is retired and freed once no
+ * lookup can still be probing it.
+ */
+static void ARPRebuildTable(unsigned long long now)
+{
+	arp_table_t *old = ARPtable, *tbl;
+	int i, j, slots = old->size, nkeep = 0;
+
+	for (i = 0; i < old->size; i++)
+		if ((old->entry[i].state == ARP_ENTRY_VALID) && !ARPExpired(&(old->entry[i]), now))
+			nkeep++;
+	if ((nkeep > slots / 2) && (slots < (1 << 30)))
+		slots <<= 1;
+
+	if ((tbl = ARPAllocTable(slots)) == NULL)
+	{
+		error("[ARPRebuildTable]:: unable to allocate an ARP table of %d slots ", slots);
+		return;
+	}
 
-	tbl_replace_indx = 0;
+	for (i = 0; i < old->size; i++)
+	{
+		if ((old->entry[i].state != ARP_ENTRY_VALID) || ARPExpired(&(old->entry[i]), now))
+			continue;
+		for (j = ARPHash(tbl, old->entry[i].ip_addr); tbl->entry[j].state != ARP_ENTRY_EMPTY;
+		     j = (j + 1) & (tbl->size - 1));
+		tbl->entry[j] = old->entry[i];
+		tbl->entry[j].seq = 0;
+		tbl->entry[j].refreshing = 0;
+	}
+	tbl->used = nkeep;
+
+	epochRetire(ARPFreeTable, epochPublish((void * volatile *)&ARPtable, tbl));
 
-	for (i = 0; i < MAX_ARP; i++)
-		ARPtable[i].is_empty = TRUE;
+	verbose(2, "[ARPRebuildTable]:: ARP table rebuilt, %d entries kept in %d slots ", nkeep, slots);
+}
 
-	verbose(2, "[ARPInitTable]:: ARP table initialized.. ");
+
+/*
+ * a deleted slot followed by an empty slot ends every probe sequence
+ * through it, so it can become empty again (and so can the deleted
+ * slots right before it).
+ */
+static void ARPReclaimSlots(arp_table_t *tbl, int i)
+{
+	int mask = tbl->size - 1;
+
+	while ((tbl->entry[i].state == ARP_ENTRY_DELETED) &&
+	       (tbl->entry[(i + 1) & mask].state == ARP_ENTRY_EMPTY))
+	{
+		ARPWriteBegin(&(tbl->entry[i]));
+		tbl->entry[i].state = ARP_ENTRY_EMPTY;
+		ARPWriteEnd(&(tbl->entry[i]));
+		tbl->used--;
+		i = (i - 1) & mask;
+	}
+}
+
+
+/*
+ * initialize the ARP table with at least size slots
+ */
+void ARPInitTable(int size)
+{
+	int slots = MIN_ARP_SIZE;
+
+	while ((slots < size) && (slots < (1 << 30)))
+		slots <<= 1;
+
+	if ((ARPtable = ARPAllocTable(slots)) == NULL)
+	{
+		fatal("[ARPInitTable]:: unable to allocate the ARP table ");
+		return;
+	}
+
+	verbose(2, "[ARPInitTable]:: ARP table initialized with %d slots.. ", slots);
 	return;
 }
 
 
+void ARPSetTimeout(int seconds)
+{
+	arp_timeout = seconds;
+}
+
+
+int ARPGetTimeout(void)
+{
+	return arp_timeout;
+}
+
+
+/*
+ * probe the table for the valid entry of ip_addr and copy it into
+ * entry. returns the slot, or -1 if there is no valid entry.
+ */
+static int ARPLookup(arp_table_t *tbl, uchar *ip_addr, arp_entry_t *entry)
+{
+	int i, n;
+
+	i = ARPHash(tbl, ip_addr);
+	for (n = 0; n < tbl->size; n++, i = (i + 1) & (tbl->size - 1))
+	{
+		ARPReadEntry(&(tbl->entry[i]), entry);
+		if (entry->state == ARP_ENTRY_EMPTY)
+			break;
+		if ((entry->state != ARP_ENTRY_VALID) || (COMPARE_IP(entry->ip_addr, ip_addr) != 0))
+			continue;
+		if ((arp_timeout > 0) && ARPExpired(entry, getTimeNanos()))
+			break;
+		return i;
+	}
+	return -1;
+}
+
+
 /*
  * Find an ARP entry matching the supplied IP address in the ARP table
  * ARGUMENTS: uchar *ip_addr: IP address to look up
  *            uchar *mac_addr: returned MAC address corresponding to the IP
- * The MAC is only set when the return status is EXIT_SUCCESS. If error,
- * the MAC address (mac_addr) is undefined.
+ * The MAC is only set when the return status is EXIT_SUCCESS or ARP_STALE.
+ * ARP_STALE means the entry is about to expire and the caller should send
+ * a request to refresh it. If error, the MAC address (mac_addr) is undefined.
  */
 int ARPFindEntry(uchar *ip_addr, uchar *mac_addr)
 {
-	int i;
+	arp_table_t *tbl;
+	arp_entry_t entry;
+	int i, status = EXIT_SUCCESS;
 	char tmpbuf[MAX_TMPBUF_LEN];
 
-	for (i = 0; i < MAX_ARP; i++)
+	epochEnter();
+	tbl = ARPtable;
+	if ((i = ARPLookup(tbl, ip_addr, &entry)) >= 0)
 	{
-		if(ARPtable[i].is_empty == FALSE &&
-		   COMPARE_IP(ARPtable[i].ip_addr, ip_addr) == 0)
-		{
-			// found IP address - copy the MAC address
-			COPY_MAC(mac_addr, ARPtable[i].mac_addr);
-			verbose(2, "[ARPFindEntry]:: found ARP entry #%d for IP %s", i, IP2Dot(tmpbuf, ip_addr));
-			return EXIT_SUCCESS;
-		}
+		if ((arp_timeout > 0) && (getTimeNanos() - entry.updated > arp_timeout * 750000000ULL) &&
+		    __sync_bool_compare_and_swap(&(tbl->entry[i].refreshing), 0, 1))
+			status = ARP_STALE;
+		epochExit();
+
+		// found IP address - copy the MAC address
+		COPY_MAC(mac_addr, entry.mac_addr);
+		VERBOSE(2, "[ARPFindEntry]:: found ARP entry #%d for IP %s", i, IP2Dot(tmpbuf, ip_addr));
+		TRACE(TRACE_ARP_HIT, traceIP(ip_addr), i, status);
+		return status;
 	}
+	epochExit();
 
-	verbose(2, "[ARPFindEntry]:: failed to find ARP entry for IP %s", IP2Dot(tmpbuf, ip_addr));
+	VERBOSE(2, "[ARPFindEntry]:: failed to find ARP entry for IP %s", IP2Dot(tmpbuf, ip_addr));
+	TRACE(TRACE_ARP_MISS, traceIP(ip_addr), 0, 0);
 	return EXIT_FAILURE;
 }
 
 
+/*
+ * Like ARPFindEntry, for the flow cache: returns EXIT_SUCCESS with the
+ * MAC only if the entry is not due for a refresh, and sets until to the
+ * time it will be (~0 if entries do not age). Never asks for a refresh.
+ */
+int ARPFindFresh(uchar *ip_addr, uchar *mac_addr, unsigned long long *until)
+{
+	arp_entry_t entry;
+	int i;
+
+	epochEnter();
+	i = ARPLookup(ARPtable, ip_addr, &entry);
+	epochExit();
+	if (i < 0)
+		return EXIT_FAILURE;
+	if (arp_timeout > 0)
+	{
+		*until = entry.updated + arp_timeout * 750000000ULL;
+		if (getTimeNanos() >= *until)
+			return EXIT_FAILURE;
+	} else
+		*until = ~0ULL;
+	COPY_MAC(mac_addr, entry.mac_addr);
+	return EXIT_SUCCESS;
+}
+
+
 
 /*
- * add an entry to the ARP table
+ * add an entry to the ARP table or refresh an existing one
  * ARGUMENTS: uchar *ip_addr - the IP address (4 bytes)
  *            uchar *mac_addr - the MAC address (6 bytes)
  * RETURNS: Nothing
  */
 void ARPAddEntry(uchar *ip_addr, uchar *mac_addr)
 {
-	int i;
-	int empty_slot = MAX_ARP;
+	unsigned long long now = getTimeNanos();
+	arp_table_t *tbl;
+	int i, n, slot = -1, moved;
 	char tmpbuf[MAX_TMPBUF_LEN];
 
-	for (i = 0; i < MAX_ARP; i++)
+	pthread_mutex_lock(&arp_tbl_lock);
+	tbl = ARPtable;
+	i = ARPHash(tbl, ip_addr);
+	for (n = 0; n < tbl->size; n++, i = (i + 1) & (tbl->size - 1))
 	{
-		if ((ARPtable[i].is_empty == FALSE) &&
-		    (COMPARE_IP(ARPtable[i].ip_addr, ip_addr) == 0))
+		if (tbl->entry[i].state == ARP_ENTRY_EMPTY)
+			break;
+		if ((tbl->entry[i].state == ARP_ENTRY_VALID) &&
+		    (COMPARE_IP(tbl->entry[i].ip_addr, ip_addr) == 0))
 		{
-			// update entry
-			COPY_IP(ARPtable[i].ip_addr, ip_addr);
-			COPY_MAC(ARPtable[i].mac_addr, mac_addr);
+			// update entry; a new MAC invalidates the cached flows
+			moved = (COMPARE_MAC(tbl->entry[i].mac_addr, mac_addr) != 0);
+			ARPWriteBegin(&(tbl->entry[i]));
+			COPY_MAC(tbl->entry[i].mac_addr, mac_addr);
+			tbl->entry[i].updated = now;
+			ARPWriteEnd(&(tbl->entry[i]));
+			tbl->entry[i].refreshing = 0;
+			pthread_mutex_unlock(&arp_tbl_lock);
+			if (moved)
+				flowInvalidate();
 
 			verbose(2, "[ARPAddEntry]:: updated ARP table entry #%d: IP %s = MAC %s", i,
 			       IP2Dot(tmpbuf, ip_addr), MAC2Colon(tmpbuf+20, mac_addr));
 			return;
 		}
-		if (ARPtable[i].is_empty == TRUE)
-			empty_slot = i;
+		// deleted and expired slots on the probe sequence can be reused
+		if ((slot < 0) && ((tbl->entry[i].state == ARP_ENTRY_DELETED) || ARPExpired(&(tbl->entry[i]), now)))
+			slot = i;
 	}
 
-	if (empty_slot == MAX_ARP)
+	if (slot < 0)
 	{
-		// ARP table full.. do the replacement
-		// use the FIFO strategy: table replace index is the FIFO pointer
-		empty_slot = tbl_replace_indx;
-		tbl_replace_indx = (tbl_replace_indx + 1) % MAX_ARP;
+		// a new slot is needed: keep a quarter of the slots empty so
+		// that the probe sequences stay short
+		if (tbl->used + 1 > tbl->size - tbl->size / 4)
+		{
+			ARPRebuildTable(now);
+			tbl = ARPtable;
+			for (i = ARPHash(tbl, ip_addr); tbl->entry[i].state != ARP_ENTRY_EMPTY;
+			     i = (i + 1) & (tbl->size - 1));
+		}
+		slot = i;
+		tbl->used++;
 	}
 
 	// add new entry or overwrite the replaced entry
-	ARPtable[empty_slot].is_empty = FALSE;
-	COPY_IP(ARPtable[empty_slot].ip_addr, ip_addr);
-	COPY_MAC(ARPtable[empty_slot].mac_addr, mac_addr);
-
-	verbose(2, "[ARPAddEntry]:: updated ARP table entry #%d: IP %s = MAC %s", empty_slot,
+	ARPWriteBegin(&(tbl->entry[slot]));
+	tbl->entry[slot].state = ARP_ENTRY_VALID;
+	COPY_IP(tbl->entry[slot].ip_addr, ip_addr);
+	COPY_MAC(tbl->entry[slot].mac_addr, mac_addr);
+	tbl->entry[slot].updated = now;
+	ARPWriteEnd(&(tbl->entry[slot]));
+	tbl->entry[slot].refreshing = 0;
+	pthread_mutex_unlock(&arp_tbl_lock);
+
+	verbose(2, "[ARPAddEntry]:: updated ARP table entry #%d: IP %s = MAC %s", slot,
 	       IP2Dot(tmpbuf, ip_addr), MAC2Colon(tmpbuf+20, mac_addr));
 
 	return;
@@ -276,55 +556,106 @@ void ARPAddEntry(uchar *ip_addr, uchar *mac_addr)
 
 
 /*
- * print the ARP table
+ * print the ARP table (only the entry for ip_addr if it is not NULL)
  */
-void ARPPrintTable(void)
+void ARPPrintTable(uchar *ip_addr)
 {
-	int i;
+	arp_table_t *tbl;
+	arp_entry_t entry;
+	unsigned long long now = getTimeNanos();
+	int i, count = 0;
 	char tmpbuf[MAX_TMPBUF_LEN];
 
 	printf("-----------------------------------------------------------\n");
 	printf("      A R P  T A B L E \n");
 	printf("-----------------------------------------------------------\n");
-	printf("Index\tIP address\tMAC address \n");
+	printf("Index\tIP address\tMAC address\t\tAge (s) \n");
 
-	for (i = 0; i < MAX_ARP; i++)
-		if (ARPtable[i].is_empty == FALSE)
-			printf("%d\t%s\t%s\n", i, IP2Dot(tmpbuf, ARPtable[i].ip_addr), MAC2Colon((tmpbuf+20), ARPtable[i].mac_addr));
+	epochEnter();
+	tbl = ARPtable;
+	for (i = 0; i < tbl->size; i++)
+	{
+		ARPReadEntry(&(tbl->entry[i]), &entry);
+		if (entry.state != ARP_ENTRY_VALID)
+			continue;
+		if ((ip_addr != NULL) && (COMPARE_IP(entry.ip_addr, ip_addr) != 0))
+			continue;
+		printf("%d\t%s\t%s\t%llu%s\n", i, IP2Dot(tmpbuf, entry.ip_addr), MAC2Colon((tmpbuf+20), entry.mac_addr),
+		       (now - entry.updated) / 1000000000ULL, ARPExpired(&entry, now) ? " (expired)" : "");
+		count++;
+	}
 	printf("-----------------------------------------------------------\n");
+	printf("      %d entries, %d slots, timeout %d (seconds) \n", count, tbl->size, arp_timeout);
+	epochExit();
 	return;
 }
 
 /*
- * Delete ARP entry with the given IP address
+ * Delete ARP entry with the given IP address, all entries if ip_addr is NULL
  */
-void ARPDeleteEntry(char *ip_addr)
+void ARPDeleteEntry(uchar *ip_addr)
 {
-	int i;
+	arp_table_t *tbl;
+	int i, n;
+
+	pthread_mutex_lock(&arp_tbl_lock);
+	tbl = ARPtable;
+	if (ip_addr == NULL)
+	{
+		for (i = 0; i < tbl->size; i++)
+			if (tbl->entry[i].state != ARP_ENTRY_EMPTY)
+			{
+				ARPWriteBegin(&(tbl->entry[i]));
+				tbl->entry[i].state = ARP_ENTRY_EMPTY;
+				ARPWriteEnd(&(tbl->entry[i]));
+			}
+		tbl->used = 0;
+		pthread_mutex_unlock(&arp_tbl_lock);
+		flowInvalidate();
+		verbose(2, "[ARPDeleteEntry]:: all arp entries deleted");
+		return;
+	}
 
-	for (i = 0; i < MAX_ARP; i++)
+	i = ARPHash(tbl, ip_addr);
+	for (n = 0; n < tbl->size; n++, i = (i + 1) & (tbl->size - 1))
 	{
-		if ( (ARPtable[i].is_empty == FALSE) &&
-		     (COMPARE_IP(ARPtable[i].ip_addr, ip_addr)) == 0)
+		if (tbl->entry[i].state == ARP_ENTRY_EMPTY)
+			break;
+		if ((tbl->entry[i].state == ARP_ENTRY_VALID) &&
+		    (COMPARE_IP(tbl->entry[i].ip_addr, ip_addr) == 0))
 		{
-			ARPtable[i].is_empty = TRUE;
+			ARPWriteBegin(&(tbl->entry[i]));
+			tbl->entry[i].state = ARP_ENTRY_DELETED;
+			ARPWriteEnd(&(tbl->entry[i]));
+			ARPReclaimSlots(tbl, i);
 			verbose(2, "[ARPDeleteEntry]:: arp entry #%d deleted", i);
+			break;
 		}
 	}
+	pthread_mutex_unlock(&arp_tbl_lock);
+	flowInvalidate();
 	return;
 }
 
 
 /*
- * send an ARP request to eventually process message,
- * a copy of which is now in the buffer
+ * send an ARP request for the next hop nxth_ip_addr on the given interface
  */
-void ARPSendRequest(gpacket_t *pkt)
+static void ARPSendRequestTo(uchar *nxth_ip_addr, int interface)
 {
-	arp_packet_t *apkt = (arp_packet_t *) pkt->data.data;
+	gpacket_t *pkt;
+	arp_packet_t *apkt;
 	uchar bcast_addr[6];
 	char tmpbuf[MAX_TMPBUF_LEN];
 
+	// a request is small: it goes in a small buffer
+	if ((pkt = newPacketSize(ETHER_HEADER_LEN + sizeof(arp_packet_t))) == NULL)
+		return;
+	gpktPut(pkt, ETHER_HEADER_LEN + sizeof(arp_packet_t));
+	apkt = (arp_packet_t *)GPKT_PAYLOAD(pkt);
+	pkt->frame.dst_interface = interface;
+	COPY_IP(pkt->frame.nxth_ip_addr, nxth_ip_addr);
+	pkt->frame.arp_bcast = TRUE;                        // tell gnet this is bcast to prevent recursive ARP lookup!
 	memset(bcast_addr, 0xFF, 6);
 
 	/*
@@ -351,31 +682,104 @@ void ARPSendRequest(gpacket_t *pkt)
 
 	// prepare sending.. to GNET adapter..
 
-	COPY_MAC(pkt->data.header.dst, bcast_addr);
-	pkt->data.header.prot = htons(ARP_PROTOCOL);
+	COPY_MAC(GPKT_ETH(pkt)->header.dst, bcast_addr);
+	GPKT_ETH(pkt)->header.prot = htons(ARP_PROTOCOL);
 	// actually send the message to the other module..
 	ARPSend2Output(pkt);
+	releasePacket(pkt);
+	__sync_fetch_and_add(&arp_requests, 1);
 
 	return;
 }
 
 
+/*
+ * send an ARP request to eventually process message,
+ * which is now held in the buffer. the request is built in a new
+ * packet so the buffered message is left untouched.
+ */
+void ARPSendRequest(gpacket_t *in_pkt)
+{
+	ARPSendRequestTo(in_pkt->frame.nxth_ip_addr, in_pkt->frame.dst_interface);
+}
+
+
 /*-------------------------------------------------------------------------
  *                   A R P  B U F F E R  F U N C T I O N S
  *-------------------------------------------------------------------------*/
 
+/*
+ * Packets waiting for ARP resolution are kept per next hop: a small
+ * hash on the next hop IP leads to an ARPbuffer entry that holds a
+ * bounded FIFO of packets. Only the first packet to an unresolved next
+ * hop sends a request; the following packets are queued behind it and
+ * the retransmit timer (ARPTimer) repeats the request every
+ * ARP_REQUEST_INTERVAL until the reply arrives or ARP_MAX_RETRIES
+ * requests went unanswered, in which case the packets are dropped.
+ * A reply releases the packets of its next hop in order.
+ */
+
+static inline int ARPBufferHash(uchar *nexthop)
+{
+	unsigned int h = nexthop[0] | (nexthop[1] << 8) | (nexthop[2] << 16) | (nexthop[3] << 24);
+
+	return ((h * 0x9e3779b1) >> 16) % MAX_ARP_PENDING;
+}
+
 
 /*
- * initialize buffer
+ * find the pending entry of a next hop, unlink it from the hash chain
+ * if unlink is TRUE. arp_buf_lock must be held.
  */
-void ARPInitBuffer()
+static int ARPFindBuffer(uchar *nexthop, int unlink)
 {
+	int *link = &(arp_buf_hash[ARPBufferHash(nexthop)]);
 	int i;
 
-	buf_replace_indx = 0;
+	while ((i = *link) >= 0)
+	{
+		if (COMPARE_IP(ARPbuffer[i].nxth_ip_addr, nexthop) == 0)
+		{
+			if (unlink)
+				*link = ARPbuffer[i].hnext;
+			return i;
+		}
+		link = &(ARPbuffer[i].hnext);
+	}
+	return -1;
+}
+
+
+/*
+ * return an unlinked pending entry to the free list. arp_buf_lock must be held.
+ */
+static void ARPFreeBuffer(int i)
+{
+	ARPbuffer[i].is_empty = TRUE;
+	ARPbuffer[i].count = 0;
+	ARPbuffer[i].hnext = arp_buf_free;
+	arp_buf_free = i;
+}
+
 
-	for (i = 0; i < MAX_ARP_BUFFERS; i++)
+/*
+ * initialize buffer and start the retransmit timer
+ */
+void ARPInitBuffer()
+{
+	int i;
+
+	for (i = 0; i < MAX_ARP_PENDING; i++)
+	{
 		ARPbuffer[i].is_empty = TRUE;
+		ARPbuffer[i].count = 0;
+		ARPbuffer[i].hnext = (i + 1 < MAX_ARP_PENDING) ? i + 1 : -1;
+		arp_buf_hash[i] = -1;
+	}
+	arp_buf_free = 0;
+
+	if (pthread_create(&arp_timer, NULL, ARPTimer, NULL) != 0)
+		error("[initARPBuffer]:: unable to start the ARP retransmit timer ");
 
 	verbose(2, "[initARPBuffer]:: packet buffer initialized");
 	return;
@@ -384,92 +788,197 @@ void ARPInitBuffer()
 
 /*
  * Add a packet to ARP buffer: This packet is waiting resolution
- * ARGUMENTS: in_pkt - pointer to message that is to be copied into buffer
+ * ARGUMENTS: in_pkt - pointer to message that is to be held in the buffer
  * RETURNS: none
  */
 void ARPAddBuffer(gpacket_t *in_pkt)
 {
-	int i;
-	gpacket_t *cppkt;
+	uchar mac_addr[6];
+	arp_pending_t *pend;
+	gpacket_t *dropped = NULL;
+	int i, status, sendreq = FALSE;
+	char tmpbuf[MAX_TMPBUF_LEN];
 
-	// duplicate the packet..
-	cppkt = duplicatePacket(in_pkt);
+	pthread_mutex_lock(&arp_buf_lock);
+	if ((i = ARPFindBuffer(in_pkt->frame.nxth_ip_addr, FALSE)) < 0)
+	{
+		// the reply may have been processed since the lookup in ARPResolve..
+		// the entry may already be due for a refresh, as there
+		if ((status = ARPFindEntry(in_pkt->frame.nxth_ip_addr, mac_addr)) != EXIT_FAILURE)
+		{
+			pthread_mutex_unlock(&arp_buf_lock);
+			if (status == ARP_STALE)
+				ARPSendRequest(in_pkt);
+			COPY_MAC(GPKT_ETH(in_pkt)->header.dst, mac_addr);
+			in_pkt->frame.arp_valid = TRUE;
+			ARPSend2Output(in_pkt);
+			return;
+		}
 
-	// Find an empty slot
-	for (i = 0; i < MAX_ARP_BUFFERS; i++){
-		if (ARPbuffer[i].is_empty == TRUE)
+		if ((i = arp_buf_free) < 0)
 		{
-			ARPbuffer[i].is_empty = FALSE;
-			ARPbuffer[i].wait_msg = cppkt;
-			verbose(2, "[addARPBuffer]:: packet stored in entry %d", i);
+			pthread_mutex_unlock(&arp_buf_lock);
+			__sync_fetch_and_add(&arp_dropped, 1);
+			verbose(2, "[addARPBuffer]:: too many unresolved next hops, packet dropped");
 			return;
 		}
+		arp_buf_free = ARPbuffer[i].hnext;
+		pend = &(ARPbuffer[i]);
+		pend->is_empty = FALSE;
+		COPY_IP(pend->nxth_ip_addr, in_pkt->frame.nxth_ip_addr);
+		pend->interface = in_pkt->frame.dst_interface;
+		pend->head = pend->count = 0;
+		pend->retries = 1;
+		pend->lastreq = getTimeNanos();
+		pend->hnext = arp_buf_hash[ARPBufferHash(pend->nxth_ip_addr)];
+		arp_buf_hash[ARPBufferHash(pend->nxth_ip_addr)] = i;
+		sendreq = TRUE;
+	} else
+		__sync_fetch_and_add(&arp_suppressed, 1);
+
+	// the buffer shares the packet.. no copy is needed
+	pend = &(ARPbuffer[i]);
+	if (pend->count == ARP_PENDING_QLEN)
+	{
+		// queue full: drop the oldest packet
+		dropped = pend->wait_msg[pend->head];
+		pend->head = (pend->head + 1) % ARP_PENDING_QLEN;
+		pend->count--;
 	}
+	pend->wait_msg[(pend->head + pend->count) % ARP_PENDING_QLEN] = holdPacket(in_pkt);
+	pend->count++;
+	pthread_mutex_unlock(&arp_buf_lock);
 
-	// No empty spot? Replace a packet, we need to deallocate the old packet
-	free(ARPbuffer[i].wait_msg);
-	ARPbuffer[i].wait_msg = cppkt;
-	verbose(2, "[addARPBuffer]:: buffer full, packet buffered to replaced entry %d",
-	       buf_replace_indx);
-	buf_replace_indx = (buf_replace_indx + 1) % MAX_ARP_BUFFERS; // adjust for FIFO
+	verbose(2, "[addARPBuffer]:: packet for %s buffered in entry %d",
+		IP2Dot(tmpbuf, in_pkt->frame.nxth_ip_addr), i);
+	if (dropped != NULL)
+	{
+		__sync_fetch_and_add(&arp_dropped, 1);
+		releasePacket(dropped);
+	}
+	if (sendreq == TRUE)
+		ARPSendRequest(in_pkt);
 
 	return;
 }
 
 
 /*
- * get a packet from the ARP buffer
- * ARGUMENTS: out_pkt - pointer at which packet matching message is to be copied
- *              nexthop - pointer to dest. IP address to search for
- * RETURNS: The function returns EXIT_SUCCESS if packet was found and copied,
- * or EXIT_FAILURE if it was not found.
+ * flush all packets from buffer matching the nexthop
+ * for which we now have an ARP entry
  */
-int ARPGetBuffer(gpacket_t **out_pkt, uchar *nexthop)
+void ARPFlushBuffer(uchar *next_hop, uchar *mac_addr)
 {
-	int i;
+	gpacket_t *bfrd_msg[ARP_PENDING_QLEN];
+	int i, j, count;
 	char tmpbuf[MAX_TMPBUF_LEN];
 
-	// Search for packet in buffer
-	for (i = 0; i < MAX_ARP_BUFFERS; i++)
+	pthread_mutex_lock(&arp_buf_lock);
+	if ((i = ARPFindBuffer(next_hop, TRUE)) < 0)
 	{
-		if (ARPbuffer[i].is_empty == TRUE) continue;
-		if (COMPARE_IP(ARPbuffer[i].wait_msg->frame.nxth_ip_addr, nexthop) == 0)
-		{
-			// match found
-			*out_pkt =  ARPbuffer[i].wait_msg;
-			ARPbuffer[i].is_empty = TRUE;
-			verbose(2, "[ARPGetBuffer]:: found packet matching nexthop %s at entry %d",
-			       IP2Dot(tmpbuf, nexthop), i);
-			return EXIT_SUCCESS;
-		}
+		pthread_mutex_unlock(&arp_buf_lock);
+		return;
 	}
-	verbose(2, "[ARPGetBuffer]:: no match for nexthop %s", IP2Dot(tmpbuf, nexthop));
-	return EXIT_FAILURE;
+	count = ARPbuffer[i].count;
+	for (j = 0; j < count; j++)
+		bfrd_msg[j] = ARPbuffer[i].wait_msg[(ARPbuffer[i].head + j) % ARP_PENDING_QLEN];
+	ARPFreeBuffer(i);
+	pthread_mutex_unlock(&arp_buf_lock);
+
+	verbose(2, "[ARPFlushBuffer]:: flushing %d packets with next_hop %s ", count, IP2Dot(tmpbuf, next_hop));
+	for (j = 0; j < count; j++)
+	{
+		COPY_MAC(GPKT_ETH(bfrd_msg[j])->header.dst, mac_addr);
+		bfrd_msg[j]->frame.arp_valid = TRUE;
+		ARPSend2Output(bfrd_msg[j]);
+		releasePacket(bfrd_msg[j]);
+	}
+
+	return;
 }
 
 
 /*
- * flush all packets from buffer matching the nexthop
- * for which we now have an ARP entry
+ * the retransmit timer: repeats the request of every next hop that did
+ * not answer within ARP_REQUEST_INTERVAL and gives up after ARP_MAX_RETRIES.
  */
-void ARPFlushBuffer(char *next_hop, char *mac_addr)
+void *ARPTimer(void *arg)
 {
-	gpacket_t *bfrd_msg;
+	gpacket_t *dropped[ARP_PENDING_QLEN];
+	uchar resend_ip[MAX_ARP_PENDING][4];
+	int resend_if[MAX_ARP_PENDING];
+	unsigned long long now;
+	int i, j, k, nresend, ndropped;
 	char tmpbuf[MAX_TMPBUF_LEN];
 
-	verbose(2, "[ARPFlushBuffer]:: Entering the function.. ");
-	while (ARPGetBuffer(&bfrd_msg, next_hop) == EXIT_SUCCESS)
+	while (1)
 	{
-		// a message is already buffered.. send it out..
-		// TODO: include QoS routines.. for now they are removed!
+		usleep(ARP_TIMER_INTERVAL * 1000);
+		now = getTimeNanos();
+		nresend = 0;
 
-		// send to gnetAdapter
-		// no need to set dst_int_num -- why?
+		pthread_mutex_lock(&arp_buf_lock);
+		for (i = 0; i < MAX_ARP_PENDING; i++)
+		{
+			if ((ARPbuffer[i].is_empty == TRUE) ||
+			    (now - ARPbuffer[i].lastreq < ARP_REQUEST_INTERVAL * 1000000ULL))
+				continue;
+
+			if (ARPbuffer[i].retries < ARP_MAX_RETRIES)
+			{
+				ARPbuffer[i].retries++;
+				ARPbuffer[i].lastreq = now;
+				COPY_IP(resend_ip[nresend], ARPbuffer[i].nxth_ip_addr);
+				resend_if[nresend++] = ARPbuffer[i].interface;
+				continue;
+			}
+
+			// no reply: drop the waiting packets
+			verbose(2, "[ARPTimer]:: no ARP reply from %s, %d packets dropped",
+				IP2Dot(tmpbuf, ARPbuffer[i].nxth_ip_addr), ARPbuffer[i].count);
+			ARPFindBuffer(ARPbuffer[i].nxth_ip_addr, TRUE);
+			ndropped = ARPbuffer[i].count;
+			for (j = 0; j < ndropped; j++)
+				dropped[j] = ARPbuffer[i].wait_msg[(ARPbuffer[i].head + j) % ARP_PENDING_QLEN];
+			ARPFreeBuffer(i);
+			for (j = 0; j < ndropped; j++)
+				releasePacket(dropped[j]);
+			__sync_fetch_and_add(&arp_dropped, ndropped);
+		}
+		pthread_mutex_unlock(&arp_buf_lock);
 
-		verbose(2, "[ARPFlushBuffer]:: flushing the entry with next_hop %s ", IP2Dot(tmpbuf, next_hop));
-		COPY_MAC(bfrd_msg->data.header.dst, mac_addr);
-		ARPSend2Output(bfrd_msg);
+		for (k = 0; k < nresend; k++)
+			ARPSendRequestTo(resend_ip[k], resend_if[k]);
 	}
+	return NULL;
+}
 
-	return;
+
+/*
+ * print the next hops waiting for resolution and the request counters
+ */
+void ARPPrintBuffer(void)
+{
+	unsigned long long now = getTimeNanos();
+	int i, count = 0;
+	char tmpbuf[MAX_TMPBUF_LEN];
+
+	printf("-----------------------------------------------------------\n");
+	printf("      P E N D I N G  R E S O L U T I O N S \n");
+	printf("-----------------------------------------------------------\n");
+	printf("Next hop\tInterface\tPackets\tRequests\tLast (ms) \n");
+
+	pthread_mutex_lock(&arp_buf_lock);
+	for (i = 0; i < MAX_ARP_PENDING; i++)
+		if (ARPbuffer[i].is_empty == FALSE)
+		{
+			printf("%s\t%d\t\t%d\t%d\t\t%llu\n", IP2Dot(tmpbuf, ARPbuffer[i].nxth_ip_addr),
+			       ARPbuffer[i].interface, ARPbuffer[i].count, ARPbuffer[i].retries,
+			       (now - ARPbuffer[i].lastreq) / 1000000ULL);
+			count++;
+		}
+	pthread_mutex_unlock(&arp_buf_lock);
+	printf("-----------------------------------------------------------\n");
+	printf("      %d pending, requests sent %lu, suppressed %lu, packets dropped %lu \n",
+	       count, arp_requests, arp_suppressed, arp_dropped);
 }
@@ -0,0 +1,439 @@
+/*
+ * bench.c (micro benchmarks for the gRouter)
+ *
+ * The worker benchmark runs the IP forwarding fast path (header check,
+ * route lookup, MTU lookup, ARP cache lookup and TTL update) over a set
+ * of synthetic packets with 1..N threads and reports the throughput.
+ * It exercises the same tables the packet workers read, so it shows
+ * how well the forwarding path scales with the number of workers.
+ *
+ * The checksum benchmark checks the checksum kernels against the
+ * original byte at a time checksum and times them.
+ *
+ * The scheduler benchmark keeps hundreds of queues backlogged and runs
+ * each scheduling policy over them, for its cost per packet and how
+ * fairly it shares the output among the queues.
+ */
+
+#include <slack/std.h>
+#include <slack/err.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include "grouter.h"
+#include "message.h"
+#include "packetpool.h"
+#include "protocols.h"
+#include "ip.h"
+#include "routetable.h"
+#include "mtu.h"
+#include "packetcore.h"
+#include "arp.h"
+#include "checksum.h"
+#include "pktsched.h"
+#include "qdisc.h"
+#include "bench.h"
+
+
+extern route_table_t *route_tbl;
+extern mtu_table_t *MTU_tbl;
+
+
+// all benchmark threads of a run wait at the gate until it is opened
+typedef struct _benchgate_t
+{
+	pthread_mutex_t lock;
+	pthread_cond_t open;
+	int isopen;
+} benchgate_t;
+
+
+typedef struct _benchthread_t
+{
+	pthread_t threadid;
+	benchgate_t *gate;
+	long npkts;
+	long forwarded;
+	char pad[CACHE_LINE_SIZE];
+} benchthread_t;
+
+
+/*
+ * fill in a packet with an IP header for a destination picked from the
+ * route table (or a random destination if the table is empty).
+ */
+static void benchMakePacket(gpacket_t *pkt, int flow)
+{
+	ip_packet_t *ip_pkt = (ip_packet_t *)GPKT_PAYLOAD(pkt);
+	route_entry_t rentry;
+	uchar dst[4];
+	int i, r, nroutes;
+
+	bzero(pkt->data, ETHER_HEADER_LEN + sizeof(ip_packet_t));
+	GPKT_ETH(pkt)->header.prot = htons(IP_PROTOCOL);
+
+	// spread the flows over the routes, the table may have holes
+	for (r = flow, nroutes = getRouteTableSize(route_tbl); r < nroutes; r += BENCH_FLOWS)
+		if (getRouteEntry(route_tbl, r, &rentry) == EXIT_SUCCESS)
+			break;
+	if (r < nroutes)
+	{
+		for (i = 0; i < 4; i++)
+			dst[i] = rentry.network[i] | (rand() & ~rentry.netmask[i]);
+	} else
+		for (i = 0; i < 4; i++)
+			dst[i] = rand() & 0xFF;
+
+	ip_pkt->ip_version = 4;
+	ip_pkt->ip_hdr_len = 5;
+	ip_pkt->ip_tos = 0;
+	ip_pkt->ip_pkt_len = htons(20 + 64);
+	ip_pkt->ip_identifier = htons(flow);
+	ip_pkt->ip_frag_off = 0;
+	ip_pkt->ip_ttl = 64;
+	ip_pkt->ip_prot = UDP_PROTOCOL;
+	ip_pkt->ip_src[0] = 10;
+	ip_pkt->ip_src[1] = 0;
+	ip_pkt->ip_src[2] = flow >> 8;
+	ip_pkt->ip_src[3] = flow & 0xFF;
+	gHtonl(ip_pkt->ip_dst, dst);
+	ip_pkt->ip_cksum = 0;
+	ip_pkt->ip_cksum = htons(checksum((uchar *)ip_pkt, ip_pkt->ip_hdr_len * 2));
+}
+
+
+static void *benchForwardLoop(void *arg)
+{
+	benchthread_t *bt = (benchthread_t *)arg;
+	gpacket_t *pkts[BENCH_FLOWS];
+	ip_packet_t *ip_pkt;
+	uchar dst[4], nhop[4], mac[6];
+	int ixface, i;
+	long n;
+
+	// every thread works on its own copy of the packets
+	for (i = 0; i < BENCH_FLOWS; i++)
+		if ((pkts[i] = newPacket()) == NULL)
+		{
+			while (--i >= 0)
+				releasePacket(pkts[i]);
+			return NULL;
+		} else
+			benchMakePacket(pkts[i], i);
+
+	pthread_mutex_lock(&(bt->gate->lock));
+	while (!bt->gate->isopen)
+		pthread_cond_wait(&(bt->gate->open), &(bt->gate->lock));
+	pthread_mutex_unlock(&(bt->gate->lock));
+	for (n = 0; n < bt->npkts; n++)
+	{
+		ip_pkt = (ip_packet_t *)GPKT_PAYLOAD(pkts[n % BENCH_FLOWS]);
+
+		if (IPVerifyPacket(ip_pkt) == EXIT_FAILURE)
+			continue;
+		gNtohl(dst, ip_pkt->ip_dst);
+		if (findRouteEntry(route_tbl, dst, nhop, &ixface) == EXIT_FAILURE)
+			continue;
+		if (findMTU(MTU_tbl, ixface) < ntohs(ip_pkt->ip_pkt_len))
+			continue;
+		if ((nhop[0] | nhop[1] | nhop[2] | nhop[3]) == 0)
+			COPY_IP(nhop, dst);
+		ARPFindEntry(nhop, mac);
+
+		if (IPDecrementTTL(ip_pkt) <= 1)
+		{
+			ip_pkt->ip_ttl = 64;
+			ip_pkt->ip_cksum = 0;
+			ip_pkt->ip_cksum = htons(checksum((uchar *)ip_pkt, ip_pkt->ip_hdr_len * 2));
+		}
+		bt->forwarded++;
+	}
+
+	for (i = 0; i < BENCH_FLOWS; i++)
+		releasePacket(pkts[i]);
+	return NULL;
+}
+
+
+/*
+ * run the forwarding fast path with 1..maxworkers threads, each thread
+ * processing npkts packets, and print the throughput of each run.
+ */
+void benchWorkers(int maxworkers, long npkts)
+{
+	benchthread_t *bt;
+	benchgate_t gate = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0};
+	unsigned long long t0, t1;
+	double kpps, base = 0.0;
+	long forwarded;
+	int k, i, nthreads;
+
+	if (maxworkers < 1 || maxworkers > MAX_WORKERS)
+		maxworkers = MAX_WORKERS;
+	if (npkts <= 0)
+		npkts = BENCH_DEFAULT_PACKETS;
+
+	if ((bt = calloc(maxworkers, sizeof(benchthread_t))) == NULL)
+	{
+		error("[benchWorkers]:: unable to allocate memory for the benchmark ");
+		return;
+	}
+
+	printf("\nForwarding fast path: %ld packets per thread, %d flows \n", npkts, BENCH_FLOWS);
+	printf("Threads\tKpps\t\tSpeedup\t\tForwarded \n");
+	for (k = 1; k <= maxworkers; k++)
+	{
+		gate.isopen = 0;
+		for (i = 0; i < k; i++)
+		{
+			bt[i].gate = &gate;
+			bt[i].npkts = npkts;
+			bt[i].forwarded = 0;
+			if (pthread_create(&(bt[i].threadid), NULL, benchForwardLoop, &bt[i]) != 0)
+				break;
+		}
+		// setup time (building the packets) is not measured
+		usleep(100000);
+
+		pthread_mutex_lock(&(gate.lock));
+		gate.isopen = 1;
+		pthread_cond_broadcast(&(gate.open));
+		pthread_mutex_unlock(&(gate.lock));
+
+		t0 = getTimeNanos();
+		forwarded = 0;
+		nthreads = i;
+		for (i = 0; i < nthreads; i++)
+		{
+			pthread_join(bt[i].threadid, NULL);
+			forwarded += bt[i].forwarded;
+		}
+		t1 = getTimeNanos();
+		if (nthreads < k)
+		{
+			error("[benchWorkers]:: unable to create benchmark thread %d ", nthreads);
+			break;
+		}
+
+		kpps = (double)npkts * k / ((t1 - t0) / 1e9) / 1000.0;
+		if (k == 1)
+			base = kpps;
+		printf("%d\t%.1f\t\t%.2f\t\t%ld \n", k, kpps, (base > 0.0) ? kpps / base : 0.0, forwarded);
+	}
+
+	free(bt);
+}
+
+
+/*
+ * check the checksum kernels against the original byte at a time
+ * checksum on random buffers (random length and alignment), then time
+ * them over niters calls for common packet sizes. also times the TTL
+ * update of the forwarding path: the full header checksum against the
+ * incremental update.
+ */
+void benchChecksum(long niters)
+{
+	static int sizes[] = {20, 64, 576, 1500};
+	char *names[BENCH_CKSUM_KERNELS] = {"Reference", "64-bit", "SSE2"};
+	ushort (*kernels[BENCH_CKSUM_KERNELS])(uchar *, int) = {checksumRef, checksum64, NULL};
+	double ns[BENCH_CKSUM_KERNELS];
+	volatile ushort sink = 0;
+	unsigned long long t0, t1;
+	uchar *buf, *p;
+	ip_packet_t *ip_pkt;
+	int nkernels = 2, i, j, k, iwords, mismatches = 0;
+	long n;
+
+#ifdef __SSE2__
+	kernels[nkernels++] = checksumSSE2;
+#endif
+	if (niters <= 0)
+		niters = BENCH_CKSUM_ITERATIONS;
+	if ((buf = malloc(BENCH_CKSUM_MAXLEN + 16)) == NULL)
+	{
+		error("[benchChecksum]:: unable to allocate memory for the benchmark ");
+		return;
+	}
+
+	for (i = 0; i < BENCH_CKSUM_TRIALS; i++)
+	{
+		p = buf + (rand() & 7);
+		iwords = rand() % (BENCH_CKSUM_MAXLEN / 2 + 1);
+		for (j = 0; j < iwords * 2; j++)
+			p[j] = rand() & 0xFF;
+		for (k = 1; k < nkernels; k++)
+			if (kernels[k](p, iwords) != checksumRef(p, iwords))
+				mismatches++;
+		if (checksum(p, iwords) != checksumRef(p, iwords))
+			mismatches++;
+	}
+
+	// a header with a valid checksum stays valid across TTL updates
+	ip_pkt = (ip_packet_t *)buf;
+	for (i = 0; i < BENCH_CKSUM_TRIALS; i++)
+	{
+		for (j = 0; j < 20; j++)
+			buf[j] = rand() & 0xFF;
+		ip_pkt->ip_hdr_len = 5;
+		ip_pkt->ip_cksum = 0;
+		ip_pkt->ip_cksum = htons(checksumRef(buf, 10));
+		IPDecrementTTL(ip_pkt);
+		if (checksumRef(buf, 10) != 0)
+			mismatches++;
+	}
+	printf("\nChecksum: %d random buffers and headers, %d mismatches \n", BENCH_CKSUM_TRIALS, mismatches);
+
+	for (j = 0; j < BENCH_CKSUM_MAXLEN; j++)
+		buf[j] = rand() & 0xFF;
+	printf("%ld calls per size, time per call (ns) \n", niters);
+	printf("Bytes");
+	for (k = 0; k < nkernels; k++)
+		printf("\t%s", names[k]);
+	printf("\tSpeedup\tGbit/s \n");
+	for (i = 0; i < sizeof(sizes) / sizeof(int); i++)
+	{
+		printf("%d", sizes[i]);
+		for (k = 0; k < nkernels; k++)
+		{
+			t0 = getTimeNanos();
+			for (n = 0; n < niters; n++)
+				sink += kernels[k](buf, sizes[i] / 2);
+			t1 = getTimeNanos();
+			ns[k] = (double)(t1 - t0) / niters;
+			printf("\t%.1f\t", ns[k]);
+		}
+		t0 = getTimeNanos();
+		for (n = 0; n < niters; n++)
+			sink += checksum(buf, sizes[i] / 2);
+		t1 = getTimeNanos();
+		printf("%.1f\t%.2f \n", ns[0] * niters / (double)(t1 - t0),
+		       sizes[i] * 8.0 * niters / (double)(t1 - t0));
+	}
+
+	t0 = getTimeNanos();
+	for (n = 0; n < niters; n++)
+	{
+		ip_pkt->ip_ttl--;
+		ip_pkt->ip_cksum = 0;
+		ip_pkt->ip_cksum = htons(checksum(buf, 10));
+	}
+	t1 = getTimeNanos();
+	printf("TTL update: full checksum %.1f ns, ", (double)(t1 - t0) / niters);
+	t0 = getTimeNanos();
+	for (n = 0; n < niters; n++)
+		IPDecrementTTL(ip_pkt);
+	t1 = getTimeNanos();
+	printf("incremental (RFC 1624) %.1f ns \n", (double)(t1 - t0) / niters);
+
+	free(buf);
+}
+
+
+/*
+ * run every scheduling policy over nqueues queues that never run empty.
+ * queue i has weight 1 + i % 4, priority i % 4 and packets of its own
+ * size (64 to 1500 bytes). the fairness is Jain's index of the bytes
+ * each queue sent divided by its weight (1 is a share exactly in
+ * proportion to the weights); for prio the share of the priority 0
+ * queues is printed instead.
+ */
+void benchSched(int nqueues, long npkts)
+{
+	static char *policies[] = {"rr", "drr", "wfq", "prio"};
+	simplequeue_t **queues;
+	sched_t *s;
+	gpacket_t *pkts;
+	char qname[MAX_NAME_LEN];
+	double *share, sum, sumsq, smin, smax, top, total;
+	unsigned long long t0, t1;
+	gpacket_t *pkt;
+	int p, i, j, len, *lens;
+	long n;
+
+	if (nqueues <= 0)
+		nqueues = BENCH_SCHED_QUEUES;
+	if (nqueues > MAX_SCHED_QUEUES)
+		nqueues = MAX_SCHED_QUEUES;
+	if (npkts <= 0)
+		npkts = BENCH_DEFAULT_PACKETS;
+
+	queues = calloc(nqueues, sizeof(simplequeue_t *));
+	pkts = calloc(nqueues, sizeof(gpacket_t)); // queue i holds pkts[i] again and again
+	share = calloc(nqueues, sizeof(double));
+	lens = calloc(nqueues, sizeof(int));
+	if ((queues == NULL) || (pkts == NULL) || (share == NULL) || (lens == NULL))
+	{
+		error("[benchSched]:: unable to allocate memory for the benchmark ");
+		free(queues); free(pkts); free(share); free(lens);
+		return;
+	}
+
+	printf("\nScheduler: %d queues (weights 1..4, 64..1500 byte packets), %ld packets \n", nqueues, npkts);
+	printf("Policy\tns/pkt\tMpkt/s\tFairness\tMin/Max share \n");
+	for (p = 0; p < sizeof(policies) / sizeof(char *); p++)
+	{
+		if ((s = createScheduler(policies[p])) == NULL)
+			break;
+		for (i = 0; i < nqueues; i++)
+		{
+			sprintf(qname, "bench %d", i);
+			queues[i] = createSimpleQueue(qname, BENCH_SCHED_DEPTH, 0, 0);
+			queues[i]->weight = 1 + i % 4;
+			queues[i]->prio = i % 4;
+			lens[i] = 64 + (i * 397) % 1437;
+			share[i] = 0.0;
+			qdiscAttach(queues[i], QDISC_DEFAULT);
+			schedAddQueue(s, queues[i]);
+			for (j = 0; j < BENCH_SCHED_DEPTH; j++)
+				schedEnqueue(s, queues[i], &(pkts[i]), lens[i], 1);
+		}
+
+		// each packet sent goes back to its queue
+		t0 = getTimeNanos();
+		for (n = 0; n < npkts; n++)
+		{
+			pkt = schedDequeue(s, &len, t0);
+			i = pkt - pkts;
+			share[i] += len;
+			schedEnqueue(s, queues[i], pkt, len, t0);
+		}
+		t1 = getTimeNanos();
+
+		sum = sumsq = top = total = 0.0;
+		smin = smax = share[0] / queues[0]->weight;
+		for (i = 0; i < nqueues; i++)
+		{
+			if (queues[i]->prio == 0)
+				top += share[i];
+			total += share[i];
+			share[i] /= queues[i]->weight;
+			sum += share[i];
+			sumsq += share[i] * share[i];
+			smin = min(smin, share[i]);
+			smax = max(smax, share[i]);
+		}
+		printf("%s\t%.1f\t%.2f\t", policies[p], (double)(t1 - t0) / npkts, npkts * 1000.0 / (t1 - t0));
+		if (strcmp(policies[p], "prio"))
+			printf("%.4f\t\t%.3f \n", (sumsq > 0) ? sum * sum / (nqueues * sumsq) : 0.0,
+			       (smax > 0) ? smin / smax : 0.0);
+		else
+			printf("priority 0 queues sent %.1f%% of the bytes \n", 100.0 * top / max(total, 1.0));
+
+		// the packets are not from the pool: empty the queues without releasing them
+		for (i = 0; i < nqueues; i++)
+		{
+			while (queues[i]->qops->pop(queues[i], &len) != NULL)
+				;
+			qdiscDetach(queues[i]);
+			destroySimpleQueue(queues[i]);
+		}
+		free(s);
+	}
+	free(queues);
+	free(pkts);
+	free(share);
+	free(lens);
+}
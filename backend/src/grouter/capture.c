@@ -0,0 +1,386 @@
+/*
+ * capture.c (packet capture for the console)
+ *
+ * Every frame received or sent on a VPL interface can be recorded for
+ * the .port console (wireshark). The packet path copies the frame (up
+ * to the snap length) into a preallocated ring of records and goes on;
+ * it never takes a lock, allocates memory or makes a system call. The
+ * ring uses the sequence number protocol of ringbuffer.c: a record at
+ * position pos is free when seq == pos and filled when seq == pos + 1.
+ * When the ring is full the frame is not recorded and counted as
+ * dropped, so a slow or absent reader costs the packet path nothing
+ * more than the failed claim.
+ *
+ * A single writer thread drains the ring, gathers the records in a
+ * buffer and writes them out with one write() call per batch, in pcap
+ * (nanosecond timestamps) or pcapng format.
+ *
+ * The capture can be turned off, limited to a snap length, to one frame
+ * in N and to the frames matching a class (see class command); the
+ * settings are changed with the console command.
+ */
+
+#include <slack/err.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include "capture.h"
+#include "gpcap.h"
+#include "epoch.h"
+
+extern classlist_t *classifier;
+
+capture_t capture = {.ring = NULL, .fd = -1};
+pthread_mutex_t capture_lock = PTHREAD_MUTEX_INITIALIZER;   // output file and filter changes
+
+static __thread unsigned int capture_tick;                  // sampling counter of each thread
+
+
+void *captureWriter(void *arg);
+
+
+void captureInit(void)
+{
+	unsigned long i;
+	int status;
+
+	if (capture.ring != NULL)
+		return;
+
+	if (posix_memalign((void **)&(capture.ring), CACHE_LINE_SIZE, CAPTURE_RING_SIZE * sizeof(caprec_t)) != 0)
+	{
+		fatal("[captureInit]:: Could not allocate memory for the capture ring ");
+		return;
+	}
+	for (i = 0; i < CAPTURE_RING_SIZE; i++)
+		capture.ring[i].seq = i;
+	capture.mask = CAPTURE_RING_SIZE - 1;
+	capture.head = capture.tail = 0;
+	capture.snaplen = MAX_CAPTURE_LEN;
+	capture.sample = 1;
+	capture.format = CAPTURE_PCAP;
+	capture.filtername[0] = '\0';
+	capture.filter = NULL;
+	capture.fd = -1;
+	capture.newfile = FALSE;
+	capture.enabled = TRUE;
+
+	status = pthread_create(&(capture.writer), NULL, captureWriter, NULL);
+	if (status != 0)
+		error("[captureInit]:: Unable to create the capture writer thread... ");
+}
+
+
+/*
+ * record a frame of len bytes going through an interface, in niov
+ * pieces (called by the packet path)
+ */
+void captureFrame(struct iovec *iov, int niov, int len, int dir)
+{
+	caprec_t *rec;
+	cls_table_t *filter;
+	struct timespec now;
+	unsigned long pos;
+	int match[CLS_MAX_GROUPS];
+	int i, n, copied;
+	long dif;
+
+	if (!capture.enabled || (capture.ring == NULL) || (len <= 0))
+		return;
+	if ((capture.sample > 1) && ((++capture_tick % capture.sample) != 0))
+		return;
+	if (capture.filter != NULL)
+	{
+		// the filter may be replaced meanwhile: look it up in an epoch section
+		match[0] = 0;
+		epochEnter();
+		if ((filter = capture.filter) != NULL)
+			lookupClassTable(filter, (pkt_data_t *)iov[0].iov_base, match);   // the headers are in the first piece
+		epochExit();
+		if (match[0] < 0)
+			return;
+	}
+
+	pos = capture.head;
+	while (1)
+	{
+		rec = &(capture.ring[pos & capture.mask]);
+		dif = (long)rec->seq - (long)pos;
+		if (dif == 0)
+		{
+			if (__sync_bool_compare_and_swap(&(capture.head), pos, pos + 1))
+				break;
+		} else if (dif < 0)
+		{
+			__sync_fetch_and_add(&(capture.dropped), 1);   // the writer is behind
+			return;
+		}
+		pos = capture.head;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	rec->ts = now.tv_sec * 1000000000ULL + now.tv_nsec;
+	rec->origlen = len;
+	rec->caplen = (len < capture.snaplen) ? len : capture.snaplen;
+	if (rec->caplen > MAX_CAPTURE_LEN)
+		rec->caplen = MAX_CAPTURE_LEN;
+	rec->dir = dir;
+	for (i = 0, copied = 0; (i < niov) && (copied < rec->caplen); i++)
+	{
+		n = min((int)iov[i].iov_len, rec->caplen - copied);
+		memcpy(rec->data + copied, iov[i].iov_base, n);
+		copied += n;
+	}
+	__sync_synchronize();
+	rec->seq = pos + 1;                   // publish the record
+	__sync_fetch_and_add(&(capture.captured), 1);
+}
+
+
+/*
+ * put the file header of the given format in buf. returns its length.
+ */
+static int captureFileHeader(char *buf, int format)
+{
+	pcap_hdr_t phdr = {PCAP_NSEC_MAGIC, 2, 4, 0, 0, MAX_CAPTURE_LEN, LINKTYPE_ETHERNET};
+	pcapng_shb_t shb = {PCAPNG_SHB_TYPE, sizeof(pcapng_shb_t), PCAPNG_BYTE_ORDER, 1, 0, -1, sizeof(pcapng_shb_t)};
+	pcapng_idb_t idb = {PCAPNG_IDB_TYPE, sizeof(pcapng_idb_t), LINKTYPE_ETHERNET, 0, MAX_CAPTURE_LEN,
+			    PCAPNG_OPT_IF_TSRESOL, 1, 9, {0, 0, 0}, PCAPNG_OPT_ENDOFOPT, sizeof(pcapng_idb_t)};
+
+	if (format == CAPTURE_PCAPNG)
+	{
+		memcpy(buf, &shb, sizeof(pcapng_shb_t));
+		memcpy(buf + sizeof(pcapng_shb_t), &idb, sizeof(pcapng_idb_t));
+		return sizeof(pcapng_shb_t) + sizeof(pcapng_idb_t);
+	}
+	memcpy(buf, &phdr, sizeof(pcap_hdr_t));
+	return sizeof(pcap_hdr_t);
+}
+
+
+/*
+ * put a record in the given format in buf. returns its length.
+ */
+static int captureRecord(char *buf, caprec_t *rec, int format)
+{
+	pcaprec_hdr_t rhdr;
+	pcapng_epb_t epb;
+	pcapng_epb_trailer_t trailer;
+	int padded;
+
+	if (format == CAPTURE_PCAPNG)
+	{
+		padded = (rec->caplen + 3) & ~3;
+		epb.block_type = PCAPNG_EPB_TYPE;
+		epb.block_len = sizeof(pcapng_epb_t) + padded + sizeof(pcapng_epb_trailer_t);
+		epb.interface_id = 0;
+		epb.ts_high = rec->ts >> 32;
+		epb.ts_low = rec->ts & 0xffffffff;
+		epb.incl_len = rec->caplen;
+		epb.orig_len = rec->origlen;
+		trailer.flags_code = PCAPNG_OPT_EPB_FLAGS;
+		trailer.flags_len = 4;
+		trailer.flags = rec->dir;
+		trailer.endofopt = PCAPNG_OPT_ENDOFOPT;
+		trailer.block_len2 = epb.block_len;
+
+		memcpy(buf, &epb, sizeof(pcapng_epb_t));
+		memcpy(buf + sizeof(pcapng_epb_t), rec->data, rec->caplen);
+		memset(buf + sizeof(pcapng_epb_t) + rec->caplen, 0, padded - rec->caplen);
+		memcpy(buf + sizeof(pcapng_epb_t) + padded, &trailer, sizeof(pcapng_epb_trailer_t));
+		return epb.block_len;
+	}
+
+	rhdr.ts_sec = rec->ts / 1000000000ULL;
+	rhdr.ts_usec = rec->ts % 1000000000ULL;       // nanoseconds with PCAP_NSEC_MAGIC
+	rhdr.incl_len = rec->caplen;
+	rhdr.orig_len = rec->origlen;
+	memcpy(buf, &rhdr, sizeof(pcaprec_hdr_t));
+	memcpy(buf + sizeof(pcaprec_hdr_t), rec->data, rec->caplen);
+	return sizeof(pcaprec_hdr_t) + rec->caplen;
+}
+
+
+static int captureWriteAll(int fd, char *buf, int len)
+{
+	int n;
+
+	while (len > 0)
+	{
+		if ((n = write(fd, buf, len)) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+
+/*
+ * The writer thread: drains the ring in batches of up to
+ * CAPTURE_WRITE_BUF bytes. The records are consumed even when there is
+ * no output so that the ring does not stay full.
+ */
+void *captureWriter(void *arg)
+{
+	char *obuf;
+	caprec_t *rec;
+	int used, nrecs, fd, format = CAPTURE_PCAP;
+	int maxrec = sizeof(pcapng_epb_t) + MAX_CAPTURE_LEN + 3 + sizeof(pcapng_epb_trailer_t);
+
+	if ((obuf = malloc(CAPTURE_WRITE_BUF)) == NULL)
+	{
+		fatal("[captureWriter]:: Could not allocate memory for the capture buffer ");
+		return NULL;
+	}
+
+	while (1)
+	{
+		used = nrecs = 0;
+		pthread_mutex_lock(&capture_lock);
+		fd = capture.fd;
+		if (capture.newfile && (fd >= 0))
+		{
+			format = capture.format;
+			used = captureFileHeader(obuf, format);
+			capture.newfile = FALSE;
+		}
+		pthread_mutex_unlock(&capture_lock);
+
+		while (used + maxrec <= CAPTURE_WRITE_BUF)
+		{
+			rec = &(capture.ring[capture.tail & capture.mask]);
+			if (rec->seq != capture.tail + 1)
+				break;
+			__sync_synchronize();
+			if (fd >= 0)
+				used += captureRecord(obuf + used, rec, format);
+			nrecs++;
+			__sync_synchronize();
+			rec->seq = capture.tail + capture.mask + 1;   // free for the next lap
+			capture.tail++;
+		}
+
+		if (used > 0)
+		{
+			// blocks while the FIFO is not read; the ring absorbs the frames meanwhile
+			if (captureWriteAll(fd, obuf, used) < 0)
+				capture.errors++;
+			else
+				capture.written += nrecs;
+		} else if (nrecs == 0)
+			usleep(CAPTURE_IDLE_US);
+	}
+	return NULL;
+}
+
+
+/*
+ * send the capture to a new file (or FIFO); the file starts with a header
+ */
+void captureSetFile(int fd)
+{
+	pthread_mutex_lock(&capture_lock);
+	capture.fd = fd;
+	capture.newfile = TRUE;
+	pthread_mutex_unlock(&capture_lock);
+}
+
+
+void captureSetState(int on)
+{
+	capture.enabled = on;
+}
+
+
+int captureSetSnaplen(int snaplen)
+{
+	if ((snaplen < 14) || (snaplen > MAX_CAPTURE_LEN))
+		return EXIT_FAILURE;
+	capture.snaplen = snaplen;
+	return EXIT_SUCCESS;
+}
+
+
+int captureSetSample(int sample)
+{
+	if (sample < 1)
+		return EXIT_FAILURE;
+	capture.sample = sample;
+	return EXIT_SUCCESS;
+}
+
+
+/*
+ * the format applies from the next file header (console restart)
+ */
+int captureSetFormat(char *format)
+{
+	if (!strcmp(format, "pcap"))
+		capture.format = CAPTURE_PCAP;
+	else if (!strcmp(format, "pcapng"))
+		capture.format = CAPTURE_PCAPNG;
+	else
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
+
+
+/*
+ * record only the frames matching the class cname; "none" or NULL
+ * records all frames.
+ */
+int captureSetFilter(char *cname)
+{
+	if ((cname == NULL) || !strcmp(cname, "none"))
+		capture.filtername[0] = '\0';
+	else if (getClassDef(classifier, cname) == NULL)
+		return EXIT_FAILURE;
+	else
+	{
+		strncpy(capture.filtername, cname, MAX_NAME_LEN - 1);
+		capture.filtername[MAX_NAME_LEN - 1] = '\0';
+	}
+	captureRebuildFilter();
+	return EXIT_SUCCESS;
+}
+
+
+/*
+ * compile the filter class again; must be called when the classes change.
+ * the replaced table is retired and freed once no packet thread can still
+ * be matching a frame against it (see epoch.h).
+ */
+void captureRebuildFilter(void)
+{
+	cls_table_t *filter = NULL;
+	char *cnames[1];
+
+	pthread_mutex_lock(&capture_lock);
+	if (capture.filtername[0] != '\0')
+	{
+		cnames[0] = capture.filtername;
+		filter = compileClassTable(classifier, cnames, NULL, NULL, 1);
+	}
+	epochRetire((void (*)(void *))freeClassTable, epochPublish((void * volatile *)&(capture.filter), filter));
+	pthread_mutex_unlock(&capture_lock);
+}
+
+
+void capturePrint(void)
+{
+	printf("Capture is %s, format %s, snap length %d, sampling 1 in %d, filter %s \n",
+	       capture.enabled ? "on" : "off",
+	       (capture.format == CAPTURE_PCAPNG) ? "pcapng" : "pcap",
+	       capture.snaplen, capture.sample,
+	       (capture.filtername[0] != '\0') ? capture.filtername : "none");
+	printf("Frames captured %lu, written %lu, dropped %lu (ring full), write errors %lu, in ring %lu \n",
+	       capture.captured, capture.written, capture.dropped, capture.errors,
+	       capture.head - capture.tail);
+}
@@ -0,0 +1,187 @@
+/*
+ * checksum.c (Internet checksum, RFC 1071)
+ *
+ * The one's complement sum does not depend on the byte order of the
+ * words it adds (RFC 1071, section 2), so the kernels add the buffer
+ * in the native byte order, as wide as possible, and swap the result
+ * once at the end. checksum() keeps its original contract: iwords
+ * 16-bit words are summed and the complement is returned in host
+ * byte order (callers store it with htons).
+ *
+ * checksum64 adds 32-bit halves of 64-bit loads into a 64-bit
+ * accumulator (no carry handling in the loop); checksumSSE2 adds the
+ * 16-bit words into four 32-bit lanes. checksumAdjust updates a
+ * checksum for a changed 16-bit field without summing the header
+ * again (RFC 1624).
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <netinet/in.h>
+#include "checksum.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+static uint32_t cksumFold(uint64_t sum)
+{
+	sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+	sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	return (uint32_t)sum;
+}
+
+
+static uint64_t cksumAdd64(const uchar *buf, int len, uint64_t sum)
+{
+	uint64_t w0, w1, w2, w3;
+	uint32_t w;
+	uint16_t h;
+
+	while (len >= 32)
+	{
+		memcpy(&w0, buf, 8);
+		memcpy(&w1, buf + 8, 8);
+		memcpy(&w2, buf + 16, 8);
+		memcpy(&w3, buf + 24, 8);
+		sum += (w0 & 0xFFFFFFFF) + (w0 >> 32) + (w1 & 0xFFFFFFFF) + (w1 >> 32);
+		sum += (w2 & 0xFFFFFFFF) + (w2 >> 32) + (w3 & 0xFFFFFFFF) + (w3 >> 32);
+		buf += 32;
+		len -= 32;
+	}
+	while (len >= 8)
+	{
+		memcpy(&w0, buf, 8);
+		sum += (w0 & 0xFFFFFFFF) + (w0 >> 32);
+		buf += 8;
+		len -= 8;
+	}
+	if (len >= 4)
+	{
+		memcpy(&w, buf, 4);
+		sum += w;
+		buf += 4;
+		len -= 4;
+	}
+	if (len >= 2)
+	{
+		memcpy(&h, buf, 2);
+		sum += h;
+		buf += 2;
+		len -= 2;
+	}
+	if (len > 0)
+	{
+		// a trailing byte is padded with a zero byte
+		h = 0;
+		memcpy(&h, buf, 1);
+		sum += h;
+	}
+	return sum;
+}
+
+
+#ifdef __SSE2__
+static uint64_t cksumAddSSE2(const uchar *buf, int len, uint64_t sum)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i acc0, acc1, acc2, acc3, v0, v1;
+	uint32_t lanes[4];
+	int n;
+
+	while (len >= 32)
+	{
+		// four independent accumulators keep the adds from waiting on
+		// each other. a lane gains at most 0xFFFF per block: flush
+		// them before they can overflow.
+		acc0 = acc1 = acc2 = acc3 = _mm_setzero_si128();
+		for (n = 0; (len >= 32) && (n < 32768); n++)
+		{
+			v0 = _mm_loadu_si128((const __m128i *)buf);
+			v1 = _mm_loadu_si128((const __m128i *)(buf + 16));
+			acc0 = _mm_add_epi32(acc0, _mm_unpacklo_epi16(v0, zero));
+			acc1 = _mm_add_epi32(acc1, _mm_unpackhi_epi16(v0, zero));
+			acc2 = _mm_add_epi32(acc2, _mm_unpacklo_epi16(v1, zero));
+			acc3 = _mm_add_epi32(acc3, _mm_unpackhi_epi16(v1, zero));
+			buf += 32;
+			len -= 32;
+		}
+		// the sum of two lanes fits in 32 bits within a block
+		acc0 = _mm_add_epi32(acc0, acc1);
+		acc2 = _mm_add_epi32(acc2, acc3);
+		_mm_storeu_si128((__m128i *)lanes, acc0);
+		sum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+		_mm_storeu_si128((__m128i *)lanes, acc2);
+		sum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	}
+	return cksumAdd64(buf, len, sum);
+}
+
+
+ushort checksumSSE2(uchar *buf, int iwords)
+{
+	return ntohs((ushort)~cksumFold(cksumAddSSE2(buf, iwords * 2, 0)));
+}
+#endif
+
+
+ushort checksum64(uchar *buf, int iwords)
+{
+	return ntohs((ushort)~cksumFold(cksumAdd64(buf, iwords * 2, 0)));
+}
+
+
+/*
+ * compute the checksum of a buffer, by adding 2-byte words
+ * and returning their one's complement
+ */
+ushort checksum(uchar *buf, int iwords)
+{
+#ifdef __SSE2__
+	if (iwords * 2 >= CKSUM_SIMD_MIN)
+		return checksumSSE2(buf, iwords);
+#endif
+	return checksum64(buf, iwords);
+}
+
+
+/*
+ * the original byte at a time checksum, kept as the reference for the
+ * benchmark
+ */
+ushort checksumRef(uchar *buf, int iwords)
+{
+	unsigned long cksum = 0;
+	int i;
+
+	for(i = 0; i < iwords; i++)
+	{
+		cksum += buf[0] << 8;
+		cksum += buf[1];
+		buf += 2;
+	}
+
+	// add in all carries
+	while (cksum >> 16)
+		cksum = (cksum & 0xFFFF) + (cksum >> 16);
+
+	return (unsigned short) (~cksum);
+}
+
+
+/*
+ * incremental update (RFC 1624, eqn. 3): the checksum of a header in
+ * which one 16-bit field changed from oldval to newval. all three
+ * values must be in the same byte order (e.g., as stored in the header).
+ */
+ushort checksumAdjust(ushort cksum, ushort oldval, ushort newval)
+{
+	uint32_t sum;
+
+	sum = (~cksum & 0xFFFF) + (~oldval & 0xFFFF) + newval;
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	return (ushort)~sum;
+}
@@ -12,8 +12,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <slack/list.h>
+#include <netinet/in.h>
 #include "classspec.h"
 #include "classifier.h"
+#include "protocols.h"
 #include "ip.h"
 
 
@@ -274,7 +276,11 @@ int compareIP2Spec(uchar ip[], ip_spec_t *ips)
 			mask = mask >> 1;
 		}
 
+		// host bits of the spec do not take part in the match
 		temp[prefbytes] = ip[prefbytes] & tbyte;
+		spec[prefbytes] &= tbyte;
+		for (i = prefbytes + 1; i < 4; i++)
+			spec[i] = 0;
 	}
 	return COMPARE_IP(temp, spec) == 0;
 }
@@ -297,18 +303,342 @@ int compareTos2Spec(int tos, int tspec)
 
 
 /*
- * TODO: What happened to the port range check? Not implemented?
+ * a port range of 0-0 matches all ports, a single port may be given
+ * as lower bound only.
+ */
+static int isAnyPortRange(port_range_t *prs)
+{
+	return (prs == NULL) || ((prs->minport == 0) && (prs->maxport == 0));
+}
+
+
+static int portRangeMax(port_range_t *prs)
+{
+	return (prs->maxport < prs->minport) ? prs->minport : prs->maxport;
+}
+
+
+/*
+ * get the transport ports of a packet. returns 0 if the packet has
+ * no ports: not TCP or UDP, or not the first fragment.
+ */
+int getPacketPorts(ip_packet_t *ip_pkt, int *sport, int *dport)
+{
+	uchar *l4hdr;
+
+	if (((ip_pkt->ip_prot != TCP_PROTOCOL) && (ip_pkt->ip_prot != UDP_PROTOCOL)) ||
+	    ((ntohs(ip_pkt->ip_frag_off) & IP_OFFMASK) != 0))
+		return 0;
+
+	l4hdr = (uchar *)ip_pkt + ip_pkt->ip_hdr_len * 4;
+	*sport = (l4hdr[0] << 8) | l4hdr[1];
+	*dport = (l4hdr[2] << 8) | l4hdr[3];
+	return 1;
+}
+
+
+int comparePorts2Spec(int port, port_range_t *prs)
+{
+	if (isAnyPortRange(prs)) return 1;
+	return (port >= prs->minport) && (port <= portRangeMax(prs));
+}
+
+
+/*
  * Returns 1 if the rule given by cdef matches the packet and 0 otherwise.
+ * A rule with a port range matches only TCP and UDP packets carrying
+ * the transport header.
  */
 int isRuleMatching(classdef_t *cdef, gpacket_t *in_pkt)
 {
 
-	ip_packet_t *ip_pkt = (ip_packet_t *)&in_pkt->data.data;
+	ip_packet_t *ip_pkt = (ip_packet_t *)GPKT_PAYLOAD(in_pkt);
+	int sport, dport;
+
+	if (!compareIP2Spec(ip_pkt->ip_src, cdef->srcspec) ||
+	    !compareIP2Spec(ip_pkt->ip_dst, cdef->dstspec) ||
+	    !compareProt2Spec(ip_pkt->ip_prot, cdef->prot) ||
+	    !compareTos2Spec(ip_pkt->ip_tos, cdef->tos))
+		return 0;
 
-	return compareIP2Spec(ip_pkt->ip_src, cdef->srcspec) *
-		compareIP2Spec(ip_pkt->ip_dst, cdef->dstspec) *
-		compareProt2Spec(ip_pkt->ip_prot, cdef->prot) *
-		compareTos2Spec(ip_pkt->ip_tos, cdef->tos);
+	if (isAnyPortRange(cdef->srcports) && isAnyPortRange(cdef->dstports))
+		return 1;
+	if (!getPacketPorts(ip_pkt, &sport, &dport))
+		return 0;
+	return comparePorts2Spec(sport, cdef->srcports) * comparePorts2Spec(dport, cdef->dstports);
+}
+
+
+/*-------------------------------------------------------------------------
+ *              C O M P I L E D  C L A S S  T A B L E
+ *-------------------------------------------------------------------------*/
+
+static uint32_t prefixMask(int preflen)
+{
+	if (preflen <= 0)
+		return 0;
+	if (preflen >= 32)
+		return 0xffffffff;
+	return 0xffffffff << (32 - preflen);
+}
+
+
+static uint32_t specAddr(ip_spec_t *ips)
+{
+	return (ips->ip_addr[3] << 24) | (ips->ip_addr[2] << 16) | (ips->ip_addr[1] << 8) | ips->ip_addr[0];
+}
+
+
+static inline unsigned int classHash(uint32_t src, uint32_t dst)
+{
+	unsigned int h = src * 0x9e3779b1;
+
+	h ^= dst + 0x7f4a7c15 + (h << 6) + (h >> 2);
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	return h;
+}
+
+
+static int compareTuples(const void *a, const void *b)
+{
+	return ((cls_tuple_t *)a)->minprio - ((cls_tuple_t *)b)->minprio;
+}
+
+
+/*
+ * compile the class definitions named in cnames into a lookup table.
+ * the position of a name in cnames is its priority: when several
+ * classes of a group match a packet the lookup returns the first.
+ * groups gives the group of each name (all in group 0 if NULL), values
+ * an integer that is kept with the name for the caller (may be NULL).
+ * names that are NULL or have no class definition are skipped.
+ */
+cls_table_t *compileClassTable(classlist_t *clas, char **cnames, int *groups, int *values, int n)
+{
+	cls_table_t *ct;
+	cls_rule_t *r;
+	cls_tuple_t *t;
+	classdef_t *cdef;
+	int *tid, *tcount;
+	int i, j, k, size;
+	uint32_t srcmask, dstmask;
+
+	if (((ct = (cls_table_t *) calloc(1, sizeof(cls_table_t))) == NULL) ||
+	    ((ct->rules = (cls_rule_t *) calloc(n + 1, sizeof(cls_rule_t))) == NULL) ||
+	    ((ct->tuples = (cls_tuple_t *) calloc(n + 1, sizeof(cls_tuple_t))) == NULL) ||
+	    ((ct->names = calloc(n + 1, MAX_NAME_LEN)) == NULL) ||
+	    ((ct->values = (int *) calloc(n + 1, sizeof(int))) == NULL) ||
+	    ((tid = (int *) calloc(n + 1, sizeof(int))) == NULL) ||
+	    ((tcount = (int *) calloc(n + 1, sizeof(int))) == NULL))
+	{
+		fatal("[compileClassTable]:: Could not allocate memory for the class table ");
+		return NULL;
+	}
+	ct->nnames = n;
+	ct->ngroups = CLS_MAX_GROUPS;
+	for (i = 0; i < CLS_MAX_GROUPS; i++)
+		ct->catchall[i] = -1;
+
+	for (j = 0; j < n; j++)
+	{
+		if (cnames[j] == NULL)
+			continue;
+		strncpy(ct->names[j], cnames[j], MAX_NAME_LEN - 1);
+		if (values != NULL)
+			ct->values[j] = values[j];
+		if ((cdef = getClassDef(clas, cnames[j])) == NULL)
+			continue;
+
+		r = &(ct->rules[ct->nrules]);
+		srcmask = (cdef->srcspec == NULL) ? 0 : prefixMask(cdef->srcspec->preflen);
+		dstmask = (cdef->dstspec == NULL) ? 0 : prefixMask(cdef->dstspec->preflen);
+		r->src = (cdef->srcspec == NULL) ? 0 : (specAddr(cdef->srcspec) & srcmask);
+		r->dst = (cdef->dstspec == NULL) ? 0 : (specAddr(cdef->dstspec) & dstmask);
+		r->sport_lo = r->dport_lo = 0;
+		r->sport_hi = r->dport_hi = 0xffff;
+		if (!isAnyPortRange(cdef->srcports))
+		{
+			r->sport_lo = cdef->srcports->minport;
+			r->sport_hi = portRangeMax(cdef->srcports);
+		}
+		if (!isAnyPortRange(cdef->dstports))
+		{
+			r->dport_lo = cdef->dstports->minport;
+			r->dport_hi = portRangeMax(cdef->dstports);
+		}
+		r->ports = !isAnyPortRange(cdef->srcports) || !isAnyPortRange(cdef->dstports);
+		r->prot = cdef->prot;
+		r->tos = cdef->tos;
+		r->prio = j;
+		r->group = (groups == NULL) ? 0 : groups[j];
+		if ((r->group < 0) || (r->group >= CLS_MAX_GROUPS))
+		{
+			error("[compileClassTable]:: invalid group %d for class %s ", r->group, cnames[j]);
+			continue;
+		}
+		ct->groupsize[r->group]++;
+		if ((srcmask == 0) && (dstmask == 0) && !r->ports && (r->prot == 0) &&
+		    (r->tos == 0) && (ct->catchall[r->group] < 0))
+			ct->catchall[r->group] = j;
+
+		// find the tuple of the prefix lengths
+		for (i = 0; i < ct->ntuples; i++)
+			if ((ct->tuples[i].srcmask == srcmask) && (ct->tuples[i].dstmask == dstmask))
+				break;
+		if (i == ct->ntuples)
+		{
+			ct->tuples[i].srcmask = srcmask;
+			ct->tuples[i].dstmask = dstmask;
+			ct->tuples[i].minprio = j;
+			for (k = 0; k < CLS_MAX_GROUPS; k++)
+				ct->tuples[i].groupprio[k] = n;
+			ct->ntuples++;
+		}
+		if (ct->tuples[i].groupprio[r->group] == n)
+			ct->tuples[i].groupprio[r->group] = j;
+		tid[ct->nrules] = i;
+		tcount[i]++;
+		ct->nrules++;
+	}
+
+	for (i = 0; i < ct->ntuples; i++)
+	{
+		t = &(ct->tuples[i]);
+		for (size = 2; size < 2 * tcount[i]; size <<= 1);
+		if ((t->bucket = (int *) malloc(size * sizeof(int))) == NULL)
+		{
+			fatal("[compileClassTable]:: Could not allocate memory for the class table ");
+			return NULL;
+		}
+		memset(t->bucket, 0xff, size * sizeof(int));
+		t->hashmask = size - 1;
+	}
+
+	// prepend in reverse order so that every chain is sorted by priority
+	for (j = ct->nrules - 1; j >= 0; j--)
+	{
+		r = &(ct->rules[j]);
+		t = &(ct->tuples[tid[j]]);
+		i = classHash(r->src, r->dst) & t->hashmask;
+		r->next = t->bucket[i];
+		t->bucket[i] = j;
+	}
+	qsort(ct->tuples, ct->ntuples, sizeof(cls_tuple_t), compareTuples);
+
+	free(tid);
+	free(tcount);
+	return ct;
+}
+
+
+/*
+ * sets match[g] to the priority (position in the compiled name list)
+ * of the first class of group g matching the packet, or -1 if no class
+ * of the group matches. match must have CLS_MAX_GROUPS elements.
+ */
+void lookupClassTable(cls_table_t *ct, pkt_data_t *frame, int *match)
+{
+	ip_packet_t *ip_pkt = (ip_packet_t *)frame->data;
+	cls_tuple_t *t;
+	cls_rule_t *r;
+	uint32_t src, dst;
+	int sport = -1, dport = -1, haveports;
+	int i, g, k, worst;
+
+	for (g = 0; g < CLS_MAX_GROUPS; g++)
+		match[g] = -1;
+	if (ct == NULL)
+		return;
+	if (ntohs(frame->header.prot) != IP_PROTOCOL)
+	{
+		for (g = 0; g < CLS_MAX_GROUPS; g++)
+			match[g] = ct->catchall[g];
+		return;
+	}
+
+	src = (ip_pkt->ip_src[0] << 24) | (ip_pkt->ip_src[1] << 16) | (ip_pkt->ip_src[2] << 8) | ip_pkt->ip_src[3];
+	dst = (ip_pkt->ip_dst[0] << 24) | (ip_pkt->ip_dst[1] << 16) | (ip_pkt->ip_dst[2] << 8) | ip_pkt->ip_dst[3];
+	haveports = getPacketPorts(ip_pkt, &sport, &dport);
+
+	// match[g] is the best rule of group g so far (nnames if none yet,
+	// -1 if the group is empty); no rule at or after the worst of them
+	// can improve the result
+	for (g = 0, worst = -1; g < CLS_MAX_GROUPS; g++)
+		if (ct->groupsize[g] > 0)
+			match[g] = worst = ct->nnames;
+	for (k = 0; (k < ct->ntuples) && (ct->tuples[k].minprio < worst); k++)
+	{
+		t = &(ct->tuples[k]);
+		for (g = 0; g < CLS_MAX_GROUPS; g++)
+			if (t->groupprio[g] < match[g])
+				break;
+		if (g == CLS_MAX_GROUPS)
+			continue;
+		i = t->bucket[classHash(src & t->srcmask, dst & t->dstmask) & t->hashmask];
+		for (; (i >= 0) && (ct->rules[i].prio < worst); i = r->next)
+		{
+			r = &(ct->rules[i]);
+			if (r->prio >= match[r->group])
+				continue;
+			if ((r->src != (src & t->srcmask)) || (r->dst != (dst & t->dstmask)))
+				continue;
+			if ((r->prot != 0) && (r->prot != ip_pkt->ip_prot))
+				continue;
+			if ((r->tos != 0) && (r->tos != ip_pkt->ip_tos))
+				continue;
+			if (r->ports && (!haveports ||
+					 (sport < r->sport_lo) || (sport > r->sport_hi) ||
+					 (dport < r->dport_lo) || (dport > r->dport_hi)))
+				continue;
+			match[r->group] = r->prio;
+			for (g = 0, worst = 0; g < CLS_MAX_GROUPS; g++)
+				if (match[g] > worst)
+					worst = match[g];
+		}
+	}
+
+	for (g = 0; g < CLS_MAX_GROUPS; g++)
+		if (match[g] == ct->nnames)
+			match[g] = -1;
+}
+
+
+void freeClassTable(cls_table_t *ct)
+{
+	int i;
+
+	if (ct == NULL)
+		return;
+	for (i = 0; i < ct->ntuples; i++)
+		free(ct->tuples[i].bucket);
+	free(ct->tuples);
+	free(ct->rules);
+	free(ct->names);
+	free(ct->values);
+	free(ct);
+}
+
+
+void printClassTable(cls_table_t *ct)
+{
+	int i, j, k, count;
+
+	if (ct == NULL)
+		return;
+	printf("Compiled table: %d rules in %d tuples\n", ct->nrules, ct->ntuples);
+	printf("Src len\tDst len\tRules\tFirst \n");
+	for (i = 0; i < ct->ntuples; i++)
+	{
+		for (j = 0, count = 0; j <= ct->tuples[i].hashmask; j++)
+			for (k = ct->tuples[i].bucket[j]; k >= 0; k = ct->rules[k].next)
+				count++;
+		printf("/%d\t/%d\t%d\t%s\n", __builtin_popcount(ct->tuples[i].srcmask),
+		       __builtin_popcount(ct->tuples[i].dstmask), count,
+		       ct->names[ct->tuples[i].minprio]);
+	}
+	printf("\n");
 }
 
 
@@ -21,16 +21,27 @@
 #include "grouter.h"
 #include "routetable.h"
 #include "mtu.h"
+#include "arp.h"
 #include "message.h"
 #include "classifier.h"
 #include "filter.h"
 #include "classspec.h"
 #include "packetcore.h"
+#include "packetpool.h"
+#include "epoch.h"
+#include "bench.h"
+#include "capture.h"
+#include "reactor.h"
+#include "trace.h"
+#include "fragment.h"
+#include "flowcache.h"
+#include "cpu.h"
 #include <slack/err.h>
 #include <slack/std.h>
 #include <slack/prog.h>
 #include <slack/err.h>
 #include <stdlib.h>
+#include <sched.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 
@@ -42,8 +53,8 @@ static char *cur_line = (char *)NULL;       // static variable for holding the l
 extern FILE *rl_instream;
 extern router_config rconfig;
 
-extern route_entry_t route_tbl[MAX_ROUTES];
-extern mtu_entry_t MTU_tbl[MAX_MTU];
+extern route_table_t *route_tbl;
+extern mtu_table_t *MTU_tbl;
 extern classlist_t *classifier;
 extern filtertab_t *filter;
 extern pktcore_t *pcore;
@@ -91,6 +102,14 @@ int CLIInit(router_config *rarg)
 	registerCLI("spolicy", spolicyCmd, SHELP_SPOLICY, USAGE_SPOLICY, LHELP_SPOLICY); // Check
 	registerCLI("class", classCmd, SHELP_CLASS, USAGE_CLASS, LHELP_CLASS);
 	registerCLI("filter", filterCmd, SHELP_FILTER, USAGE_FILTER, LHELP_FILTER);
+	registerCLI("pool", poolCmd, SHELP_POOL, USAGE_POOL, LHELP_POOL);
+	registerCLI("worker", workerCmd, SHELP_WORKER, USAGE_WORKER, LHELP_WORKER);
+	registerCLI("bench", benchCmd, SHELP_BENCH, USAGE_BENCH, LHELP_BENCH);
+	registerCLI("trace", traceCmd, SHELP_TRACE, USAGE_TRACE, LHELP_TRACE);
+	registerCLI("frag", fragCmd, SHELP_FRAG, USAGE_FRAG, LHELP_FRAG);
+	registerCLI("flow", flowCmd, SHELP_FLOW, USAGE_FLOW, LHELP_FLOW);
+	registerCLI("cpu", cpuCmd, SHELP_CPU, USAGE_CPU, LHELP_CPU);
+	registerCLI("snapshot", snapshotCmd, SHELP_SNAPSHOT, USAGE_SNAPSHOT, LHELP_SNAPSHOT);
 
 
 	if (rarg->config_dir != NULL)
@@ -123,6 +142,7 @@ void *CLIProcessCmdsInteractive(void *arg)
 {
 	FILE *fp = (FILE *)arg;
 
+	cpuThreadRegister(CPU_ROLE_CONTROL, 0, "cli");
 	CLIPrintHelpPreamble();
 	CLIProcessCmds(fp, 1);
 }
@@ -152,6 +172,9 @@ void parseACLICmd(char *str)
 		clie->handler((void *)clie);
 	else
 		system(orig_str);
+	// free the configuration snapshots the command replaced, if the
+	// packet threads are done with them
+	epochReclaim();
 
 }
 
@@ -354,7 +377,7 @@ int getDevType(char *str)
  * ifconfig show [brief|verbose]
  * ifconfig up eth0|tap0
  * ifconfig down eth0|tap0
- * ifconfig mod eth0 (-gateway GW | -mtu N)
+ * ifconfig mod eth0 (-gateway GW | -mtu N | -rate kbps | -burst bytes)
  */
 void ifconfigCmd()
 {
@@ -362,7 +385,7 @@ void ifconfigCmd()
 	interface_t *iface;
 	char dev_name[MAX_DNAME_LEN], con_sock[MAX_NAME_LEN], dev_type[MAX_NAME_LEN];
 	uchar mac_addr[6], ip_addr[4], gw_addr[4];
-	int mtu, interface, mode;
+	int mtu, interface, mode, rate, burst;
 
 	// set default values for optional parameters
 	bzero(gw_addr, 4);
@@ -413,6 +436,11 @@ void ifconfigCmd()
 				mtu = atoi(next_tok);
 			}
 
+		if ((mtu < MIN_MTU) || (mtu > MAX_JUMBO_MTU))
+		{
+			printf("[ifconfigCmd]:: MTU must be between %d and %d bytes \n", MIN_MTU, MAX_JUMBO_MTU);
+			return;
+		}
 		if (strcmp(dev_type, "eth") == 0)
 			iface = GNETMakeEthInterface(con_sock, dev_name, mac_addr, ip_addr, mtu, 0);
 		else
@@ -432,7 +460,7 @@ void ifconfigCmd()
 		strcpy(dev_name, next_tok);
 		interface = gAtoi(next_tok);
 		destroyInterfaceByIndex(interface);
-		deleteMTUEntry(interface);
+		deleteMTUEntry(MTU_tbl, interface);
 	}
 	else if (!strcmp(next_tok, "up"))
 	{
@@ -454,6 +482,7 @@ void ifconfigCmd()
 		GET_THIS_PARAMETER("eth", "ifconfig:: missing interface spec ..");
 		strcpy(dev_name, next_tok);
 		interface = gAtoi(next_tok);
+		mtu = rate = burst = -1;
 
 		while ((next_tok = strtok(NULL, " \n")) != NULL)
 			if (!strcmp("-gateway", next_tok))
@@ -464,9 +493,27 @@ void ifconfigCmd()
 			{
 				next_tok = strtok(NULL, " \n");
 				mtu = atoi(next_tok);
+			} else if (!strcmp("-rate", next_tok))
+			{
+				next_tok = strtok(NULL, " \n");
+				rate = atoi(next_tok);
+			} else if (!strcmp("-burst", next_tok))
+			{
+				next_tok = strtok(NULL, " \n");
+				burst = atoi(next_tok);
 			}
 
-		changeInterfaceMTU(interface, mtu);
+		// IP fragments to the MTU in the MTU table: keep it in step
+		if ((mtu > 0) && (changeInterfaceMTU(interface, mtu) == EXIT_SUCCESS) &&
+		    ((iface = findInterface(interface)) != NULL))
+			addMTUEntry(MTU_tbl, interface, mtu, iface->ip_addr);
+		if ((rate >= 0) || (burst > 0))
+		{
+			// -burst alone keeps the current rate
+			if ((rate < 0) && ((iface = findInterface(interface)) != NULL))
+				rate = iface->tx_rate;
+			changeInterfaceRate(interface, (rate >= 0) ? rate : 0, (burst > 0) ? burst : 0);
+		}
 	}
 	else if (!strcmp(next_tok, "show"))
 	{
@@ -490,6 +537,7 @@ void ifconfigCmd()
  * route show
  * route add -dev eth0|tap0 -net nw_addr -netmask mask [-gw gw_addr]
  * route del route_number
+ * route load route_file
  */
 void routeCmd()
 {
@@ -537,6 +585,13 @@ void routeCmd()
 		}
 		else if (!strcmp(next_tok, "show"))
 			printRouteTable(route_tbl);
+		else if (!strcmp(next_tok, "load"))
+		{
+			if ((next_tok = strtok(NULL, " \n")) == NULL)
+				printf("[routeCmd]:: missing route file name.. \n");
+			else
+				loadRouteFile(route_tbl, next_tok);
+		}
 	}
 	return;
 }
@@ -551,7 +606,7 @@ void routeCmd()
 void arpCmd()
 {
 	char *next_tok;
-	uchar mac_addr[6], ip_addr[4];
+	uchar ip_addr[4], *ip_spec = NULL;
 
 	next_tok = strtok(NULL, " \n");
 
@@ -565,24 +620,26 @@ void arpCmd()
 	{
 		if ((next_tok = strtok(NULL, " \n")) != NULL)
 		{
-			if (!strcmp("-ip", next_tok))
+			if ((!strcmp("-ip", next_tok)) && ((next_tok = strtok(NULL, " \n")) != NULL))
 			{
-				next_tok = strtok(NULL, " \n");
-				strcpy(ip_addr, next_tok);
+				Dot2IP(next_tok, ip_addr);
+				ip_spec = ip_addr;
 			}
 		}
-		ARPPrintTable();
+		ARPPrintTable(ip_spec);
+		if (ip_spec == NULL)
+			ARPPrintBuffer();
 	} else if (!strcmp(next_tok, "del"))
 	{
 		if ((next_tok = strtok(NULL, " \n")) != NULL)
 		{
-			if (!strcmp("-ip", next_tok))
+			if ((!strcmp("-ip", next_tok)) && ((next_tok = strtok(NULL, " \n")) != NULL))
 			{
-				next_tok = strtok(NULL, " \n");
-				strcpy(ip_addr, next_tok);
+				Dot2IP(next_tok, ip_addr);
+				ip_spec = ip_addr;
 			}
 		}
-		ARPDeleteEntry(ip_addr);
+		ARPDeleteEntry(ip_spec);
 	}
 }
 
@@ -689,6 +746,8 @@ void classCmd()
 					}
 				}
 			}
+			rebuildPktCoreClassTable(pcore);
+			captureRebuildFilter();
 		}
 		else if (!strcmp(next_tok, "del"))
 		{
@@ -697,10 +756,17 @@ void classCmd()
 			{
 				strcpy(cname, next_tok);
 				delClassDef(classifier, cname);
+				rebuildPktCoreClassTable(pcore);
+				captureRebuildFilter();
 			}
 		}
 		else if (!strcmp(next_tok, "show"))
-		  printClassifier(classifier);
+		{
+			printClassifier(classifier);
+			epochEnter();
+			printClassTable(pcore->ctable);
+			epochExit();
+		}
 	}
 	return;
 }
@@ -744,7 +810,8 @@ void filterCmd()
 			else
 				return;
 			if ((next_tok = strtok(NULL, " \n")) != NULL)
-				addFilterRule(filter, type, next_tok);
+				if (addFilterRule(filter, type, next_tok))
+					rebuildPktCoreClassTable(pcore);
 		}
 		else if (!strcmp(next_tok, "move"))
 		{
@@ -756,8 +823,10 @@ void filterCmd()
 					printf("Invalid rule number %d \n", rulenum);
 					return;
 				}
-				next_tok = strtok(NULL, " \n");
+				if ((next_tok = strtok(NULL, " \n")) == NULL)
+					return;
 				moveRule(filter, rulenum, next_tok);
+				rebuildPktCoreClassTable(pcore);
 			}
 		}
 		else if (!strcmp(next_tok, "del"))
@@ -771,6 +840,7 @@ void filterCmd()
 					return;
 				}
 				delFilterRule(filter, rulenum);
+				rebuildPktCoreClassTable(pcore);
 			}
 		}
 		else if (!strcmp(next_tok, "show"))
@@ -778,7 +848,10 @@ void filterCmd()
 		else if (!strcmp(next_tok, "stats"))
 			printFilterStats(filter);
 		else if (!strcmp(next_tok, "flush"))
+		{
 			flushFilter(filter);
+			rebuildPktCoreClassTable(pcore);
+		}
 	}
 }
 
@@ -850,33 +923,85 @@ void pingCmd()
  * set verbose [value]
  * set raw-time [true | false ]
  * set update-delay value
- * set sched-cycle value
+ * set sched-rate value (kbps, 0 for unlimited)
+ * set sched-burst value (bytes, 0 for default)
+ * set arp-timeout value (seconds, 0 to never expire)
+ * set io-batch value (frames per system call, 1 to disable batching)
+ * set io-threads value (reactor threads, 0 for a receive thread per interface)
  */
 void setCmd()
 {
 	char *next_tok = strtok(NULL, " \n");
-	int level, cyclelen, rawmode, updateinterval;
+	int level, rate, burst, rawmode, updateinterval, timeout, iobatch, iothreads;
 
 	if (next_tok == NULL)
 		error("[setCmd]:: ERROR!! missing set-parameter");
-	else if (!strcmp(next_tok, "sched-cycle"))
+	else if (!strcmp(next_tok, "sched-rate"))
+	{
+		if ((next_tok = strtok(NULL, " \n")) != NULL)
+		{
+			rate = atoi(next_tok);
+			if (rate >= 0)
+			{
+				rconfig.schedrate = rate;
+				setTokenBucket(&(pcore->egress), rconfig.schedrate, rconfig.schedburst);
+			} else
+				verbose(1, "ERROR!! schedule rate should be positive \n");
+		} else
+			printf("\nSchedule rate: %d (kbps) \n", rconfig.schedrate);
+	} else if (!strcmp(next_tok, "sched-burst"))
+	{
+		if ((next_tok = strtok(NULL, " \n")) != NULL)
+		{
+			burst = atoi(next_tok);
+			if (burst >= 0)
+			{
+				rconfig.schedburst = burst;
+				setTokenBucket(&(pcore->egress), rconfig.schedrate, rconfig.schedburst);
+			} else
+				verbose(1, "ERROR!! schedule burst should be positive \n");
+		} else
+			printf("\nSchedule burst: %d (bytes) \n", rconfig.schedburst);
+	} else if (!strcmp(next_tok, "arp-timeout"))
+	{
+		if ((next_tok = strtok(NULL, " \n")) != NULL)
+		{
+			timeout = atoi(next_tok);
+			if (timeout >= 0)
+				ARPSetTimeout(timeout);
+			else
+				verbose(1, "ERROR!! ARP timeout should be positive \n");
+		} else
+			printf("\nARP timeout: %d (seconds) \n", ARPGetTimeout());
+	} else if (!strcmp(next_tok, "io-batch"))
+	{
+		if ((next_tok = strtok(NULL, " \n")) != NULL)
+		{
+			iobatch = atoi(next_tok);
+			if ((iobatch >= 1) && (iobatch <= VPL_MAX_BATCH))
+				rconfig.iobatch = iobatch;
+			else
+				verbose(1, "ERROR!! I/O batch should be in [1..%d] \n", VPL_MAX_BATCH);
+		} else
+			printf("\nI/O batch: %d (frames) \n", rconfig.iobatch);
+	} else if (!strcmp(next_tok, "io-threads"))
 	{
 		if ((next_tok = strtok(NULL, " \n")) != NULL)
 		{
-			cyclelen = atoi(next_tok);
-			if (cyclelen >=0)
-				rconfig.schedcycle = cyclelen;
+			iothreads = atoi(next_tok);
+			if ((iothreads >= 0) && (iothreads <= MAX_REACTOR_THREADS))
+				rconfig.iothreads = iothreads;
 			else
-				verbose(1, "ERROR!! schedule cycle length should be positive \n");
+				verbose(1, "ERROR!! I/O threads should be in [0..%d] \n", MAX_REACTOR_THREADS);
 		} else
-			printf("\nSchedule cycle length: %d (microseconds) \n", rconfig.schedcycle);
+			printf("\nI/O threads: %d \n", rconfig.iothreads);
 	} else if (!strcmp(next_tok, "verbose"))
 	{
 		if ((next_tok = strtok(NULL, " \n")) != NULL)
 		{
 			level = atoi(next_tok);
 			if ((level >= 0) && (level <= 6))
-				prog_set_verbosity_level(level);
+				traceSetVerbosity(level);
 			else
 				verbose(1, "[setCmd]:: ERROR!! level should be in [0..6] \n");
 		} else
@@ -891,19 +1016,18 @@ void setCmd()
 			else
 				printf("\nRaw time mode: %d  \n", getTimeMode());
 		}
-		else if (!strcmp(next_tok, "update-delay"))
+	} else if (!strcmp(next_tok, "update-delay"))
+	{
+		if ((next_tok = strtok(NULL, " \n")) != NULL)
 		{
-			if ((next_tok = strtok(NULL, " \n")) != NULL)
-			{
-				updateinterval = atoi(next_tok);
-				if (updateinterval >=2)
-					setUpdateInterval(updateinterval);
-				else
-					verbose(1, "Invalid update interval.. setting failed.. \n");
-			}
+			updateinterval = atoi(next_tok);
+			if (updateinterval >=2)
+				setUpdateInterval(updateinterval);
 			else
-				printf("Update interval: %d (seconds) \n", getUpdateInterval());
+				verbose(1, "Invalid update interval.. setting failed.. \n");
 		}
+		else
+			printf("Update interval: %d (seconds) \n", getUpdateInterval());
 	}
 }
 
@@ -936,10 +1060,40 @@ void consoleCmd()
 {
 	char *next_tok = strtok(NULL, " \n");
 
-	if (next_tok == NULL)
+	if ((next_tok == NULL) || !strcmp(next_tok, "show"))
 		consoleGetState();
 	else if (!strcmp(next_tok, "restart"))
 		consoleRestart(rconfig.config_dir, rconfig.router_name);
+	else if (!strcmp(next_tok, "on"))
+		captureSetState(TRUE);
+	else if (!strcmp(next_tok, "off"))
+		captureSetState(FALSE);
+	else if (!strcmp(next_tok, "snaplen"))
+	{
+		next_tok = strtok(NULL, " \n");
+		if ((next_tok == NULL) || (captureSetSnaplen(atoi(next_tok)) == EXIT_FAILURE))
+			printf("Snap length must be between 14 and %d bytes \n", (int)MAX_CAPTURE_LEN);
+	}
+	else if (!strcmp(next_tok, "sample"))
+	{
+		next_tok = strtok(NULL, " \n");
+		if ((next_tok == NULL) || (captureSetSample(atoi(next_tok)) == EXIT_FAILURE))
+			printf("Sampling rate must be 1 or more \n");
+	}
+	else if (!strcmp(next_tok, "filter"))
+	{
+		next_tok = strtok(NULL, " \n");
+		if ((next_tok == NULL) || (captureSetFilter(next_tok) == EXIT_FAILURE))
+			printf("Unknown class %s \n", (next_tok == NULL) ? "" : next_tok);
+	}
+	else if (!strcmp(next_tok, "format"))
+	{
+		next_tok = strtok(NULL, " \n");
+		if ((next_tok == NULL) || (captureSetFormat(next_tok) == EXIT_FAILURE))
+			printf("Format must be pcap or pcapng \n");
+		else
+			printf("Format takes effect at the next console restart \n");
+	}
 	else
 	{
 		verbose(2, "[consoleCmd]:: Unknown port action requested \n");
@@ -989,12 +1143,19 @@ void helpCmd()
 void getCmd()
 {
 	char *next_tok = strtok(NULL, " \n");
-	int level, cyclelen, rawmode, updateinterval;
 
 	if (next_tok == NULL)
 		error("[getCmd]:: ERROR!! missing get-parameter");
-	else if (!strcmp(next_tok, "sched-cycle"))
-		printf("\nSchedule cycle length: %d (microseconds) \n", rconfig.schedcycle);
+	else if (!strcmp(next_tok, "sched-rate"))
+		printf("\nSchedule rate: %d (kbps) \n", rconfig.schedrate);
+	else if (!strcmp(next_tok, "sched-burst"))
+		printf("\nSchedule burst: %d (bytes) \n", rconfig.schedburst);
+	else if (!strcmp(next_tok, "arp-timeout"))
+		printf("\nARP timeout: %d (seconds) \n", ARPGetTimeout());
+	else if (!strcmp(next_tok, "io-batch"))
+		printf("\nI/O batch: %d (frames) \n", rconfig.iobatch);
+	else if (!strcmp(next_tok, "io-threads"))
+		printf("\nI/O threads: %d \n", rconfig.iothreads);
 	else if (!strcmp(next_tok, "verbose"))
 		printf("\nVerbose level: %ld \n", prog_verbosity_level());
 	else if (!strcmp(next_tok, "raw-times"))
@@ -1016,16 +1177,16 @@ void exitCmd()
  * queue add class_name qdisc_name [-size num_slots] [-weight value] [-delay delay_microsec]
  * queue show
  * queue del queue_number
- * queue mod queue_number [-weight value] [-delay delay_microsec]
+ * queue mod queue_number [-weight value] [-delay delay_microsec] [-qdisc disc] [-prio priority]
  * queue stats [queue_number]
  */
 void queueCmd()
 {
-	char *next_tok;
-	char cname[MAX_DNAME_LEN], qdisc[MAX_DNAME_LEN], qname[MAX_DNAME_LEN];
+	char *next_tok, *opt;
+	char cname[MAX_DNAME_LEN], qdisc[MAX_DNAME_LEN], qname[MAX_DNAME_LEN], parent[MAX_DNAME_LEN] = "";
 	// the following parameters are set to default values which are sometimes overwritten
-	int num_slots = -1;
-	double weight = 1.0, delay = 2.0;
+	int num_slots = -1, prio = 0, burst = -1;
+	double weight = 1.0, delay = 0.0, rate = -1.0, ceil = -1.0;
 
 
 	if ((next_tok = strtok(NULL, " \n")) != NULL)
@@ -1059,8 +1220,50 @@ void queueCmd()
 					next_tok = strtok(NULL, " \n");
 					delay = atof(next_tok);
 				}
+				else if (!strcmp(next_tok, "-prio"))
+				{
+					next_tok = strtok(NULL, " \n");
+					prio = atoi(next_tok);
+				}
+				else if (!strcmp(next_tok, "-rate"))
+				{
+					next_tok = strtok(NULL, " \n");
+					rate = atof(next_tok);
+				}
+				else if (!strcmp(next_tok, "-ceil"))
+				{
+					next_tok = strtok(NULL, " \n");
+					ceil = atof(next_tok);
+				}
+				else if (!strcmp(next_tok, "-burst"))
+				{
+					next_tok = strtok(NULL, " \n");
+					burst = atoi(next_tok);
+				}
+				else if (!strcmp(next_tok, "-parent"))
+				{
+					next_tok = strtok(NULL, " \n");
+					strcpy(parent, next_tok);
+				}
+			}
+			if ((prio < 0) || (prio > SCHED_MAX_PRIO))
+			{
+				printf("[queue]:: priority should be in [0..%d] \n", SCHED_MAX_PRIO);
+				return;
 			}
-			addPktCoreQueue(pcore, cname, qdisc, weight, delay, num_slots);
+			if ((parent[0] != 0) && (getCoreQueue(pcore, parent) == NULL))
+			{
+				printf("[queue]:: parent queue %s not defined.. \n", parent);
+				return;
+			}
+			if (addPktCoreQueue(pcore, cname, qdisc, weight, delay, num_slots) == EXIT_FAILURE)
+				return;
+			modifyQueuePriority(pcore, cname, prio);
+			if (((rate >= 0.0) || (ceil >= 0.0) || (burst >= 0)) &&
+			    (modifyQueueShaper(pcore, cname, rate, ceil, burst) == EXIT_FAILURE))
+				printf("[queue]:: shaper of %s not set.. ceil should not be below rate \n", cname);
+			if ((parent[0] != 0) && (modifyQueueParent(pcore, cname, parent) == EXIT_FAILURE))
+				printf("[queue]:: %s cannot borrow from %s \n", cname, parent);
 		}
 		else if (!strcmp(next_tok, "show"))
 			printAllQueues(pcore);
@@ -1080,12 +1283,49 @@ void queueCmd()
 					{
 						next_tok = strtok(NULL, " \n");
 						weight = atof(next_tok);
-						modifyQueueWeight(pcore, cname, weight);
+						modifyQueueWeight(pcore, qname, weight);
 					}
 					else if (!strcmp(next_tok, "-qdisc"))
 					{
 						next_tok = strtok(NULL, " \n");
-						modifyQueueDiscipline(pcore, cname, next_tok);
+						if (modifyQueueDiscipline(pcore, qname, next_tok) == EXIT_FAILURE)
+							printf("[queue]:: unknown queue or discipline.. type qdisc show for the disciplines \n");
+					}
+					else if (!strcmp(next_tok, "-delay"))
+					{
+						next_tok = strtok(NULL, " \n");
+						modifyQueueDelay(pcore, qname, atof(next_tok));
+					}
+					else if (!strcmp(next_tok, "-prio"))
+					{
+						next_tok = strtok(NULL, " \n");
+						prio = atoi(next_tok);
+						if ((prio >= 0) && (prio <= SCHED_MAX_PRIO))
+							modifyQueuePriority(pcore, qname, prio);
+						else
+							printf("[queue]:: priority should be in [0..%d] \n", SCHED_MAX_PRIO);
+					}
+					else if (!strcmp(next_tok, "-rate") || !strcmp(next_tok, "-ceil") ||
+						 !strcmp(next_tok, "-burst"))
+					{
+						opt = next_tok;
+						if ((next_tok = strtok(NULL, " \n")) == NULL)
+							return;
+						if (!strcmp(opt, "-rate"))
+							rate = atof(next_tok);
+						else if (!strcmp(opt, "-ceil"))
+							ceil = atof(next_tok);
+						else
+							burst = atoi(next_tok);
+						if (modifyQueueShaper(pcore, qname, rate, ceil, burst) == EXIT_FAILURE)
+							printf("[queue]:: unknown queue or ceil below rate.. \n");
+					}
+					else if (!strcmp(next_tok, "-parent"))
+					{
+						if ((next_tok = strtok(NULL, " \n")) == NULL)
+							return;
+						if (modifyQueueParent(pcore, qname, next_tok) == EXIT_FAILURE)
+							printf("[queue]:: unknown queue, or %s cannot borrow from %s \n", qname, next_tok);
 					}
 				}
 			}
@@ -1097,16 +1337,333 @@ void queueCmd()
 
 
 
-// TODO: complete this function
-void qdiscCmd()
+/*
+ * pool show
+ */
+void poolCmd()
 {
+	char *next_tok = strtok(NULL, " \n");
+
+	if ((next_tok == NULL) || (!strcmp(next_tok, "show")))
+		printPacketPool();
+	else
+		error("[poolCmd]:: ERROR!! unknown pool action %s ", next_tok);
+}
 
 
+/*
+ * worker [show]
+ */
+void workerCmd()
+{
+	char *next_tok = strtok(NULL, " \n");
+
+	if ((next_tok == NULL) || (!strcmp(next_tok, "show")))
+		printWorkers(pcore);
+	else
+		error("[workerCmd]:: ERROR!! unknown worker action %s ", next_tok);
 }
 
-// TODO: complete this function
-void spolicyCmd()
+
+/*
+ * bench workers [maxworkers] [npackets] | checksum [ncalls] |
+ *       sched [nqueues] [npackets]
+ */
+void benchCmd()
 {
+	char *next_tok = strtok(NULL, " \n");
+	int maxworkers = 0, nqueues = 0;
+	long npkts = 0;
 
+	if ((next_tok != NULL) && !strcmp(next_tok, "checksum"))
+	{
+		if ((next_tok = strtok(NULL, " \n")) != NULL)
+			npkts = atol(next_tok);
+		benchChecksum(npkts);
+		return;
+	}
+	if ((next_tok != NULL) && !strcmp(next_tok, "sched"))
+	{
+		if ((next_tok = strtok(NULL, " \n")) != NULL)
+		{
+			nqueues = gAtoi(next_tok);
+			if ((next_tok = strtok(NULL, " \n")) != NULL)
+				npkts = atol(next_tok);
+		}
+		benchSched(nqueues, npkts);
+		return;
+	}
+	if ((next_tok == NULL) || (strcmp(next_tok, "workers")))
+	{
+		printf("[benchCmd]:: missing or unknown benchmark.. type help bench for usage \n");
+		return;
+	}
+	if ((next_tok = strtok(NULL, " \n")) != NULL)
+	{
+		maxworkers = gAtoi(next_tok);
+		if ((next_tok = strtok(NULL, " \n")) != NULL)
+			npkts = atol(next_tok);
+	}
+	benchWorkers(maxworkers, npkts);
+}
+
+
+/*
+ * trace [show [count] | on event|all | off event|all | list | clear |
+ *        dump file | decode file [count]]
+ */
+void traceCmd()
+{
+	char *next_tok = strtok(NULL, " \n");
+	char *arg;
+	int count = 0;
+
+	if ((next_tok == NULL) || !strcmp(next_tok, "show"))
+	{
+		if ((next_tok != NULL) && ((next_tok = strtok(NULL, " \n")) != NULL))
+			count = gAtoi(next_tok);
+		traceShow(count);
+	} else if (!strcmp(next_tok, "on") || !strcmp(next_tok, "off"))
+	{
+		if ((arg = strtok(NULL, " \n")) == NULL)
+			printf("[traceCmd]:: missing event.. type trace list for the events \n");
+		else if (traceSetEvent(arg, !strcmp(next_tok, "on")) == EXIT_FAILURE)
+			printf("[traceCmd]:: unknown event %s.. type trace list for the events \n", arg);
+	} else if (!strcmp(next_tok, "list"))
+		traceList();
+	else if (!strcmp(next_tok, "clear"))
+		traceClear();
+	else if (!strcmp(next_tok, "dump"))
+	{
+		if ((arg = strtok(NULL, " \n")) == NULL)
+			printf("[traceCmd]:: missing file name \n");
+		else
+			traceDump(arg);
+	} else if (!strcmp(next_tok, "decode"))
+	{
+		if ((arg = strtok(NULL, " \n")) == NULL)
+			printf("[traceCmd]:: missing file name \n");
+		else
+		{
+			if ((next_tok = strtok(NULL, " \n")) != NULL)
+				count = gAtoi(next_tok);
+			traceDecode(arg, count);
+		}
+	} else
+		printf("[traceCmd]:: unknown command %s.. type help trace for usage \n", next_tok);
+}
+
+
+/*
+ * frag [show | timeout seconds | memory kbytes]
+ */
+void fragCmd()
+{
+	char *next_tok = strtok(NULL, " \n");
+	char *arg;
+
+	if ((next_tok == NULL) || !strcmp(next_tok, "show"))
+		printFragStats();
+	else if (!strcmp(next_tok, "timeout") || !strcmp(next_tok, "memory"))
+	{
+		if ((arg = strtok(NULL, " \n")) == NULL)
+			printf("[fragCmd]:: missing value.. type help frag for usage \n");
+		else if (!strcmp(next_tok, "timeout"))
+			setReassemblyTimeout(gAtoi(arg));
+		else
+			setReassemblyMemory(gAtoi(arg) * 1024);
+	} else
+		printf("[fragCmd]:: unknown command %s.. type help frag for usage \n", next_tok);
+}
+
+
+/*
+ * flow [show [count] | on | off | flush | size entries]
+ */
+void flowCmd()
+{
+	char *next_tok = strtok(NULL, " \n");
+	char *arg;
+	int count = 0;
+
+	if ((next_tok == NULL) || !strcmp(next_tok, "show"))
+	{
+		if ((next_tok != NULL) && ((next_tok = strtok(NULL, " \n")) != NULL))
+			count = gAtoi(next_tok);
+		flowPrint(count);
+	} else if (!strcmp(next_tok, "on") || !strcmp(next_tok, "off"))
+		flowEnable(!strcmp(next_tok, "on"));
+	else if (!strcmp(next_tok, "flush"))
+	{
+		flowInvalidate();
+		flowInvalidateClasses();
+	} else if (!strcmp(next_tok, "size"))
+	{
+		if ((arg = strtok(NULL, " \n")) == NULL)
+			printf("[flowCmd]:: missing number of entries \n");
+		else
+			flowSetSize(gAtoi(arg));
+	} else
+		printf("[flowCmd]:: unknown command %s.. type help flow for usage \n", next_tok);
+}
+
+
+/*
+ * cpu [show]
+ * cpu set role[:index] cpulist [-spread | -share] [-fifo prio | -other]
+ * cpu clear role[:index]
+ */
+void cpuCmd()
+{
+	char *next_tok = strtok(NULL, " \n");
+	char *target, *cpulist, *colon;
+	int role, index = -1, spread = -1, policy = CPU_POLICY_DEFAULT, prio = 0;
+
+	if ((next_tok == NULL) || !strcmp(next_tok, "show"))
+	{
+		cpuPrint();
+		return;
+	}
+	if (strcmp(next_tok, "set") && strcmp(next_tok, "clear"))
+	{
+		printf("[cpuCmd]:: unknown command %s.. type help cpu for usage \n", next_tok);
+		return;
+	}
+	if ((target = strtok(NULL, " \n")) == NULL)
+	{
+		printf("[cpuCmd]:: missing role.. type help cpu for usage \n");
+		return;
+	}
+	if ((colon = strchr(target, ':')) != NULL)
+	{
+		*colon = '\0';
+		index = gAtoi(colon + 1);
+	}
+	if ((role = cpuRoleByName(target)) < 0)
+	{
+		printf("[cpuCmd]:: unknown role %s (rx, reactor, sched, worker, gnet, tx, control) \n", target);
+		return;
+	}
 
+	if (!strcmp(next_tok, "clear"))
+	{
+		cpuClearPlacement(role, index);
+		return;
+	}
+	if ((cpulist = strtok(NULL, " \n")) == NULL)
+	{
+		printf("[cpuCmd]:: missing CPU list.. type help cpu for usage \n");
+		return;
+	}
+	while ((next_tok = strtok(NULL, " \n")) != NULL)
+	{
+		if (!strcmp(next_tok, "-spread") || !strcmp(next_tok, "-share"))
+			spread = !strcmp(next_tok, "-spread");
+		else if (!strcmp(next_tok, "-other"))
+			policy = SCHED_OTHER;
+		else if (!strcmp(next_tok, "-fifo"))
+		{
+			policy = SCHED_FIFO;
+			if ((next_tok = strtok(NULL, " \n")) == NULL)
+			{
+				printf("[cpuCmd]:: missing FIFO priority \n");
+				return;
+			}
+			prio = gAtoi(next_tok);
+		} else
+		{
+			printf("[cpuCmd]:: unknown option %s.. type help cpu for usage \n", next_tok);
+			return;
+		}
+	}
+	cpuSetPlacement(role, index, cpulist, spread, policy, prio);
+}
+
+
+/*
+ * snapshot [show]
+ */
+void snapshotCmd()
+{
+	char *next_tok = strtok(NULL, " \n");
+
+	if ((next_tok != NULL) && strcmp(next_tok, "show"))
+	{
+		printf("[snapshotCmd]:: unknown command %s.. type help snapshot for usage \n", next_tok);
+		return;
+	}
+	printf("\n");
+	printRouteTableVersion(route_tbl);
+	printMTUTableVersion(MTU_tbl);
+	printPktCoreClassVersion(pcore);
+	epochPrint();
+	printf("\n");
+}
+
+
+/*
+ * qdisc [show [queue_name]]
+ * qdisc set queue_name disc [-param value ...]
+ */
+void qdiscCmd()
+{
+	char *next_tok = strtok(NULL, " \n");
+	char qname[MAX_DNAME_LEN], *param;
+
+	if ((next_tok == NULL) || !strcmp(next_tok, "show"))
+	{
+		if ((next_tok != NULL) && ((next_tok = strtok(NULL, " \n")) != NULL))
+			printPktCoreQdiscs(pcore, next_tok);
+		else
+			printPktCoreQdiscs(pcore, NULL);
+	} else if (!strcmp(next_tok, "set"))
+	{
+		if ((next_tok = strtok(NULL, " \n")) == NULL)
+		{
+			printf("[qdiscCmd]:: missing queue name.. type help qdisc for usage \n");
+			return;
+		}
+		strcpy(qname, next_tok);
+		if ((next_tok = strtok(NULL, " \n")) == NULL)
+		{
+			printf("[qdiscCmd]:: missing discipline.. type qdisc show for the disciplines \n");
+			return;
+		}
+		if (getCoreQueue(pcore, qname) == NULL)
+		{
+			printf("[qdiscCmd]:: no queue named %s \n", qname);
+			return;
+		}
+		if (modifyQueueDiscipline(pcore, qname, next_tok) == EXIT_FAILURE)
+		{
+			printf("[qdiscCmd]:: unknown discipline %s.. type qdisc show for the disciplines \n", next_tok);
+			return;
+		}
+		while ((param = strtok(NULL, " \n")) != NULL)
+		{
+			if ((param[0] != '-') || ((next_tok = strtok(NULL, " \n")) == NULL) ||
+			    (setPktCoreQdiscParam(pcore, qname, param + 1, atof(next_tok)) == EXIT_FAILURE))
+				printf("[qdiscCmd]:: bad parameter %s for the discipline of %s \n", param, qname);
+		}
+	} else
+		printf("[qdiscCmd]:: unknown action %s.. type help qdisc for usage \n", next_tok);
+}
+
+/*
+ * spolicy [show | activate policy_name]
+ */
+void spolicyCmd()
+{
+	char *next_tok = strtok(NULL, " \n");
+
+	if ((next_tok == NULL) || !strcmp(next_tok, "show"))
+		printPktCoreSched(pcore);
+	else if (!strcmp(next_tok, "activate"))
+	{
+		if ((next_tok = strtok(NULL, " \n")) == NULL)
+			printf("[spolicyCmd]:: missing policy name.. type spolicy show for the policies \n");
+		else if (setPktCoreSchedPolicy(pcore, next_tok) == EXIT_FAILURE)
+			printf("[spolicyCmd]:: unknown policy %s.. type spolicy show for the policies \n", next_tok);
+	} else
+		printf("[spolicyCmd]:: unknown action %s.. type help spolicy for usage \n", next_tok);
 }
@@ -0,0 +1,700 @@
+/*
+ * cpu.c (placement of the gRouter threads on CPUs and NUMA nodes)
+ *
+ * The placement of each role (and of single threads of a role) is kept
+ * here with the threads and queues registered so far (see cpu.h). A
+ * thread is placed by its kernel thread id, so a placement can be
+ * applied from the CLI to any registered thread; a thread that has
+ * gone (an interface taken down) is dropped when it cannot be found.
+ * The NUMA node of a CPU is read from sysfs and the rings of the queues
+ * are moved with mbind(); both are skipped on machines with one node.
+ */
+
+#define _GNU_SOURCE                   // cpu_set_t, sched_setaffinity
+#include <slack/err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include "cpu.h"
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED              1               // as in <numaif.h>; libnuma is not needed
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE                (1 << 1)
+#endif
+
+#define CPU_LONG_BITS               (8 * sizeof(unsigned long))
+
+
+// the placement of a role (index -1) or of one thread of a role
+typedef struct _cpuplace_t
+{
+	int role;                           // -1 if the slot is free (overrides)
+	int index;
+	cpu_set_t cpus;
+	int ncpus;                          // 0: no CPU set, the kernel places the threads
+	int spread;                         // thread i gets the i-th CPU of the set
+	int policy;                         // SCHED_OTHER, SCHED_FIFO or CPU_POLICY_DEFAULT
+	int prio;
+} cpuplace_t;
+
+
+static char *cpu_rolenames[CPU_MAX_ROLES] = {"rx", "reactor", "sched", "worker", "gnet", "tx", "control"};
+static int cpu_rolespread[CPU_MAX_ROLES] = {TRUE, TRUE, FALSE, TRUE, FALSE, TRUE, FALSE};
+
+static cpuplace_t cpu_roles[CPU_MAX_ROLES];
+static cpuplace_t cpu_overrides[CPU_MAX_OVERRIDES];
+static cputhread_t cpu_threads[CPU_MAX_THREADS];
+static cpuqueue_t cpu_queues[CPU_MAX_QUEUES];
+static cpu_set_t cpu_all;                               // the CPUs the router may use
+static int cpu_node[CPU_SETSIZE];
+static int cpu_nnodes = 1;
+static pthread_mutex_t cpu_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*
+ * find the NUMA node of every CPU (sysfs: cpu<n>/node<m>). without
+ * sysfs every CPU is on node 0.
+ */
+static void cpuReadNodes(void)
+{
+	char path[MAX_NAME_LEN];
+	struct dirent *d;
+	DIR *dir;
+	int cpu, node;
+
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+	{
+		cpu_node[cpu] = 0;
+		if (!CPU_ISSET(cpu, &cpu_all))
+			continue;
+		sprintf(path, "/sys/devices/system/cpu/cpu%d", cpu);
+		if ((dir = opendir(path)) == NULL)
+			continue;
+		while ((d = readdir(dir)) != NULL)
+			if ((sscanf(d->d_name, "node%d", &node) == 1) && (node >= 0) && (node < CPU_MAX_NODES))
+			{
+				cpu_node[cpu] = node;
+				if (node >= cpu_nnodes)
+					cpu_nnodes = node + 1;
+				break;
+			}
+		closedir(dir);
+	}
+}
+
+
+void cpuInit(void)
+{
+	int i;
+
+	if (sched_getaffinity(0, sizeof(cpu_set_t), &cpu_all) < 0)
+	{
+		CPU_ZERO(&cpu_all);
+		for (i = 0; (i < sysconf(_SC_NPROCESSORS_CONF)) && (i < CPU_SETSIZE); i++)
+			CPU_SET(i, &cpu_all);
+	}
+	cpuReadNodes();
+
+	for (i = 0; i < CPU_MAX_ROLES; i++)
+	{
+		bzero(&(cpu_roles[i]), sizeof(cpuplace_t));
+		cpu_roles[i].role = i;
+		cpu_roles[i].index = -1;
+		cpu_roles[i].spread = cpu_rolespread[i];
+		cpu_roles[i].policy = CPU_POLICY_DEFAULT;
+	}
+	for (i = 0; i < CPU_MAX_OVERRIDES; i++)
+		cpu_overrides[i].role = -1;
+	verbose(2, "[cpuInit]:: %d CPUs on %d NUMA nodes ", CPU_COUNT(&cpu_all), cpu_nnodes);
+}
+
+
+int cpuRoleByName(char *name)
+{
+	int i;
+
+	for (i = 0; i < CPU_MAX_ROLES; i++)
+		if (!strcmp(name, cpu_rolenames[i]))
+			return i;
+	return -1;
+}
+
+
+char *cpuRoleName(int role)
+{
+	return ((role >= 0) && (role < CPU_MAX_ROLES)) ? cpu_rolenames[role] : "?";
+}
+
+
+int cpuNode(int cpu)
+{
+	return ((cpu >= 0) && (cpu < CPU_SETSIZE)) ? cpu_node[cpu] : -1;
+}
+
+
+/*
+ * parse a CPU list such as "0-3,8,10-11" (as taskset -c takes it).
+ * returns the number of CPUs or -1 if the list is malformed.
+ */
+static int cpuParseList(char *list, cpu_set_t *cpus)
+{
+	char *p = list, *end;
+	long first, last, i;
+
+	CPU_ZERO(cpus);
+	while (*p != '\0')
+	{
+		first = last = strtol(p, &end, 10);
+		if ((end == p) || (first < 0))
+			return -1;
+		p = end;
+		if (*p == '-')
+		{
+			last = strtol(p + 1, &end, 10);
+			if ((end == p + 1) || (last < first))
+				return -1;
+			p = end;
+		}
+		if (last >= CPU_SETSIZE)
+			return -1;
+		for (i = first; i <= last; i++)
+			CPU_SET(i, cpus);
+		if (*p == ',')
+			p++;
+		else if (*p != '\0')
+			return -1;
+	}
+	return CPU_COUNT(cpus);
+}
+
+
+static char *cpuListString(char *buf, cpu_set_t *cpus)
+{
+	int cpu, last;
+	char *p = buf;
+
+	*p = '\0';
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+	{
+		if (!CPU_ISSET(cpu, cpus))
+			continue;
+		for (last = cpu; (last + 1 < CPU_SETSIZE) && CPU_ISSET(last + 1, cpus); last++)
+			;
+		p += sprintf(p, (p == buf) ? "%d" : ",%d", cpu);
+		if (last > cpu)
+			p += sprintf(p, "-%d", last);
+		cpu = last;
+	}
+	if (p == buf)
+		strcpy(buf, "-");
+	return buf;
+}
+
+
+static char *cpuPolicyString(char *buf, int policy, int prio)
+{
+	if (policy == SCHED_FIFO)
+		sprintf(buf, "fifo %d", prio);
+	else if (policy == SCHED_OTHER)
+		strcpy(buf, "other");
+	else if (policy == CPU_POLICY_DEFAULT)
+		strcpy(buf, "-");
+	else
+		sprintf(buf, "%d/%d", policy, prio);
+	return buf;
+}
+
+
+// the placement that applies to thread index of role
+static cpuplace_t *cpuPlacement(int role, int index)
+{
+	int i;
+
+	for (i = 0; i < CPU_MAX_OVERRIDES; i++)
+		if ((cpu_overrides[i].role == role) && (cpu_overrides[i].index == index))
+			return &(cpu_overrides[i]);
+	return &(cpu_roles[role]);
+}
+
+
+/*
+ * the CPUs thread index of role is to run on: the set of its placement
+ * or, if the placement spreads, the (index mod n)-th CPU of the set.
+ * returns the number of CPUs, 0 if the thread is not placed.
+ */
+static int cpuEffective(cpuplace_t *place, int index, cpu_set_t *cpus)
+{
+	int cpu, k;
+
+	CPU_ZERO(cpus);
+	if (place->ncpus == 0)
+		return 0;
+	if (!place->spread)
+	{
+		memcpy(cpus, &(place->cpus), sizeof(cpu_set_t));
+		return place->ncpus;
+	}
+
+	k = (index > 0) ? index % place->ncpus : 0;
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		if (CPU_ISSET(cpu, &(place->cpus)) && (k-- == 0))
+			break;
+	CPU_SET(cpu, cpus);
+	return 1;
+}
+
+
+static int cpuFirst(cpu_set_t *cpus)
+{
+	int cpu;
+
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		if (CPU_ISSET(cpu, cpus))
+			return cpu;
+	return -1;
+}
+
+
+// apply the placement to a registered thread (cpu_lock held)
+static void cpuApplyThread(cputhread_t *t)
+{
+	cpuplace_t *place = cpuPlacement(t->role, t->index);
+	struct sched_param param;
+	cpu_set_t cpus;
+	char tmpbuf[MAX_TMPBUF_LEN];
+
+	// a thread without a placement may use all the CPUs again
+	if (cpuEffective(place, t->index, &cpus) == 0)
+		memcpy(&cpus, &cpu_all, sizeof(cpu_set_t));
+	if (sched_setaffinity(t->tid, sizeof(cpu_set_t), &cpus) < 0)
+	{
+		if (errno == ESRCH)
+		{
+			verbose(2, "[cpuApplyThread]:: thread %s has exited ", t->name);
+			t->tid = 0;
+			return;
+		}
+		error("[cpuApplyThread]:: unable to place thread %s on CPUs %s ", t->name, cpuListString(tmpbuf, &cpus));
+	}
+
+	if (place->policy != CPU_POLICY_DEFAULT)
+	{
+		param.sched_priority = (place->policy == SCHED_FIFO) ? place->prio : 0;
+		if (sched_setscheduler(t->tid, place->policy, &param) < 0)
+			error("[cpuApplyThread]:: unable to set the policy of thread %s (%s) ", t->name,
+			      (errno == EPERM) ? "needs CAP_SYS_NICE" : "invalid");
+	}
+}
+
+
+/*
+ * move memory to a NUMA node; the pages already there stay, the rest
+ * are migrated and new pages are taken from the node when possible.
+ */
+static int cpuMoveMemory(void *addr, unsigned long len, int node)
+{
+#ifdef SYS_mbind
+	unsigned long mask[CPU_MAX_NODES / CPU_LONG_BITS];
+
+	bzero(mask, sizeof(mask));
+	mask[node / CPU_LONG_BITS] |= 1UL << (node % CPU_LONG_BITS);
+	return syscall(SYS_mbind, addr, len, MPOL_PREFERRED, mask, CPU_MAX_NODES + 1, MPOL_MF_MOVE);
+#else
+	return -1;
+#endif
+}
+
+
+// the node the first page of addr is on, -1 if unknown
+static int cpuMemoryNode(void *addr)
+{
+#ifdef SYS_move_pages
+	int status = -1;
+
+	if (syscall(SYS_move_pages, 0, 1, &addr, NULL, &status, 0) == 0)
+		return status;
+#endif
+	return -1;
+}
+
+
+// move the ring of a registered queue to the node of its consumer (cpu_lock held)
+static void cpuApplyQueue(cpuqueue_t *cq)
+{
+	cpu_set_t cpus;
+	int node;
+
+	if ((cq->q->ring == NULL) || (cpu_nnodes < 2) ||
+	    (cpuEffective(cpuPlacement(cq->role, cq->index), cq->index, &cpus) == 0))
+		return;
+
+	node = cpu_node[cpuFirst(&cpus)];
+	if (node == cq->node)
+		return;
+	if (cpuMoveMemory(cq->q->ring, cq->q->ring->memsize, node) < 0)
+		error("[cpuApplyQueue]:: unable to move queue %s to node %d ", cq->q->name, node);
+	else
+		cq->node = node;
+}
+
+
+// apply the placements to the threads and queues of role (thread index only if index >= 0)
+static void cpuApply(int role, int index)
+{
+	int i;
+
+	for (i = 0; i < CPU_MAX_THREADS; i++)
+		if ((cpu_threads[i].tid != 0) && (cpu_threads[i].role == role) &&
+		    ((index < 0) || (cpu_threads[i].index == index)))
+			cpuApplyThread(&(cpu_threads[i]));
+	for (i = 0; i < CPU_MAX_QUEUES; i++)
+		if ((cpu_queues[i].q != NULL) && (cpu_queues[i].role == role) &&
+		    ((index < 0) || (cpu_queues[i].index == index)))
+			cpuApplyQueue(&(cpu_queues[i]));
+}
+
+
+/*
+ * place role (or thread index of role if index >= 0) on the CPUs of
+ * cpulist. a role that spreads gives each thread one CPU of the list;
+ * with spread < 0 the role spreads (or shares) as it did before.
+ * policy is SCHED_FIFO (with prio), SCHED_OTHER or CPU_POLICY_DEFAULT.
+ */
+int cpuSetPlacement(int role, int index, char *cpulist, int spread, int policy, int prio)
+{
+	cpuplace_t *place = NULL;
+	cpu_set_t cpus, bad;
+	int ncpus, i;
+	char tmpbuf[MAX_TMPBUF_LEN];
+
+	if ((role < 0) || (role >= CPU_MAX_ROLES))
+		return EXIT_FAILURE;
+	if ((ncpus = cpuParseList(cpulist, &cpus)) <= 0)
+	{
+		error("[cpuSetPlacement]:: malformed CPU list %s ", cpulist);
+		return EXIT_FAILURE;
+	}
+	CPU_XOR(&bad, &cpus, &cpu_all);
+	CPU_AND(&bad, &bad, &cpus);
+	if (CPU_COUNT(&bad) > 0)
+	{
+		error("[cpuSetPlacement]:: CPUs %s are not available ", cpuListString(tmpbuf, &bad));
+		return EXIT_FAILURE;
+	}
+	if ((policy == SCHED_FIFO) &&
+	    ((prio < sched_get_priority_min(SCHED_FIFO)) || (prio > sched_get_priority_max(SCHED_FIFO))))
+	{
+		error("[cpuSetPlacement]:: FIFO priority must be between %d and %d ",
+		      sched_get_priority_min(SCHED_FIFO), sched_get_priority_max(SCHED_FIFO));
+		return EXIT_FAILURE;
+	}
+
+	pthread_mutex_lock(&cpu_lock);
+	if (index < 0)
+	{
+		place = &(cpu_roles[role]);
+		if (spread < 0)
+			spread = place->spread;
+	} else
+	{
+		if ((place = cpuPlacement(role, index)) == &(cpu_roles[role]))
+			for (i = 0, place = NULL; (i < CPU_MAX_OVERRIDES) && (place == NULL); i++)
+				if (cpu_overrides[i].role < 0)
+					place = &(cpu_overrides[i]);
+		if (place == NULL)
+		{
+			pthread_mutex_unlock(&cpu_lock);
+			error("[cpuSetPlacement]:: no more than %d threads can be placed on their own ", CPU_MAX_OVERRIDES);
+			return EXIT_FAILURE;
+		}
+		spread = FALSE;
+	}
+	place->role = role;
+	place->index = index;
+	memcpy(&(place->cpus), &cpus, sizeof(cpu_set_t));
+	place->ncpus = ncpus;
+	place->spread = spread;
+	place->policy = policy;
+	place->prio = prio;
+	cpuApply(role, index);
+	pthread_mutex_unlock(&cpu_lock);
+	return EXIT_SUCCESS;
+}
+
+
+/*
+ * clear the placement of role and of its threads (or of thread index
+ * only): they may run on every CPU again, with the normal policy if
+ * they had another.
+ */
+int cpuClearPlacement(int role, int index)
+{
+	cpuplace_t *place;
+	int i;
+
+	if ((role < 0) || (role >= CPU_MAX_ROLES))
+		return EXIT_FAILURE;
+
+	pthread_mutex_lock(&cpu_lock);
+	for (i = 0; i < CPU_MAX_OVERRIDES; i++)
+	{
+		place = &(cpu_overrides[i]);
+		if ((place->role != role) || ((index >= 0) && (place->index != index)))
+			continue;
+		// reset the thread first, then let the role apply to it
+		place->ncpus = 0;
+		if (place->policy != CPU_POLICY_DEFAULT)
+			place->policy = SCHED_OTHER;
+		cpuApply(role, place->index);
+		place->role = -1;
+		cpuApply(role, place->index);
+	}
+	if (index < 0)
+	{
+		place = &(cpu_roles[role]);
+		place->ncpus = 0;
+		place->spread = cpu_rolespread[role];
+		if (place->policy != CPU_POLICY_DEFAULT)
+			place->policy = SCHED_OTHER;
+		cpuApply(role, -1);
+		place->policy = CPU_POLICY_DEFAULT;
+	}
+	pthread_mutex_unlock(&cpu_lock);
+	return EXIT_SUCCESS;
+}
+
+
+/*
+ * called by a thread when it starts: record it and place it. a thread
+ * that takes the role and index of an earlier one (an interface that
+ * was restarted) takes its slot.
+ */
+void cpuThreadRegister(int role, int index, char *name)
+{
+	pid_t tid = syscall(SYS_gettid);
+	int i, slot = -1;
+
+	pthread_mutex_lock(&cpu_lock);
+	for (i = 0; i < CPU_MAX_THREADS; i++)
+	{
+		if ((cpu_threads[i].tid != 0) && (cpu_threads[i].role == role) && (cpu_threads[i].index == index))
+		{
+			slot = i;
+			break;
+		}
+		if ((slot < 0) && (cpu_threads[i].tid == 0))
+			slot = i;
+	}
+	if (slot < 0)
+	{
+		pthread_mutex_unlock(&cpu_lock);
+		verbose(1, "[cpuThreadRegister]:: no slot left for thread %s, not placed ", name);
+		return;
+	}
+	strncpy(cpu_threads[slot].name, name, CPU_NAME_LEN - 1);
+	cpu_threads[slot].name[CPU_NAME_LEN - 1] = '\0';
+	cpu_threads[slot].role = role;
+	cpu_threads[slot].index = index;
+	cpu_threads[slot].tid = tid;
+	cpuApplyThread(&(cpu_threads[slot]));
+	pthread_mutex_unlock(&cpu_lock);
+}
+
+
+// record that q is drained by thread index of role and move it to its node
+void cpuQueueRegister(simplequeue_t *q, int role, int index)
+{
+	int i, slot = -1;
+
+	pthread_mutex_lock(&cpu_lock);
+	for (i = 0; i < CPU_MAX_QUEUES; i++)
+	{
+		if (cpu_queues[i].q == q)
+		{
+			slot = i;
+			break;
+		}
+		if ((slot < 0) && (cpu_queues[i].q == NULL))
+			slot = i;
+	}
+	if (slot < 0)
+	{
+		pthread_mutex_unlock(&cpu_lock);
+		verbose(1, "[cpuQueueRegister]:: no slot left for queue %s, not placed ", q->name);
+		return;
+	}
+	cpu_queues[slot].q = q;
+	cpu_queues[slot].role = role;
+	cpu_queues[slot].index = index;
+	cpu_queues[slot].node = -1;
+	cpuApplyQueue(&(cpu_queues[slot]));
+	pthread_mutex_unlock(&cpu_lock);
+}
+
+
+void cpuQueueUnregister(simplequeue_t *q)
+{
+	int i;
+
+	pthread_mutex_lock(&cpu_lock);
+	for (i = 0; i < CPU_MAX_QUEUES; i++)
+		if (cpu_queues[i].q == q)
+			cpu_queues[i].q = NULL;
+	pthread_mutex_unlock(&cpu_lock);
+}
+
+
+// the CPU a thread last ran on (field 39 of /proc/<pid>/task/<tid>/stat), -1 if unknown
+static int cpuThreadLastCPU(pid_t tid)
+{
+	char path[MAX_NAME_LEN], line[1024], *p;
+	FILE *fp;
+	int field, cpu = -1;
+
+	sprintf(path, "/proc/%d/task/%d/stat", (int)getpid(), (int)tid);
+	if ((fp = fopen(path, "r")) == NULL)
+		return -1;
+	if ((fgets(line, sizeof(line), fp) != NULL) && ((p = strrchr(line, ')')) != NULL))
+	{
+		// the fields after the command start with field 3
+		for (field = 2, p = strtok(p + 1, " "); p != NULL; p = strtok(NULL, " "))
+			if (++field == 39)
+			{
+				cpu = atoi(p);
+				break;
+			}
+	}
+	fclose(fp);
+	return cpu;
+}
+
+
+/*
+ * the placement in effect for thread index of role, e.g. "2 (node 0)",
+ * or "-" if there is no such thread.
+ */
+char *cpuThreadPlacement(char *buf, int role, int index)
+{
+	cpu_set_t cpus;
+	int i;
+
+	strcpy(buf, "-");
+	pthread_mutex_lock(&cpu_lock);
+	for (i = 0; i < CPU_MAX_THREADS; i++)
+		if ((cpu_threads[i].tid != 0) && (cpu_threads[i].role == role) && (cpu_threads[i].index == index))
+		{
+			if (sched_getaffinity(cpu_threads[i].tid, sizeof(cpu_set_t), &cpus) == 0)
+			{
+				cpuListString(buf, &cpus);
+				if (cpu_nnodes > 1)
+					sprintf(buf + strlen(buf), " (node %d)", cpu_node[cpuFirst(&cpus)]);
+			}
+			break;
+		}
+	pthread_mutex_unlock(&cpu_lock);
+	return buf;
+}
+
+
+static void cpuPrintPlace(cpuplace_t *place)
+{
+	char name[CPU_NAME_LEN], tmpbuf[MAX_TMPBUF_LEN], pbuf[MAX_TMPBUF_LEN];
+
+	if (place->index < 0)
+		strcpy(name, cpu_rolenames[place->role]);
+	else
+		sprintf(name, "%s:%d", cpu_rolenames[place->role], place->index);
+	printf("%-16s%-16s%s\t%s\n", name, (place->ncpus > 0) ? cpuListString(tmpbuf, &(place->cpus)) : "all",
+	       ((place->index < 0) && place->spread) ? "spread" : "share",
+	       cpuPolicyString(pbuf, place->policy, place->prio));
+}
+
+
+/*
+ * print the placements, the registered threads with the placement in
+ * effect (as the kernel reports it) and the queues with their node
+ */
+void cpuPrint(void)
+{
+	struct sched_param param;
+	cpu_set_t cpus;
+	cputhread_t *t;
+	cpuqueue_t *cq;
+	int i, node, policy, last;
+	char tmpbuf[MAX_TMPBUF_LEN], pbuf[MAX_TMPBUF_LEN];
+
+	printf("\n------------------------------------------------------------------\n");
+	printf("      T H R E A D  P L A C E M E N T \n");
+	printf("------------------------------------------------------------------\n");
+	printf("%d CPUs available (%s) on %d NUMA node%s\n", CPU_COUNT(&cpu_all), cpuListString(tmpbuf, &cpu_all),
+	       cpu_nnodes, (cpu_nnodes > 1) ? "s" : "");
+	for (node = 0; (cpu_nnodes > 1) && (node < cpu_nnodes); node++)
+	{
+		CPU_ZERO(&cpus);
+		for (i = 0; i < CPU_SETSIZE; i++)
+			if (CPU_ISSET(i, &cpu_all) && (cpu_node[i] == node))
+				CPU_SET(i, &cpus);
+		printf("  node %d: CPUs %s\n", node, cpuListString(tmpbuf, &cpus));
+	}
+
+	pthread_mutex_lock(&cpu_lock);
+	printf("\nRole\t\tCPUs\t\tMode\tPolicy\n");
+	for (i = 0; i < CPU_MAX_ROLES; i++)
+		cpuPrintPlace(&(cpu_roles[i]));
+	for (i = 0; i < CPU_MAX_OVERRIDES; i++)
+		if (cpu_overrides[i].role >= 0)
+			cpuPrintPlace(&(cpu_overrides[i]));
+
+	printf("\nThread\t\tTID\tRole\t\tCPUs\t\tLast CPU  Node\tPolicy\n");
+	for (i = 0; i < CPU_MAX_THREADS; i++)
+	{
+		t = &(cpu_threads[i]);
+		if (t->tid == 0)
+			continue;
+		if (sched_getaffinity(t->tid, sizeof(cpu_set_t), &cpus) < 0)
+		{
+			t->tid = 0;                        // the thread has exited
+			continue;
+		}
+		policy = sched_getscheduler(t->tid);
+		if ((policy < 0) || (sched_getparam(t->tid, &param) < 0))
+			param.sched_priority = 0;
+		last = cpuThreadLastCPU(t->tid);
+		sprintf(pbuf, "%s:%d", cpu_rolenames[t->role], t->index);
+		printf("%-16s%d\t%-16s%-16s", t->name, (int)t->tid, pbuf, cpuListString(tmpbuf, &cpus));
+		if (last >= 0)
+			printf("%-10d%d\t", last, cpu_node[last]);
+		else
+			printf("-         -\t");
+		printf("%s\n", (policy == SCHED_OTHER) ? "other" : cpuPolicyString(pbuf, policy, param.sched_priority));
+	}
+
+	printf("\nQueue\t\t\tDrained by\tSlots\tNode\n");
+	for (i = 0; i < CPU_MAX_QUEUES; i++)
+	{
+		cq = &(cpu_queues[i]);
+		if (cq->q == NULL)
+			continue;
+		sprintf(pbuf, "%s:%d", cpu_rolenames[cq->role], cq->index);
+		printf("%-24s%-16s", cq->q->name, pbuf);
+		if (cq->q->ring != NULL)
+		{
+			printf("%d\t", ringCapacity(cq->q->ring));
+			if ((node = cpuMemoryNode(cq->q->ring)) >= 0)
+				printf("%d\n", node);
+			else
+				printf("-\n");
+		} else
+			printf("-\t-\n");
+	}
+	pthread_mutex_unlock(&cpu_lock);
+	printf("------------------------------------------------------------------\n");
+}
@@ -0,0 +1,271 @@
+/*
+ * epoch.c (epoch based reclamation of the tables read without a lock)
+ *
+ * A global epoch is advanced whenever an object is retired. A reader
+ * records the epoch it saw when it entered its outermost section and
+ * clears the record when it leaves. An object retired in epoch e may
+ * be freed once every record is either clear or later than e: a
+ * reader that entered after the retirement can only have seen the
+ * snapshot that replaced the object.
+ *
+ * Readers take a record the first time they enter a section. Threads
+ * beyond EPOCH_MAX_THREADS share a count of readers instead, and while
+ * one of them is inside a section nothing is freed. A record held by a
+ * thread that has gone (cancelled inside a section) is found when it
+ * holds up the reclamation and is cleared.
+ */
+
+#include <slack/err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include "epoch.h"
+
+
+static epoch_thread_t epoch_threads[EPOCH_MAX_THREADS];
+static epoch_thread_t epoch_shared;             // marks the threads without a record
+static volatile unsigned long epoch_global = 1;
+static volatile int epoch_nshared;              // of them, inside a section
+
+static pthread_mutex_t epoch_lock = PTHREAD_MUTEX_INITIALIZER;
+static epoch_retired_t *epoch_head, *epoch_tail; // retired, oldest first
+static unsigned long epoch_nretired, epoch_nfreed;
+static int epoch_npending;
+
+static __thread epoch_thread_t *epoch_self;
+static __thread int epoch_nest;
+
+
+// TRUE if thread tid of this process is gone
+static int epochThreadGone(pid_t tid)
+{
+	return (syscall(SYS_tgkill, getpid(), tid, 0) < 0) && (errno == ESRCH);
+}
+
+
+static void epochRegister(void)
+{
+	pid_t tid = syscall(SYS_gettid);
+	epoch_thread_t *rec;
+	int i, pass;
+
+	// the second pass takes back the records of the threads that have gone
+	for (pass = 0; pass < 2; pass++)
+		for (i = 0; i < EPOCH_MAX_THREADS; i++)
+		{
+			rec = &(epoch_threads[i]);
+			if ((pass == 1) && rec->used && epochThreadGone(rec->tid))
+			{
+				rec->epoch = 0;
+				__sync_bool_compare_and_swap(&(rec->used), 1, 0);
+			}
+			if (!rec->used &&
+			    __sync_bool_compare_and_swap(&(rec->used), 0, 1))
+			{
+				rec->tid = tid;
+				rec->epoch = 0;
+				epoch_self = rec;
+				return;
+			}
+		}
+	verbose(1, "[epochRegister]:: more than %d reader threads, "
+		"thread %d shares a count ", EPOCH_MAX_THREADS, (int)tid);
+	epoch_self = &epoch_shared;
+}
+
+
+/*
+ * enter a read section: the snapshots loaded from here on stay valid
+ * until the matching epochExit(). the store to the record must be
+ * visible before the snapshot pointers are loaded, hence the barrier.
+ */
+void epochEnter(void)
+{
+	if (epoch_nest++ > 0)
+		return;
+	if (epoch_self == NULL)
+		epochRegister();
+
+	if (epoch_self == &epoch_shared)
+		__sync_fetch_and_add(&epoch_nshared, 1);
+	else
+	{
+		epoch_self->epoch = epoch_global;
+		__sync_synchronize();
+	}
+}
+
+
+void epochExit(void)
+{
+	if (--epoch_nest > 0)
+		return;
+
+	if (epoch_self == &epoch_shared)
+		__sync_fetch_and_sub(&epoch_nshared, 1);
+	else
+	{
+		// the loads of the section are done before the record is cleared
+		__sync_synchronize();
+		epoch_self->epoch = 0;
+	}
+}
+
+
+/*
+ * publish obj at *ptr (everything written to obj before is visible to
+ * the readers that load the pointer). returns the object it replaces.
+ */
+void *epochPublish(void * volatile *ptr, void *obj)
+{
+	__sync_synchronize();
+	return __sync_lock_test_and_set(ptr, obj);
+}
+
+
+// the oldest epoch a reader other than skip is still in, ~0 if none
+// (epoch_lock held)
+static unsigned long epochOldest(epoch_thread_t *skip)
+{
+	unsigned long oldest = ~0UL, e;
+	epoch_thread_t *rec;
+
+	if (epoch_nshared > 0)
+		return 0;
+	for (rec = epoch_threads; rec < epoch_threads + EPOCH_MAX_THREADS; rec++)
+		if (rec->used && (rec != skip) &&
+		    ((e = rec->epoch) != 0) && (e < oldest))
+		{
+			if ((e + 1 < epoch_global) && epochThreadGone(rec->tid))
+			{
+				verbose(1, "[epochOldest]:: thread %d left a section "
+					"open, cleared ", (int)rec->tid);
+				rec->epoch = 0;
+				continue;
+			}
+			oldest = e;
+		}
+	return oldest;
+}
+
+
+// free the retired objects no reader can see (epoch_lock held)
+static int epochReclaimLocked(void)
+{
+	unsigned long oldest = epochOldest(NULL);
+	epoch_retired_t *r;
+	int nfreed = 0;
+
+	while ((epoch_head != NULL) && (epoch_head->epoch < oldest))
+	{
+		r = epoch_head;
+		if ((epoch_head = r->next) == NULL)
+			epoch_tail = NULL;
+		r->release(r->obj);
+		free(r);
+		nfreed++;
+	}
+	epoch_nfreed += nfreed;
+	epoch_npending -= nfreed;
+	return nfreed;
+}
+
+
+/*
+ * retire obj (already replaced by epochPublish): release(obj) is called
+ * once the readers are done with it, from this or a later call of
+ * epochRetire(), epochReclaim() or epochSynchronize(). never waits.
+ */
+void epochRetire(void (*release)(void *), void *obj)
+{
+	epoch_retired_t *r;
+
+	if (obj == NULL)
+		return;
+	if ((r = malloc(sizeof(epoch_retired_t))) == NULL)
+	{
+		// no memory to defer it: wait for the readers instead
+		epochSynchronize();
+		release(obj);
+		return;
+	}
+	r->release = release;
+	r->obj = obj;
+	r->next = NULL;
+
+	pthread_mutex_lock(&epoch_lock);
+	r->epoch = __sync_fetch_and_add(&epoch_global, 1);
+	if (epoch_tail != NULL)
+		epoch_tail->next = r;
+	else
+		epoch_head = r;
+	epoch_tail = r;
+	epoch_nretired++;
+	epoch_npending++;
+	epochReclaimLocked();
+	pthread_mutex_unlock(&epoch_lock);
+}
+
+
+/*
+ * free what can be freed; called by the CLI after each command so that
+ * the last snapshots retired do not wait for the next change.
+ * returns the number of objects freed.
+ */
+int epochReclaim(void)
+{
+	int nfreed;
+
+	if (epoch_head == NULL)
+		return 0;
+	pthread_mutex_lock(&epoch_lock);
+	nfreed = epochReclaimLocked();
+	pthread_mutex_unlock(&epoch_lock);
+	return nfreed;
+}
+
+
+/*
+ * wait until every reader that may have seen what was unpublished
+ * before the call has left its section (a grace period). a section of
+ * the caller itself is not waited for: the caller may be a signal
+ * handler that interrupted a packet thread.
+ */
+void epochSynchronize(void)
+{
+	unsigned long e;
+
+	pthread_mutex_lock(&epoch_lock);
+	e = __sync_fetch_and_add(&epoch_global, 1);
+	while (epochOldest(epoch_self) <= e)
+	{
+		pthread_mutex_unlock(&epoch_lock);
+		usleep(50);
+		pthread_mutex_lock(&epoch_lock);
+	}
+	epochReclaimLocked();
+	pthread_mutex_unlock(&epoch_lock);
+}
+
+
+void epochPrint(void)
+{
+	int i, nthreads = 0, nactive = 0;
+
+	pthread_mutex_lock(&epoch_lock);
+	for (i = 0; i < EPOCH_MAX_THREADS; i++)
+		if (epoch_threads[i].used)
+		{
+			nthreads++;
+			if (epoch_threads[i].epoch != 0)
+				nactive++;
+		}
+	printf("Epoch %lu, %d reader threads, %d in a section (%d sharing a count) \n",
+	       epoch_global, nthreads, nactive + epoch_nshared, epoch_nshared);
+	printf("Retired %lu, freed %lu, waiting for readers %d \n",
+	       epoch_nretired, epoch_nfreed, epoch_npending);
+	pthread_mutex_unlock(&epoch_lock);
+}
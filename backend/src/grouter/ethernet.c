@@ -12,11 +12,18 @@
 #include "filter.h"
 #include "protocols.h"
 #include "message.h"
+#include "packetpool.h"
 #include "gnet.h"
+#include "ethernet.h"
 #include "arp.h"
 #include "ip.h"
+#include "trace.h"
+#include "stats.h"
+#include "cpu.h"
+#include "epoch.h"
 #include <netinet/in.h>
 #include <stdlib.h>
+#include <string.h>
 
 
 extern pktcore_t *pcore;
@@ -26,20 +33,43 @@ extern filtertab_t *filter;
 
 extern router_config rconfig;
 
-int findPacketSize(pkt_data_t *pkt)
+/*
+ * bytes of the frame of a packet as its headers give them (a received
+ * frame may carry padding behind the packet)
+ */
+int findPacketSize(gpacket_t *pkt)
 {
 	ip_packet_t *ip_pkt;
 
-	if (pkt->header.prot == htons(IP_PROTOCOL))
+	if (GPKT_ETH(pkt)->header.prot == htons(IP_PROTOCOL))
 	{
-		ip_pkt = (ip_packet_t *) pkt->data;
-		return (14 + ntohs(ip_pkt->ip_pkt_len));
-	} else if (pkt->header.prot == htons(ARP_PROTOCOL))
+		ip_pkt = (ip_packet_t *)GPKT_PAYLOAD(pkt);
+		return (ETHER_HEADER_LEN + ntohs(ip_pkt->ip_pkt_len));
+	} else if (GPKT_ETH(pkt)->header.prot == htons(ARP_PROTOCOL))
 		return 42;
 	// above assumes IP and ARP; we can compute this length by
 	// reading the address lengths from the packet.
 	else
-		return sizeof(pkt_data_t);
+		return gpktLength(pkt);
+}
+
+
+/*
+ * last touches on an outgoing frame: ARP packets carry the address of
+ * the interface they leave from.
+ */
+static void prepareEthernetFrame(interface_t *iface, gpacket_t *inpkt)
+{
+	arp_packet_t *apkt;
+	char tmpbuf[MAX_TMPBUF_LEN];
+
+	/* send IP packet or ARP reply */
+	if (GPKT_ETH(inpkt)->header.prot == htons(ARP_PROTOCOL))
+	{
+		apkt = (arp_packet_t *)GPKT_PAYLOAD(inpkt);
+		COPY_MAC(apkt->src_hw_addr, iface->mac_addr);
+		COPY_IP(apkt->src_ip_addr, gHtonl(tmpbuf, iface->ip_addr));
+	}
 }
 
 
@@ -47,27 +77,18 @@ void *toEthernetDev(void *arg)
 {
 	gpacket_t *inpkt = (gpacket_t *)arg;
 	interface_t *iface;
-	arp_packet_t *apkt;
-	char tmpbuf[MAX_TMPBUF_LEN];
-	int pkt_size;
 
-	verbose(2, "[toEthernetDev]:: entering the function.. ");
+	VERBOSE(2, "[toEthernetDev]:: entering the function.. ");
 	// find the outgoing interface and device...
 	if ((iface = findInterface(inpkt->frame.dst_interface)) != NULL)
 	{
-		/* send IP packet or ARP reply */
-		if (inpkt->data.header.prot == htons(ARP_PROTOCOL))
-		{
-			apkt = (arp_packet_t *) inpkt->data.data;
-			COPY_MAC(apkt->src_hw_addr, iface->mac_addr);
-			COPY_IP(apkt->src_ip_addr, gHtonl(tmpbuf, iface->ip_addr));
-		}
-		pkt_size = findPacketSize(&(inpkt->data));
-		verbose(2, "[toEthernetDev]:: vpl_sendto called for interface %d..%d bytes written ", iface->interface_id, pkt_size);
-		vpl_sendto(iface->vpl_data, &(inpkt->data), pkt_size);
-		free(inpkt);          // finally destroy the memory allocated to the packet..
-	} else
-		error("[toEthernetDev]:: ERROR!! Could not find outgoing interface ...");
+		VERBOSE(2, "[toEthernetDev]:: sending %d bytes on interface %d ", findPacketSize(inpkt), iface->interface_id);
+		toEthernetDevBatch(iface, &inpkt, 1);
+		return arg;
+	}
+	error("[toEthernetDev]:: ERROR!! Could not find outgoing interface ...");
+
+	releasePacket(inpkt);          // finally drop the reference held by the output queue..
 
 	// this is just a dummy return -- return value not used.
 	return arg;
@@ -75,66 +96,243 @@ void *toEthernetDev(void *arg)
 
 
 /*
- * TODO: Some form of conformance check so that only packets
- * destined to the particular Ethernet protocol are being captured
- * by the handler... right now.. this might capture other packets as well.
+ * send a batch of packets out of one interface with a single sendmmsg().
+ * the frame of a packet is gathered from its buffer and its segments.
+ * like toEthernetDev, drops the references held by the output queue.
  */
-void* fromEthernetDev(void *arg)
+void toEthernetDevBatch(interface_t *iface, gpacket_t **pkts, int npkts)
+{
+	struct iovec iovs[VPL_MAX_BATCH * VPL_MAX_IOV];
+	int niovs[VPL_MAX_BATCH];
+	int i, n, sent;
+
+	for (i = 0, n = 0; i < npkts; i++)
+	{
+		prepareEthernetFrame(iface, pkts[i]);
+		niovs[i] = gpktIovec(pkts[i], iovs + n, findPacketSize(pkts[i]));
+		n += niovs[i];
+	}
+
+	if ((sent = vpl_sendmmsg(iface->vpl_data, iovs, niovs, npkts)) < npkts)
+		VERBOSE(2, "[toEthernetDevBatch]:: only %d of %d packets sent on interface %d ",
+			sent, npkts, iface->interface_id);
+
+	for (i = 0; i < npkts; i++)
+		releasePacket(pkts[i]);
+}
+
+
+/*
+ * handle a frame received on an Ethernet interface: drop it unless it
+ * is for this router, then filter, classify and queue it.
+ */
+static void ethernetIngress(interface_t *iface, gpacket_t *in_pkt)
 {
-	interface_t *iface = (interface_t *) arg;
-	interface_array_t *iarr = (interface_array_t *)iface->iarray;
 	uchar bcast_mac[] = MAC_BCAST_ADDR;
 	char *pkttag;
-	gpacket_t *in_pkt;
 
-	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);		// die as soon as cancelled
-	while (1)
+	// check whether the incoming packet is a layer 2 broadcast or
+	// meant for this node... otherwise should be thrown..
+	// TODO: fix for promiscuous mode packet snooping.
+	if ((COMPARE_MAC(GPKT_ETH(in_pkt)->header.dst, iface->mac_addr) != 0) &&
+		(COMPARE_MAC(GPKT_ETH(in_pkt)->header.dst, bcast_mac) != 0))
+	{
+		verbose(1, "[fromEthernetDev]:: Packet dropped .. not for this router!? ");
+		STATS_DROP(1);
+		releasePacket(in_pkt);
+		return;
+	}
+
+	TRACE(TRACE_RX, iface->interface_id, findPacketSize(in_pkt), 0);
+	STATS_COUNT(1, findPacketSize(in_pkt));
+
+	// copy fields into the message from the packet..
+	in_pkt->frame.src_interface = iface->interface_id;
+	COPY_MAC(in_pkt->frame.src_hw_addr, iface->mac_addr);
+	COPY_IP(in_pkt->frame.src_ip_addr, iface->ip_addr);
+
+	// one classification pass gives the filter verdict and the packet
+	// tag.. if the packet should be filtered.. then drop. at the very
+	// minimum, we get the "default" tag!
+	epochEnter();
+	if (classifyPacket(pcore, in_pkt, &pkttag) == FALSE)
 	{
-		verbose(2, "[fromEthernetDev]:: Receiving a packet ...");
-		if ((in_pkt = (gpacket_t *)malloc(sizeof(gpacket_t))) == NULL)
+		epochExit();
+		VERBOSE(2, "[fromEthernetDev]:: Packet filtered..!");
+		TRACE(TRACE_DROP, TRACE_DROP_FILTER, iface->interface_id, 0);
+		STATS_DROP(1);
+		releasePacket(in_pkt);
+		return;
+	}
+	VERBOSE(2, "[fromEthernetDev]:: Packet tagged as %s ", pkttag);
+	if (PktCoreEnqueue(pcore, in_pkt, pkttag) == EXIT_FAILURE)
+		STATS_DROP(1);
+	epochExit();
+}
+
+
+/*
+ * top up the packets allocated for the next receive to nbatch; with a
+ * jumbo MTU each of them gets a spare jumbo buffer as well
+ */
+static int fillRxBatch(interface_t *iface, rxbatch_t *rx, int nbatch)
+{
+	int i;
+
+	for (; rx->nalloc < nbatch; rx->nalloc++)
+		if ((rx->pkts[rx->nalloc] = newPacket()) == NULL)
 		{
-			fatal("[fromEthernetDev]:: unable to allocate memory for packet.. ");
-			return NULL;
+			fatal("[fillRxBatch]:: unable to allocate memory for packet.. ");
+			return EXIT_FAILURE;
+		}
+	for (i = 0; (i < nbatch) && (iface->device_mtu > DEFAULT_MTU); i++)
+		if ((rx->spares[i] == NULL) && ((rx->spares[i] = newPacketSize(MAX_FRAME_LEN)) == NULL))
+		{
+			fatal("[fillRxBatch]:: unable to allocate memory for packet.. ");
+			return EXIT_FAILURE;
 		}
+	return EXIT_SUCCESS;
+}
 
-		bzero(in_pkt, sizeof(gpacket_t));
-		vpl_recvfrom(iface->vpl_data, &(in_pkt->data), sizeof(pkt_data_t));
-		pthread_testcancel();
-		// check whether the incoming packet is a layer 2 broadcast or
-		// meant for this node... otherwise should be thrown..
-		// TODO: fix for promiscuous mode packet snooping.
-		if ((COMPARE_MAC(in_pkt->data.header.dst, iface->mac_addr) != 0) &&
-			(COMPARE_MAC(in_pkt->data.header.dst, bcast_mac) != 0))
+
+/*
+ * point the receive at the buffers of the batch: a frame fills the
+ * buffer of its packet and, with a jumbo MTU, goes on in the spare
+ * buffer. returns the buffers per frame.
+ */
+static int setRxIovec(interface_t *iface, rxbatch_t *rx, int nbatch, struct iovec *iovs)
+{
+	int niov = (iface->device_mtu > DEFAULT_MTU) ? 2 : 1, i;
+
+	for (i = 0; i < nbatch; i++)
+	{
+		iovs[i * niov].iov_base = rx->pkts[i]->data;
+		iovs[i * niov].iov_len = GPKT_ROOM(rx->pkts[i]);
+		if (niov == 2)
 		{
-			verbose(1, "[fromEthernetDev]:: Packet dropped .. not for this router!? ");
-			free(in_pkt);
-			continue;
+			iovs[i * niov + 1].iov_base = rx->spares[i]->data;
+			iovs[i * niov + 1].iov_len = GPKT_ROOM(rx->spares[i]);
 		}
+	}
+	return niov;
+}
+
 
-		// copy fields into the message from the packet..
-		in_pkt->frame.src_interface = iface->interface_id;
-		COPY_MAC(in_pkt->frame.src_hw_addr, iface->mac_addr);
-		COPY_IP(in_pkt->frame.src_ip_addr, iface->ip_addr);
+/*
+ * hand the n frames of lens bytes filled by a receive to the router and
+ * keep the packets that were not filled for the next receive. a frame
+ * up to RX_COPYBREAK bytes is copied to a small buffer and its packet
+ * is kept as well; the rest of a frame that did not fit in its packet
+ * is chained to it in the spare buffer of its slot. the frames of a
+ * batch are classified against the same configuration snapshot.
+ */
+static void ingressRxBatch(interface_t *iface, rxbatch_t *rx, int *lens, int n)
+{
+	gpacket_t *pkt, *small;
+	int i, kept = 0;
 
-		// check for filtering.. if the it should be filtered.. then drop
-		if (filteredPacket(filter, in_pkt))
+	epochEnter();
+	for (i = 0; i < n; i++)
+	{
+		pkt = rx->pkts[i];
+		if ((lens[i] <= RX_COPYBREAK) && ((small = newPacketSize(lens[i])) != NULL))
 		{
-			verbose(2, "[fromEthernetDev]:: Packet filtered..!");
-			free(in_pkt);
-			continue;   // skip the rest of the loop
+			memcpy(small->data, pkt->data, lens[i]);
+			small->len = lens[i];
+			rx->pkts[kept++] = pkt;
+			ethernetIngress(iface, small);
+			continue;
 		}
+		if (lens[i] > GPKT_ROOM(pkt))
+		{
+			pkt->len = GPKT_ROOM(pkt);
+			gpktAddSeg(pkt, rx->spares[i], rx->spares[i]->data, lens[i] - pkt->len);
+			rx->spares[i] = NULL;
+		} else
+			pkt->len = lens[i];
+		ethernetIngress(iface, pkt);
+	}
+	epochExit();
+	for (i = max(n, 0); i < rx->nalloc; i++)
+		rx->pkts[kept++] = rx->pkts[i];
+	rx->nalloc = kept;
+}
+
+
+static int getRxBatchSize(void)
+{
+	int nbatch = rconfig.iobatch;
+
+	if (nbatch < 1)
+		nbatch = 1;
+	if (nbatch > VPL_MAX_BATCH)
+		nbatch = VPL_MAX_BATCH;
+	return nbatch;
+}
 
-		// invoke the packet core classifier to get the packet tag
-		// at the very minimum, we get the "default" tag!
-		verbose(2, "[fromEthernetDev]:: Calling the classifier..");
-		pkttag = tagPacket(pcore, in_pkt);
-		verbose(2, "[fromEthernetDev]:: Packet tagged as %s ", pkttag);
-		if (!strcmp(rconfig.schedpolicy, "rr"))
-			roundRobinQueuer(pcore, in_pkt, sizeof(gpacket_t), pkttag);
-		else if (!strcmp(rconfig.schedpolicy, "wfq"))
-			weightedFairQueuer(pcore, in_pkt, sizeof(gpacket_t), pkttag);
-		else
-			fatal("[fromEthernetDev]:: Unknown queuer specification! %s \n", rconfig.schedpolicy);
+
+/*
+ * TODO: Some form of conformance check so that only packets
+ * destined to the particular Ethernet protocol are being captured
+ * by the handler... right now.. this might capture other packets as well.
+ *
+ * A recvmmsg() call fills up to io-batch packets at once (set io-batch).
+ * The packets are allocated before the call; the ones left unfilled are
+ * kept for the next call.
+ */
+void* fromEthernetDev(void *arg)
+{
+	interface_t *iface = (interface_t *) arg;
+	rxbatch_t rx;
+	struct iovec iovs[VPL_MAX_BATCH * 2];
+	int lens[VPL_MAX_BATCH];
+	char tname[STATS_NAME_LEN];
+	int n, niov, nbatch;
+
+	bzero(&rx, sizeof(rxbatch_t));
+	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);		// die as soon as cancelled
+	sprintf(tname, "rx %d", iface->interface_id);
+	statsThreadRegister(tname);
+	cpuThreadRegister(CPU_ROLE_RX, iface->interface_id, tname);
+	while (1)
+	{
+		nbatch = getRxBatchSize();
+		if (fillRxBatch(iface, &rx, nbatch) == EXIT_FAILURE)
+			return NULL;
+		niov = setRxIovec(iface, &rx, nbatch, iovs);
+
+		VERBOSE(2, "[fromEthernetDev]:: Receiving a packet ...");
+		n = vpl_recvmmsg(iface->vpl_data, iovs, niov, lens, nbatch);
+		pthread_testcancel();
+
+		ingressRxBatch(iface, &rx, lens, n);
 	}
 }
 
+
+/*
+ * Reactor mode (see reactor.c): read the frames waiting on the interface
+ * without blocking, at most budget batches of io-batch frames. Returns
+ * TRUE if the budget was used up (more frames may be waiting) and FALSE
+ * once the socket is drained or failed.
+ */
+int pollEthernetDev(interface_t *iface, rxbatch_t *rx, int budget)
+{
+	struct iovec iovs[VPL_MAX_BATCH * 2];
+	int lens[VPL_MAX_BATCH];
+	int n, niov, nbatch;
+
+	for (; budget > 0; budget--)
+	{
+		nbatch = getRxBatchSize();
+		if (fillRxBatch(iface, rx, nbatch) == EXIT_FAILURE)
+			return FALSE;
+		niov = setRxIovec(iface, rx, nbatch, iovs);
+		if ((n = vpl_tryrecvmmsg(iface->vpl_data, iovs, niov, lens, nbatch)) <= 0)
+			return FALSE;
+		ingressRxBatch(iface, rx, lens, n);
+		if (n < nbatch)
+			return FALSE;            // took all that was waiting
+	}
+	return TRUE;
+}
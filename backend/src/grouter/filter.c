@@ -25,7 +25,7 @@ filtertab_t *createFilter(classlist_t *cl, int state)
 {
 	filtertab_t *ft;
 
-	ft = (filtertab_t *) malloc(sizeof(filtertab_t));
+	ft = (filtertab_t *) calloc(1, sizeof(filtertab_t));
 	ft->filteron = state;
 	ft->clist = cl;
 	ft->rulecnt = 0;
@@ -125,6 +125,28 @@ void flushFilter(filtertab_t *ft)
 }
 
 
+/*
+ * returns the lowest counter index not used by a rule, with its
+ * counters cleared.
+ */
+static int newFilterRuleId(filtertab_t *ft)
+{
+	int id, j, slot;
+
+	for (id = 0; id < MAX_FILTER_RULES; id++)
+	{
+		for (j = 0; j < ft->rulecnt; j++)
+			if (ft->ruletab[j]->id == id)
+				break;
+		if (j == ft->rulecnt)
+			break;
+	}
+	for (slot = 0; slot < MAX_FILTER_SLOTS; slot++)
+		ft->count[slot].passes[id] = ft->count[slot].failures[id] = 0;
+	return id;
+}
+
+
 /*
  * Returns 1 if successful in adding the filter or 0 otherwise.
  * Fails if another rule is present with the given classifier or
@@ -150,10 +172,16 @@ int addFilterRule(filtertab_t *ft, int type, char *cname)
 		return 0;
 	}
 
+	if (ft->rulecnt >= MAX_FILTER_RULES)
+	{
+		verbose(2, "[addFilterRule]:: filter is full, rule [%s] not added", cname);
+		return 0;
+	}
+
 	fr = (filterrule_t *)malloc(sizeof(filterrule_t));
 	fr->type = type;
 	strcpy(fr->cname, cname);
-	fr->failures = fr->passes = 0;
+	fr->id = newFilterRuleId(ft);
 	ft->ruletab[ft->rulecnt] = fr;
 	ft->rulecnt++;
 	ft->filteron = 1;
@@ -162,34 +190,50 @@ int addFilterRule(filtertab_t *ft, int type, char *cname)
 }
 
 
-// returns 1 if the packet is filtered.. otherwise returns 0
-int filteredPacket(filtertab_t *ft, gpacket_t *in_pkt)
+/*
+ * The filter rules are matched by the ingress classification in the
+ * packet core (classifyPacket), which counts a hit here. Each thread
+ * counts in its own slot so that no atomic operation or shared cache
+ * line is needed on the packet path; the slots are added up on read.
+ * Threads beyond MAX_FILTER_SLOTS share the last slot atomically.
+ */
+static __thread int filter_slot = -1;
+
+void countFilterRule(filtertab_t *ft, int id, int type)
 {
-	int j, matched = 0;
-	classdef_t *cdef;
+	unsigned long *counter;
 
-	// if filtering is OFF, then return 0
-	if (!ft->filteron)
-		return 0;
+	if (filter_slot < 0)
+		filter_slot = __sync_fetch_and_add(&(ft->nslots), 1);
 
-	for (j = 0; j < ft->rulecnt; j++)
+	if (filter_slot < MAX_FILTER_SLOTS - 1)
 	{
-		cdef = getClassDef(ft->clist, ft->ruletab[j]->cname);
-		if (cdef == NULL)
-			continue;
-		if (isRuleMatching(cdef, in_pkt))
-		{
-			matched = 1;
-			break;
-		}
+		counter = type ? ft->count[filter_slot].passes : ft->count[filter_slot].failures;
+		counter[id]++;
+	} else
+	{
+		counter = type ? ft->count[MAX_FILTER_SLOTS - 1].passes : ft->count[MAX_FILTER_SLOTS - 1].failures;
+		__sync_fetch_and_add(&(counter[id]), 1);
 	}
+}
+
 
-	return matched;
+void getFilterRuleCount(filtertab_t *ft, int id, unsigned long *passes, unsigned long *failures)
+{
+	int slot;
+
+	*passes = *failures = 0;
+	for (slot = 0; slot < MAX_FILTER_SLOTS; slot++)
+	{
+		*passes += ft->count[slot].passes[id];
+		*failures += ft->count[slot].failures[id];
+	}
 }
 
 
 void printFilterStats(filtertab_t *ft)
 {
+	unsigned long passes, failures;
 	int j;
 
 	for (j =0; j < ft->rulecnt; j++)
@@ -199,7 +243,8 @@ void printFilterStats(filtertab_t *ft)
 		else
 			printf("Deny\t");
 		printf("%s\t", ft->ruletab[j]->cname);
-		printf("%d\t%d\n", ft->ruletab[j]->passes, ft->ruletab[j]->failures);
+		getFilterRuleCount(ft, ft->ruletab[j]->id, &passes, &failures);
+		printf("%lu\t%lu\n", passes, failures);
 	}
 }
 
@@ -0,0 +1,445 @@
+/*
+ * flowcache.c (flow cache of the forwarding and class decisions)
+ *
+ * A direct mapped table of flow_entry_t, one cache line each, indexed
+ * by a hash of the flow key (see flowcache.h). The receive threads
+ * write the class matches of an entry and the packet workers its
+ * forwarding decision; a writer takes the entry by moving its sequence
+ * count to odd with a compare and swap and simply does not cache the
+ * decision if another thread has the entry. Readers take no lock.
+ * The table is replaced when it is resized: it is used inside an epoch
+ * section and the old one is freed after a grace period (epoch.h).
+ */
+
+#include <slack/err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include "message.h"
+#include "protocols.h"
+#include "ip.h"
+#include "packetcore.h"
+#include "flowcache.h"
+#include "epoch.h"
+
+
+extern pktcore_t *pcore;
+
+static flow_table_t * volatile flowtbl = NULL;
+static volatile int flow_enabled = 1;
+static volatile unsigned int flow_fgen = 1;             // 0 means no decision: never used
+static volatile unsigned int flow_cgen = 1;
+
+/*
+ * Each thread counts in its own slot, as the filter does; the threads
+ * beyond FLOW_MAX_SLOTS share the last slot atomically.
+ */
+static flow_count_t flow_counts[FLOW_MAX_SLOTS];
+static int flow_nslots = 0;
+static __thread int flow_slot = -1;
+
+#define FLOW_COUNT(F) do { \
+	if (flow_slot < 0) \
+		flow_slot = __sync_fetch_and_add(&flow_nslots, 1); \
+	if (flow_slot < FLOW_MAX_SLOTS - 1) \
+		flow_counts[flow_slot].F++; \
+	else \
+		__sync_fetch_and_add(&(flow_counts[FLOW_MAX_SLOTS - 1].F), 1); \
+	} while (0)
+
+
+static flow_table_t *flowAllocTable(int size)
+{
+	flow_table_t *tbl;
+
+	if ((tbl = malloc(sizeof(flow_table_t))) == NULL)
+		return NULL;
+	if (posix_memalign((void **)&(tbl->entry), CACHE_LINE_SIZE, size * sizeof(flow_entry_t)) != 0)
+	{
+		free(tbl);
+		return NULL;
+	}
+	bzero(tbl->entry, size * sizeof(flow_entry_t));
+	tbl->size = size;
+	return tbl;
+}
+
+
+static void flowFreeTable(void *arg)
+{
+	flow_table_t *tbl = (flow_table_t *)arg;
+
+	free(tbl->entry);
+	free(tbl);
+}
+
+
+void flowInit(int size)
+{
+	if (flowSetSize(size) == EXIT_FAILURE)
+		fatal("[flowInit]:: unable to allocate the flow cache ");
+}
+
+
+/*
+ * replace the table by an empty one of size entries (rounded up to a
+ * power of two). the old table is retired and freed once no thread can
+ * still be probing it.
+ */
+int flowSetSize(int size)
+{
+	flow_table_t *tbl;
+	int n;
+
+	if ((size < FLOW_MIN_SIZE) || (size > FLOW_MAX_SIZE))
+	{
+		error("[flowSetSize]:: flow cache size must be between %d and %d ", FLOW_MIN_SIZE, FLOW_MAX_SIZE);
+		return EXIT_FAILURE;
+	}
+	for (n = FLOW_MIN_SIZE; n < size; n *= 2)
+		;
+	if ((tbl = flowAllocTable(n)) == NULL)
+		return EXIT_FAILURE;
+
+	epochRetire(flowFreeTable, epochPublish((void * volatile *)&flowtbl, tbl));
+	verbose(2, "[flowSetSize]:: flow cache of %d entries ", n);
+	return EXIT_SUCCESS;
+}
+
+
+void flowEnable(int on)
+{
+	flow_enabled = on;
+}
+
+
+static void flowBump(volatile unsigned int *gen)
+{
+	if (__sync_add_and_fetch(gen, 1) == 0)
+		__sync_add_and_fetch(gen, 1);
+}
+
+
+/*
+ * called after the routes, the MTU table, the ARP table or an interface
+ * changed: no forwarding decision made before is used again.
+ */
+void flowInvalidate(void)
+{
+	flowBump(&flow_fgen);
+}
+
+
+// called after a new class table is swapped in
+void flowInvalidateClasses(void)
+{
+	flowBump(&flow_cgen);
+}
+
+
+/*
+ * the key of an IP packet. returns FALSE if the packet cannot be cached
+ * (not IP).
+ */
+static int flowKey(gpacket_t *pkt, flow_key_t *key)
+{
+	ip_packet_t *ip_pkt = (ip_packet_t *)GPKT_PAYLOAD(pkt);
+	int sport, dport;
+
+	if ((ntohs(GPKT_ETH(pkt)->header.prot) != IP_PROTOCOL) ||
+	    (pkt->frame.src_interface < 0) || (pkt->frame.src_interface > 255))
+		return FALSE;
+
+	COPY_IP(key->src, ip_pkt->ip_src);
+	COPY_IP(key->dst, ip_pkt->ip_dst);
+	key->prot = ip_pkt->ip_prot;
+	key->tos = ip_pkt->ip_tos;
+	key->iface = pkt->frame.src_interface;
+	if ((key->ports = getPacketPorts(ip_pkt, &sport, &dport)))
+	{
+		key->sport = sport;
+		key->dport = dport;
+	} else
+		key->sport = key->dport = 0;
+	return TRUE;
+}
+
+
+static inline unsigned int flowKeyHash(flow_key_t *key)
+{
+	uint32_t *w = (uint32_t *)key;
+	uint32_t h;
+
+	h = w[0] * 0x9e3779b1;
+	h = (h ^ w[1]) * 0x85ebca6b;
+	h = (h ^ w[2]) * 0xc2b2ae35;
+	h = (h ^ w[3]) * 0x9e3779b1;
+	return h ^ (h >> 16);
+}
+
+
+/*
+ * copy the entry of key into copy. returns FALSE if the slot holds
+ * another flow or a writer had it.
+ */
+static int flowRead(flow_key_t *key, flow_entry_t *copy)
+{
+	flow_table_t *tbl;
+	flow_entry_t *e;
+	unsigned int seq;
+	int same;
+
+	epochEnter();
+	tbl = flowtbl;
+	e = &(tbl->entry[flowKeyHash(key) & (tbl->size - 1)]);
+	if ((seq = e->seq) & 1)
+	{
+		epochExit();
+		return FALSE;
+	}
+	__sync_synchronize();
+	memcpy(copy, e, sizeof(flow_entry_t));
+	__sync_synchronize();
+	same = (e->seq == seq);
+	epochExit();
+	return same && (memcmp(&(copy->key), key, sizeof(flow_key_t)) == 0);
+}
+
+
+/*
+ * write the class matches (class set) or the forwarding decision of
+ * flow into its slot. a slot holding another flow is taken over.
+ */
+static void flowStore(flow_entry_t *flow, int class)
+{
+	flow_table_t *tbl;
+	flow_entry_t *e;
+	unsigned int seq;
+
+	epochEnter();
+	tbl = flowtbl;
+	e = &(tbl->entry[flowKeyHash(&(flow->key)) & (tbl->size - 1)]);
+	seq = e->seq;
+
+	// another thread is writing the slot: leave it alone
+	if ((seq & 1) || !__sync_bool_compare_and_swap(&(e->seq), seq, seq + 1))
+	{
+		epochExit();
+		return;
+	}
+
+	if (memcmp(&(e->key), &(flow->key), sizeof(flow_key_t)) != 0)
+	{
+		if ((e->fgen != 0) || (e->cgen != 0))
+			FLOW_COUNT(collisions);
+		memcpy(&(e->key), &(flow->key), sizeof(flow_key_t));
+		e->fgen = e->cgen = 0;
+	}
+	if (class)
+	{
+		memcpy(e->match, flow->match, sizeof(e->match));
+		e->ctable = flow->ctable;
+		e->cgen = flow->cgen;
+	} else
+	{
+		e->action = flow->action;
+		e->dst_interface = flow->dst_interface;
+		COPY_IP(e->nxth_ip_addr, flow->nxth_ip_addr);
+		COPY_MAC(e->mac_addr, flow->mac_addr);
+		e->mtu = flow->mtu;
+		e->redirect = flow->redirect;
+		e->until = flow->until;
+		e->fgen = flow->fgen;
+	}
+	FLOW_COUNT(stores);
+
+	__sync_synchronize();
+	e->seq = seq + 2;
+	epochExit();
+}
+
+
+/*
+ * look up the forwarding decision for pkt. returns FLOW_LOCAL or
+ * FLOW_FORWARD with the decision in flow, or FLOW_MISS. after a miss
+ * flow holds what flowCacheLocal and flowCacheForward need to cache
+ * the decision made by the caller.
+ */
+int flowLookup(gpacket_t *pkt, flow_entry_t *flow)
+{
+	unsigned int gen = flow_fgen;
+	flow_key_t key;
+
+	flow->fgen = 0;
+	if (!flow_enabled || !flowKey(pkt, &key))
+		return FLOW_MISS;
+
+	if (flowRead(&key, flow) && (flow->fgen == gen) &&
+	    ((flow->action == FLOW_LOCAL) || (flow->until == ~0ULL) || (getTimeNanos() < flow->until)))
+	{
+		FLOW_COUNT(fhits);
+		return flow->action;
+	}
+
+	FLOW_COUNT(fmisses);
+	memcpy(&(flow->key), &key, sizeof(flow_key_t));
+	flow->fgen = gen;
+	return FLOW_MISS;
+}
+
+
+// cache that the packets of the flow are for the router
+void flowCacheLocal(flow_entry_t *flow)
+{
+	if (flow->fgen == 0)
+		return;
+	flow->action = FLOW_LOCAL;
+	flowStore(flow, FALSE);
+}
+
+
+/*
+ * cache the forwarding decision made for pkt: its dst_interface and
+ * nxth_ip_addr, the mtu of the link, the next hop MAC and when it must
+ * be refreshed, and whether the source is on the next hop network.
+ */
+void flowCacheForward(flow_entry_t *flow, gpacket_t *pkt, int mtu, uchar *mac_addr,
+		      unsigned long long until, int redirect)
+{
+	if ((flow->fgen == 0) || (pkt->frame.dst_interface < 0) || (pkt->frame.dst_interface > 255))
+		return;
+	flow->action = FLOW_FORWARD;
+	flow->dst_interface = pkt->frame.dst_interface;
+	COPY_IP(flow->nxth_ip_addr, pkt->frame.nxth_ip_addr);
+	COPY_MAC(flow->mac_addr, mac_addr);
+	flow->mtu = mtu;
+	flow->until = until;
+	flow->redirect = redirect;
+	flowStore(flow, FALSE);
+}
+
+
+/*
+ * look up the class matches of pkt in ctable. returns TRUE with the
+ * matches in match; otherwise flow holds what flowCacheClass needs.
+ */
+int flowLookupClass(gpacket_t *pkt, cls_table_t *ctable, int *match, flow_entry_t *flow)
+{
+	unsigned int gen = flow_cgen;
+	flow_key_t key;
+	int g;
+
+	flow->cgen = 0;
+	if (!flow_enabled || (ctable == NULL) || !flowKey(pkt, &key))
+		return FALSE;
+
+	if (flowRead(&key, flow) && (flow->cgen == gen) && (flow->ctable == ctable))
+	{
+		for (g = 0; g < CLS_MAX_GROUPS; g++)
+			match[g] = flow->match[g];
+		FLOW_COUNT(chits);
+		return TRUE;
+	}
+
+	FLOW_COUNT(cmisses);
+	memcpy(&(flow->key), &key, sizeof(flow_key_t));
+	flow->cgen = gen;
+	return FALSE;
+}
+
+
+void flowCacheClass(flow_entry_t *flow, cls_table_t *ctable, int *match)
+{
+	int g;
+
+	if (flow->cgen == 0)
+		return;
+	for (g = 0; g < CLS_MAX_GROUPS; g++)
+		flow->match[g] = match[g];
+	flow->ctable = ctable;
+	flowStore(flow, TRUE);
+}
+
+
+static double flowRatio(unsigned long hits, unsigned long misses)
+{
+	return (hits + misses > 0) ? 100.0 * hits / (hits + misses) : 0.0;
+}
+
+
+/*
+ * print the settings and counters of the flow cache and up to count
+ * of its valid entries
+ */
+void flowPrint(int count)
+{
+	flow_table_t *tbl;
+	cls_table_t *ctable;
+	flow_count_t total;
+	flow_entry_t e;
+	unsigned long long now = getTimeNanos();
+	int i, slot, valid = 0, shown = 0, fvalid, cvalid;
+	char tmpbuf[MAX_TMPBUF_LEN], *cname;
+
+	bzero(&total, sizeof(total));
+	for (slot = 0; slot < FLOW_MAX_SLOTS; slot++)
+	{
+		total.fhits += flow_counts[slot].fhits;
+		total.fmisses += flow_counts[slot].fmisses;
+		total.chits += flow_counts[slot].chits;
+		total.cmisses += flow_counts[slot].cmisses;
+		total.stores += flow_counts[slot].stores;
+		total.collisions += flow_counts[slot].collisions;
+	}
+
+	// the table and the class names are used until the summary is printed
+	epochEnter();
+	tbl = flowtbl;
+	ctable = pcore->ctable;
+	if (count > 0)
+		printf("Source\t\tSport\tDestination\tDport\tProt\tIn\tOut\tNext hop\tMAC\t\t\tMTU\tClass\n");
+	for (i = 0; i < tbl->size; i++)
+	{
+		if (!flowRead(&(tbl->entry[i].key), &e))
+			continue;
+		fvalid = (e.fgen == flow_fgen) &&
+			((e.action == FLOW_LOCAL) || (e.until == ~0ULL) || (now < e.until));
+		cvalid = (e.cgen == flow_cgen) && (e.ctable == ctable);
+		if (!fvalid && !cvalid)
+			continue;
+		valid++;
+		if (shown >= count)
+			continue;
+		shown++;
+
+		printf("%s\t", IP2Dot(tmpbuf, gNtohl((tmpbuf+20), e.key.src)));
+		if (e.key.ports) printf("%d\t", e.key.sport); else printf("-\t");
+		printf("%s\t", IP2Dot(tmpbuf, gNtohl((tmpbuf+20), e.key.dst)));
+		if (e.key.ports) printf("%d\t", e.key.dport); else printf("-\t");
+		printf("%d\t%d\t", e.key.prot, e.key.iface);
+		if (!fvalid)
+			printf("-\t-\t\t-\t\t\t-\t");
+		else if (e.action == FLOW_LOCAL)
+			printf("local\t-\t\t-\t\t\t-\t");
+		else
+			printf("%d\t%s\t%s\t%d\t", e.dst_interface, IP2Dot(tmpbuf, e.nxth_ip_addr),
+			       MAC2Colon((tmpbuf+20), e.mac_addr), e.mtu);
+		if (!cvalid)
+			cname = "-";
+		else if (e.match[CLS_GROUP_QUEUE] >= 0)
+			cname = ctable->names[e.match[CLS_GROUP_QUEUE]];
+		else
+			cname = "default";
+		printf("%s\n", cname);
+	}
+
+	printf("\nFlow cache %s: %d entries of %d bytes, %d valid \n", flow_enabled ? "on" : "off",
+	       tbl->size, (int)sizeof(flow_entry_t), valid);
+	epochExit();
+	printf("Forwarding: %lu hits, %lu misses (%.1f%% hits), generation %u \n",
+	       total.fhits, total.fmisses, flowRatio(total.fhits, total.fmisses), flow_fgen);
+	printf("Classes:    %lu hits, %lu misses (%.1f%% hits), generation %u \n",
+	       total.chits, total.cmisses, flowRatio(total.chits, total.cmisses), flow_cgen);
+	printf("Stores:     %lu, %lu over another flow \n", total.stores, total.collisions);
+}
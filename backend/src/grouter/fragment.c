@@ -6,7 +6,6 @@
  */
 
 
-#include <math.h>
 #include "message.h"
 #include "grouter.h"
 #include "moduledefs.h"
@@ -15,13 +14,16 @@
 #include "protocols.h"
 #include "ip.h"
 #include "fragment.h"
+#include "packetpool.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <slack/err.h>
 #include <netinet/in.h>
 
-extern mtu_entry_t MTU_tbl[MAX_MTU];	   
+extern mtu_table_t *MTU_tbl;
+
+frag_stats_t fragstats;                  // fragmentation and reassembly counters
 
 
 /*
@@ -31,7 +33,7 @@ extern mtu_entry_t MTU_tbl[MAX_MTU];
  */
 int needFragmentation(gpacket_t *pkt)
 {
-	ip_packet_t *ip_pkt = (ip_packet_t *)pkt->data.data;	
+	ip_packet_t *ip_pkt = (ip_packet_t *)GPKT_PAYLOAD(pkt);	
 	int link_mtu;
 
 	verbose(2, "[needFragmentation]:: Checking whether the packet needs fragmentation.. ");
@@ -44,59 +46,169 @@ int needFragmentation(gpacket_t *pkt)
 
 
 /*
- * with the current data structures, fragmentation is a hypothetical
- * requirement! the gpacket_t datastructure has a hardcoded limit for
- * IP packets. therefore, we cannot have larger frames to require
- * fragmentation. may be we can remove this hardcoding and dynamically
- * create the payload -- this will require dynamic memory allocations and
- * deallocations. 
+ * the IP header of the fragments after the first: the options that are
+ * not copied into every fragment are left out (RFC 791). it goes to hdr;
+ * RETURNS its length.
+ */
+static int fragCopiedHeader(ip_packet_t *ip_pkt, uchar *hdr)
+{
+	uchar *opt = (uchar *)ip_pkt + 20, *end = (uchar *)ip_pkt + ip_pkt->ip_hdr_len * 4;
+	int len = 20, olen;
+
+	memcpy(hdr, ip_pkt, 20);
+	while ((opt < end) && (*opt != IP_OPT_EOL))
+	{
+		if (*opt == IP_OPT_NOP)
+		{
+			opt++;
+			continue;
+		}
+		if ((opt + 1 >= end) || ((olen = opt[1]) < 2) || (opt + olen > end))
+			break;
+		if (IP_OPT_COPIED(*opt))
+		{
+			memcpy(hdr + len, opt, olen);
+			len += olen;
+		}
+		opt += olen;
+	}
+	while (len & 3)
+		hdr[len++] = IP_OPT_EOL;
+	((ip_packet_t *)hdr)->ip_hdr_len = len / 4;
+	return len;
+}
+
+
+/*
+ * chain len bytes of the frame of pkt from offset off to the fragment:
+ * the pieces of pkt that hold them become segments of the fragment,
+ * which holds a reference on their buffers. nothing is copied.
+ */
+static int fragShareData(gpacket_t *frag, gpacket_t *pkt, int off, int len)
+{
+	gpacket_t *owner = pkt;
+	uchar *data = pkt->data;
+	int i = -1, n, plen = pkt->len;
+
+	while (len > 0)
+	{
+		if (off < plen)
+		{
+			n = min(len, plen - off);
+			if (gpktAddSeg(frag, holdPacket(owner), data + off, n) == EXIT_FAILURE)
+			{
+				releasePacket(owner);
+				return EXIT_FAILURE;
+			}
+			len -= n;
+			off = plen;
+		}
+		off -= plen;
+		if (++i == pkt->nsegs)
+			break;
+		owner = pkt->segs[i].owner;
+		data = pkt->segs[i].data;
+		plen = pkt->segs[i].len;
+	}
+	return (len > 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+/*
+ * a fragment: the headers hdr (Ethernet and IP, hdrlen bytes) in a
+ * buffer of its own and len bytes of the frame of pkt from offset off.
+ * the data is shared with pkt; if it is spread over more pieces than a
+ * packet can chain, it is copied.
+ */
+static gpacket_t *fragNewPacket(gpacket_t *pkt, uchar *hdr, int hdrlen, int off, int len)
+{
+	gpacket_t *frag;
+
+	if ((frag = newPacketSize(hdrlen)) == NULL)
+		return NULL;
+	memcpy(gpktPut(frag, hdrlen), hdr, hdrlen);
+	if (fragShareData(frag, pkt, off, len) == EXIT_SUCCESS)
+	{
+		__sync_fetch_and_add(&(fragstats.fragshared), 1);
+		return frag;
+	}
+
+	releasePacket(frag);
+	if ((frag = newPacketSize(hdrlen + len)) == NULL)
+		return NULL;
+	memcpy(gpktPut(frag, hdrlen + len), hdr, hdrlen);
+	gpktCopyOut(pkt, off, frag->data + hdrlen, len);
+	return frag;
+}
+
+
+/*
+ * split the IP packet into fragments that fit the MTU of the outgoing
+ * link: every fragment but the last carries a multiple of 8 bytes of
+ * the data. a fragment is a buffer with the Ethernet and IP headers
+ * and the data of the packet it refers to (fragNewPacket): the packet
+ * stays around until its last fragment is sent. the fragments after
+ * the first only carry the options that are copied.
+ * RETURNS the number of fragments, 0 on failure.
  */
 int fragmentIPPacket(gpacket_t *pkt, gpacket_t **frags)
 {
-	ip_packet_t *ip_pkt = (ip_packet_t *)pkt->data.data;	
-	int link_mtu, num_frags, i;
-	int frag_offset, frag_len;
+	ip_packet_t *ip_pkt = (ip_packet_t *)GPKT_PAYLOAD(pkt);
+	int hlen = ip_pkt->ip_hdr_len * 4;
+	int datalen = ntohs(ip_pkt->ip_pkt_len) - hlen;
+	int link_mtu, num_frags, i, frag_len, len, offset, first, mf, fhlen;
+	uchar hdr[ETHER_HEADER_LEN + 60];
 	ip_packet_t *this_ippkt;
-	uchar *ipdata_ptr;
 
 	link_mtu = findMTU(MTU_tbl, pkt->frame.dst_interface);
-	
-	num_frags = (int) ceil(((double) ntohs(ip_pkt->ip_pkt_len))/((double) link_mtu));
-	frag_len = ntohs(ip_pkt->ip_pkt_len)/num_frags;
-
-	*frags = (gpacket_t *) malloc(sizeof(gpacket_t) * num_frags);
-	if (*frags == NULL)
-		verbose(1, "[fragmentIPPacket]:: unable to allocate memory ");
+	frag_len = (link_mtu - hlen) & ~7;
+	if ((frag_len <= 0) || (datalen < 0) || (gpktLength(pkt) < ETHER_HEADER_LEN + hlen + datalen))
+	{
+		__sync_fetch_and_add(&(fragstats.fragfails), 1);
+		return 0;
+	}
+	num_frags = (datalen + frag_len - 1) / frag_len;
+	if (num_frags > MAX_FRAGMENTS)
+	{
+		verbose(1, "[fragmentIPPacket]:: %d bytes need more than %d fragments at MTU %d ",
+			datalen, MAX_FRAGMENTS, link_mtu);
+		__sync_fetch_and_add(&(fragstats.fragfails), 1);
+		return 0;
+	}
 
-	frag_offset = 0;
-	ipdata_ptr = (uchar *)ip_pkt + (ip_pkt->ip_hdr_len << 2);
+	// a fragment fragmented again: its pieces go on from its own offset
+	first = ntohs(ip_pkt->ip_frag_off) & IP_OFFMASK;
+	mf = ntohs(ip_pkt->ip_frag_off) & IP_MF;
 
-	for (i = 0; i < (num_frags -1); i++)
+	memcpy(hdr, pkt->data, ETHER_HEADER_LEN + hlen);
+	fhlen = hlen;
+	for (i = 0, offset = 0; i < num_frags; i++, offset += frag_len)
 	{
-		memcpy(frags[i], pkt, sizeof(gpacket_t));
-		this_ippkt = (ip_packet_t *)frags[i]->data.data;
-		this_ippkt->ip_frag_off = frag_offset;
-		memcpy(((uchar *)this_ippkt + (this_ippkt->ip_hdr_len << 2)), 
-		       (ipdata_ptr + frag_offset), frag_len);
-		SET_MF_BITS(this_ippkt->ip_frag_off);
-		SET_DF_BITS(this_ippkt->ip_frag_off);
-		this_ippkt->ip_pkt_len = htons((ip_pkt->ip_hdr_len << 2) + frag_len);
+		len = min(frag_len, datalen - offset);
+		if ((frags[i] = fragNewPacket(pkt, hdr, ETHER_HEADER_LEN + fhlen,
+					      ETHER_HEADER_LEN + hlen + offset, len)) == NULL)
+		{
+			verbose(1, "[fragmentIPPacket]:: unable to allocate memory ");
+			deallocateFragments(frags, i);
+			__sync_fetch_and_add(&(fragstats.fragfails), 1);
+			return 0;
+		}
+		memcpy(&(frags[i]->frame), &(pkt->frame), sizeof(pkt_frame_t));
+		frags[i]->frame.refcnt = 1;
+
+		this_ippkt = (ip_packet_t *)GPKT_PAYLOAD(frags[i]);
+		this_ippkt->ip_frag_off = htons((first + offset / 8) | (((i < num_frags - 1) || mf) ? IP_MF : 0) |
+						(ntohs(ip_pkt->ip_frag_off) & IP_DF));
+		this_ippkt->ip_pkt_len = htons(fhlen + len);
 		this_ippkt->ip_cksum = 0;
-		this_ippkt->ip_cksum = htons(checksum((uchar *)this_ippkt, this_ippkt->ip_hdr_len *2));
-		frag_offset += frag_len;
+		this_ippkt->ip_cksum = htons(checksum((uchar *)this_ippkt, fhlen / 2));
+
+		if ((i == 0) && (first == 0) && (hlen > 20))
+			fhlen = fragCopiedHeader(ip_pkt, hdr + ETHER_HEADER_LEN);
 	}
-	frag_len = ntohs(ip_pkt->ip_pkt_len) - frag_offset;
-	memcpy(frags[i], pkt, sizeof(gpacket_t));
-	this_ippkt = (ip_packet_t *)frags[i]->data.data;
-	this_ippkt->ip_frag_off = frag_offset;
-	memcpy(((uchar *)this_ippkt + (this_ippkt->ip_hdr_len << 2)), 
-	       (ipdata_ptr + frag_offset), frag_len);
-	RESET_MF_BITS(this_ippkt->ip_frag_off);
-	RESET_DF_BITS(this_ippkt->ip_frag_off);
-	this_ippkt->ip_pkt_len = htons((ip_pkt->ip_hdr_len << 2) + frag_len);
-	this_ippkt->ip_cksum = 0;
-	this_ippkt->ip_cksum = htons(checksum((uchar *)this_ippkt, this_ippkt->ip_hdr_len *2));
 
+	__sync_fetch_and_add(&(fragstats.fragoks), 1);
+	__sync_fetch_and_add(&(fragstats.fragcreates), num_frags);
 	return num_frags;
 }
 
@@ -107,6 +219,6 @@ void deallocateFragments(gpacket_t **pkt_frags, int num_frags)
 
 	verbose(2, "[deallocateFragments]:: Deallocating fragment table memory ");
 	for (i = 0; i < num_frags; i++)
-		free(pkt_frags[i]);
+		releasePacket(pkt_frags[i]);
 }
 
@@ -14,6 +14,7 @@
 #include "grouter.h"
 #include "device.h"
 #include "message.h"
+#include "packetpool.h"
 #include "ethernet.h"
 #include "tap.h"
 #include "tapio.h"
@@ -22,12 +23,20 @@
 #include <sys/time.h>
 #include <netinet/in.h>
 #include "routetable.h"
+#include "reactor.h"
+#include "trace.h"
+#include "stats.h"
+#include "cpu.h"
+#include "epoch.h"
+#include "flowcache.h"
+#include <string.h>
 
-extern route_entry_t route_tbl[MAX_ROUTES];
+extern router_config rconfig;
+
+extern route_table_t *route_tbl;
 
 interface_array_t netarray;
 devicearray_t devarray;
-arp_entry_t arp_cache[ARP_CACHE_SIZE];
 
 
 /*----------------------------------------------------------------------------------
@@ -141,7 +150,9 @@ int getNextInterfaceID(void)
 
 
 /*
- * insert the given interface into the Interface table
+ * insert the given interface into the Interface table. the cached
+ * flows are invalidated by every change of an interface: a flow may
+ * have been forwarded to or dropped for an address it now owns.
  */
 void GNETInsertInterface(interface_t *iface)
 {
@@ -152,30 +163,31 @@ void GNETInsertInterface(interface_t *iface)
 		verbose(1, "[insertInterface]:: Cannot create interface.. delete exiting one first ");
 		return;
 	}
-	netarray.elem[ifid] = iface;
+	epochPublish((void * volatile *)&(netarray.elem[ifid]), iface);
 	netarray.count++;
+	flowInvalidate();
 }
 
 
 /*
  * returns EXIT_SUCCESS if the element was removed.
- * Otherwise returns EXIT_FAILURE.
+ * Otherwise returns EXIT_FAILURE. The packet threads may still hold the
+ * interface: it is only taken out of the table, the caller frees it
+ * after a grace period (see destroyInterface).
  */
 int deleteInterface(int indx)
 {
 
-	if (indx > MAX_INTERFACES)
+	if ((indx < 0) || (indx >= MAX_INTERFACES))
 	{
 		verbose(1, "[deleteInterface]:: Specified index: Out of range ");
 		return EXIT_FAILURE;
 	}
 
-	// release memory;
-	free(netarray.elem[indx]);
-
 	// delete slot...
-	netarray.elem[indx] = NULL;
+	epochPublish((void * volatile *)&(netarray.elem[indx]), NULL);
 	if (netarray.count > 0) netarray.count--;
+	flowInvalidate();
 
 	return EXIT_SUCCESS;
 }
@@ -185,7 +197,8 @@ int deleteInterface(int indx)
 /*
  * findInterface... this is pretty simple because the interface table
  * is direct mapped! We need to search the table if we want to find interfaces
- * by IP address or MAC address or any other parameter.
+ * by IP address or MAC address or any other parameter. The packet threads
+ * use the interface returned inside an epoch section (epoch.h).
  */
 
 interface_t *findInterface(int indx)
@@ -221,7 +234,8 @@ void printInterfaces(int mode)
 {
 	int i;
 	interface_t *ifptr;
-	char tmpbuf[MAX_TMPBUF_LEN];
+	vpl_data_t *vdata;
+	char tmpbuf[MAX_TMPBUF_LEN], txbuf[MAX_TMPBUF_LEN];
 
 	printf("\n\n");
 	printHorLine(mode);
@@ -261,6 +275,43 @@ void printInterfaces(int mode)
 			}
 		}
 	printHorLine(mode);
+
+	// system calls per frame show how well the I/O batching (set io-batch) works
+	if (mode == VERBOSE_LISTING)
+	{
+		printf("I/O batch: %d frames\n", rconfig.iobatch);
+		printf("Int.\tRx frames\tRx calls\tCalls/frame\tTx frames\tTx calls\tCalls/frame\n");
+		for (i = 0; i < MAX_INTERFACES; i++)
+			if ((netarray.elem[i] != NULL) && ((vdata = netarray.elem[i]->vpl_data) != NULL))
+				printf("%d\t%lu\t\t%lu\t\t%.3f\t\t%lu\t\t%lu\t\t%.3f\n",
+				       netarray.elem[i]->interface_id,
+				       vdata->rx_frames, vdata->rx_calls,
+				       vdata->rx_frames ? (double)vdata->rx_calls / vdata->rx_frames : 0.0,
+				       vdata->tx_frames, vdata->tx_calls,
+				       vdata->tx_frames ? (double)vdata->tx_calls / vdata->tx_frames : 0.0);
+		reactorPrint();
+		printHorLine(mode);
+
+		// transmit queues: drops here mean the interface cannot keep up
+		printf("Int.\tTx queued\tTx sent\t\tTx dropped\tIn queue\tRate (kbit/s)\tBurst (bytes)\n");
+		for (i = 0; i < MAX_INTERFACES; i++)
+			if ((ifptr = netarray.elem[i]) != NULL)
+				printf("%d\t%lu\t\t%lu\t\t%lu\t\t%d\t\t%d\t\t%d\n",
+				       ifptr->interface_id, ifptr->tx_queued, ifptr->tx_sent,
+				       ifptr->tx_dropped, (ifptr->txq != NULL) ? ifptr->txq->cursize : 0,
+				       ifptr->tx_rate, ifptr->tx_burst);
+		printHorLine(mode);
+
+		// the CPUs the threads of each interface may run on (see cpu); rx is
+		// "-" when the reactor threads do the receiving
+		printf("Int.\tRx thread CPUs\t\tTx thread CPUs\n");
+		for (i = 0; i < MAX_INTERFACES; i++)
+			if ((ifptr = netarray.elem[i]) != NULL)
+				printf("%d\t%-24s%s\n", ifptr->interface_id,
+				       cpuThreadPlacement(tmpbuf, CPU_ROLE_RX, ifptr->interface_id),
+				       cpuThreadPlacement(txbuf, CPU_ROLE_TX, ifptr->interface_id));
+		printHorLine(mode);
+	}
 	printf("\n\n");
 	return;
 }
@@ -315,8 +366,9 @@ interface_t *newInterfaceStructure(char *vsock_name, char *device,
  * created. Otherwise, it returns a pointer to the newly created
  * structure that contains all the details for the interface. This
  * function also creates a thread for each activated interface. This
- * thread is responsible for listening for any incoming packets. There is
- * no thread created for outgoing packets!
+ * thread is responsible for listening for any incoming packets. The
+ * outgoing packets are sent by a second thread of the interface that
+ * drains its transmit queue (see GNETTransmitter).
  * ARGUMENTS: vsock_name: string name of the vpl_socket
  * 			  device:  eth1, eth2 (device name and device IDs are separated from this)
  * 			  mac_addr: hardware address of the interface
@@ -490,10 +542,14 @@ int destroyInterfaceByIndex(int indx)
 /*
  * destroyInterface(): remove the specified interface from the router.
  * The router should remove associated route table information, ARP entries,
- * and stop the threads (only fromXDevice thread).
+ * and stop the threads (only fromXDevice thread). The interface is taken
+ * out of the table first and torn down once no packet thread can be
+ * using it any more.
  */
 int destroyInterface(interface_t *iface)
 {
+	gpacket_t *pkt;
+	int size;
 
 	// nothing to do if iface is NULL
 	if (iface == NULL)
@@ -506,14 +562,43 @@ int destroyInterface(interface_t *iface)
 	// remove the ARP table entries
 	ARPDeleteEntry(iface->ip_addr);
 
+	// remove interface from table... and wait for the packet threads
+	// that may have found it (e.g. the GNET handler) to be done with it
+	deleteInterface(iface->interface_id);
+	epochSynchronize();
+
 	verbose(2, "[destroyInterface]:: cancelling the fromdev handler.. ");
 	if (iface->state == INTERFACE_UP)
 	{
-		pthread_cancel(iface->threadid);        // cancel the running thread
+		if (iface->reactor != NULL)
+			reactorDel(iface);                  // no thread to cancel in reactor mode
+		else
+		{
+			pthread_cancel(iface->threadid);    // cancel the running thread
+			pthread_join(iface->threadid, NULL);
+		}
 		// close socket
 		close(iface->iface_fd);
 	}
 
+	// the transmit thread is not cancelled: it could be stopped holding
+	// a queue lock or half way through a ring update. it exits when it
+	// sees txstop, and the NULL packet wakes it if it sleeps on the queue
+	// (if the queue is full it does not sleep).
+	verbose(2, "[destroyInterface]:: stopping the transmit thread.. ");
+	if (iface->txq != NULL)
+	{
+		iface->txstop = TRUE;
+		__sync_synchronize();
+		writeQueue(iface->txq, NULL, 0);
+		pthread_join(iface->txthread, NULL);
+		while (tryReadQueue(iface->txq, (void **)&pkt, &size) == EXIT_SUCCESS)
+			if (pkt != NULL)
+				releasePacket(pkt);
+		destroySimpleQueue(iface->txq);
+		iface->txq = NULL;
+	}
+
 	verbose(2, "[destroyInterface]:: cancelling the shadow thread.. ");
 	if (iface->mode == IFACE_SERVER_MODE)
 	{
@@ -521,16 +606,15 @@ int destroyInterface(interface_t *iface)
 		unlink(iface->sock_name);
 	}
 
-	// remove interface from table...
-	deleteInterface(iface->interface_id);
-
+	free(iface);
 	return EXIT_SUCCESS;
 }
 
 
 
 /*
- * change the MTU value of the interface
+ * change the MTU value of the interface. above DEFAULT_MTU (jumbo
+ * frames), its receive takes a jumbo buffer for each frame as well.
  */
 int changeInterfaceMTU(int index, int new_mtu)
 {
@@ -542,7 +626,38 @@ int changeInterfaceMTU(int index, int new_mtu)
 		error("[changeInterface]:: Interface %d not found.. unable to change MTU ", index);
 		return EXIT_FAILURE;
 	}
+	if ((new_mtu < MIN_MTU) || (new_mtu > MAX_JUMBO_MTU))
+	{
+		error("[changeInterfaceMTU]:: MTU must be between %d and %d bytes ", MIN_MTU, MAX_JUMBO_MTU);
+		return EXIT_FAILURE;
+	}
 	iface->device_mtu = new_mtu;
+	flowInvalidate();
+	return EXIT_SUCCESS;
+}
+
+
+/*
+ * set the egress shaper of the interface: rate in kbit/s (0 removes
+ * the shaper) and bucket size in bytes (0 keeps the current one)
+ */
+int changeInterfaceRate(int index, int rate, int burst)
+{
+	interface_t *iface;
+
+	iface = findInterface(index);
+	if ((iface == NULL) || (rate < 0) || (burst < 0))
+	{
+		error("[changeInterfaceRate]:: Interface %d not found or invalid rate.. unable to change rate ", index);
+		return EXIT_FAILURE;
+	}
+	if (burst > 0)
+		iface->tx_burst = burst;
+	else if (iface->tx_burst == 0)
+		iface->tx_burst = DEFAULT_TX_BURST;
+	iface->tx_tokens = iface->tx_burst;
+	gettimeofday(&(iface->tx_last), NULL);
+	iface->tx_rate = rate;
 	return EXIT_SUCCESS;
 }
 
@@ -554,7 +669,25 @@ int upThisInterface(interface_t *iface)
 {
 	int thread_stat;
 
+	// the transmit queue and thread live as long as the interface
+	if (iface->txq == NULL)
+	{
+		iface->txq = createSimpleQueue("transmit queue", TX_QUEUE_SIZE, 0, 1);
+		cpuQueueRegister(iface->txq, CPU_ROLE_TX, iface->interface_id);
+		iface->txstop = FALSE;
+		thread_stat = pthread_create(&(iface->txthread), NULL, GNETTransmitter, (void *)iface);
+		if (thread_stat != 0)
+			return EXIT_FAILURE;
+	}
+
 	iface->state = INTERFACE_UP;
+	flowInvalidate();
+
+	// in reactor mode, Ethernet interfaces share the reactor threads
+	if ((rconfig.iothreads > 0) && !strcmp(iface->device_type, ETHERNET_DEVICE) &&
+	    (reactorAdd(iface) == EXIT_SUCCESS))
+		return EXIT_SUCCESS;
+
 	thread_stat = pthread_create(&(iface->threadid), NULL,
 				     (void *)iface->devdriver->fromdev, (void *)iface);
 	if (thread_stat != 0)
@@ -572,8 +705,12 @@ int downThisInterface(interface_t *iface)
 {
 	int status;
 
-	status = pthread_cancel(iface->threadid);
+	if (iface->reactor != NULL)
+		status = (reactorDel(iface) == EXIT_SUCCESS) ? 0 : -1;
+	else
+		status = pthread_cancel(iface->threadid);
 	iface->state = INTERFACE_DOWN;
+	flowInvalidate();
 
 	if (status == 0)
 		return EXIT_SUCCESS;
@@ -621,88 +758,6 @@ int downInterface(int index)
 
 
 
-/*----------------------------------------------------------------------------------
- *             A R P  C A C H E  M A N A G E M E N T  F U N C T I O N S
- *---------------------------------------------------------------------------------*/
-
-/*
- * return the ARP cache key. This value is used to
- * index into the direct mapped ARP cache. Direct mapped cache
- * is used for simplicity.. Should we use more complex organizations??
- */
-
-int getARPCacheKey(uchar *ip)
-{
-	unsigned int sum = 0;
-
-	sum = ip[0] + ip[1] + ip[2] + ip[3];
-	return sum % ARP_CACHE_SIZE;
-}
-
-
-void GNETInitARPCache(void)
-{
-	int i;
-
-	for (i = 0; i < ARP_CACHE_SIZE; i++)
-		arp_cache[i].is_empty = TRUE;
-}
-
-
-/*
- * lookup the given ip_addr in the ARP cache.
- * copy the MAC address in mac_addr and return TRUE
- * otherwise return FALSE -- mac_addr is undefined in this case.
- */
-int lookupARPCache(uchar *ip_addr, uchar *mac_addr)
-{
-	int key;
-
-	key = getARPCacheKey(ip_addr);
-	if ((arp_cache[key].is_empty == FALSE) &&
-	    (COMPARE_IP(arp_cache[key].ip_addr, ip_addr) == 0))
-	{
-		COPY_MAC(mac_addr, arp_cache[key].mac_addr);
-		return TRUE;
-	}
-
-	return FALSE;
-}
-
-
-void putARPCache(uchar *ip_addr, uchar *mac_addr)
-{
-	int key;
-
-	key = getARPCacheKey(ip_addr);
-	arp_cache[key].is_empty = FALSE;
-	COPY_IP(arp_cache[key].ip_addr, ip_addr);
-	COPY_MAC(arp_cache[key].mac_addr, mac_addr);
-}
-
-
-
-void printARPCache(void)
-{
-	int i;
-	char tmpbuf[MAX_TMPBUF_LEN];
-
-	printf("\n-----------------------------------------------------------\n");
-	printf("      A R P  C A C H E \n");
-	printf("-----------------------------------------------------------\n");
-	printf("Index\tIP address\tMAC address \n");
-
-	for (i = 0; i < MAX_ARP; i++)
-		if (arp_cache[i].is_empty == FALSE)
-			printf("%d\t%s\t%s\n", i, IP2Dot(tmpbuf, arp_cache[i].ip_addr),
-			       MAC2Colon((tmpbuf+20), arp_cache[i].mac_addr));
-	printf("-----------------------------------------------------------\n");
-	return;
-}
-
-
-
-
 /*----------------------------------------------------------------------------------
  *                         M A I N  F U N C T I O N S
  *---------------------------------------------------------------------------------*/
@@ -720,7 +775,7 @@ void GNETHalt(int gnethandler)
  * GNETInit: Initialize the GNET subsystem..
  * Initialize the necessary data structures. Setup a thread to read the output Queue and
  * handle the packet. Note that some packets can have valid ARP addresses. Such packets
- * are sent to the device. Packets that do not have valid ARP addresses need ARP resolution
+ * are put in the transmit queue of their interface. Packets that do not have valid ARP addresses need ARP resolution
  * to get the valid MAC address. They are buffered in the ARP buffer (within the ARP routines)
  * and injected back into the Output Queue once the ARP reply from a remote machine comes back.
  * This means a packet can go through the Output Queue two times.
@@ -732,7 +787,6 @@ int GNETInit(int *ghandler, char *config_dir, char *rname, simplequeue_t *sq)
 	// do the initializations...
 	vpl_init(config_dir, rname);
 	GNETInitInterfaces();
- 	GNETInitARPCache();
 
 	thread_stat = pthread_create((pthread_t *)ghandler, NULL, GNETHandler, (void *)sq);
 	if (thread_stat != 0)
@@ -742,53 +796,187 @@ int GNETInit(int *ghandler, char *config_dir, char *rname, simplequeue_t *sq)
 
 }
 
-void *GNETHandler(void *outq)
+/*
+ * get a packet taken from the output queue ready for its interface:
+ * set the source MAC and resolve the destination MAC. returns the
+ * interface, or NULL if the packet was dropped or handed to ARP.
+ */
+static interface_t *GNETPrepareOutput(gpacket_t *in_pkt)
 {
-	char tmpbuf[MAX_NAME_LEN];
 	interface_t *iface;
 	uchar mac_addr[6];
+	int status;
+
+	if ((iface = findInterface(in_pkt->frame.dst_interface)) == NULL)
+	{
+		error("[gnetHandler]:: Packet dropped, interface [%d] is invalid ", in_pkt->frame.dst_interface);
+		releasePacket(in_pkt);
+		return NULL;
+	} else if (iface->state == INTERFACE_DOWN)
+	{
+		error("[gnetHandler]:: Packet dropped! Interface not up");
+		releasePacket(in_pkt);
+		return NULL;
+	}
+
+	// we have a valid interface handle -- iface.
+	COPY_MAC(GPKT_ETH(in_pkt)->header.src, iface->mac_addr);
+
+	// packets resolved by ARPResolve come with arp_valid set; the rest
+	// are looked up in the ARP table (a lock free read)
+	if ((in_pkt->frame.arp_valid != TRUE) && (in_pkt->frame.arp_bcast != TRUE))
+	{
+		if ((status = ARPFindEntry(in_pkt->frame.nxth_ip_addr, mac_addr)) != EXIT_FAILURE)
+		{
+			COPY_MAC(GPKT_ETH(in_pkt)->header.dst, mac_addr);
+			if (status == ARP_STALE)
+				ARPSendRequest(in_pkt);
+		} else
+		{
+			// ARP takes its own reference (buffer or output queue)
+			ARPResolve(in_pkt);
+			releasePacket(in_pkt);
+			return NULL;
+		}
+	}
+	return iface;
+}
+
+
+/*
+ * The GNET handler is the dispatch stage of the egress path: it moves
+ * packets from the output queue to the transmit queues of their
+ * interfaces and never blocks on a device. When a transmit queue is
+ * full the packet is dropped and counted (tx_dropped), so a slow or
+ * blocked peer only holds up its own interface.
+ */
+void *GNETHandler(void *outq)
+{
 	simplequeue_t *outputQ = (simplequeue_t *)outq;
+	interface_t *iface;
 	gpacket_t *in_pkt;
-	int inbytes, cached;
+	int inbytes;
 
 	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);       // die as soon as cancelled
+	statsThreadRegister("gnet");
+	cpuThreadRegister(CPU_ROLE_GNET, 0, "gnet");
 	while (1)
 	{
-		verbose(2, "[gnetHandler]:: Reading message from output Queue..");
+		VERBOSE(2, "[gnetHandler]:: Reading message from output Queue..");
 		if (readQueue(outputQ, (void **)&in_pkt, &inbytes) == EXIT_FAILURE)
 			return NULL;
-		verbose(2, "[gnetHandler]:: Recvd message pkt ");
+		VERBOSE(2, "[gnetHandler]:: Recvd message pkt ");
 		pthread_testcancel();
+		STATS_COUNT(1, findPacketSize(in_pkt));
 
-		if ((iface = findInterface(in_pkt->frame.dst_interface)) == NULL)
+		// the interface is not freed while the packet is handed to it
+		epochEnter();
+		if ((iface = GNETPrepareOutput(in_pkt)) == NULL)
 		{
-			error("[gnetHandler]:: Packet dropped, interface [%d] is invalid ", in_pkt->frame.dst_interface);
-			continue;
-		} else if (iface->state == INTERFACE_DOWN)
-		{
-			error("[gnetHandler]:: Packet dropped! Interface not up");
+			epochExit();
 			continue;
 		}
+		if ((iface->txq == NULL) || (writeQueue(iface->txq, in_pkt, sizeof(gpacket_t)) == EXIT_FAILURE))
+		{
+			__sync_fetch_and_add(&(iface->tx_dropped), 1);
+			STATS_DROP(1);
+			VERBOSE(2, "[gnetHandler]:: Packet dropped, transmit queue of interface %d full ", iface->interface_id);
+			TRACE(TRACE_DROP, TRACE_DROP_TXQ, iface->interface_id, 0);
+			releasePacket(in_pkt);
+		} else
+			__sync_fetch_and_add(&(iface->tx_queued), 1);
+		epochExit();
+	}
+}
+
+
+/*
+ * egress shaper: a token bucket of tx_burst bytes filled at tx_rate.
+ * waits until the bucket is not empty and takes the bytes about to be
+ * sent, so the bucket may go below zero after a large batch; the next
+ * batch waits for it to fill up again.
+ */
+static void GNETShape(interface_t *iface, int bytes)
+{
+	struct timeval now;
+	double rate, wait_ms;
+
+	while (1)
+	{
+		rate = iface->tx_rate * 0.125;                       // kbit/s to bytes/ms
+		if (rate <= 0)
+			return;
+		gettimeofday(&now, NULL);
+		iface->tx_tokens += subTimeVal(&now, &(iface->tx_last)) * rate;
+		iface->tx_last = now;
+		if (iface->tx_tokens > iface->tx_burst)
+			iface->tx_tokens = iface->tx_burst;
+		if (iface->tx_tokens > 0)
+			break;
+		wait_ms = -iface->tx_tokens / rate;
+		usleep((useconds_t)(wait_ms * 1000) + 1);
+	}
+	iface->tx_tokens -= bytes;
+}
 
-		// we have a valid interface handle -- iface.
-		COPY_MAC(in_pkt->data.header.src, iface->mac_addr);
 
-		if (in_pkt->frame.arp_valid == TRUE)
-			putARPCache(in_pkt->frame.nxth_ip_addr, in_pkt->data.header.dst);
-		else if (in_pkt->frame.arp_bcast != TRUE)
+/*
+ * The transmit thread of an interface: drains its transmit queue and
+ * hands the packets to the device. With an I/O batch above 1 (set
+ * io-batch), it takes up to that many packets at a time and an Ethernet
+ * interface sends them with one sendmmsg() call. It runs until
+ * destroyInterface sets txstop; a NULL packet in the queue only wakes it.
+ */
+void *GNETTransmitter(void *arg)
+{
+	interface_t *iface = (interface_t *)arg;
+	gpacket_t *batch[VPL_MAX_BATCH];
+	char tname[STATS_NAME_LEN];
+	int inbytes, i, n, bytes, iobatch;
+
+	sprintf(tname, "tx %d", iface->interface_id);
+	statsThreadRegister(tname);
+	cpuThreadRegister(CPU_ROLE_TX, iface->interface_id, tname);
+	while (!iface->txstop)
+	{
+		if (readQueue(iface->txq, (void **)&(batch[0]), &inbytes) == EXIT_FAILURE)
+			return NULL;
+		if (batch[0] == NULL)
+			continue;
+
+		iobatch = rconfig.iobatch;
+		if (iobatch > VPL_MAX_BATCH)
+			iobatch = VPL_MAX_BATCH;
+		bytes = findPacketSize(batch[0]);
+		for (n = 1; n < iobatch; n++)
 		{
-			if ((cached = lookupARPCache(in_pkt->frame.nxth_ip_addr,
-						     mac_addr)) == TRUE)
-				COPY_MAC(in_pkt->data.header.dst, mac_addr);
-			else
-			{
-				ARPResolve(in_pkt);
-				continue;
-			}
+			if ((tryReadQueue(iface->txq, (void **)&(batch[n]), &inbytes) == EXIT_FAILURE) ||
+			    (batch[n] == NULL))
+				break;
+			bytes += findPacketSize(batch[n]);
 		}
 
-		iface->devdriver->todev((void *)in_pkt);
+		if (iface->state == INTERFACE_DOWN)
+		{
+			verbose(2, "[GNETTransmitter]:: %d packets dropped! Interface %d not up", n, iface->interface_id);
+			for (i = 0; i < n; i++)
+				releasePacket(batch[i]);
+			__sync_fetch_and_add(&(iface->tx_dropped), n);
+			STATS_DROP(n);
+			continue;
+		}
 
+		if (iface->tx_rate > 0)
+			GNETShape(iface, bytes);
+
+		if ((n > 1) && !strcmp(iface->device_type, ETHERNET_DEVICE))
+			toEthernetDevBatch(iface, batch, n);
+		else
+			for (i = 0; i < n; i++)
+				iface->devdriver->todev((void *)batch[i]);
+		iface->tx_sent += n;
+		STATS_COUNT(n, bytes);
+		TRACE(TRACE_TX, iface->interface_id, n, 0);
 	}
+	return NULL;
 }
-
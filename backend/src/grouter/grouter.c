@@ -15,9 +15,14 @@
 #include "packetcore.h"
 #include "classifier.h"
 #include "filter.h"
+#include "packetpool.h"
+#include "arp.h"
+#include "trace.h"
+#include "stats.h"
+#include "cpu.h"
 #include <pthread.h>
 
-router_config rconfig = {.router_name=NULL, .gini_home=NULL, .cli_flag=0, .config_file=NULL, .config_dir=NULL, .ghandler=0, .clihandler= 0, .scheduler=0, .worker=0, .schedcycle=10000, .schedpolicy="rr"};
+router_config rconfig = {.router_name=NULL, .gini_home=NULL, .cli_flag=0, .config_file=NULL, .config_dir=NULL, .ghandler=0, .clihandler= 0, .scheduler=0, .worker=0, .schedrate=0, .schedburst=0, .poolsize=DEFAULT_POOL_SIZE, .nworkers=1, .arpsize=DEFAULT_ARP_SIZE, .iobatch=1, .iothreads=0, .schedpolicy="rr"};
 pktcore_t *pcore;
 classlist_t *classifier;
 filtertab_t *filter;
@@ -37,6 +42,18 @@ Option grouter_optab[] =
 		"confpath", 'p', "path", "Specify directory with configuration files",
 		required_argument, OPT_STRING, OPT_VARIABLE, &(rconfig.config_dir)
 	},
+	{
+		"poolsize", 'b', "buffers", "Number of packet buffers in the packet pool",
+		required_argument, OPT_INTEGER, OPT_VARIABLE, &(rconfig.poolsize)
+	},
+	{
+		"workers", 'w', "count", "Number of packet worker threads",
+		required_argument, OPT_INTEGER, OPT_VARIABLE, &(rconfig.nworkers)
+	},
+	{
+		"arpsize", 'a', "entries", "Number of entries in the neighbor (ARP) table",
+		required_argument, OPT_INTEGER, OPT_VARIABLE, &(rconfig.arpsize)
+	},
 	{
 		NULL, '\0', NULL, NULL, 0, 0, 0, NULL
 	}
@@ -54,7 +71,7 @@ int isPIDAlive(int pid);
 int main(int ac, char *av[])
 {
 	char rpath[MAX_NAME_LEN];
-	int status, *jstatus;
+	int status, *jstatus, i;
 	simplequeue_t *outputQ, *workQ, *qtoa;
 
 	// setup the program properties
@@ -65,8 +82,17 @@ int main(int ac, char *av[])
 	redefineSignalHandler(SIGUSR1, shutdownRouter);
 	redefineSignalHandler(SIGUSR2, shutdownRouter);
 
-	outputQ = createSimpleQueue("outputQueue", INFINITE_Q_SIZE, 0, 1);
-	workQ = createSimpleQueue("work Queue", INFINITE_Q_SIZE, 0, 1);
+	PacketPoolInit(rconfig.poolsize);
+	// counters of the datapath, published in <config dir>/<router>.stats
+	statsInit(rconfig.config_dir, rconfig.router_name);
+	// CPU and NUMA placement of the threads (cpu command), before they start
+	cpuInit();
+
+	// bounded (ring backed) queues; a full work queue holds back the scheduler,
+	// the output queue drops (GNET handler writes into it when ARP resolves)
+	outputQ = createSimpleQueue("outputQueue", WORK_Q_SIZE, 0, 1);
+	workQ = createSimpleQueue("work Queue", WORK_Q_SIZE, 1, 1);
+	cpuQueueRegister(outputQ, CPU_ROLE_GNET, 0);
 
 	GNETInit(&(rconfig.ghandler), rconfig.config_dir, rconfig.router_name, outputQ);
 	ARPInit();
@@ -79,7 +105,7 @@ int main(int ac, char *av[])
 
 	// add a default Queue.. the createClassifier has already added a rule with "default" tag
 	// char *qname, char *dqisc, double qweight, double delay_us, int nslots);
-	addPktCoreQueue(pcore, "default", "fifo", 1.0, 2.0, 0);
+	addPktCoreQueue(pcore, "default", "fifo", 1.0, 0.0, 0);
 	rconfig.scheduler = PktCoreSchedulerInit(pcore);
 	rconfig.worker = PktCoreWorkerInit(pcore);
 
@@ -96,7 +122,8 @@ int main(int ac, char *av[])
 
 
 	wait4thread(rconfig.scheduler);
-	wait4thread(rconfig.worker);
+	for (i = 0; i < pcore->nworkers; i++)
+		wait4thread(pcore->workers[i].threadid);
 	wait4thread(rconfig.ghandler);
 }
 
@@ -115,7 +142,7 @@ void shutdownRouter()
 	GNETHalt(rconfig.ghandler);
 	verbose(1, "[main]:: shutting down the packet core... "); fflush(stdout);
 	pthread_cancel(rconfig.scheduler);
-	pthread_cancel(rconfig.worker);
+	PktCoreWorkerHalt(pcore);
 	verbose(1, "[main]:: shutting down the CLI handler.. ");
 	pthread_cancel(rconfig.clihandler);
 
@@ -139,9 +166,10 @@ void setupProgram(int ac, char *av[])
 	prog_set_url("http://www.cs.mcgill.ca/~anrl/gini/");
 	prog_set_desc("GINI router provides a user-space IP router for teaching and learning purposes.");
 
-	prog_set_verbosity_level(1);
+	traceSetVerbosity(1);
 
 	indx = prog_opt_process(ac, av);
+	traceSetVerbosity(prog_verbosity_level());        // -v may have changed it
 
 	if (indx < ac)
 		rconfig.router_name = strdup(av[indx]);
@@ -0,0 +1,302 @@
+#include <slack/std.h>
+#include <slack/err.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "grouter.h"
+#include "pktsched.h"
+
+/*
+ * Hierarchical token bucket shaper (after Linux HTB): one part of the
+ * scheduler engine (see sched.c).
+ *
+ * Every class queue of the packet core is a class with a rate (what it
+ * is guaranteed), a ceil (what it may take at most) and a burst, and may
+ * have another queue as its parent. A class below its rate sends on its
+ * own tokens (CAN_SEND). A class above its rate but below its ceil
+ * (MAY_BORROW) sends on the tokens of the first ancestor that is below
+ * its rate, if its ancestors up to that one are below their ceil. A
+ * class above its ceil waits (CANT_SEND). What a class sends is charged
+ * to the ceil of the class and of all its ancestors, and to the rate of
+ * the class that lent the tokens and of its ancestors. A class without
+ * a rate only borrows; a root without a rate is only held by its ceil,
+ * so a class with neither is not shaped at all.
+ *
+ * The tokens are refilled from the time they were last looked at, so a
+ * decision or a charge walks the path of the class to its root and
+ * nothing else: O(HTB_MAX_DEPTH) per packet. A queue that may not send
+ * goes on the timer heap of the engine until the time its path has
+ * tokens again (htbRelease) and the scheduler thread sleeps until then.
+ * The time is a lower bound: if a sibling takes the tokens first, the
+ * queue is held again when it comes up.
+ *
+ * The queues held for the tokens of one parent come due at the same
+ * time; the engine lets the one that has waited longest since it last
+ * borrowed go first, so the borrowers take turns a packet each and share
+ * the excess of their parent equally (Linux HTB shares it by quantum).
+ * The policy (rr, drr, wfq, prio) orders the queues that may send.
+ */
+
+#define HTB_NEVER                   (~0ULL)
+
+#define htbCeil(hc)                 (((hc)->ceil > 0.0) ? (hc)->ceil : (hc)->rate)
+#define htbShaped(hc)               (((hc)->rate > 0.0) || ((hc)->ceil > 0.0) || ((hc)->parent >= 0))
+
+
+void htbInitClass(htbclass_t *hc)
+{
+	bzero(hc, sizeof(htbclass_t));
+	hc->parent = -1;
+}
+
+
+static void htbRefill(htbclass_t *hc, unsigned long long now)
+{
+	double dt;
+
+	if (now <= hc->last)
+		return;
+	dt = (now - hc->last) / 1e9;
+	hc->tokens = min(hc->burst, hc->tokens + dt * hc->rate);
+	hc->ctokens = min(hc->burst, hc->ctokens + dt * htbCeil(hc));
+	hc->last = now;
+}
+
+
+static int htbMode(htbclass_t *hc)
+{
+	if ((htbCeil(hc) > 0.0) && (hc->ctokens < 0.0))
+		return HTB_CANT_SEND;
+	if (hc->rate > 0.0)
+		return (hc->tokens >= 0.0) ? HTB_CAN_SEND : HTB_MAY_BORROW;
+	return (hc->parent < 0) ? HTB_CAN_SEND : HTB_MAY_BORROW;
+}
+
+
+// nanoseconds until a bucket in debt by bytes is back at 0
+static unsigned long long htbNanos(double bytes, double rate)
+{
+	return (unsigned long long)(bytes * 1e9 / rate) + 1;
+}
+
+
+/*
+ * earliest time class id may send, as far as its path knows now
+ */
+static unsigned long long htbWhen(sched_t *s, int id, unsigned long long now)
+{
+	htbclass_t *hc = &(s->queues[id].htb);
+	unsigned long long tceil = now, trate;
+
+	htbRefill(hc, now);
+	if ((htbCeil(hc) > 0.0) && (hc->ctokens < 0.0))
+		tceil = now + htbNanos(-hc->ctokens, htbCeil(hc));
+
+	if (hc->rate > 0.0)
+		trate = (hc->tokens >= 0.0) ? now : now + htbNanos(-hc->tokens, hc->rate);
+	else
+		trate = (hc->parent < 0) ? now : HTB_NEVER;
+	if ((trate > now) && (hc->parent >= 0))
+		trate = min(trate, htbWhen(s, hc->parent, now));
+
+	return max(tceil, trate);
+}
+
+
+/*
+ * now if the queue may send at now, otherwise when it may
+ */
+unsigned long long htbRelease(sched_t *s, schedq_t *sq, unsigned long long now)
+{
+	if (!htbShaped(&(sq->htb)))
+		return now;
+	return htbWhen(s, sq - s->queues, now);
+}
+
+
+/*
+ * the rate a class sent at: an average of samples of
+ * HTB_EST_INTERVAL_NS, where an idle sample counts as one of rate 0
+ */
+static void htbEstimate(htbclass_t *hc, int len, unsigned long long now)
+{
+	double sample, weight;
+	unsigned long long dt;
+
+	hc->estbytes += len;
+	if (now < hc->eststamp + HTB_EST_INTERVAL_NS)
+		return;
+	dt = now - hc->eststamp;
+	sample = hc->estbytes * 1e9 / dt;
+	weight = 1.0 - pow(1.0 - HTB_EST_WEIGHT, (double)(dt / HTB_EST_INTERVAL_NS));
+	hc->estrate += (sample - hc->estrate) * weight;
+	hc->estbytes = 0;
+	hc->eststamp = now;
+}
+
+
+double htbEstRate(htbclass_t *hc, unsigned long long now)
+{
+	htbEstimate(hc, 0, now);
+	return hc->estrate;
+}
+
+
+/*
+ * charge a packet of len bytes the queue sent at now to its path.
+ * RETURNS TRUE if it went on the tokens of an ancestor.
+ */
+int htbCharge(sched_t *s, schedq_t *sq, int len, unsigned long long now)
+{
+	htbclass_t *hc = &(sq->htb);
+	int id, lender = -1;
+
+	htbEstimate(hc, len, now);
+	if (!htbShaped(hc))
+		return FALSE;
+
+	for (id = sq - s->queues; id >= 0; id = hc->parent)
+	{
+		hc = &(s->queues[id].htb);
+		htbRefill(hc, now);
+		if ((lender < 0) && (htbMode(hc) == HTB_CAN_SEND))
+			lender = id;
+		// the classes below the lender only borrowed: their rate is not charged
+		if ((lender >= 0) && (hc->rate > 0.0))
+			hc->tokens = max(hc->tokens - len, -hc->burst);
+		if (htbCeil(hc) > 0.0)
+			hc->ctokens = max(hc->ctokens - len, -hc->burst);
+		if (id == lender && hc != &(sq->htb))
+			hc->lent += len;
+		if (hc != &(sq->htb))
+			htbEstimate(hc, len, now);
+	}
+	if (lender == sq - s->queues)
+		return FALSE;
+	sq->htb.borrowed += len;
+	return TRUE;
+}
+
+
+/*
+ * set the rate and ceil (kbps) and the burst (bytes) of the class of a
+ * queue; a negative value leaves that one as it is, a burst of 0 is 10
+ * milliseconds at the ceil. the buckets start full.
+ */
+int htbSetRate(sched_t *s, schedq_t *sq, double ratekbps, double ceilkbps, int burst, unsigned long long now)
+{
+	htbclass_t *hc = &(sq->htb);
+	double rate, ceil;
+
+	rate = (ratekbps < 0.0) ? hc->rate : ratekbps * 1000.0 / 8.0;
+	ceil = (ceilkbps < 0.0) ? hc->ceil : ceilkbps * 1000.0 / 8.0;
+	if ((ceil > 0.0) && (ceil < rate))
+	{
+		error("[htbSetRate]:: ceil of %s is below its rate ", sq->q->name);
+		return EXIT_FAILURE;
+	}
+	hc->rate = rate;
+	hc->ceil = ceil;
+	if (burst >= 0)
+		hc->burstset = burst;
+
+	hc->burst = (hc->burstset > 0) ? hc->burstset : htbCeil(hc) / 100.0;
+	if (hc->burst < HTB_MIN_BURST)
+		hc->burst = HTB_MIN_BURST;
+	hc->tokens = hc->ctokens = hc->burst;
+	hc->last = now;
+	return EXIT_SUCCESS;
+}
+
+
+// classes from slot id up to its root
+static int htbDepth(sched_t *s, int id)
+{
+	int depth = 0;
+
+	for (; id >= 0; id = s->queues[id].htb.parent)
+		depth++;
+	return depth;
+}
+
+
+/*
+ * make the class of slot parent (-1 for none) the parent of the class
+ * of the queue. the class may not end up below itself and no path may
+ * get longer than HTB_MAX_DEPTH.
+ */
+int htbSetParent(sched_t *s, schedq_t *sq, int parent)
+{
+	int id = sq - s->queues, i, j, below = 0, d;
+
+	for (i = parent; i >= 0; i = s->queues[i].htb.parent)
+		if (i == id)
+		{
+			error("[htbSetParent]:: %s would be its own ancestor ", sq->q->name);
+			return EXIT_FAILURE;
+		}
+
+	// the deepest class below this one
+	for (i = 0; i < s->nslots; i++)
+	{
+		if (s->queues[i].q == NULL)
+			continue;
+		for (j = i, d = 0; (j >= 0) && (j != id); j = s->queues[j].htb.parent)
+			d++;
+		if (j == id)
+			below = max(below, d);
+	}
+	if (htbDepth(s, parent) + 1 + below > HTB_MAX_DEPTH)
+	{
+		error("[htbSetParent]:: classes may only be %d deep ", HTB_MAX_DEPTH);
+		return EXIT_FAILURE;
+	}
+
+	if (sq->htb.parent >= 0)
+		s->queues[sq->htb.parent].htb.nchildren--;
+	sq->htb.parent = parent;
+	if (parent >= 0)
+		s->queues[parent].htb.nchildren++;
+	return EXIT_SUCCESS;
+}
+
+
+/*
+ * the class of the queue goes away: its children move up to its parent
+ */
+void htbDelClass(sched_t *s, schedq_t *sq)
+{
+	int id = sq - s->queues, i;
+
+	for (i = 0; i < s->nslots; i++)
+		if ((s->queues[i].q != NULL) && (s->queues[i].htb.parent == id))
+			htbSetParent(s, &(s->queues[i]), sq->htb.parent);
+	htbSetParent(s, sq, -1);
+}
+
+
+void htbPrint(sched_t *s, unsigned long long now)
+{
+	static char *modes[] = {"rate", "borrow", "ceil"};
+	schedq_t *sq;
+	htbclass_t *hc;
+	int i, header = 0;
+
+	for (i = 0; i < s->nslots; i++)
+	{
+		sq = &(s->queues[i]);
+		hc = &(sq->htb);
+		if ((sq->q == NULL) || !htbShaped(hc))
+			continue;
+		if (!header)
+		{
+			printf("\nClass\t\tParent\t\tRate\tCeil\tBurst\tTokens\tCtokens\tMode\tSent(kbps)\tBorrowed\tHeld\n");
+			header = 1;
+		}
+		htbRefill(hc, now);
+		printf("%-16s%-16s%.0f\t%.0f\t%.0f\t%.0f\t%.0f\t%s\t%-12.1f\t%-12lu\t%lu\n", sq->q->name,
+		       (hc->parent >= 0) ? s->queues[hc->parent].q->name : "-",
+		       hc->rate * 8.0 / 1000.0, htbCeil(hc) * 8.0 / 1000.0, hc->burst, hc->tokens, hc->ctokens,
+		       modes[htbMode(hc)], htbEstRate(hc, now) * 8.0 / 1000.0, hc->borrowed, hc->nheld);
+	}
+}
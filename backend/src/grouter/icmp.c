@@ -11,7 +11,9 @@
 #include "icmp.h"
 #include "ip.h"
 #include "message.h"
+#include "packetpool.h"
 #include "grouter.h"
+#include "checksum.h"
 #include <slack/err.h>
 #include <netinet/in.h>
 #include <sys/time.h>
@@ -28,7 +30,7 @@ pingstat_t pstat;
  */
 void ICMPProcessPacket(gpacket_t *in_pkt)
 {
-	ip_packet_t *ip_pkt = (ip_packet_t *)in_pkt->data.data;
+	ip_packet_t *ip_pkt = (ip_packet_t *)GPKT_PAYLOAD(in_pkt);
 	int iphdrlen = ip_pkt->ip_hdr_len *4;
 	icmphdr_t *icmphdr = (icmphdr_t *)((uchar *)ip_pkt + iphdrlen);
 
@@ -95,17 +97,24 @@ void ICMPDoPing(uchar *ipaddr, int pkt_size, int retries)
 
 void ICMPSendPingPacket(uchar *dst_ip, int size, int seq)
 {
-	gpacket_t *out_pkt = (gpacket_t *) malloc(sizeof(gpacket_t));
-	ip_packet_t *ipkt = (ip_packet_t *)(out_pkt->data.data);
-	ipkt->ip_hdr_len = 5;                                  // no IP header options!!
-	icmphdr_t *icmphdr = (icmphdr_t *)((uchar *)ipkt + ipkt->ip_hdr_len*4);
+	gpacket_t *out_pkt;
+	ip_packet_t *ipkt;
+	icmphdr_t *icmphdr;
 	ushort cksum;
-	struct timeval *tp = (struct timeval *)((uchar *)icmphdr + 8);
+	struct timeval *tp;
 	struct timezone tz;
 	uchar *dataptr;
 	int i;
 	char tmpbuf[64];
 
+	// a buffer that holds the whole message: up to a jumbo frame
+	if ((out_pkt = newPacketSize(ETHER_HEADER_LEN + 20 + size)) == NULL)
+		return;
+	ipkt = (ip_packet_t *)GPKT_PAYLOAD(out_pkt);
+	ipkt->ip_hdr_len = 5;                                  // no IP header options!!
+	icmphdr = (icmphdr_t *)((uchar *)ipkt + ipkt->ip_hdr_len*4);
+	tp = (struct timeval *)((uchar *)icmphdr + 8);
+
 	pstat.ntransmitted++;
 
 	icmphdr->type = ICMP_ECHO_REQUEST;
@@ -130,17 +139,18 @@ void ICMPSendPingPacket(uchar *dst_ip, int size, int seq)
 	// tag the message as new packet
 	// IPOutgoingPacket(/context, packet, IPaddr, size, newflag, source)
 	IPOutgoingPacket(out_pkt, dst_ip, size, 1, ICMP_PROTOCOL);
+	releasePacket(out_pkt);
 }
 
 
 
 
 /*
- * Send TTL expired message.
+ * Send time exceeded message (code: TTL or reassembly time).
  */
-void ICMPProcessTTLExpired(gpacket_t *in_pkt)
+static void ICMPSendTimeExceeded(gpacket_t *in_pkt, int code)
 {
-	ip_packet_t *ipkt = (ip_packet_t *)in_pkt->data.data;
+	ip_packet_t *ipkt = (ip_packet_t *)GPKT_PAYLOAD(in_pkt);
 	int iphdrlen = ipkt->ip_hdr_len *4;
 	icmphdr_t *icmphdr = (icmphdr_t *)((uchar *)ipkt + iphdrlen);
 	ushort cksum;
@@ -155,15 +165,15 @@ void ICMPProcessTTLExpired(gpacket_t *in_pkt)
 	 * header ...
 	 */
 	icmphdr->type = ICMP_TTL_EXPIRED;
-	icmphdr->code = 0; 
+	icmphdr->code = code;
 	icmphdr->checksum = 0;
 	bzero((void *)&(icmphdr->un), sizeof(icmphdr->un));
 	memcpy(((uchar *)icmphdr + 8), prevbytes, iprevlen);    /* ip header + 64 bits of original pkt */
 	cksum = checksum((uchar *)icmphdr, (8 + iprevlen)/2 );
 	icmphdr->checksum = htons(cksum);
 
-	verbose(2, "[ICMPProcessTTLExpired]:: Sending... ICMP TTL expired message ");
-	printf("Checksum at ICMP routine (TTL expired):  %x\n", cksum);
+	verbose(2, "[ICMPSendTimeExceeded]:: Sending... ICMP time exceeded message (code %d) ", code);
+	printf("Checksum at ICMP routine (time exceeded):  %x\n", cksum);
 
 	// send the message back to the IP module for further processing ..
 	// set the messsage as REPLY_PACKET
@@ -171,31 +181,39 @@ void ICMPProcessTTLExpired(gpacket_t *in_pkt)
 }
 
 
+void ICMPProcessTTLExpired(gpacket_t *in_pkt)
+{
+	ICMPSendTimeExceeded(in_pkt, ICMP_EXC_TTL);
+}
+
+
+/*
+ * the datagram of the first fragment in_pkt was not reassembled in time
+ */
+void ICMPProcessFragTimeExceeded(gpacket_t *in_pkt)
+{
+	ICMPSendTimeExceeded(in_pkt, ICMP_EXC_FRAGTIME);
+}
+
+
 
 /*
  * send a PING reply in response to the incoming REQUEST
  */
 void ICMPProcessEchoRequest(gpacket_t *in_pkt)
 {
-	ip_packet_t *ipkt = (ip_packet_t *)in_pkt->data.data;
+	ip_packet_t *ipkt = (ip_packet_t *)GPKT_PAYLOAD(in_pkt);
 	int iphdrlen = ipkt->ip_hdr_len *4;
 	icmphdr_t *icmphdr = (icmphdr_t *)((uchar *)ipkt + iphdrlen);
-	uchar *icmppkt_b = (uchar *)icmphdr;
-
-	ushort cksum;
-	int ilen = ntohs(ipkt->ip_pkt_len) - iphdrlen;
-
+	ushort oldval, newval;
 
+	// only the type changes: update the checksum for it (RFC 1624)
+	// rather than summing the message again, which may go on in the
+	// segments of a jumbo frame
+	oldval = htons((icmphdr->type << 8) | icmphdr->code);
 	icmphdr->type = ICMP_ECHO_REPLY;
-	icmphdr->checksum = 0;
-	if (IS_ODD(ilen))
-	{
-		// pad with a zero byte.. IP packet length remains the same 
-		icmppkt_b[ilen] = 0x0;
-		ilen++;
-	}
-	cksum = checksum(icmppkt_b, (ilen/2));
-	icmphdr->checksum = htons(cksum);
+	newval = htons((icmphdr->type << 8) | icmphdr->code);
+	icmphdr->checksum = checksumAdjust(icmphdr->checksum, oldval, newval);
 	
 	// send the message back to the IP routine for further processing ..
 	// set the messsage as REPLY_PACKET..
@@ -214,7 +232,7 @@ void ICMPProcessEchoRequest(gpacket_t *in_pkt)
  */
 void ICMPProcessEchoReply(gpacket_t *in_pkt)
 {
-	ip_packet_t *ipkt = (ip_packet_t *)in_pkt->data.data;
+	ip_packet_t *ipkt = (ip_packet_t *)GPKT_PAYLOAD(in_pkt);
 	int iphdrlen = ipkt->ip_hdr_len *4;
 	icmphdr_t *icmphdr = (icmphdr_t *)((uchar *)ipkt + iphdrlen);
 	uchar *icmppkt_b = (uchar *)icmphdr;
@@ -243,7 +261,7 @@ void ICMPProcessEchoReply(gpacket_t *in_pkt)
  */
 void ICMPProcessRedirect(gpacket_t *in_pkt, uchar *gw_addr)
 {
-	ip_packet_t *ipkt = (ip_packet_t *)in_pkt->data.data;
+	ip_packet_t *ipkt = (ip_packet_t *)GPKT_PAYLOAD(in_pkt);
 	int iphdrlen = ipkt->ip_hdr_len * 4;
 	icmphdr_t *icmphdr = (icmphdr_t *)((uchar *)ipkt + iphdrlen);
 	int iprevlen = iphdrlen + 8;  // IP header + 64 bits
@@ -277,7 +295,7 @@ void ICMPProcessRedirect(gpacket_t *in_pkt, uchar *gw_addr)
  */
 void ICMPProcessFragNeeded(gpacket_t *in_pkt, int interface_mtu)
 {
-	ip_packet_t *ipkt = (ip_packet_t *)in_pkt->data.data;
+	ip_packet_t *ipkt = (ip_packet_t *)GPKT_PAYLOAD(in_pkt);
 	int iphdrlen = ipkt->ip_hdr_len *4;
 	icmphdr_t *icmphdr = (icmphdr_t *)((uchar *)ipkt + iphdrlen);
 	int iprevlen = iphdrlen + 8;  // IP header + 64 bits
@@ -290,7 +308,7 @@ void ICMPProcessFragNeeded(gpacket_t *in_pkt, int interface_mtu)
 	icmphdr->type = ICMP_DEST_UNREACH;
 	icmphdr->code = ICMP_FRAG_NEEDED; 
 	icmphdr->checksum = 0;
-	icmphdr->un.frag.mtu = interface_mtu;
+	icmphdr->un.frag.mtu = htons(interface_mtu);
 	memcpy(((uchar *)icmphdr + 8), prevbytes, iprevlen);    // OLD ip header + 64 bits of original pkt 
 	cksum = checksum((uchar *)icmphdr, (8 + iprevlen)/2 );
 	icmphdr->checksum = htons(cksum);
@@ -10,6 +10,9 @@
 #include "cli.h"
 #include "simplequeue.h"
 #include "info.h"
+#include "packetpool.h"
+#include "packetcore.h"
+#include "cpu.h"
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
@@ -22,6 +25,9 @@
  * Some global variables!
  */
 info_config_t  iconf;
+extern pktcore_t *pcore;
+
+static schedclassstats_t cstats[MAX_SCHED_QUEUES];
 
 
 
@@ -55,9 +61,12 @@ void infoHandler()
 	int len;
 	time_t tval;
 	Lister *lster;
+	pktpoolstats_t pstats;
+	int i, nclasses;
 
 
 	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+	cpuThreadRegister(CPU_ROLE_CONTROL, 1, "info");
 	while(1)
 	{
 		sleep(iconf.updateinterval);
@@ -82,6 +91,26 @@ void infoHandler()
 			write_to_fifo(iconf.id, linebuf, strlen(linebuf));
 		}
 		lister_release(lster);
+
+		// the class queues of the packet core with their shapers (kbps)
+		nclasses = getPktCoreClassStats(pcore, cstats, MAX_SCHED_QUEUES);
+		sprintf(linebuf, "//Time stamp\t Class name\t Parent\t Rate\t Ceil\t Send rate\t Backlog\t Backlog bytes\t Borrowed bytes\n");
+		write_to_fifo(iconf.id, linebuf, strlen(linebuf));
+		for (i = 0; i < nclasses; i++)
+		{
+			snprintf(linebuf, sizeof(linebuf), "%s\t%s\t%s\t%.1f\t%.1f\t%.1f\t%d\t%d\t%lu\n", timestr, cstats[i].name,
+				(cstats[i].parent[0] != 0) ? cstats[i].parent : "-", cstats[i].rate * 8.0 / 1000.0,
+				cstats[i].ceil * 8.0 / 1000.0, cstats[i].sendrate * 8.0 / 1000.0, cstats[i].backlog,
+				cstats[i].backlogbytes, cstats[i].borrowed);
+			write_to_fifo(iconf.id, linebuf, strlen(linebuf));
+		}
+
+		getPacketPoolStats(&pstats);
+		sprintf(linebuf, "//Time stamp\t Pool size\t Pool free\t Pool in use\t Pool exhausted\n");
+		len = strlen(linebuf);
+		sprintf(linebuf+len, "%s\t%d\t%d\t%d\t%lu\n", timestr, pstats.total, pstats.free + pstats.cached,
+			pstats.inuse + pstats.heapinuse, pstats.exhausted);
+		write_to_fifo(iconf.id, linebuf, strlen(linebuf));
 	}
 
 }
@@ -11,22 +11,29 @@
 #include "mtu.h"
 #include "protocols.h"
 #include "ip.h"
+#include "checksum.h"
+#include "trace.h"
 #include "fragment.h"
 #include "packetcore.h"
+#include "packetpool.h"
+#include "arp.h"
+#include "flowcache.h"
 #include <stdlib.h>
 #include <slack/err.h>
 #include <netinet/in.h>
 #include <string.h>
 
-route_entry_t route_tbl[MAX_ROUTES];       	// routing table
-mtu_entry_t MTU_tbl[MAX_MTU];		        // MTU table
+route_table_t *route_tbl;                 	// routing table
+mtu_table_t *MTU_tbl;		        	// MTU table
 
 extern pktcore_t *pcore;
 
 void IPInit()
 {
-	RouteTableInit(route_tbl);
-	MTUTableInit(MTU_tbl);
+	route_tbl = createRouteTable();
+	MTU_tbl = createMTUTable();
+	reassemblyInit();
+	flowInit(FLOW_DEFAULT_SIZE);
 }
 
 
@@ -36,30 +43,46 @@ void IPInit()
  * Or it could be a packet meant for forwarding: either unicast or multicast/broadcast.
  * This is a wrapper routine that calls the appropriate subroutine to take
  * the appropriate function.
+ * The packets of a flow seen before take the decision cached for it
+ * (see flowcache.c); a packet that needs fragmenting goes the long way.
  */
 void IPIncomingPacket(gpacket_t *in_pkt)
 {
 	char tmpbuf[MAX_TMPBUF_LEN];
 	// get a pointer to the IP packet
-        ip_packet_t *ip_pkt = (ip_packet_t *)&in_pkt->data.data;
+        ip_packet_t *ip_pkt = (ip_packet_t *)GPKT_PAYLOAD(in_pkt);
 	uchar bcast_ip[] = IP_BCAST_ADDR;
-        
+	flow_entry_t flow;
+	int action;
+
+	action = flowLookup(in_pkt, &flow);
+	if ((action == FLOW_FORWARD) && (ntohs(ip_pkt->ip_pkt_len) <= flow.mtu))
+	{
+		VERBOSE(2, "[IPIncomingPacket]:: got IP packet of a cached flow");
+		IPForwardFlowPacket(in_pkt, &flow);
+		return;
+	}
+
 	// Is this IP packet for me??
-	if (IPCheckPacket4Me(in_pkt))
+	if ((action == FLOW_LOCAL) || IPCheckPacket4Me(in_pkt))
 	{
-		verbose(2, "[IPIncomingPacket]:: got IP packet destined to this router");
+		VERBOSE(2, "[IPIncomingPacket]:: got IP packet destined to this router");
+		if (action == FLOW_LOCAL)
+			TRACE(TRACE_IP_LOCAL, traceIP(ip_pkt->ip_dst), 0, 0);
+		else
+			flowCacheLocal(&flow);
 		IPProcessMyPacket(in_pkt);
 	} else if (COMPARE_IP(gNtohl(tmpbuf, ip_pkt->ip_dst), bcast_ip) == 0)
 	{           
 		// TODO: rudimentary 'broadcast IP address' check
-		verbose(2, "[IPIncomingPacket]:: not repeat broadcast (final destination %s), packet thrown",
+		VERBOSE(2, "[IPIncomingPacket]:: not repeat broadcast (final destination %s), packet thrown",
 		       IP2Dot(tmpbuf, gNtohl((tmpbuf+20), ip_pkt->ip_dst)));
 		IPProcessBcastPacket(in_pkt);
 	} else
 	{
 		// Destinated to someone else 
-		verbose(2, "[IPIncomingPacket]:: got IP packet destined to someone else");
-		IPProcessForwardingPacket(in_pkt);
+		VERBOSE(2, "[IPIncomingPacket]:: got IP packet destined to someone else");
+		IPProcessForwardingPacket(in_pkt, &flow);
 	}
 }
 
@@ -72,21 +95,22 @@ void IPIncomingPacket(gpacket_t *in_pkt)
  */
 int IPCheckPacket4Me(gpacket_t *in_pkt)
 {
-	ip_packet_t *ip_pkt = (ip_packet_t *)&in_pkt->data.data;
+	ip_packet_t *ip_pkt = (ip_packet_t *)GPKT_PAYLOAD(in_pkt);
 	char tmpbuf[MAX_TMPBUF_LEN];
 	int count, i;
 	uchar iface_ip[MAX_MTU][4];
 	uchar pkt_ip[4];
 
 	COPY_IP(pkt_ip, gNtohl(tmpbuf, ip_pkt->ip_dst));
-	verbose(2, "[IPCheckPacket4Me]:: looking for IP %s ", IP2Dot(tmpbuf, pkt_ip));
+	VERBOSE(2, "[IPCheckPacket4Me]:: looking for IP %s ", IP2Dot(tmpbuf, pkt_ip));
 	if ((count = findAllInterfaceIPs(MTU_tbl, iface_ip)) > 0)
 	{
 		for (i = 0; i < count; i++)
 		{
 			if (COMPARE_IP(iface_ip[i], pkt_ip) == 0)
 			{
-				verbose(2, "[IPCheckPacket4Me]:: found a matching IP.. for %s ", IP2Dot(tmpbuf, pkt_ip));
+				VERBOSE(2, "[IPCheckPacket4Me]:: found a matching IP.. for %s ", IP2Dot(tmpbuf, pkt_ip));
+				TRACE(TRACE_IP_LOCAL, traceIP(ip_pkt->ip_dst), 0, 0);
 				return TRUE;
 			}
 		}
@@ -108,9 +132,40 @@ int IPProcessBcastPacket(gpacket_t *in_pkt)
 
 
 
+/*
+ * forward a packet of a cached flow (that fits the MTU of the link):
+ * the errors are checked as for any packet, the rest of the decision
+ * comes from the cache, next hop MAC included.
+ */
+int IPForwardFlowPacket(gpacket_t *in_pkt, flow_entry_t *flow)
+{
+	ip_packet_t *ip_pkt = (ip_packet_t *)GPKT_PAYLOAD(in_pkt);
+
+	if (IPCheck4Errors(in_pkt) == EXIT_FAILURE)
+		return EXIT_FAILURE;
+
+	in_pkt->frame.dst_interface = flow->dst_interface;
+	COPY_IP(in_pkt->frame.nxth_ip_addr, flow->nxth_ip_addr);
+	TRACE(TRACE_IP_FORWARD, traceIP(ip_pkt->ip_src), traceIP(ip_pkt->ip_dst), ip_pkt->ip_ttl);
+	if (flow->redirect)
+		IPCheck4Redirection(in_pkt);
+
+	GPKT_ETH(in_pkt)->header.prot = htons(IP_PROTOCOL);
+	COPY_MAC(GPKT_ETH(in_pkt)->header.dst, flow->mac_addr);
+	in_pkt->frame.arp_valid = TRUE;
+	if (IPSend2Output(in_pkt) == EXIT_FAILURE)
+	{
+		VERBOSE(1, "[IPForwardFlowPacket]:: WARNING: could not forward packet ");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+
 /*
  * process an IP packet destined to someone else...
  * ARGUMENT: in_pkt - pointer to incoming packet
+ *           flow - what flowLookup left to cache the decision (or NULL)
  * 
  * Error processing: Check for conditions that generate ICMP packets.
  * For example, TTL expired, redirect, mulformed packets, ...
@@ -120,14 +175,15 @@ int IPProcessBcastPacket(gpacket_t *in_pkt)
  *
  * Forward packet and fragments (could be multicasting)
  */
-int IPProcessForwardingPacket(gpacket_t *in_pkt)
+int IPProcessForwardingPacket(gpacket_t *in_pkt, flow_entry_t *flow)
 {
-	gpacket_t *pkt_frags[MAX_FRAGMENTS];
-	ip_packet_t *ip_pkt = (ip_packet_t *)in_pkt->data.data;
-	int num_frags, i, need_frag;
+	ip_packet_t *ip_pkt = (ip_packet_t *)GPKT_PAYLOAD(in_pkt);
+	int need_frag, redirect;
+	uchar mac_addr[6];
+	unsigned long long until;
 	char tmpbuf[MAX_TMPBUF_LEN];
  
-	verbose(2, "[IPProcessForwardingPacket]:: checking for any IP errors..");
+	VERBOSE(2, "[IPProcessForwardingPacket]:: checking for any IP errors..");
 	// all the validation and ICMP generation, processing is
 	// done in this function...
 	if (IPCheck4Errors(in_pkt) == EXIT_FAILURE)
@@ -139,12 +195,13 @@ int IPProcessForwardingPacket(gpacket_t *in_pkt)
 			   in_pkt->frame.nxth_ip_addr, 
 			   &(in_pkt->frame.dst_interface)) == EXIT_FAILURE)
 		return EXIT_FAILURE;
+	TRACE(TRACE_IP_FORWARD, traceIP(ip_pkt->ip_src), traceIP(ip_pkt->ip_dst), ip_pkt->ip_ttl);
 
 	// check for redirection?? -- the output interface is already found 
 	// by the previous command.. if needed the following routine sends the 
 	// redirects but the packet is sent to destination..
 	// TODO: Check the RFC for conformance??
-	IPCheck4Redirection(in_pkt);
+	redirect = IPCheck4Redirection(in_pkt);
 
 	// check for fragmentation -- this should return three conditions:
 	// FRAGS_NONE, FRAGS_ERROR, MORE_FRAGS
@@ -153,38 +210,40 @@ int IPProcessForwardingPacket(gpacket_t *in_pkt)
 	switch (need_frag)
 	{
 	case FRAGS_NONE:
-		verbose(2, "[IPProcessForwardingPacket]:: sending packet to GNET..");
-		// compute the checksum before sending out.. the fragmentation routine does this inside it.
-		ip_pkt->ip_cksum = 0;
-		ip_pkt->ip_cksum = htons(checksum((uchar *)ip_pkt, ip_pkt->ip_hdr_len *2));
+		VERBOSE(2, "[IPProcessForwardingPacket]:: sending packet to GNET..");
+		// the checksum was updated with the TTL (IPDecrementTTL).. the
+		// fragmentation routine computes the checksums of the fragments.
+		// a flow is cached once its next hop MAC is known; the MAC
+		// saves the GNET handler its ARP lookup as well.
+		if ((flow != NULL) && (ARPFindFresh(in_pkt->frame.nxth_ip_addr, mac_addr, &until) == EXIT_SUCCESS))
+		{
+			flowCacheForward(flow, in_pkt, findMTU(MTU_tbl, in_pkt->frame.dst_interface),
+					 mac_addr, until, redirect);
+			GPKT_ETH(in_pkt)->header.prot = htons(IP_PROTOCOL);
+			COPY_MAC(GPKT_ETH(in_pkt)->header.dst, mac_addr);
+			in_pkt->frame.arp_valid = TRUE;
+		}
 		if (IPSend2Output(in_pkt) == EXIT_FAILURE)
 		{
-			verbose(1, "[IPProcessForwardingPacket]:: WARNING: IPProcessForwardingPacket(): Could not forward packets ");
+			VERBOSE(1, "[IPProcessForwardingPacket]:: WARNING: IPProcessForwardingPacket(): Could not forward packets ");
 			return EXIT_FAILURE;
 		}
 		break;
 
 	case FRAGS_ERROR:
-		verbose(2, "[IPProcessForwardingPacket]:: unreachable on packet from %s",
+		VERBOSE(2, "[IPProcessForwardingPacket]:: unreachable on packet from %s",
 			IP2Dot(tmpbuf, gNtohl((tmpbuf+20), ip_pkt->ip_src)));
-		ICMPProcessFragNeeded(in_pkt);
+		__sync_fetch_and_add(&(fragstats.fragfails), 1);
+		ICMPProcessFragNeeded(in_pkt, findMTU(MTU_tbl, in_pkt->frame.dst_interface));
 		break;
 
 	case MORE_FRAGS:
-		// fragment processing... 
-		num_frags = fragmentIPPacket(in_pkt, pkt_frags);
-
-		verbose(2, "[IPProcessForwardingPacket]:: IP packet needs fragmentation");
-		// forward each fragment
-		for (i = 0; i < num_frags; i++)
+		VERBOSE(2, "[IPProcessForwardingPacket]:: IP packet needs fragmentation");
+		if (IPSendFragments(in_pkt) == EXIT_FAILURE)
 		{
-			if (IPSend2Output(pkt_frags[i]) == EXIT_FAILURE)
-			{
-				verbose(1, "[IPProcessForwardingPacket]:: processForwardIPPacket(): Could not forward packets ");
-				return EXIT_FAILURE;
-			}
+			VERBOSE(1, "[IPProcessForwardingPacket]:: processForwardIPPacket(): Could not forward packets ");
+			return EXIT_FAILURE;
 		}
-		deallocateFragments(pkt_frags, num_frags);
 		break;
 	default:
 		return EXIT_FAILURE;
@@ -193,10 +252,27 @@ int IPProcessForwardingPacket(gpacket_t *in_pkt)
 }
 
 
+/*
+ * decrement the TTL and update the header checksum for the change
+ * (RFC 1624) instead of computing it again. returns the new TTL.
+ */
+int IPDecrementTTL(ip_packet_t *ip_pkt)
+{
+	ushort oldval, newval;
+
+	// the TTL shares a 16-bit word of the header with the protocol
+	oldval = htons((ip_pkt->ip_ttl << 8) | ip_pkt->ip_prot);
+	ip_pkt->ip_ttl--;
+	newval = htons((ip_pkt->ip_ttl << 8) | ip_pkt->ip_prot);
+	ip_pkt->ip_cksum = checksumAdjust(ip_pkt->ip_cksum, oldval, newval);
+	return ip_pkt->ip_ttl;
+}
+
+
 int IPCheck4Errors(gpacket_t *in_pkt)
 {
 	char tmpbuf[MAX_TMPBUF_LEN];
-	ip_packet_t *ip_pkt = (ip_packet_t *)in_pkt->data.data;
+	ip_packet_t *ip_pkt = (ip_packet_t *)GPKT_PAYLOAD(in_pkt);
 
 	// check for valid version and checksum.. silently drop the packet if not.
 	if (IPVerifyPacket(ip_pkt) == EXIT_FAILURE)
@@ -204,11 +280,11 @@ int IPCheck4Errors(gpacket_t *in_pkt)
 
 	// Decrement TTL, if TTL <= 0, send to ICMP module with TTL-expired command
 	// return EXIT_FAILURE
-	if (--ip_pkt->ip_ttl <= 0)
+	if (IPDecrementTTL(ip_pkt) <= 0)
 	{
-		verbose(2, "[processIPErrors]:: TTL expired on packet from %s",
+		VERBOSE(2, "[processIPErrors]:: TTL expired on packet from %s",
 		       IP2Dot(tmpbuf, gNtohl((tmpbuf+20), ip_pkt->ip_src)));
-		
+		TRACE(TRACE_DROP, TRACE_DROP_TTL, in_pkt->frame.src_interface, 0);
 		ICMPProcessTTLExpired(in_pkt);
 		return EXIT_FAILURE;
 	}
@@ -233,9 +309,9 @@ int IPCheck4Fragmentation(gpacket_t *in_pkt)
 {
 	int link_mtu;
 	char tmpbuf[MAX_TMPBUF_LEN];
-	ip_packet_t *ip_pkt = (ip_packet_t *)in_pkt->data.data;
+	ip_packet_t *ip_pkt = (ip_packet_t *)GPKT_PAYLOAD(in_pkt);
 
-	verbose(2, "[IPCheck4Fragmentation]:: .. checking mtu for next hop %s and interface %d ", 
+	VERBOSE(2, "[IPCheck4Fragmentation]:: .. checking mtu for next hop %s and interface %d ", 
 		IP2Dot(tmpbuf, in_pkt->frame.nxth_ip_addr), in_pkt->frame.dst_interface);
 
 	if ((link_mtu = findMTU(MTU_tbl, in_pkt->frame.dst_interface)) < 0)
@@ -243,7 +319,7 @@ int IPCheck4Fragmentation(gpacket_t *in_pkt)
 	
 	if (link_mtu < ntohs(ip_pkt->ip_pkt_len))                 // need fragmentation
 	{
-		if (TEST_DF_BITS(ip_pkt->ip_frag_off))    // DF is set: destination unreachable
+		if (TEST_DF_BITS(ntohs(ip_pkt->ip_frag_off)))    // DF is set: destination unreachable
 			return FRAGS_ERROR;
 		return MORE_FRAGS;
 	} else
@@ -253,31 +329,35 @@ int IPCheck4Fragmentation(gpacket_t *in_pkt)
 
 
 /*
- * check for redirection condition. This function always returns
- * success. That is no matter whether redirection was sent or not
- * it returns success!
+ * check for redirection condition. returns TRUE if a redirect was sent
+ * (the source is on the network of the next hop) and FALSE otherwise;
+ * either way the packet is to be forwarded.
  */
 int IPCheck4Redirection(gpacket_t *in_pkt)
 {
 	char tmpbuf[MAX_TMPBUF_LEN];
 	gpacket_t *cp_pkt;
-	ip_packet_t *ip_pkt = (ip_packet_t *)in_pkt->data.data;
+	ip_packet_t *ip_pkt = (ip_packet_t *)GPKT_PAYLOAD(in_pkt);
 
 	// check for redirect condition and send an ICMP back... let the current packet
 	// go as well (check the specification??)
 	if (isInSameNetwork(gNtohl(tmpbuf, ip_pkt->ip_src), in_pkt->frame.nxth_ip_addr) == EXIT_SUCCESS)
 	{
-		verbose(2, "[processIPErrors]:: redirect message sent on packet from %s",
+		VERBOSE(2, "[processIPErrors]:: redirect message sent on packet from %s",
 		       IP2Dot(tmpbuf, gNtohl((tmpbuf+20), ip_pkt->ip_src)));
 		
-		cp_pkt = duplicatePacket(in_pkt);
-
-		ICMPProcessRedirect(cp_pkt, cp_pkt->frame.nxth_ip_addr);
+		// the redirect only quotes the IP header + 64 bits of the packet
+		if ((cp_pkt = duplicatePacketHead(in_pkt, ip_pkt->ip_hdr_len * 4 + 8)) != NULL)
+		{
+			ICMPProcessRedirect(cp_pkt, cp_pkt->frame.nxth_ip_addr);
+			releasePacket(cp_pkt);
+		}
+		return TRUE;
 	}
 	
 	// IP packet is verified to be good. This packet should be
 	// further processed to carry out forwarding.
-	return EXIT_SUCCESS;
+	return FALSE;
 }
 
 
@@ -298,10 +378,22 @@ int IPCheck4Redirection(gpacket_t *in_pkt)
  */
 int IPProcessMyPacket(gpacket_t *in_pkt)
 {
-	ip_packet_t *ip_pkt = (ip_packet_t *)in_pkt->data.data;
+	ip_packet_t *ip_pkt = (ip_packet_t *)GPKT_PAYLOAD(in_pkt);
+	gpacket_t *whole;
+	int status;
 
 	if (IPVerifyPacket(ip_pkt) == EXIT_SUCCESS)
 	{
+		// a fragment: the datagram is processed when it is complete
+		if (ntohs(ip_pkt->ip_frag_off) & (IP_MF | IP_OFFMASK))
+		{
+			if ((whole = reassembleIPPacket(in_pkt)) == NULL)
+				return EXIT_SUCCESS;
+			status = IPProcessMyPacket(whole);
+			releasePacket(whole);
+			return status;
+		}
+
 		// Is packet ICMP? send it to the ICMP module 
 		// further processing with appropriate type code
 		
@@ -325,7 +417,7 @@ int IPProcessMyPacket(gpacket_t *in_pkt)
  */
 int UDPProcess(gpacket_t *in_pkt)
 {
-	verbose(2, "[UDPProcess]:: packet received for processing.. NOT YET IMPLEMENTED!! ");
+	VERBOSE(2, "[UDPProcess]:: packet received for processing.. NOT YET IMPLEMENTED!! ");
 	return EXIT_SUCCESS;
 }
 
@@ -340,7 +432,7 @@ int UDPProcess(gpacket_t *in_pkt)
  */
 int IPOutgoingPacket(gpacket_t *pkt, uchar *dst_ip, int size, int newflag, int src_prot)
 {
-        ip_packet_t *ip_pkt = (ip_packet_t *)pkt->data.data;
+        ip_packet_t *ip_pkt = (ip_packet_t *)GPKT_PAYLOAD(pkt);
 	ushort cksum;
 	char tmpbuf[MAX_TMPBUF_LEN];
 	uchar iface_ip_addr[4];
@@ -355,6 +447,8 @@ int IPOutgoingPacket(gpacket_t *pkt, uchar *dst_ip, int size, int newflag, int s
 	{
 		COPY_IP(ip_pkt->ip_dst, ip_pkt->ip_src); 		    // set dst to original src
 		COPY_IP(ip_pkt->ip_src, gHtonl(tmpbuf, pkt->frame.src_ip_addr));    // set src to me
+		if (size > 0)                                   // an error message quoting the packet
+			ip_pkt->ip_pkt_len = htons(size + ip_pkt->ip_hdr_len * 4);
 
 		// find the nexthop and interface and fill them in the "meta" frame		
 		// NOTE: the packet itself is not modified by this lookup!
@@ -376,21 +470,21 @@ int IPOutgoingPacket(gpacket_t *pkt, uchar *dst_ip, int size, int newflag, int s
 		COPY_IP(ip_pkt->ip_dst, gHtonl(tmpbuf, dst_ip));	
 		ip_pkt->ip_pkt_len = htons(size + ip_pkt->ip_hdr_len * 4);
 
-		verbose(2, "[IPOutgoingPacket]:: lookup next hop ");
+		VERBOSE(2, "[IPOutgoingPacket]:: lookup next hop ");
 		// find the nexthop and interface and fill them in the "meta" frame		
 		// NOTE: the packet itself is not modified by this lookup!
 		if (findRouteEntry(route_tbl, gNtohl(tmpbuf, ip_pkt->ip_dst), 
 				   pkt->frame.nxth_ip_addr, &(pkt->frame.dst_interface)) == EXIT_FAILURE)
 				   return EXIT_FAILURE; 
 
-		verbose(2, "[IPOutgoingPacket]:: lookup MTU of nexthop");
+		VERBOSE(2, "[IPOutgoingPacket]:: lookup MTU of nexthop");
 		// lookup the IP address of the destination interface..
 		if ((status = findInterfaceIP(MTU_tbl, pkt->frame.dst_interface,
 					      iface_ip_addr)) == EXIT_FAILURE)
 					      return EXIT_FAILURE; 
 		// the outgoing packet should have the interface IP as source
 		COPY_IP(ip_pkt->ip_src, gHtonl(tmpbuf, iface_ip_addr)); 
-		verbose(2, "[IPOutgoingPacket]:: almost one processing the IP header.");
+		VERBOSE(2, "[IPOutgoingPacket]:: almost one processing the IP header.");
 	} else
 	{
 		error("[IPOutgoingPacket]:: unknown outgoing packet action.. packet discarded ");
@@ -400,15 +494,40 @@ int IPOutgoingPacket(gpacket_t *pkt, uchar *dst_ip, int size, int newflag, int s
 	//	compute the new checksum
 	cksum = checksum((uchar *)ip_pkt, ip_pkt->ip_hdr_len*2);
 	ip_pkt->ip_cksum = htons(cksum);
-	pkt->data.header.prot = htons(IP_PROTOCOL);
+	GPKT_ETH(pkt)->header.prot = htons(IP_PROTOCOL);
+	// the frame ends with the IP packet (a reply may be shorter than the request)
+	gpktSetLength(pkt, ETHER_HEADER_LEN + ntohs(ip_pkt->ip_pkt_len));
 
+	// a reply to a reassembled datagram may not fit the link either
+	if (IPCheck4Fragmentation(pkt) == MORE_FRAGS)
+		return IPSendFragments(pkt);
 	IPSend2Output(pkt);
-	verbose(2, "[IPOutgoingPacket]:: IP packet sent to output queue.. ");
+	VERBOSE(2, "[IPOutgoingPacket]:: IP packet sent to output queue.. ");
 	return EXIT_SUCCESS;
 }
 
 
 
+/*
+ * send the fragments of a packet that does not fit the MTU of its
+ * outgoing link. the fragments share the data of the packet.
+ */
+int IPSendFragments(gpacket_t *pkt)
+{
+	gpacket_t *pkt_frags[MAX_FRAGMENTS];
+	int num_frags, i;
+
+	if ((num_frags = fragmentIPPacket(pkt, pkt_frags)) == 0)
+		return EXIT_FAILURE;
+	for (i = 0; i < num_frags; i++)
+		if (IPSend2Output(pkt_frags[i]) == EXIT_FAILURE)
+			break;
+	// the output queue holds the fragments now.. drop our references
+	deallocateFragments(pkt_frags, num_frags);
+	return (i < num_frags) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
 /* 
  * IPSend2Output - write to the output Queue..
  */
@@ -418,15 +537,22 @@ int IPSend2Output(gpacket_t *pkt)
 
 	if (pkt == NULL)
 	{
-		verbose(1, "[IPSend2Output]:: NULL pointer error... nothing sent");
+		VERBOSE(1, "[IPSend2Output]:: NULL pointer error... nothing sent");
 		return EXIT_FAILURE;
 	}
 
-	vlevel = prog_verbosity_level();
-	if (vlevel >= 3)
+	if ((vlevel = trace_level) >= 3)
 		printGPacket(pkt, vlevel, "IP_ROUTINE");
 
-	return writeQueue(pcore->outputQ, (void *)pkt, sizeof(gpacket_t));
+	// the output queue holds its own reference until the packet is sent
+	holdPacket(pkt);
+	if (writeQueue(pcore->outputQ, (void *)pkt, sizeof(gpacket_t)) == EXIT_FAILURE)
+	{
+		VERBOSE(2, "[IPSend2Output]:: output queue full.. packet dropped ");
+		releasePacket(pkt);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
 }
 
 
@@ -447,7 +573,7 @@ int IPVerifyPacket(ip_packet_t *ip_pkt)
 	// verify the header checksum
 	if (checksum((void *)ip_pkt, hdr_len *2) != 0)
 	{
-		verbose(2, "[IPVerifyPacket]:: packet from %s failed checksum, packet thrown",
+		VERBOSE(2, "[IPVerifyPacket]:: packet from %s failed checksum, packet thrown",
 		       IP2Dot(tmpbuf, gNtohl((tmpbuf+20), ip_pkt->ip_src)));
 		return EXIT_FAILURE;
 	}
@@ -455,7 +581,7 @@ int IPVerifyPacket(ip_packet_t *ip_pkt)
 	// Check correct IP version 
 	if (ip_pkt->ip_version != 4)
 	{
-		verbose(2, "[IPVerifyPacket]:: from %s failed checksum, packet thrown",
+		VERBOSE(2, "[IPVerifyPacket]:: from %s failed checksum, packet thrown",
 		       IP2Dot(tmpbuf, gNtohl((tmpbuf + 20), ip_pkt->ip_src)));
 		return EXIT_FAILURE;
 	}
@@ -465,34 +591,25 @@ int IPVerifyPacket(ip_packet_t *ip_pkt)
 
 
 /*
- * Checks if two IP addresses are on the same network
+ * Checks if ip_addr1 is on the network of the route towards ip_addr2
+ * (e.g. the source of a packet and its next hop). A default route covers
+ * every address and does not put two addresses on the same network.
  * returns: EXIT_FAILURE if not and EXIT_SUCCESS if they are
  */
 int isInSameNetwork(uchar *ip_addr1, uchar *ip_addr2)
 {
 	char tmpbuf[MAX_TMPBUF_LEN];
-	int i, j;
-	uchar net1[4], net2[4];
+	route_entry_t rentry;
 
-	for (i = 0; i < MAX_ROUTES; i++)
+	if ((findRoute(route_tbl, ip_addr2, &rentry) == EXIT_SUCCESS) && (rentry.prefixlen > 0) &&
+	    (compareIPUsingMask(ip_addr1, rentry.network, rentry.netmask) == 0))
 	{
-		if (route_tbl[i].is_empty == TRUE) continue;
-		// TODO: Could there be a bug here? What about default routes with 0.0.0.0??
-		for (j = 0; j < 4; j++)
-		{
-			net1[j] = ip_addr1[j] & route_tbl[i].netmask[j];
-			net2[j] = ip_addr2[j] & route_tbl[i].netmask[j];
-		}
-		if (COMPARE_IP(net1, net2) == 0)
-		{
-			verbose(2, "[isInSameNetwork]:: IPs %s and %s are on the same network %s",
-			       IP2Dot(tmpbuf, ip_addr1), IP2Dot((tmpbuf+20), ip_addr2), IP2Dot((tmpbuf+40), route_tbl[i].network));
-			
-			return EXIT_SUCCESS;
-		}
+		VERBOSE(2, "[isInSameNetwork]:: IPs %s and %s are on the same network %s",
+		       IP2Dot(tmpbuf, ip_addr1), IP2Dot((tmpbuf+20), ip_addr2), IP2Dot((tmpbuf+40), rentry.network));
+		return EXIT_SUCCESS;
 	}
 
-	verbose(2, "[isInSameNetwork]:: IPs %s and %s are not on the same network",
+	VERBOSE(2, "[isInSameNetwork]:: IPs %s and %s are not on the same network",
 	       IP2Dot(tmpbuf, ip_addr1), IP2Dot((tmpbuf+20), ip_addr2));
 
 	return EXIT_FAILURE;
@@ -1,6 +1,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
 #include "grouter.h"
@@ -8,22 +9,185 @@
 #include "protocols.h"
 #include "ip.h"
 #include "arp.h"
+#include "packetpool.h"
 
 
+/*
+ * copy a packet: the GINI frame and the buffer. the copy shares the
+ * segments of the frame (they are only read once received).
+ */
 gpacket_t *duplicatePacket(gpacket_t *inpkt)
 {
-	gpacket_t *cpptr = (gpacket_t *) malloc(sizeof(gpacket_t));
+	gpacket_t *cpptr = newPacketSize(GPKT_ROOM(inpkt));
+	int i;
 
 	if (cpptr == NULL)
 	{
 		error("[duplicatePacket]:: error allocating memory for duplication.. ");
 		return NULL;
 	}
-	memcpy(cpptr, inpkt, sizeof(gpacket_t));
+	memcpy(&(cpptr->frame), &(inpkt->frame), sizeof(pkt_frame_t));
+	memcpy(cpptr->data, inpkt->data, GPKT_ROOM(inpkt));
+	cpptr->frame.refcnt = 1;
+	cpptr->len = inpkt->len;
+	cpptr->nsegs = inpkt->nsegs;
+	for (i = 0; i < inpkt->nsegs; i++)
+	{
+		cpptr->segs[i] = inpkt->segs[i];
+		holdPacket(cpptr->segs[i].owner);
+	}
+	return cpptr;
+}
+
+
+/*
+ * copy only the GINI frame, the Ethernet header and the first len
+ * bytes of the payload. used when a reply needs just the headers of
+ * the original packet (e.g., ICMP errors quote the IP header + 64 bits).
+ */
+gpacket_t *duplicatePacketHead(gpacket_t *inpkt, int len)
+{
+	gpacket_t *cpptr = newPacket();
+
+	if (cpptr == NULL)
+	{
+		error("[duplicatePacketHead]:: error allocating memory for duplication.. ");
+		return NULL;
+	}
+	len = min(len + ETHER_HEADER_LEN, GPKT_ROOM(cpptr));
+	memcpy(&(cpptr->frame), &(inpkt->frame), sizeof(pkt_frame_t));
+	gpktCopyOut(inpkt, 0, cpptr->data, len);
+	cpptr->frame.refcnt = 1;
+	cpptr->len = len;
 	return cpptr;
 }
 
 
+/*
+ * bytes of the frame: the buffer and the segments
+ */
+int gpktLength(gpacket_t *pkt)
+{
+	int i, len = pkt->len;
+
+	for (i = 0; i < pkt->nsegs; i++)
+		len += pkt->segs[i].len;
+	return len;
+}
+
+
+/*
+ * make the frame len bytes long: the segments past len are dropped. a
+ * packet without segments takes len bytes of its buffer (its writer put
+ * the frame there).
+ */
+void gpktSetLength(gpacket_t *pkt, int len)
+{
+	int i, n;
+
+	if (pkt->nsegs == 0)
+	{
+		pkt->len = min(len, GPKT_ROOM(pkt));
+		return;
+	}
+	pkt->len = min(len, pkt->len);
+	len -= pkt->len;
+	for (i = 0, n = 0; i < pkt->nsegs; i++)
+	{
+		if (len <= 0)
+		{
+			releasePacket(pkt->segs[i].owner);
+			continue;
+		}
+		pkt->segs[i].len = min(len, pkt->segs[i].len);
+		len -= pkt->segs[i].len;
+		pkt->segs[n++] = pkt->segs[i];
+	}
+	pkt->nsegs = n;
+}
+
+
+/*
+ * add len bytes at the end of the frame in the buffer (it must not have
+ * segments); returns where they go or NULL if the tailroom is short
+ */
+uchar *gpktPut(gpacket_t *pkt, int len)
+{
+	uchar *tail = pkt->data + pkt->len;
+
+	if ((pkt->nsegs > 0) || (len > GPKT_TAILROOM(pkt)))
+		return NULL;
+	pkt->len += len;
+	return tail;
+}
+
+
+/*
+ * chain len bytes at data in the buffer of owner after the frame. the
+ * packet takes over the reference of the caller on owner.
+ */
+int gpktAddSeg(gpacket_t *pkt, gpacket_t *owner, uchar *data, int len)
+{
+	if (pkt->nsegs == PKT_MAX_SEGS)
+		return EXIT_FAILURE;
+	pkt->segs[pkt->nsegs].owner = owner;
+	pkt->segs[pkt->nsegs].data = data;
+	pkt->segs[pkt->nsegs].len = len;
+	pkt->nsegs++;
+	return EXIT_SUCCESS;
+}
+
+
+/*
+ * copy len bytes of the frame from offset off to dst, across the
+ * segments. returns the bytes copied (less if the frame ends first).
+ */
+int gpktCopyOut(gpacket_t *pkt, int off, uchar *dst, int len)
+{
+	uchar *src = pkt->data;
+	int i = -1, n, copied = 0, slen = pkt->len;
+
+	while (len > 0)
+	{
+		if (off < slen)
+		{
+			n = min(len, slen - off);
+			memcpy(dst + copied, src + off, n);
+			copied += n;
+			len -= n;
+			off = slen;
+		}
+		off -= slen;
+		if (++i == pkt->nsegs)
+			break;
+		src = pkt->segs[i].data;
+		slen = pkt->segs[i].len;
+	}
+	return copied;
+}
+
+
+/*
+ * fill iov with the pieces of the first len bytes of the frame (at most
+ * 1 + PKT_MAX_SEGS); returns the number of pieces
+ */
+int gpktIovec(gpacket_t *pkt, struct iovec *iov, int len)
+{
+	int i, n = 0;
+
+	iov[n].iov_base = pkt->data;
+	iov[n].iov_len = min(len, pkt->len);
+	len -= iov[n++].iov_len;
+	for (i = 0; (i < pkt->nsegs) && (len > 0); i++)
+	{
+		iov[n].iov_base = pkt->segs[i].data;
+		iov[n].iov_len = min(len, pkt->segs[i].len);
+		len -= iov[n++].iov_len;
+	}
+	return n;
+}
+
+
 
 void printSepLine(char *start, char *end, int count, char sep)
 {
@@ -97,9 +261,9 @@ int printEthernetHeader(gpacket_t *msg)
 	int prot;
 
 	printf("\n    P A C K E T  D A T A  S E C T I O N of GMESSAGE \n");
-	printf(" DST MAC addr : \t %s\n", MAC2Colon(tmpbuf, msg->data.header.dst));
-	printf(" SRC MAC addr : \t %s\n", MAC2Colon(tmpbuf, msg->data.header.src));
-	prot = ntohs(msg->data.header.prot);
+	printf(" DST MAC addr : \t %s\n", MAC2Colon(tmpbuf, GPKT_ETH(msg)->header.dst));
+	printf(" SRC MAC addr : \t %s\n", MAC2Colon(tmpbuf, GPKT_ETH(msg)->header.src));
+	prot = ntohs(GPKT_ETH(msg)->header.prot);
 	printf(" Protocol : \t %x\n", prot);
 
 	return prot;
@@ -112,7 +276,7 @@ int printIPPacket(gpacket_t *msg)
 	char tmpbuf[MAX_TMPBUF_LEN];
 	int tos;
 
-	ip_pkt = (ip_packet_t *)msg->data.data;
+	ip_pkt = (ip_packet_t *)GPKT_PAYLOAD(msg);
 	printf("IP: ----- IP Header -----\n");
 	printf("IP: Version        : %d\n", ip_pkt->ip_version);
 	printf("IP: Header Length  : %d Bytes\n", ip_pkt->ip_hdr_len*4);
@@ -163,7 +327,7 @@ void printARPPacket(gpacket_t *msg)
 	arp_packet_t *apkt;
 	char tmpbuf[MAX_TMPBUF_LEN];
 
-	apkt = (arp_packet_t *) msg->data.data;
+	apkt = (arp_packet_t *)GPKT_PAYLOAD(msg);
 
 	printf(" ARP hardware addr type %x \n", ntohs(apkt->hw_addr_type));
 	printf(" ARP protocol %x \n", ntohs(apkt->arp_prot));
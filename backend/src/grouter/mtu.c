@@ -5,6 +5,8 @@
  */
 
 #include "mtu.h"
+#include "flowcache.h"
+#include "epoch.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -17,30 +19,67 @@
 
 /*
  * MTU table is organized as a direct indexed table.
- * 
+ * It is read by all packet workers without a lock, through the current
+ * snapshot (see epoch.h); a change swaps in a changed copy.
  */
 
 
+mtu_table_t *createMTUTable(void)
+{
+	mtu_table_t *mtbl;
+	int i;
+
+	if (((mtbl = calloc(1, sizeof(mtu_table_t))) == NULL) ||
+	    ((mtbl->snap = malloc(sizeof(mtu_snapshot_t))) == NULL))
+	{
+		fatal("[createMTUTable]:: unable to allocate memory for the MTU table ");
+		return NULL;
+	}
+	pthread_mutex_init(&(mtbl->lock), NULL);
+	for (i = 0; i < MAX_MTU; i++)
+		mtbl->snap->entry[i].is_empty = TRUE;
+
+	verbose(2, "[createMTUTable]:: table initialized..");
+	return mtbl;
+}
+
+
 /*
- * initialize the MTU table to be empty
+ * start a change: take the writer lock and return a copy of the
+ * current snapshot (NULL, lock released, if there is no memory)
  */
-void MTUTableInit(mtu_entry_t mtable[])
+static mtu_snapshot_t *MTUBeginChange(mtu_table_t *mtbl)
 {
-	int i;
+	mtu_snapshot_t *ms;
 
-	for(i = 0; i < MAX_MTU; i++)
-		mtable[i].is_empty = TRUE;
+	pthread_mutex_lock(&(mtbl->lock));
+	if ((ms = malloc(sizeof(mtu_snapshot_t))) == NULL)
+	{
+		pthread_mutex_unlock(&(mtbl->lock));
+		error("[MTUBeginChange]:: unable to copy the MTU table ");
+		return NULL;
+	}
+	*ms = *(mtbl->snap);
+	return ms;
+}
 
-	verbose(2, "[initMTUTable]:: table initialized..");
 
-	return;
+// swap the changed copy in and release the writer lock
+static void MTUEndChange(mtu_table_t *mtbl, mtu_snapshot_t *ms)
+{
+	epochRetire(free, epochPublish((void * volatile *)&(mtbl->snap), ms));
+	mtbl->version++;
+	pthread_mutex_unlock(&(mtbl->lock));
+	flowInvalidate();
 }
 
+
 /*
  * print mtu table
  */
-void printMTUTable(mtu_entry_t mtable[])
+void printMTUTable(mtu_table_t *mtbl)
 {
+	mtu_snapshot_t *ms;
 	int i;
 
 	printf("-----------------------------\n");
@@ -48,22 +87,40 @@ void printMTUTable(mtu_entry_t mtable[])
 	printf("-----------------------------\n");
 	printf("Inter. ID\tMTU \n");
 
+	epochEnter();
+	ms = mtbl->snap;
 	for (i = 0; i < MAX_MTU; i++)
-		if (mtable[i].is_empty == FALSE)
-			printf("%d\t%d\n", i, mtable[i].mtu);
+		if (ms->entry[i].is_empty == FALSE)
+			printf("%d\t%d\n", i, ms->entry[i].mtu);
+	epochExit();
 	printf("---------------------------------\n");
 	return;
 }
 
 
+void printMTUTableVersion(mtu_table_t *mtbl)
+{
+	printf("MTU table\tversion %lu \n", mtbl->version);
+}
+
+
 /*
  * Find the MTU of the given interface. Return -1 if the interface
  * was not found in the table
  */
-int findMTU(mtu_entry_t mtable[], int index)
+int findMTU(mtu_table_t *mtbl, int index)
 {
-	if (mtable[index].is_empty != TRUE) 
-		return mtable[index].mtu;
+	mtu_snapshot_t *ms;
+	int mtu;
+
+	if ((index < 0) || (index >= MAX_MTU))
+		return -1;
+	epochEnter();
+	ms = mtbl->snap;
+	mtu = (ms->entry[index].is_empty != TRUE) ? ms->entry[index].mtu : -1;
+	epochExit();
+	if (mtu >= 0)
+		return mtu;
 	verbose(2, "[findMTU]:: No entry found in MTU table for index %d ", index);
 	return -1;
 }
@@ -73,16 +130,24 @@ int findMTU(mtu_entry_t mtable[], int index)
  * returns EXIT_FAILURE if the entry is not found in the MTU table.
  * Otherwise, EXIT_SUCCESS is returned and the ip_addr is copied
  */
-int findInterfaceIP(mtu_entry_t mtable[], int index, 
+int findInterfaceIP(mtu_table_t *mtbl, int index, 
 		    uchar *ip_addr)
 {
-	if (mtable[index].is_empty != TRUE)
+	mtu_snapshot_t *ms;
+	int status = EXIT_FAILURE;
+
+	if ((index < 0) || (index >= MAX_MTU))
+		return EXIT_FAILURE;
+	epochEnter();
+	ms = mtbl->snap;
+	if (ms->entry[index].is_empty != TRUE)
 	{
-		COPY_IP(ip_addr, mtable[index].ip_addr);
-		return EXIT_SUCCESS;
+		COPY_IP(ip_addr, ms->entry[index].ip_addr);
+		status = EXIT_SUCCESS;
 	}
+	epochExit();
 	
-	return EXIT_FAILURE;
+	return status;
 }
 
 
@@ -93,16 +158,20 @@ int findInterfaceIP(mtu_entry_t mtable[], int index,
  * when the router's another interface is probed, we want to detect that
  * and reply accordingly.
  */
-int findAllInterfaceIPs(mtu_entry_t mtable[], uchar buf[][4])
+int findAllInterfaceIPs(mtu_table_t *mtbl, uchar buf[][4])
 {
+	mtu_snapshot_t *ms;
 	int i, count = 0;
 	
+	epochEnter();
+	ms = mtbl->snap;
 	for (i = 0; i < MAX_MTU; i++)
-		if (mtable[i].is_empty == FALSE)
+		if (ms->entry[i].is_empty == FALSE)
 		{
-			COPY_IP(buf[count], mtable[i].ip_addr);
+			COPY_IP(buf[count], ms->entry[i].ip_addr);
 			count++;
 		}
+	epochExit();
 
 	verbose(2, "[findAllInterfaceIPs]:: output buffer ...");
 	return count;
@@ -115,16 +184,20 @@ int findAllInterfaceIPs(mtu_entry_t mtable[], uchar buf[][4])
  * the MTU table.
  */
 
-void deleteMTUEntry(mtu_entry_t mtable[], int index)
+void deleteMTUEntry(mtu_table_t *mtbl, int index)
 {
-	if (mtable[index].is_empty != TRUE)
+	mtu_snapshot_t *ms;
+
+	if ((index < 0) || (index >= MAX_MTU) || (mtbl->snap->entry[index].is_empty == TRUE) ||
+	    ((ms = MTUBeginChange(mtbl)) == NULL))
 	{
-		mtable[index].is_empty = TRUE;
-		verbose(2, "[deleteMTUEntry]:: Table cleared of references to interface: %d", index);
+		verbose(2, "[deleteMTUEntry]:: Can't find entry for interface: %d", index);
 		return;
 	}
+	ms->entry[index].is_empty = TRUE;
+	MTUEndChange(mtbl, ms);
 
-	verbose(2, "[deleteMTUEntry]:: Can't find entry for interface: %d", index);
+	verbose(2, "[deleteMTUEntry]:: Table cleared of references to interface: %d", index);
 	return;
 }
 
@@ -132,19 +205,24 @@ void deleteMTUEntry(mtu_entry_t mtable[], int index)
 /*
  * add MTU entry by argument index,mtu is the new value
  */
-void addMTUEntry(mtu_entry_t mtable[], int index, 
+void addMTUEntry(mtu_table_t *mtbl, int index, 
 		 int mtu, uchar *ip_addr)
 {
+	mtu_snapshot_t *ms;
+
 	// check validity of the specified value, set to DEFAULT_MTU if invalid
-	if (mtu <= 0)
+	if ((mtu <= 0) || (mtu > MAX_JUMBO_MTU))
 	{
-		verbose(2, "[addMTUEntry]:: mtu<0 or no value set for mtu, MTU set to default value");
+		verbose(2, "[addMTUEntry]:: mtu out of range or no value set for mtu, MTU set to default value");
 		mtu=DEFAULT_MTU;
 	}
 
-	mtable[index].is_empty = FALSE;
-	mtable[index].mtu = mtu;
-	COPY_IP(mtable[index].ip_addr, ip_addr);
+	if ((index < 0) || (index >= MAX_MTU) || ((ms = MTUBeginChange(mtbl)) == NULL))
+		return;
+	ms->entry[index].is_empty = FALSE;
+	ms->entry[index].mtu = mtu;
+	COPY_IP(ms->entry[index].ip_addr, ip_addr);
+	MTUEndChange(mtbl, ms);
     
 	return;
 }
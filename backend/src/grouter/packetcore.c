@@ -13,19 +13,34 @@
  * packet core. The work queue is serviced by one or more worker threads
  * (for now we have one worker thread).
  */
-#define _XOPEN_SOURCE             500
+#define _XOPEN_SOURCE             600
 #include <unistd.h>
 #include <slack/std.h>
 #include <slack/map.h>
 #include <slack/list.h>
 #include <pthread.h>
+#include <time.h>
 #include "protocols.h"
 #include "packetcore.h"
 #include "message.h"
 #include "classifier.h"
+#include "filter.h"
+#include "packetpool.h"
+#include "ethernet.h"
+#include "ip.h"
+#include <netinet/in.h>
 #include "grouter.h"
+#include "pktsched.h"
+#include "qdisc.h"
+#include "trace.h"
+#include "stats.h"
+#include "flowcache.h"
+#include "cpu.h"
+#include "epoch.h"
 
 extern classlist_t *classifier;
+extern filtertab_t *filter;
+extern router_config rconfig;
 
 /*
  * Packet core Cname Cache functions are here.
@@ -46,7 +61,9 @@ pktcorecnamecache_t *createPktCoreCnameCache()
 
 void insertCnameCache(pktcorecnamecache_t *pcache, char *cname)
 {
-	pcache->cname[pcache->numofentries] = cname;
+	if (pcache->numofentries >= MAX_QUEUE_SIZE)
+		return;
+	pcache->cname[pcache->numofentries] = strdup(cname);
 	pcache->numofentries++;
 }
 
@@ -67,7 +84,7 @@ int deleteCnameCache(pktcorecnamecache_t *pcache, char *cname)
 	if (found)
 	{
 		free(pcache->cname[j]);
-		for (i = j; j < (pcache->numofentries-1); j++)
+		for (i = j; i < (pcache->numofentries-1); i++)
 			pcache->cname[i] = pcache->cname[i+1];
 		pcache->numofentries--;
 	}
@@ -80,6 +97,9 @@ int deleteCnameCache(pktcorecnamecache_t *pcache, char *cname)
 pktcore_t *createPacketCore(char *rname, simplequeue_t *outQ, simplequeue_t *workQ)
 {
 	pktcore_t *pcore;
+	pthread_condattr_t cattr;
+	char qname[MAX_NAME_LEN];
+	int i;
 
 	if ((pcore = (pktcore_t *) malloc(sizeof(pktcore_t))) == NULL)
 	{
@@ -88,18 +108,56 @@ pktcore_t *createPacketCore(char *rname, simplequeue_t *outQ, simplequeue_t *wor
 	}
 
 	pcore->pcache = createPktCoreCnameCache();
+	pcore->ctable = NULL;
+	pcore->cversion = 0;
 
 
 	strcpy(pcore->name, rname);
 	pthread_mutex_init(&(pcore->qlock), NULL);
 	pthread_mutex_init(&(pcore->wqlock), NULL);
-	pthread_cond_init(&(pcore->schwaiting), NULL);
-	pcore->lastqid = 0;
-	pcore->packetcnt = 0;
+	// the scheduler sleeps until a delayed queue is due (getTimeNanos time)
+	pthread_condattr_init(&cattr);
+	pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+	pthread_cond_init(&(pcore->schwaiting), &cattr);
+	pthread_condattr_destroy(&cattr);
+	pcore->schsleeping = 0;
 	pcore->outputQ = outQ;
 	pcore->workQ = workQ;
 	pcore->maxqsize = MAX_QUEUE_SIZE;
 
+	// worker 0 uses the given work queue, the others get their own
+	pcore->nworkers = rconfig.nworkers;
+	if (pcore->nworkers < 1)
+		pcore->nworkers = 1;
+	if (pcore->nworkers > MAX_WORKERS)
+		pcore->nworkers = MAX_WORKERS;
+	for (i = 0; i < pcore->nworkers; i++)
+	{
+		memset(&(pcore->workers[i]), 0, sizeof(pktworker_t));
+		pcore->workers[i].id = i;
+		pcore->workers[i].pcore = pcore;
+		sprintf(qname, "worker %d", i);
+		pcore->workers[i].stats = statsThreadAlloc(qname);
+		if (i == 0)
+			pcore->workers[i].workQ = workQ;
+		else
+		{
+			sprintf(qname, "work Queue %d", i);
+			if ((pcore->workers[i].workQ = createSimpleQueue(qname, WORK_Q_SIZE, 1, 1)) == NULL)
+			{
+				fatal("[createPacketCore]:: Could not create the work queue for worker %d ", i);
+				return NULL;
+			}
+		}
+		cpuQueueRegister(pcore->workers[i].workQ, CPU_ROLE_WORKER, i);
+	}
+	initTokenBucket(&(pcore->egress), rconfig.schedrate, rconfig.schedburst);
+	if ((pcore->sched = createScheduler(rconfig.schedpolicy)) == NULL)
+	{
+		fatal("[createPacketCore]:: Could not create the scheduler..");
+		return NULL;
+	}
+
 	if (!(pcore->queues = map_create(NULL)))
 	{
 		fatal("[createPacketCore]:: Could not create the queues..");
@@ -115,23 +173,39 @@ int addPktCoreQueue(pktcore_t *pcore, char *qname, char *qdisc, double qweight,
 {
 	simplequeue_t *pktq;
 
+	// if not given (0 or -1).. let the queue size be set to default
+	if (nslots <= 0)
+		nslots = pcore->maxqsize;
 
-	if ((pktq = createSimpleQueue(qname, pcore->maxqsize, 0, 0)) == NULL)
+	if ((pktq = createSimpleQueue(qname, nslots, 0, 0)) == NULL)
 	{
 		error("[addPktCoreQueue]:: packet queue creation failed.. ");
 		return EXIT_FAILURE;
 	}
 
-	// if 0.. let the queue size be set to default
-	if (nslots != 0)
-		pktq->maxsize = nslots;
-	pktq->delay_us = delay_us;
-	strcpy(pktq->qdisc, qdisc);
+	pktq->delay_us = max(delay_us, 0.0);
 	pktq->weight = qweight;
-	pktq->stime = pktq->ftime = 0.0;
 
+	if (qdiscAttach(pktq, qdisc) == EXIT_FAILURE)
+	{
+		destroySimpleQueue(pktq);
+		return EXIT_FAILURE;
+	}
+
+	pthread_mutex_lock(&(pcore->qlock));
+	if (schedAddQueue(pcore->sched, pktq) == EXIT_FAILURE)
+	{
+		pthread_mutex_unlock(&(pcore->qlock));
+		qdiscDetach(pktq);
+		destroySimpleQueue(pktq);
+		return EXIT_FAILURE;
+	}
+	pktq->qstats = statsQueueAlloc(qname);
 	map_add(pcore->queues, qname, pktq);
+	cpuQueueRegister(pktq, CPU_ROLE_SCHED, 0);
+	pthread_mutex_unlock(&(pcore->qlock));
 	insertCnameCache(pcore->pcache, qname);
+	rebuildPktCoreClassTable(pcore);
 	return EXIT_SUCCESS;
 }
 
@@ -162,6 +236,11 @@ void printAllQueues(pktcore_t *pcore)
 }
 
 
+/*
+ * render the statistics segment (stats.c): the counters of the queues
+ * with percentiles of the time their packets spent queued, then the
+ * counters of the threads.
+ */
 void printQueueStats(pktcore_t *pcore)
 {
 	List *keylst;
@@ -172,14 +251,19 @@ void printQueueStats(pktcore_t *pcore)
 	keylst = map_keys(pcore->queues);
 	klster = lister_create(keylst);
 
-	printf("NOT YET IMPLEMENTED \n");
+	printf("\n%51s%s\n", "", "----------------------- sojourn (us) -----------------------");
+	printf("Queue          Enqueued   Dequeued    Drops Backlog      mean       p50       p90       p99     p99.9       max\n");
 	while (nxtkey = ((char *)lister_next(klster)))
 	{
 		nextq = map_get(pcore->queues, nxtkey);
-		printf("Stats for %s \n", nxtkey);
+		if (nextq->qstats != NULL)
+			statsPrintQueue(nextq->qstats);
+		else
+			printf("%-12s (no statistics block) \n", nxtkey);
 	}
 	lister_release(klster);
 	list_release(keylst);
+	statsPrintThreads();
 }
 
 
@@ -230,26 +314,183 @@ void modifyQueueWeight(pktcore_t *pcore, char *qname, double weight)
 }
 
 
-void modifyQueueDiscipline(pktcore_t *pcore, char *qname, char *qdisc)
+/*
+ * give the queue another discipline; the packets queued move to it
+ */
+int modifyQueueDiscipline(pktcore_t *pcore, char *qname, char *qdisc)
+{
+	simplequeue_t *thisq;
+	int status = EXIT_FAILURE;
+
+	pthread_mutex_lock(&(pcore->qlock));
+	if ((thisq = map_get(pcore->queues, qname)) != NULL)
+	{
+		status = qdiscChange(thisq, qdisc);
+		schedQueueChanged(pcore->sched, thisq, getTimeNanos());
+	}
+	pthread_mutex_unlock(&(pcore->qlock));
+	return status;
+}
+
+
+/*
+ * change the delay of a queue. the packets already queued are held
+ * for the new delay from the time they were queued.
+ */
+void modifyQueueDelay(pktcore_t *pcore, char *qname, double delay_us)
+{
+	simplequeue_t *thisq;
+
+	pthread_mutex_lock(&(pcore->qlock));
+	if ((thisq = map_get(pcore->queues, qname)) != NULL)
+	{
+		thisq->delay_us = max(delay_us, 0.0);
+		schedQueueChanged(pcore->sched, thisq, getTimeNanos());
+		// the scheduler may be sleeping until the old release time
+		if (pcore->schsleeping)
+			pthread_cond_signal(&(pcore->schwaiting));
+	}
+	pthread_mutex_unlock(&(pcore->qlock));
+}
+
+
+/*
+ * change the shaper of a queue: rate and ceil in kbps, burst in bytes,
+ * a negative value leaves that one as it is
+ */
+int modifyQueueShaper(pktcore_t *pcore, char *qname, double ratekbps, double ceilkbps, int burst)
+{
+	simplequeue_t *thisq;
+	int status = EXIT_FAILURE;
+
+	pthread_mutex_lock(&(pcore->qlock));
+	if ((thisq = map_get(pcore->queues, qname)) != NULL)
+	{
+		status = schedSetShaper(pcore->sched, thisq, ratekbps, ceilkbps, burst, getTimeNanos());
+		// queues held for tokens may be due earlier now
+		if (pcore->schsleeping)
+			pthread_cond_signal(&(pcore->schwaiting));
+	}
+	pthread_mutex_unlock(&(pcore->qlock));
+	return status;
+}
+
+
+/*
+ * let the queue borrow from the class of queue pname ("none" for no
+ * parent)
+ */
+int modifyQueueParent(pktcore_t *pcore, char *qname, char *pname)
+{
+	simplequeue_t *thisq, *parentq = NULL;
+	int status = EXIT_FAILURE;
+
+	pthread_mutex_lock(&(pcore->qlock));
+	if (((thisq = map_get(pcore->queues, qname)) != NULL) &&
+	    (!strcmp(pname, "none") || ((parentq = map_get(pcore->queues, pname)) != NULL)))
+	{
+		status = schedSetParent(pcore->sched, thisq, parentq, getTimeNanos());
+		if (pcore->schsleeping)
+			pthread_cond_signal(&(pcore->schwaiting));
+	}
+	pthread_mutex_unlock(&(pcore->qlock));
+	return status;
+}
+
+
+/*
+ * a snapshot of the classes for the .info port, RETURNS how many
+ */
+int getPktCoreClassStats(pktcore_t *pcore, schedclassstats_t *stats, int max)
+{
+	int n;
+
+	pthread_mutex_lock(&(pcore->qlock));
+	n = schedClassStats(pcore->sched, stats, max, getTimeNanos());
+	pthread_mutex_unlock(&(pcore->qlock));
+	return n;
+}
+
+
+int setPktCoreQdiscParam(pktcore_t *pcore, char *qname, char *param, double value)
+{
+	simplequeue_t *thisq;
+	int status = EXIT_FAILURE;
+
+	pthread_mutex_lock(&(pcore->qlock));
+	if ((thisq = map_get(pcore->queues, qname)) != NULL)
+		status = qdiscSetParam(thisq, param, value);
+	pthread_mutex_unlock(&(pcore->qlock));
+	return status;
+}
+
+
+/*
+ * the disciplines and the state of the discipline of each queue (or
+ * of qname only)
+ */
+void printPktCoreQdiscs(pktcore_t *pcore, char *qname)
 {
 	List *keylst;
 	Lister *klster;
 	char *nxtkey;
-	simplequeue_t *nextq;
 
+	if (qname == NULL)
+	{
+		printf("Queuing disciplines: \n");
+		qdiscPrintAll();
+		printf("\n");
+	}
+	pthread_mutex_lock(&(pcore->qlock));
 	keylst = map_keys(pcore->queues);
 	klster = lister_create(keylst);
-
 	while (nxtkey = ((char *)lister_next(klster)))
-	{
-		if (!strcmp(qname, nxtkey))
-		{
-			nextq = map_get(pcore->queues, nxtkey);
-			strcpy(nextq->qdisc, qdisc);
-		}
-	}
+		if ((qname == NULL) || !strcmp(qname, nxtkey))
+			qdiscPrint(map_get(pcore->queues, nxtkey));
 	lister_release(klster);
 	list_release(keylst);
+	pthread_mutex_unlock(&(pcore->qlock));
+}
+
+
+/*
+ * change the priority of a queue (prio policy). a backlogged queue is
+ * placed again with its new priority.
+ */
+void modifyQueuePriority(pktcore_t *pcore, char *qname, int prio)
+{
+	simplequeue_t *thisq;
+
+	pthread_mutex_lock(&(pcore->qlock));
+	if ((thisq = map_get(pcore->queues, qname)) != NULL)
+	{
+		thisq->prio = prio;
+		schedQueueChanged(pcore->sched, thisq, getTimeNanos());
+	}
+	pthread_mutex_unlock(&(pcore->qlock));
+}
+
+
+int setPktCoreSchedPolicy(pktcore_t *pcore, char *policy)
+{
+	int status;
+
+	pthread_mutex_lock(&(pcore->qlock));
+	if ((status = schedSetPolicy(pcore->sched, policy)) == EXIT_SUCCESS)
+		strcpy(rconfig.schedpolicy, policy);
+	pthread_mutex_unlock(&(pcore->qlock));
+	return status;
+}
+
+
+void printPktCoreSched(pktcore_t *pcore)
+{
+	pthread_mutex_lock(&(pcore->qlock));
+	schedPrintPolicies(pcore->sched);
+	printf("\n");
+	schedPrint(pcore->sched);
+	htbPrint(pcore->sched, getTimeNanos());
+	pthread_mutex_unlock(&(pcore->qlock));
 }
 
 
@@ -258,6 +499,7 @@ int delPktCoreQueue(pktcore_t *pcore, char *qname)
 	List *keylst;
 	Lister *klster;
 	char *nxtkey;
+	simplequeue_t *thisq;
 	int deleted;
 
 	keylst = map_keys(pcore->queues);
@@ -268,7 +510,16 @@ int delPktCoreQueue(pktcore_t *pcore, char *qname)
 	{
 		if (!strcmp(qname, nxtkey))
 		{
+			// the packets still queued are dropped
+			pthread_mutex_lock(&(pcore->qlock));
+			thisq = map_get(pcore->queues, qname);
+			schedDelQueue(pcore->sched, thisq);
+			statsQueueFree(thisq->qstats);
+			thisq->qstats = NULL;
+			qdiscDetach(thisq);
+			cpuQueueUnregister(thisq);
 			map_remove(pcore->queues, qname);
+			pthread_mutex_unlock(&(pcore->qlock));
 			deleted = 1;
 			deleteCnameCache(pcore->pcache, qname);
 		}
@@ -277,23 +528,25 @@ int delPktCoreQueue(pktcore_t *pcore, char *qname)
 	list_release(keylst);
 
 	if (deleted)
+	{
+		rebuildPktCoreClassTable(pcore);
 		return EXIT_SUCCESS;
+	}
 	else
 		return EXIT_FAILURE;
 }
 
 
 
-// create a thread for the scheduler. for now, hook up the Worst-case WFQ
-// as the scheduler. Only the dequeue is hooked up. The enqueue part is
-// in the classifier. The dequeue will put the scheduler in wait when it
-// runs out of jobs in the queue. The enqueue will wake up a sleeping scheduler.
+// create a thread for the scheduler. The enqueue part (PktCoreEnqueue)
+// is called by the interfaces after the classifier. The scheduler waits
+// when it runs out of packets that may leave and the enqueue wakes it up.
 pthread_t PktCoreSchedulerInit(pktcore_t *pcore)
 {
 	int threadstat;
 	pthread_t threadid;
 
-	threadstat = pthread_create((pthread_t *)&threadid, NULL, (void *)roundRobinScheduler, (void *)pcore);
+	threadstat = pthread_create((pthread_t *)&threadid, NULL, (void *)PktCoreScheduler, (void *)pcore);
 	if (threadstat != 0)
 	{
 		verbose(1, "[PKTCoreSchedulerInit]:: unable to create thread.. ");
@@ -304,37 +557,147 @@ pthread_t PktCoreSchedulerInit(pktcore_t *pcore)
 }
 
 
+/*
+ * queue a classified packet on the queue of its class (qkey). the
+ * discipline of the queue may drop it (queue full, AQM).
+ */
+int PktCoreEnqueue(pktcore_t *pcore, gpacket_t *in_pkt, char *qkey)
+{
+	simplequeue_t *thisq;
+
+	if (trace_level >= 3)
+		printGPacket(in_pkt, 6, "QUEUER");
+
+	pthread_mutex_lock(&(pcore->qlock));
+	if ((thisq = map_get(pcore->queues, qkey)) == NULL)
+	{
+		// the queue was deleted after the packet was classified
+		pthread_mutex_unlock(&(pcore->qlock));
+		verbose(1, "[PktCoreEnqueue]:: no queue for %s, packet dropped ", qkey);
+		releasePacket(in_pkt);
+		return EXIT_FAILURE;
+	}
+	if (schedEnqueue(pcore->sched, thisq, in_pkt, findPacketSize(in_pkt), getTimeNanos()) == EXIT_FAILURE)
+	{
+		// released (and traced) by the discipline
+		pthread_mutex_unlock(&(pcore->qlock));
+		VERBOSE(2, "[PktCoreEnqueue]:: Packet dropped by the %s discipline of [%s] ", thisq->qdisc, qkey);
+		return EXIT_FAILURE;
+	}
+	// wake up the scheduler if it was waiting
+	if (pcore->schsleeping)
+		pthread_cond_signal(&(pcore->schwaiting));
+	pthread_mutex_unlock(&(pcore->qlock));
+	return EXIT_SUCCESS;
+}
+
+
+/*
+ * The scheduler thread sleeps on schwaiting while no queue has a packet
+ * that may leave -- until the next delayed queue is due if there is one
+ * -- and otherwise hands the packet picked by the scheduling policy (see
+ * sched.c) to the workers, back-to-back. The aggregate rate at which
+ * packets leave the core is bounded by the egress token bucket (set
+ * sched-rate/sched-burst); with a rate of 0 the core runs at full speed.
+ */
+void *PktCoreScheduler(void *pc)
+{
+	pktcore_t *pcore = (pktcore_t *)pc;
+	gpacket_t *in_pkt;
+	unsigned long long release;
+	struct timespec ts;
+	int len;
+
+	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+	statsThreadRegister("scheduler");
+	cpuThreadRegister(CPU_ROLE_SCHED, 0, "scheduler");
+	while (1)
+	{
+		pthread_mutex_lock(&(pcore->qlock));
+		while ((in_pkt = schedDequeue(pcore->sched, &len, getTimeNanos())) == NULL)
+		{
+			pcore->schsleeping = 1;
+			if ((release = schedNextRelease(pcore->sched)) == 0)
+				pthread_cond_wait(&(pcore->schwaiting), &(pcore->qlock));
+			else
+			{
+				ts.tv_sec = release / 1000000000ULL;
+				ts.tv_nsec = release % 1000000000ULL;
+				pthread_cond_timedwait(&(pcore->schwaiting), &(pcore->qlock), &ts);
+			}
+			pcore->schsleeping = 0;
+		}
+		pthread_mutex_unlock(&(pcore->qlock));
+
+		pthread_testcancel();
+		tokenBucketWait(&(pcore->egress), len);
+		STATS_COUNT(1, len);
+		dispatchPacket(pcore, in_pkt, sizeof(gpacket_t));
+	}
+}
+
+
+/*
+ * start the packet workers. each worker drains its own work queue;
+ * the scheduler picks the queue by hashing the flow of the packet
+ * (see dispatchPacket) so the packets of a flow stay in order.
+ * RETURNS the thread of worker 0 or -1 on failure.
+ */
 int PktCoreWorkerInit(pktcore_t *pcore)
 {
-	int threadstat, threadid;
+	int threadstat, i;
 
-	threadstat = pthread_create((pthread_t *)&threadid, NULL, (void *)packetProcessor, (void *)pcore);
-	if (threadstat != 0)
+	for (i = 0; i < pcore->nworkers; i++)
 	{
-		verbose(1, "[PKTCoreWorkerInit]:: unable to create thread.. ");
-		return -1;
+		threadstat = pthread_create(&(pcore->workers[i].threadid), NULL, (void *)packetProcessor,
+					    (void *)&(pcore->workers[i]));
+		if (threadstat != 0)
+		{
+			verbose(1, "[PKTCoreWorkerInit]:: unable to create thread for worker %d.. ", i);
+			return -1;
+		}
 	}
+	verbose(2, "[PKTCoreWorkerInit]:: started %d packet workers ", pcore->nworkers);
 
-	return threadid;
+	return pcore->workers[0].threadid;
 }
 
 
-void *packetProcessor(void *pc)
+void PktCoreWorkerHalt(pktcore_t *pcore)
 {
-	pktcore_t *pcore = (pktcore_t *)pc;
+	int i;
+
+	for (i = 0; i < pcore->nworkers; i++)
+		if (pcore->workers[i].threadid != 0)
+			pthread_cancel(pcore->workers[i].threadid);
+}
+
+
+void *packetProcessor(void *arg)
+{
+	pktworker_t *worker = (pktworker_t *)arg;
 	gpacket_t *in_pkt;
+	char tname[CPU_NAME_LEN];
 	int pktsize;
 
 	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+	statsThreadSet(worker->stats);
+	sprintf(tname, "worker %d", worker->id);
+	cpuThreadRegister(CPU_ROLE_WORKER, worker->id, tname);
 	while (1)
 	{
-		verbose(2, "[packetProcessor]:: Waiting for a packet...");
-		readQueue(pcore->workQ, (void **)&in_pkt, &pktsize);
+		verbose(2, "[packetProcessor]:: Worker %d waiting for a packet...", worker->id);
+		readQueue(worker->workQ, (void **)&in_pkt, &pktsize);
 		pthread_testcancel();
 		verbose(2, "[packetProcessor]:: Got a packet for further processing..");
 
+		STATS_COUNT(1, findPacketSize(in_pkt));
+
+		// the configuration (routes, MTUs, interfaces) stays the same for the
+		// whole packet; a change in the meantime is seen by the next packet
+		epochEnter();
 		// get the protocol field within the packet... and switch it accordingly
-		switch (ntohs(in_pkt->data.header.prot))
+		switch (ntohs(GPKT_ETH(in_pkt)->header.prot))
 		{
 		case IP_PROTOCOL:
 			verbose(2, "[packetProcessor]:: Packet sent to IP routine for further processing.. ");
@@ -350,48 +713,179 @@ void *packetProcessor(void *pc)
 			// TODO: should we generate ICMP errors here.. check router RFCs
 			break;
 		}
+		epochExit();
+		// modules that send or keep the packet hold their own reference
+		releasePacket(in_pkt);
 	}
 }
 
 
+/*
+ * hash the flow (source, destination, protocol and, for unfragmented
+ * TCP/UDP packets, the ports) of a packet. fragments of a datagram
+ * carry no ports, so all fragments hash on the addresses and protocol
+ * only. non-IP packets (ARP) hash to 0.
+ */
+unsigned int flowHash(gpacket_t *pkt)
+{
+	ip_packet_t *ip_pkt = (ip_packet_t *)GPKT_PAYLOAD(pkt);
+	uchar *l4hdr;
+	unsigned int h;
+
+	if (ntohs(GPKT_ETH(pkt)->header.prot) != IP_PROTOCOL)
+		return 0;
+
+	h = (ip_pkt->ip_src[0] << 24) | (ip_pkt->ip_src[1] << 16) | (ip_pkt->ip_src[2] << 8) | ip_pkt->ip_src[3];
+	h ^= ((ip_pkt->ip_dst[0] << 24) | (ip_pkt->ip_dst[1] << 16) | (ip_pkt->ip_dst[2] << 8) | ip_pkt->ip_dst[3]) * 0x9e3779b1;
+	h ^= ip_pkt->ip_prot;
+
+	if (((ip_pkt->ip_prot == TCP_PROTOCOL) || (ip_pkt->ip_prot == UDP_PROTOCOL)) &&
+	    ((ntohs(ip_pkt->ip_frag_off) & (IP_MF | IP_OFFMASK)) == 0))
+	{
+		l4hdr = (uchar *)ip_pkt + ip_pkt->ip_hdr_len * 4;
+		h ^= ((l4hdr[0] << 24) | (l4hdr[1] << 16) | (l4hdr[2] << 8) | l4hdr[3]) * 0x85ebca6b;
+	}
+
+	// final mix so that the low order bits depend on all the input bits
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
 
 /*
- * Checks if a given packets matches any of the classifier definitions
- * associated with existing queues.
- *
- * TODO: Performance issue; we are caching the cname.. should we actually
- * cache the classification rule itself? This will actually reduce the
- * lookup time. However, changes to the rules made will not be reflected
- * unless the cache is invalidated.
+ * hand a packet selected by the scheduler to the worker owning its flow.
  */
-char *tagPacket(pktcore_t *pcore, gpacket_t *in_pkt)
+int dispatchPacket(pktcore_t *pcore, gpacket_t *pkt, int pktsize)
 {
-	classdef_t *cdef;
-	int j, found = FALSE;
-	char *qname;
-	static char *defaultstr = "default";
+	int wid = 0;
+
+	if (pcore->nworkers > 1)
+		wid = flowHash(pkt) % pcore->nworkers;
+	return writeQueue(pcore->workers[wid].workQ, pkt, pktsize);
+}
 
-	verbose(2, "[tagPacket]:: Entering the packet tagging function.. ");
 
-	for (j = 0; j < pcore->pcache->numofentries; j++)
+void printWorkers(pktcore_t *pcore)
+{
+	statsthread_t *st;
+	unsigned long long tpackets = 0, tbytes = 0;
+	int i;
+
+	printf("\n=================================================================\n");
+	printf("      P A C K E T  W O R K E R S \n");
+	printf("-----------------------------------------------------------------\n");
+	printf("Worker\tPackets\t\tBytes\t\tQueued \n");
+	for (i = 0; i < pcore->nworkers; i++)
 	{
-		qname = pcore->pcache->cname[j];
-		if (!strcmp(qname, "default"))
-			continue;
-		if ((cdef = getClassDef(classifier, qname)))
+		if ((st = pcore->workers[i].stats) == NULL)
 		{
-			if (isRuleMatching(cdef, in_pkt))
-			{
-				found = TRUE;
-				break;
-			}
+			printf("%d\t-\t\t-\t\t%d\n", i, pcore->workers[i].workQ->cursize);
+			continue;
 		}
+		printf("%d\t%llu\t\t%llu\t\t%d\n", i, (unsigned long long)st->packets,
+		       (unsigned long long)st->bytes, pcore->workers[i].workQ->cursize);
+		tpackets += st->packets;
+		tbytes += st->bytes;
+	}
+	printf("-----------------------------------------------------------------\n");
+	printf("Total\t%llu\t\t%llu \n", tpackets, tbytes);
+}
+
+
+
+/*
+ * Compile the classes of the filter rules and of the queues into a new
+ * lookup table and swap it in. The filter rules keep their order and
+ * so do the queues: when the classes of several queues match, the queue
+ * added first wins. Must be called after the classes, the filter rules
+ * or the queues change. The replaced table is retired: it is freed once
+ * the receive threads that may have looked it up are done (see epoch.h).
+ */
+void rebuildPktCoreClassTable(pktcore_t *pcore)
+{
+	static pthread_mutex_t rebuild_lock = PTHREAD_MUTEX_INITIALIZER;
+	char *cnames[MAX_FILTER_RULES + MAX_QUEUE_SIZE];
+	int groups[MAX_FILTER_RULES + MAX_QUEUE_SIZE], values[MAX_FILTER_RULES + MAX_QUEUE_SIZE];
+	cls_table_t *ctable;
+	int j, n = 0;
+
+	pthread_mutex_lock(&rebuild_lock);
+	for (j = 0; (filter != NULL) && (j < filter->rulecnt); j++, n++)
+	{
+		cnames[n] = filter->ruletab[j]->cname;
+		groups[n] = CLS_GROUP_FILTER;
+		values[n] = filter->ruletab[j]->id * 2 + (filter->ruletab[j]->type ? 1 : 0);
+	}
+	for (j = 0; j < pcore->pcache->numofentries; j++, n++)
+	{
+		cnames[n] = strcmp(pcore->pcache->cname[j], "default") ? pcore->pcache->cname[j] : NULL;
+		groups[n] = CLS_GROUP_QUEUE;
+		values[n] = 0;
+	}
+
+	ctable = compileClassTable(classifier, cnames, groups, values, n);
+	epochRetire((void (*)(void *))freeClassTable, epochPublish((void * volatile *)&(pcore->ctable), ctable));
+	pcore->cversion++;
+	flowInvalidateClasses();
+	verbose(2, "[rebuildPktCoreClassTable]:: %d classes compiled into %d tuples",
+		ctable->nrules, ctable->ntuples);
+	pthread_mutex_unlock(&rebuild_lock);
+}
+
+
+void printPktCoreClassVersion(pktcore_t *pcore)
+{
+	cls_table_t *ctable;
+
+	epochEnter();
+	if ((ctable = pcore->ctable) != NULL)
+		printf("Class table\tversion %lu\t%d classes in %d tuples \n",
+		       pcore->cversion, ctable->nrules, ctable->ntuples);
+	epochExit();
+}
+
+
+/*
+ * Ingress classification of a received packet: one lookup in the
+ * compiled table gives both the filter verdict and the queue. Returns
+ * FALSE if a deny rule of the filter matches (the packet is to be
+ * dropped). Otherwise returns TRUE and sets pkttag to the name of the
+ * queue ("default" if no queue class matches). The first matching
+ * filter rule decides; packets matching no rule pass. Called inside an
+ * epoch section, which must last until the packet is queued: pkttag
+ * points into the class table.
+ */
+int classifyPacket(pktcore_t *pcore, gpacket_t *in_pkt, char **pkttag)
+{
+	cls_table_t *ctable = pcore->ctable;
+	int match[CLS_MAX_GROUPS], value;
+	flow_entry_t flow;
+	static char *defaultstr = "default";
+
+	// the packets of a flow seen before take the matches of its first packet
+	if (flowLookupClass(in_pkt, ctable, match, &flow) == FALSE)
+	{
+		lookupClassTable(ctable, GPKT_ETH(in_pkt), match);
+		flowCacheClass(&flow, ctable, match);
+	}
+
+	if (filter->filteron && (match[CLS_GROUP_FILTER] >= 0))
+	{
+		value = ctable->values[match[CLS_GROUP_FILTER]];
+		countFilterRule(filter, value / 2, value % 2);
+		if ((value % 2) == 0)
+			return FALSE;
 	}
 
-	if (found == TRUE)
-		return cdef->cname;
+	if (match[CLS_GROUP_QUEUE] >= 0)
+		*pkttag = ctable->names[match[CLS_GROUP_QUEUE]];
 	else
-		return defaultstr;
+		*pkttag = defaultstr;
+	return TRUE;
 }
 
 
@@ -0,0 +1,345 @@
+/*
+ * packetpool.c (packet buffer pool for the gRouter)
+ *
+ * All gpacket_t buffers used on the data path come from slabs that are
+ * allocated once when the router starts. Free buffers are kept on a
+ * shared stack; each thread keeps a small cache of buffers so that the
+ * common case (device thread allocates, GNET handler releases) moves
+ * buffers between the threads and the stack in batches of
+ * POOL_CACHE_BATCH under a single lock acquisition.
+ *
+ * Buffers are reference counted (frame.refcnt). newPacket() returns a
+ * packet with one reference; every module that keeps a packet beyond
+ * the call that handed it over (output queue, ARP buffer) takes its own
+ * reference with holdPacket() and drops it with releasePacket(). The
+ * buffer goes back to the pool when the last reference is dropped.
+ *
+ * A buffer holds the Ethernet frame with room in front of it and behind
+ * it (see message.h). There are three size classes: small buffers for
+ * ARP and TCP ACKs, standard ones for frames at the default MTU and
+ * jumbo ones for frames up to MAX_JUMBO_MTU. Each class has its own
+ * slab, free stack and thread caches; newPacketSize() picks the smallest
+ * class that holds the frame. A frame may go on in the buffers of other
+ * packets (segments); the packet holds a reference on each of them and
+ * drops it when it is freed.
+ *
+ * When the slab of a class is exhausted, packets are allocated from the
+ * heap so the router keeps forwarding; these allocations are counted and
+ * reported by 'pool show' and the .info port.
+ */
+
+#include <slack/std.h>
+#include <slack/err.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "grouter.h"
+#include "message.h"
+#include "packetpool.h"
+#include "ringbuffer.h"
+
+
+typedef struct _pktcache_t
+{
+	int count;
+	gpacket_t *pkts[POOL_CACHE_SIZE];
+} pktcache_t;
+
+
+typedef struct _pktclass_t
+{
+	pthread_mutex_t plock;
+	int bufsize;                          // bytes of the buffer of a packet
+	int stride;                           // bytes between packets in the slab
+	char *slab;
+	int npkts;
+	gpacket_t **freestack;
+	int nfree;
+	volatile int inuse;
+	volatile int heapinuse;
+	volatile unsigned long allocs;
+	volatile unsigned long releases;
+	volatile unsigned long exhausted;
+} pktclass_t;
+
+
+typedef struct _pktpool_t
+{
+	pthread_key_t cachekey;               // flushes the caches of an exiting thread
+	pktclass_t classes[PKT_NCLASSES];
+} pktpool_t;
+
+
+static pktpool_t pktpool;
+static __thread pktcache_t pktcache[PKT_NCLASSES];
+static __thread int pktcache_registered;
+
+static int pktclass_size[PKT_NCLASSES] = {PKT_SMALL_SIZE, PKT_STD_SIZE, PKT_JUMBO_SIZE};
+
+
+#define IS_POOL_PACKET(C, P)        (((char *)(P) >= (C)->slab) && ((char *)(P) < ((C)->slab + (C)->npkts * (C)->stride)))
+
+
+static void flushPacketCache(void *arg)
+{
+	pktcache_t *caches = (pktcache_t *)arg;
+	pktclass_t *pc;
+	int i;
+
+	for (i = 0; i < PKT_NCLASSES; i++)
+	{
+		pc = &(pktpool.classes[i]);
+		pthread_mutex_lock(&(pc->plock));
+		while (caches[i].count > 0)
+			pc->freestack[pc->nfree++] = caches[i].pkts[--caches[i].count];
+		pthread_mutex_unlock(&(pc->plock));
+	}
+}
+
+
+static int initPacketClass(pktclass_t *pc, int bufsize, int npkts)
+{
+	int i;
+
+	pthread_mutex_init(&(pc->plock), NULL);
+	pc->bufsize = bufsize;
+	pc->stride = (sizeof(gpacket_t) + bufsize + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1);
+	if (posix_memalign((void **)&(pc->slab), CACHE_LINE_SIZE, (size_t)npkts * pc->stride) != 0)
+	{
+		fatal("[PacketPoolInit]:: unable to allocate memory for %d packets ", npkts);
+		return EXIT_FAILURE;
+	}
+	if ((pc->freestack = (gpacket_t **)malloc(npkts * sizeof(gpacket_t *))) == NULL)
+	{
+		fatal("[PacketPoolInit]:: unable to allocate memory for the free stack ");
+		return EXIT_FAILURE;
+	}
+
+	// lowest addresses on top of the stack: touched first
+	for (i = 0; i < npkts; i++)
+		pc->freestack[i] = (gpacket_t *)(pc->slab + (size_t)(npkts - 1 - i) * pc->stride);
+	pc->npkts = pc->nfree = npkts;
+	pc->inuse = pc->heapinuse = 0;
+	pc->allocs = pc->releases = pc->exhausted = 0;
+	return EXIT_SUCCESS;
+}
+
+
+/*
+ * npkts standard buffers, as many small ones and a jumbo buffer for
+ * every 16 of them
+ */
+int PacketPoolInit(int npkts)
+{
+	int counts[PKT_NCLASSES], i;
+
+	if (npkts <= 0)
+		npkts = DEFAULT_POOL_SIZE;
+	counts[PKT_CLASS_SMALL] = npkts;
+	counts[PKT_CLASS_STD] = npkts;
+	counts[PKT_CLASS_JUMBO] = max(npkts / 16, 1);
+
+	verbose(2, "[PacketPoolInit]:: Initializing the packet pool with %d buffers ", npkts);
+	pthread_key_create(&(pktpool.cachekey), flushPacketCache);
+	for (i = 0; i < PKT_NCLASSES; i++)
+		if (initPacketClass(&(pktpool.classes[i]), pktclass_size[i], counts[i]) == EXIT_FAILURE)
+			return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
+}
+
+
+/*
+ * allocate a packet of a size class. only the GINI frame (metadata) and
+ * the Ethernet header are cleared; the payload is left to the writer of
+ * the packet.
+ */
+static gpacket_t *newPacketClass(int sclass)
+{
+	pktclass_t *pc = &(pktpool.classes[sclass]);
+	pktcache_t *cache = &(pktcache[sclass]);
+	gpacket_t *pkt;
+
+	if (cache->count == 0)
+	{
+		if (!pktcache_registered)
+		{
+			pthread_setspecific(pktpool.cachekey, pktcache);
+			pktcache_registered = 1;
+		}
+		pthread_mutex_lock(&(pc->plock));
+		while ((cache->count < POOL_CACHE_BATCH) && (pc->nfree > 0))
+			cache->pkts[cache->count++] = pc->freestack[--pc->nfree];
+		pthread_mutex_unlock(&(pc->plock));
+	}
+
+	if (cache->count > 0)
+	{
+		pkt = cache->pkts[--cache->count];
+		__sync_fetch_and_add(&(pc->inuse), 1);
+	} else
+	{
+		if ((pkt = (gpacket_t *)malloc(sizeof(gpacket_t) + pc->bufsize)) == NULL)
+		{
+			error("[newPacket]:: unable to allocate memory for packet.. ");
+			return NULL;
+		}
+		__sync_fetch_and_add(&(pc->exhausted), 1);
+		__sync_fetch_and_add(&(pc->heapinuse), 1);
+	}
+	__sync_fetch_and_add(&(pc->allocs), 1);
+
+	bzero(&(pkt->frame), sizeof(pkt_frame_t));
+	pkt->frame.refcnt = 1;
+	pkt->sclass = sclass;
+	pkt->size = pc->bufsize;
+	pkt->data = pkt->buf + PKT_HEADROOM;
+	pkt->len = 0;
+	pkt->nsegs = 0;
+	bzero(pkt->data, ETHER_HEADER_LEN);
+	return pkt;
+}
+
+
+/*
+ * allocate a packet for a frame at the default MTU
+ */
+gpacket_t *newPacket()
+{
+	return newPacketClass(PKT_CLASS_STD);
+}
+
+
+/*
+ * allocate a packet whose buffer holds a frame of len bytes
+ */
+gpacket_t *newPacketSize(int len)
+{
+	int i;
+
+	for (i = 0; i < PKT_NCLASSES - 1; i++)
+		if (len <= pktclass_size[i] - PKT_HEADROOM)
+			break;
+	if (len > pktclass_size[i] - PKT_HEADROOM)
+	{
+		error("[newPacketSize]:: no buffer holds a frame of %d bytes ", len);
+		return NULL;
+	}
+	return newPacketClass(i);
+}
+
+
+gpacket_t *holdPacket(gpacket_t *pkt)
+{
+	__sync_fetch_and_add(&(pkt->frame.refcnt), 1);
+	return pkt;
+}
+
+
+void releasePacket(gpacket_t *pkt)
+{
+	pktclass_t *pc;
+	pktcache_t *cache;
+	int i;
+
+	if (pkt == NULL)
+		return;
+	if (__sync_sub_and_fetch(&(pkt->frame.refcnt), 1) > 0)
+		return;
+
+	for (i = 0; i < pkt->nsegs; i++)
+		releasePacket(pkt->segs[i].owner);
+
+	pc = &(pktpool.classes[pkt->sclass]);
+	cache = &(pktcache[pkt->sclass]);
+	__sync_fetch_and_add(&(pc->releases), 1);
+	if (!IS_POOL_PACKET(pc, pkt))
+	{
+		__sync_fetch_and_sub(&(pc->heapinuse), 1);
+		free(pkt);
+		return;
+	}
+	__sync_fetch_and_sub(&(pc->inuse), 1);
+
+	if (cache->count == POOL_CACHE_SIZE)
+	{
+		pthread_mutex_lock(&(pc->plock));
+		while (cache->count > (POOL_CACHE_SIZE - POOL_CACHE_BATCH))
+			pc->freestack[pc->nfree++] = cache->pkts[--cache->count];
+		pthread_mutex_unlock(&(pc->plock));
+	} else if (!pktcache_registered)
+	{
+		pthread_setspecific(pktpool.cachekey, pktcache);
+		pktcache_registered = 1;
+	}
+	cache->pkts[cache->count++] = pkt;
+}
+
+
+void getPacketClassStats(int sclass, pktpoolstats_t *pstats)
+{
+	pktclass_t *pc = &(pktpool.classes[sclass]);
+
+	pthread_mutex_lock(&(pc->plock));
+	pstats->bufsize = pc->bufsize;
+	pstats->total = pc->npkts;
+	pstats->free = pc->nfree;
+	pstats->inuse = pc->inuse;
+	pstats->cached = pc->npkts - pc->nfree - pc->inuse;
+	pstats->allocs = pc->allocs;
+	pstats->releases = pc->releases;
+	pstats->exhausted = pc->exhausted;
+	pstats->heapinuse = pc->heapinuse;
+	pthread_mutex_unlock(&(pc->plock));
+}
+
+
+/*
+ * the counters of all the size classes together
+ */
+void getPacketPoolStats(pktpoolstats_t *pstats)
+{
+	pktpoolstats_t cstats;
+	int i;
+
+	bzero(pstats, sizeof(pktpoolstats_t));
+	for (i = 0; i < PKT_NCLASSES; i++)
+	{
+		getPacketClassStats(i, &cstats);
+		pstats->total += cstats.total;
+		pstats->free += cstats.free;
+		pstats->inuse += cstats.inuse;
+		pstats->cached += cstats.cached;
+		pstats->allocs += cstats.allocs;
+		pstats->releases += cstats.releases;
+		pstats->exhausted += cstats.exhausted;
+		pstats->heapinuse += cstats.heapinuse;
+	}
+}
+
+
+void printPacketPool()
+{
+	static char *names[PKT_NCLASSES] = {"small", "standard", "jumbo"};
+	pktpoolstats_t pstats;
+	int i;
+
+	printf("\nClass\t\tBuffer\tTotal\tFree\tCached\tIn use\tAllocs\t\tReleases\tExhausted\tHeap in use\n");
+	for (i = 0; i < PKT_NCLASSES; i++)
+	{
+		getPacketClassStats(i, &pstats);
+		printf("%-16s%d\t%d\t%d\t%d\t%d\t%-16lu%-16lu%-16lu%d\n", names[i], pstats.bufsize,
+		       pstats.total, pstats.free, pstats.cached, pstats.inuse, pstats.allocs,
+		       pstats.releases, pstats.exhausted, pstats.heapinuse);
+	}
+
+	getPacketPoolStats(&pstats);
+	printf("\nPacket pool: %d buffers \n", pstats.total);
+	printf("Free (shared): %d \n", pstats.free);
+	printf("Free (thread caches): %d \n", pstats.cached);
+	printf("In use: %d \n", pstats.inuse);
+	printf("Allocations: %lu \n", pstats.allocs);
+	printf("Releases: %lu \n", pstats.releases);
+	printf("Pool exhausted (heap allocations): %lu \n", pstats.exhausted);
+	printf("Heap packets in use: %d \n", pstats.heapinuse);
+}
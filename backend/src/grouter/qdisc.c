@@ -0,0 +1,1033 @@
+/*
+ * qdisc.c (queuing disciplines of the class queues)
+ *
+ *   fifo      tail drop
+ *   red       random early detection on the average queue length
+ *             (Floyd and Jacobson), gentle above maxth
+ *   codel     CoDel (RFC 8289): drops at dequeue once the sojourn time
+ *             has stayed above target for an interval
+ *   pie       PIE (RFC 8033): drops at enqueue with a probability
+ *             driven by the queuing delay
+ *   fq_codel  flow queues served by DRR with CoDel on each (RFC 8290)
+ *
+ * The scheduler engine stamps each packet with the time it was queued
+ * (frame.qtime). The delay the AQMs control is the time a packet waited
+ * beyond the delay_us the queue emulates (qdiscSojourn), so an emulated
+ * link latency is not taken for a standing queue.
+ *
+ * A discipline owns the packets given to it: one it does not admit is
+ * dropped (qdiscDrop) and enqueue returns EXIT_FAILURE. An enqueue with
+ * now == 0 is a requeue (change of discipline) and never drops early.
+ */
+
+#include <slack/err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "qdisc.h"
+#include "packetcore.h"
+#include "packetpool.h"
+#include "trace.h"
+#include "stats.h"
+
+
+// counters common to all disciplines, at the start of their state
+typedef struct _qdstats_t
+{
+	unsigned long drops;                  // dropped by the AQM
+	unsigned long taildrops;              // dropped because the queue was full
+} qdstats_t;
+
+
+unsigned long long qdiscSojourn(simplequeue_t *q, gpacket_t *pkt, unsigned long long now)
+{
+	unsigned long long since = pkt->frame.qtime + (unsigned long long)(q->delay_us * 1000.0);
+
+	return (now > since) ? now - since : 0;
+}
+
+
+void qdiscDrop(simplequeue_t *q, gpacket_t *pkt, int reason)
+{
+	qdstats_t *st = (qdstats_t *)q->qdata;
+
+	if (reason == TRACE_DROP_QUEUE)
+		st->taildrops++;
+	else
+		st->drops++;
+	if (q->qstats != NULL)
+		q->qstats->drops++;
+	VERBOSE(2, "[qdiscDrop]:: %s dropped a packet of queue %s ", q->qops->name, q->name);
+	TRACE(TRACE_DROP, reason, pkt->frame.src_interface, 0);
+	releasePacket(pkt);
+}
+
+
+// xorshift32, uniform in [0, 1)
+static double qdiscRandom(unsigned int *state)
+{
+	unsigned int x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x / 4294967296.0;
+}
+
+
+static unsigned int qdiscSeed(simplequeue_t *q)
+{
+	return (unsigned int)getTimeNanos() ^ (q->schedid * 0x9e3779b1) ^ 1;
+}
+
+
+/*
+ * fifo: the packets are kept in the ring (or list) of the queue
+ */
+static int fifoAdd(simplequeue_t *q, gpacket_t *pkt, int len)
+{
+	if (writeQueue(q, pkt, len) == EXIT_FAILURE)
+	{
+		qdiscDrop(q, pkt, TRACE_DROP_QUEUE);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+
+static gpacket_t *fifoPop(simplequeue_t *q, int *len)
+{
+	gpacket_t *pkt;
+
+	if (tryReadQueue(q, (void **)&pkt, len) == EXIT_FAILURE)
+		return NULL;
+	return pkt;
+}
+
+
+static int fifoPeek(simplequeue_t *q, int *len, unsigned long long *qtime)
+{
+	gpacket_t *pkt;
+
+	if (peekQueue(q, (void **)&pkt, len) == EXIT_FAILURE)
+		return EXIT_FAILURE;
+	*qtime = pkt->frame.qtime;
+	return EXIT_SUCCESS;
+}
+
+
+static int fifoInit(simplequeue_t *q)
+{
+	if ((q->qdata = calloc(1, sizeof(qdstats_t))) == NULL)
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
+
+
+static void fifoFree(simplequeue_t *q)
+{
+	free(q->qdata);
+	q->qdata = NULL;
+}
+
+
+static int fifoEnqueue(simplequeue_t *q, gpacket_t *pkt, int len, unsigned long long now)
+{
+	return fifoAdd(q, pkt, len);
+}
+
+
+static gpacket_t *fifoDequeue(simplequeue_t *q, int *len, unsigned long long now)
+{
+	return fifoPop(q, len);
+}
+
+
+static int fifoSetParam(simplequeue_t *q, char *param, double value)
+{
+	return EXIT_FAILURE;
+}
+
+
+static void fifoPrint(simplequeue_t *q)
+{
+	qdstats_t *st = (qdstats_t *)q->qdata;
+
+	printf("\ttail drops %lu \n", st->taildrops);
+}
+
+
+/*
+ * RED: the average queue length (in packets) is an EWMA updated at each
+ * arrival; while the queue is empty it decays as if an empty queue had
+ * been seen every RED_IDLE_PKT_NS. Between minth and maxth an arrival
+ * is dropped with a probability rising to maxp, spread out by the count
+ * of packets since the last drop; between maxth and 2 maxth (gentle) it
+ * rises from maxp to 1.
+ */
+typedef struct _red_t
+{
+	qdstats_t st;
+	double avg;
+	int count;                            // packets admitted since the last early drop
+	int minth, maxth;
+	double maxp;
+	unsigned long long idle_since;        // 0 while the queue is busy
+	unsigned int rnd;
+} red_t;
+
+
+static int redInit(simplequeue_t *q)
+{
+	red_t *r;
+
+	if ((r = (red_t *)calloc(1, sizeof(red_t))) == NULL)
+		return EXIT_FAILURE;
+	r->minth = max(q->maxsize / 8, 5);
+	r->maxth = min(3 * r->minth, max(q->maxsize, r->minth + 1));
+	r->maxp = RED_MAXP;
+	r->idle_since = getTimeNanos();
+	r->rnd = qdiscSeed(q);
+	q->qdata = r;
+	return EXIT_SUCCESS;
+}
+
+
+static int redEnqueue(simplequeue_t *q, gpacket_t *pkt, int len, unsigned long long now)
+{
+	red_t *r = (red_t *)q->qdata;
+	double pb, pa;
+
+	if (now == 0)
+		return fifoAdd(q, pkt, len);
+
+	if (r->idle_since != 0)
+	{
+		if (now > r->idle_since)
+			r->avg *= pow(1.0 - RED_WEIGHT, (double)(now - r->idle_since) / RED_IDLE_PKT_NS);
+		r->idle_since = 0;
+	}
+	r->avg += RED_WEIGHT * (q->cursize - r->avg);
+
+	if (r->avg < r->minth)
+		r->count = 0;
+	else if (r->avg >= 2 * r->maxth)
+	{
+		r->count = 0;
+		qdiscDrop(q, pkt, TRACE_DROP_AQM);
+		return EXIT_FAILURE;
+	} else
+	{
+		r->count++;
+		if (r->avg < r->maxth)
+			pb = r->maxp * (r->avg - r->minth) / (r->maxth - r->minth);
+		else
+			pb = r->maxp + (1.0 - r->maxp) * (r->avg - r->maxth) / r->maxth;
+		pa = (r->count * pb >= 1.0) ? 1.0 : pb / (1.0 - r->count * pb);
+		if (qdiscRandom(&(r->rnd)) < pa)
+		{
+			r->count = 0;
+			qdiscDrop(q, pkt, TRACE_DROP_AQM);
+			return EXIT_FAILURE;
+		}
+	}
+	return fifoAdd(q, pkt, len);
+}
+
+
+static gpacket_t *redDequeue(simplequeue_t *q, int *len, unsigned long long now)
+{
+	red_t *r = (red_t *)q->qdata;
+	gpacket_t *pkt = fifoPop(q, len);
+
+	if ((q->cursize == 0) && (r->idle_since == 0))
+		r->idle_since = now;
+	return pkt;
+}
+
+
+static int redSetParam(simplequeue_t *q, char *param, double value)
+{
+	red_t *r = (red_t *)q->qdata;
+
+	if (!strcmp(param, "minth") && (value >= 1) && (value < r->maxth))
+		r->minth = (int)value;
+	else if (!strcmp(param, "maxth") && (value > r->minth))
+		r->maxth = (int)value;
+	else if (!strcmp(param, "maxp") && (value > 0) && (value <= 1))
+		r->maxp = value;
+	else
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
+
+
+static void redPrint(simplequeue_t *q)
+{
+	red_t *r = (red_t *)q->qdata;
+
+	printf("\tminth %d maxth %d maxp %.3f, average %.2f packets \n", r->minth, r->maxth, r->maxp, r->avg);
+	printf("\tearly drops %lu, tail drops %lu \n", r->st.drops, r->st.taildrops);
+}
+
+
+/*
+ * CoDel (RFC 8289). pop takes the next packet of the queue (or of a flow
+ * of fq_codel, src) and gives the bytes left behind it. A packet is
+ * dropped at dequeue once the sojourn time has been above target for
+ * an interval, then at intervals shrinking with the square root of the
+ * number of drops until the sojourn time is below target again.
+ */
+typedef gpacket_t *(*codelpop_t)(simplequeue_t *q, void *src, int *len, int *backlog);
+
+
+static gpacket_t *codelDoDequeue(codel_t *c, simplequeue_t *q, void *src, codelpop_t pop, int *len,
+				 unsigned long long now, unsigned long long target,
+				 unsigned long long interval, int *oktodrop)
+{
+	gpacket_t *pkt;
+	int backlog;
+
+	*oktodrop = 0;
+	if ((pkt = pop(q, src, len, &backlog)) == NULL)
+	{
+		c->first_above = 0;
+		return NULL;
+	}
+	if ((qdiscSojourn(q, pkt, now) < target) || (backlog <= QDISC_MAXPACKET))
+		c->first_above = 0;
+	else if (c->first_above == 0)
+		c->first_above = now + interval;
+	else if (now >= c->first_above)
+		*oktodrop = 1;
+	return pkt;
+}
+
+
+static unsigned long long codelControlLaw(unsigned long long t, unsigned long long interval, unsigned int count)
+{
+	return t + (unsigned long long)(interval / sqrt((double)count));
+}
+
+
+static gpacket_t *codelDequeue(codel_t *c, simplequeue_t *q, void *src, codelpop_t pop, int *len,
+			       unsigned long long now, unsigned long long target, unsigned long long interval)
+{
+	gpacket_t *pkt;
+	int oktodrop, delta;
+
+	if ((pkt = codelDoDequeue(c, q, src, pop, len, now, target, interval, &oktodrop)) == NULL)
+	{
+		c->dropping = 0;
+		return NULL;
+	}
+	if (c->dropping)
+	{
+		if (!oktodrop)
+			c->dropping = 0;
+		while (c->dropping && (now >= c->drop_next))
+		{
+			qdiscDrop(q, pkt, TRACE_DROP_AQM);
+			c->count++;
+			pkt = codelDoDequeue(c, q, src, pop, len, now, target, interval, &oktodrop);
+			if (!oktodrop)
+				c->dropping = 0;
+			else
+				c->drop_next = codelControlLaw(c->drop_next, interval, c->count);
+		}
+	} else if (oktodrop)
+	{
+		qdiscDrop(q, pkt, TRACE_DROP_AQM);
+		pkt = codelDoDequeue(c, q, src, pop, len, now, target, interval, &oktodrop);
+		c->dropping = 1;
+		// drop faster if the last dropping state ended recently
+		delta = (int)c->count - (int)c->lastcount;
+		c->count = 1;
+		if ((delta > 1) && ((long long)(now - c->drop_next) < 16 * (long long)interval))
+			c->count = delta;
+		c->drop_next = codelControlLaw(now, interval, c->count);
+		c->lastcount = c->count;
+	}
+	return pkt;
+}
+
+
+typedef struct _codelq_t
+{
+	qdstats_t st;
+	unsigned long long target, interval;  // nanoseconds
+	codel_t cv;
+} codelq_t;
+
+
+static gpacket_t *codelRingPop(simplequeue_t *q, void *src, int *len, int *backlog)
+{
+	gpacket_t *pkt = fifoPop(q, len);
+
+	*backlog = q->bytesleft;
+	return pkt;
+}
+
+
+static int codelInit(simplequeue_t *q)
+{
+	codelq_t *cq;
+
+	if ((cq = (codelq_t *)calloc(1, sizeof(codelq_t))) == NULL)
+		return EXIT_FAILURE;
+	cq->target = CODEL_TARGET_US * 1000ULL;
+	cq->interval = CODEL_INTERVAL_US * 1000ULL;
+	q->qdata = cq;
+	return EXIT_SUCCESS;
+}
+
+
+static gpacket_t *codelQDequeue(simplequeue_t *q, int *len, unsigned long long now)
+{
+	codelq_t *cq = (codelq_t *)q->qdata;
+
+	return codelDequeue(&(cq->cv), q, NULL, codelRingPop, len, now, cq->target, cq->interval);
+}
+
+
+// target and interval of CoDel and fq_codel, in microseconds
+static int codelParam(unsigned long long *target, unsigned long long *interval, char *param, double value)
+{
+	if (value <= 0)
+		return EXIT_FAILURE;
+	if (!strcmp(param, "target"))
+		*target = (unsigned long long)(value * 1000.0);
+	else if (!strcmp(param, "interval"))
+		*interval = (unsigned long long)(value * 1000.0);
+	else
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
+
+
+static int codelSetParam(simplequeue_t *q, char *param, double value)
+{
+	codelq_t *cq = (codelq_t *)q->qdata;
+
+	return codelParam(&(cq->target), &(cq->interval), param, value);
+}
+
+
+static void codelPrint(simplequeue_t *q)
+{
+	codelq_t *cq = (codelq_t *)q->qdata;
+
+	printf("\ttarget %llu us interval %llu us, %s (count %u) \n", cq->target / 1000, cq->interval / 1000,
+	       cq->cv.dropping ? "dropping" : "not dropping", cq->cv.count);
+	printf("\tdrops %lu, tail drops %lu \n", cq->st.drops, cq->st.taildrops);
+}
+
+
+/*
+ * PIE (RFC 8033). The drop probability p is updated every tupdate from
+ * the queuing delay (the sojourn time of the head packet) and its trend;
+ * the update is done by the first enqueue or dequeue after it is due.
+ * Arrivals are dropped with probability p, except during the burst
+ * allowance and while the delay is well below target.
+ */
+typedef struct _pie_t
+{
+	qdstats_t st;
+	double p;
+	unsigned long long qdelay_old;
+	unsigned long long next_update;
+	long long burst;                      // burst allowance left
+	unsigned long long target, tupdate, maxburst;
+	unsigned int rnd;
+} pie_t;
+
+
+static int pieInit(simplequeue_t *q)
+{
+	pie_t *pie;
+
+	if ((pie = (pie_t *)calloc(1, sizeof(pie_t))) == NULL)
+		return EXIT_FAILURE;
+	pie->target = PIE_TARGET_US * 1000ULL;
+	pie->tupdate = PIE_TUPDATE_US * 1000ULL;
+	pie->maxburst = PIE_MAX_BURST_US * 1000ULL;
+	pie->burst = pie->maxburst;
+	pie->rnd = qdiscSeed(q);
+	q->qdata = pie;
+	return EXIT_SUCCESS;
+}
+
+
+static void pieUpdate(simplequeue_t *q, pie_t *pie, unsigned long long now)
+{
+	unsigned long long qdelay = 0, qtime;
+	double alpha = PIE_ALPHA, beta = PIE_BETA, delta;
+	int len;
+
+	if (now < pie->next_update)
+		return;
+	pie->next_update = now + pie->tupdate;
+
+	if (fifoPeek(q, &len, &qtime) == EXIT_SUCCESS)
+	{
+		qtime += (unsigned long long)(q->delay_us * 1000.0);
+		qdelay = (now > qtime) ? now - qtime : 0;
+	}
+
+	// small probabilities move in small steps
+	if (pie->p < 0.000001)
+		alpha /= 2048, beta /= 2048;
+	else if (pie->p < 0.00001)
+		alpha /= 512, beta /= 512;
+	else if (pie->p < 0.0001)
+		alpha /= 128, beta /= 128;
+	else if (pie->p < 0.001)
+		alpha /= 32, beta /= 32;
+	else if (pie->p < 0.01)
+		alpha /= 8, beta /= 8;
+	else if (pie->p < 0.1)
+		alpha /= 2, beta /= 2;
+	delta = alpha * ((double)qdelay - (double)pie->target) / 1e9 +
+		beta * ((double)qdelay - (double)pie->qdelay_old) / 1e9;
+	if ((pie->p >= 0.1) && (delta > 0.02))
+		delta = 0.02;
+	pie->p += delta;
+	if (qdelay > 250000000ULL)
+		pie->p += 0.02;
+	pie->p = min(max(pie->p, 0.0), 1.0);
+	if ((qdelay == 0) && (pie->qdelay_old == 0))
+		pie->p *= 0.98;
+
+	pie->burst = max(pie->burst - (long long)pie->tupdate, 0LL);
+	if ((pie->p == 0.0) && (qdelay < pie->target / 2) && (pie->qdelay_old < pie->target / 2))
+		pie->burst = pie->maxburst;
+	pie->qdelay_old = qdelay;
+}
+
+
+static int pieEnqueue(simplequeue_t *q, gpacket_t *pkt, int len, unsigned long long now)
+{
+	pie_t *pie = (pie_t *)q->qdata;
+
+	if (now == 0)
+		return fifoAdd(q, pkt, len);
+
+	pieUpdate(q, pie, now);
+	if ((pie->burst == 0) && !((pie->qdelay_old < pie->target / 2) && (pie->p < 0.2)) &&
+	    (q->bytesleft > 2 * QDISC_MAXPACKET) && (qdiscRandom(&(pie->rnd)) < pie->p))
+	{
+		qdiscDrop(q, pkt, TRACE_DROP_AQM);
+		return EXIT_FAILURE;
+	}
+	return fifoAdd(q, pkt, len);
+}
+
+
+static gpacket_t *pieDequeue(simplequeue_t *q, int *len, unsigned long long now)
+{
+	pieUpdate(q, (pie_t *)q->qdata, now);
+	return fifoPop(q, len);
+}
+
+
+static int pieSetParam(simplequeue_t *q, char *param, double value)
+{
+	pie_t *pie = (pie_t *)q->qdata;
+
+	if (value <= 0)
+		return EXIT_FAILURE;
+	if (!strcmp(param, "target"))
+		pie->target = (unsigned long long)(value * 1000.0);
+	else if (!strcmp(param, "tupdate"))
+		pie->tupdate = (unsigned long long)(value * 1000.0);
+	else if (!strcmp(param, "burst"))
+		pie->maxburst = (unsigned long long)(value * 1000.0);
+	else
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
+
+
+static void piePrint(simplequeue_t *q)
+{
+	pie_t *pie = (pie_t *)q->qdata;
+
+	printf("\ttarget %llu us tupdate %llu us burst %llu us, p %.5f, delay %llu us \n",
+	       pie->target / 1000, pie->tupdate / 1000, pie->maxburst / 1000, pie->p, pie->qdelay_old / 1000);
+	printf("\tdrops %lu, tail drops %lu \n", pie->st.drops, pie->st.taildrops);
+}
+
+
+/*
+ * fq_codel (RFC 8290). Arrivals are hashed (flowHash) to one of the
+ * flow queues; a flow that was idle joins the list of new flows, which
+ * is served before the old ones, with a quantum of credit. A flow that
+ * used its credit goes to the tail of the old flows with a new quantum.
+ * Each flow runs CoDel on its own packets. When the queue is full the
+ * head packet of the flow with the largest backlog is dropped -- its
+ * last packet if the queue has a delay, as the head is the one closest
+ * to its release and dropping it would hold the flow forever.
+ *
+ * The packets sit in a pool of nodes (one per slot of the queue) linked
+ * per flow; the ring of the queue is not used.
+ */
+#define FQ_NEW                      0
+#define FQ_OLD                      1
+
+typedef struct _fqnode_t
+{
+	gpacket_t *pkt;
+	int len;
+	int next;
+} fqnode_t;
+
+
+typedef struct _fqflow_t
+{
+	int head, tail;                       // nodes, -1 if the flow is empty
+	int backlog;                          // bytes
+	int deficit;
+	int list;                             // FQ_NEW, FQ_OLD or -1
+	int next;                             // next flow on the list
+	codel_t cv;
+} fqflow_t;
+
+
+typedef struct _fqcodel_t
+{
+	qdstats_t st;
+	unsigned long long target, interval;
+	int quantum, nflows;
+	fqflow_t *flows;
+	fqnode_t *nodes;
+	int freenode;
+	int lhead[2], ltail[2];               // lists of new and old flows
+	unsigned long newflows;
+} fqcodel_t;
+
+
+static void fqListPush(fqcodel_t *fq, int l, int f)
+{
+	fq->flows[f].next = -1;
+	fq->flows[f].list = l;
+	if (fq->lhead[l] < 0)
+		fq->lhead[l] = f;
+	else
+		fq->flows[fq->ltail[l]].next = f;
+	fq->ltail[l] = f;
+}
+
+
+// take flow f (after prev, -1 if it is the first) off list l
+static void fqListRemove(fqcodel_t *fq, int l, int f, int prev)
+{
+	if (prev < 0)
+		fq->lhead[l] = fq->flows[f].next;
+	else
+		fq->flows[prev].next = fq->flows[f].next;
+	if (fq->ltail[l] == f)
+		fq->ltail[l] = prev;
+	fq->flows[f].list = -1;
+}
+
+
+// an empty flow, or one whose head packet may leave at now
+static int fqFlowDue(simplequeue_t *q, fqcodel_t *fq, fqflow_t *flow, unsigned long long now)
+{
+	if ((flow->head < 0) || (q->delay_us <= 0))
+		return TRUE;
+	return (fq->nodes[flow->head].pkt->frame.qtime + (unsigned long long)(q->delay_us * 1000.0) <= now);
+}
+
+
+static gpacket_t *fqFlowPop(simplequeue_t *q, void *src, int *len, int *backlog)
+{
+	fqcodel_t *fq = (fqcodel_t *)q->qdata;
+	fqflow_t *flow = (fqflow_t *)src;
+	fqnode_t *n;
+	int id;
+
+	if ((id = flow->head) < 0)
+	{
+		*backlog = 0;
+		return NULL;
+	}
+	n = &(fq->nodes[id]);
+	if ((flow->head = n->next) < 0)
+		flow->tail = -1;
+	n->next = fq->freenode;
+	fq->freenode = id;
+
+	flow->backlog -= n->len;
+	q->cursize--;
+	q->bytesleft -= n->len;
+	*len = n->len;
+	*backlog = flow->backlog;
+	return n->pkt;
+}
+
+
+// the last packet of a flow
+static gpacket_t *fqFlowPopTail(simplequeue_t *q, fqflow_t *flow, int *len)
+{
+	fqcodel_t *fq = (fqcodel_t *)q->qdata;
+	int id = flow->tail, prev;
+
+	if (flow->head == id)
+		return fqFlowPop(q, flow, len, &prev);
+	for (prev = flow->head; fq->nodes[prev].next != id; prev = fq->nodes[prev].next)
+		;
+	fq->nodes[prev].next = -1;
+	flow->tail = prev;
+	fq->nodes[id].next = fq->freenode;
+	fq->freenode = id;
+
+	flow->backlog -= fq->nodes[id].len;
+	q->cursize--;
+	q->bytesleft -= fq->nodes[id].len;
+	*len = fq->nodes[id].len;
+	return fq->nodes[id].pkt;
+}
+
+
+// the first flow with packets, in the order they would be served
+static fqflow_t *fqFirstFlow(fqcodel_t *fq)
+{
+	int l, f;
+
+	for (l = FQ_NEW; l <= FQ_OLD; l++)
+		for (f = fq->lhead[l]; f >= 0; f = fq->flows[f].next)
+			if (fq->flows[f].head >= 0)
+				return &(fq->flows[f]);
+	return NULL;
+}
+
+
+static int fqInit(simplequeue_t *q)
+{
+	fqcodel_t *fq;
+	int i;
+
+	if ((fq = (fqcodel_t *)calloc(1, sizeof(fqcodel_t))) == NULL)
+		return EXIT_FAILURE;
+	fq->target = CODEL_TARGET_US * 1000ULL;
+	fq->interval = CODEL_INTERVAL_US * 1000ULL;
+	fq->quantum = FQ_CODEL_QUANTUM;
+	fq->nflows = FQ_CODEL_FLOWS;
+	fq->flows = (fqflow_t *)calloc(fq->nflows, sizeof(fqflow_t));
+	fq->nodes = (fqnode_t *)calloc(q->maxsize, sizeof(fqnode_t));
+	if ((fq->flows == NULL) || (fq->nodes == NULL))
+	{
+		free(fq->flows);
+		free(fq->nodes);
+		free(fq);
+		return EXIT_FAILURE;
+	}
+	for (i = 0; i < fq->nflows; i++)
+		fq->flows[i].head = fq->flows[i].tail = fq->flows[i].list = -1;
+	for (i = 0; i < q->maxsize; i++)
+		fq->nodes[i].next = i + 1;
+	fq->nodes[q->maxsize - 1].next = -1;
+	fq->freenode = 0;
+	fq->lhead[FQ_NEW] = fq->lhead[FQ_OLD] = fq->ltail[FQ_NEW] = fq->ltail[FQ_OLD] = -1;
+	q->qdata = fq;
+	return EXIT_SUCCESS;
+}
+
+
+static void fqFree(simplequeue_t *q)
+{
+	fqcodel_t *fq = (fqcodel_t *)q->qdata;
+
+	free(fq->flows);
+	free(fq->nodes);
+	free(fq);
+	q->qdata = NULL;
+}
+
+
+static int fqEnqueue(simplequeue_t *q, gpacket_t *pkt, int len, unsigned long long now)
+{
+	fqcodel_t *fq = (fqcodel_t *)q->qdata;
+	fqflow_t *flow;
+	gpacket_t *victim;
+	int f, fat, vlen, backlog, id;
+
+	if (q->cursize >= q->maxsize)
+	{
+		// make room in the fattest flow
+		for (fat = 0, f = 1; f < fq->nflows; f++)
+			if (fq->flows[f].backlog > fq->flows[fat].backlog)
+				fat = f;
+		if (q->delay_us > 0)
+			victim = fqFlowPopTail(q, &(fq->flows[fat]), &vlen);
+		else
+			victim = fqFlowPop(q, &(fq->flows[fat]), &vlen, &backlog);
+		if (victim != NULL)
+			qdiscDrop(q, victim, TRACE_DROP_QUEUE);
+	}
+	if ((id = fq->freenode) < 0)
+	{
+		qdiscDrop(q, pkt, TRACE_DROP_QUEUE);
+		return EXIT_FAILURE;
+	}
+	fq->freenode = fq->nodes[id].next;
+	fq->nodes[id].pkt = pkt;
+	fq->nodes[id].len = len;
+	fq->nodes[id].next = -1;
+
+	f = flowHash(pkt) % fq->nflows;
+	flow = &(fq->flows[f]);
+	if (flow->tail < 0)
+		flow->head = id;
+	else
+		fq->nodes[flow->tail].next = id;
+	flow->tail = id;
+	flow->backlog += len;
+	q->cursize++;
+	q->bytesleft += len;
+
+	if (flow->list < 0)
+	{
+		fqListPush(fq, FQ_NEW, f);
+		flow->deficit = fq->quantum;
+		fq->newflows++;
+	}
+	return EXIT_SUCCESS;
+}
+
+
+static gpacket_t *fqDequeue(simplequeue_t *q, int *len, unsigned long long now)
+{
+	fqcodel_t *fq = (fqcodel_t *)q->qdata;
+	fqflow_t *flow;
+	gpacket_t *pkt;
+	int l, f, prev;
+
+	while (1)
+	{
+		// the first flow, new ones first; with a delay the flows whose
+		// head packet is still held are passed over
+		for (l = FQ_NEW; l <= FQ_OLD; l++)
+		{
+			for (prev = -1, f = fq->lhead[l]; (f >= 0) && !fqFlowDue(q, fq, &(fq->flows[f]), now);
+			     prev = f, f = fq->flows[f].next)
+				;
+			if (f >= 0)
+				break;
+		}
+		if (l > FQ_OLD)
+			return NULL;
+		flow = &(fq->flows[f]);
+
+		if (flow->deficit <= 0)
+		{
+			flow->deficit += fq->quantum;
+			fqListRemove(fq, l, f, prev);
+			fqListPush(fq, FQ_OLD, f);
+			continue;
+		}
+		if ((pkt = codelDequeue(&(flow->cv), q, flow, fqFlowPop, len, now, fq->target, fq->interval)) == NULL)
+		{
+			// an empty new flow goes through the old list once so it cannot jump the queue again
+			fqListRemove(fq, l, f, prev);
+			if ((l == FQ_NEW) && (fq->lhead[FQ_OLD] >= 0))
+				fqListPush(fq, FQ_OLD, f);
+			continue;
+		}
+		flow->deficit -= *len;
+		return pkt;
+	}
+}
+
+
+static gpacket_t *fqPop(simplequeue_t *q, int *len)
+{
+	fqflow_t *flow;
+	int backlog;
+
+	if ((flow = fqFirstFlow((fqcodel_t *)q->qdata)) == NULL)
+		return NULL;
+	return fqFlowPop(q, flow, len, &backlog);
+}
+
+
+/*
+ * the head of the flow served next or, with a delay, the head packet
+ * that is due first
+ */
+static int fqPeek(simplequeue_t *q, int *len, unsigned long long *qtime)
+{
+	fqcodel_t *fq = (fqcodel_t *)q->qdata;
+	fqflow_t *flow, *first = NULL;
+	int l, f;
+
+	for (l = FQ_NEW; (l <= FQ_OLD) && ((first == NULL) || (q->delay_us > 0)); l++)
+		for (f = fq->lhead[l]; (f >= 0) && ((first == NULL) || (q->delay_us > 0)); f = fq->flows[f].next)
+		{
+			flow = &(fq->flows[f]);
+			if ((flow->head >= 0) && ((first == NULL) ||
+			    (fq->nodes[flow->head].pkt->frame.qtime < fq->nodes[first->head].pkt->frame.qtime)))
+				first = flow;
+		}
+	if (first == NULL)
+		return EXIT_FAILURE;
+	*len = fq->nodes[first->head].len;
+	*qtime = fq->nodes[first->head].pkt->frame.qtime;
+	return EXIT_SUCCESS;
+}
+
+
+static int fqSetParam(simplequeue_t *q, char *param, double value)
+{
+	fqcodel_t *fq = (fqcodel_t *)q->qdata;
+
+	if (!strcmp(param, "quantum") && (value >= SCHED_MIN_QUANTUM))
+	{
+		fq->quantum = (int)value;
+		return EXIT_SUCCESS;
+	}
+	return codelParam(&(fq->target), &(fq->interval), param, value);
+}
+
+
+static void fqPrint(simplequeue_t *q)
+{
+	fqcodel_t *fq = (fqcodel_t *)q->qdata;
+	int f, nnew = 0, nold = 0;
+
+	for (f = fq->lhead[FQ_NEW]; f >= 0; f = fq->flows[f].next)
+		nnew++;
+	for (f = fq->lhead[FQ_OLD]; f >= 0; f = fq->flows[f].next)
+		nold++;
+	printf("\ttarget %llu us interval %llu us quantum %d, %d flows: %d new %d old, %lu new flows seen \n",
+	       fq->target / 1000, fq->interval / 1000, fq->quantum, fq->nflows, nnew, nold, fq->newflows);
+	printf("\tdrops %lu, overflow drops %lu \n", fq->st.drops, fq->st.taildrops);
+}
+
+
+static qdisc_t qdisc_fifo = {"fifo", "tail drop first in first out", fifoInit, fifoFree,
+			     fifoEnqueue, fifoDequeue, fifoPop, fifoPeek, fifoSetParam, fifoPrint};
+static qdisc_t qdisc_red = {"red", "random early detection (minth, maxth, maxp)", redInit, fifoFree,
+			    redEnqueue, redDequeue, fifoPop, fifoPeek, redSetParam, redPrint};
+static qdisc_t qdisc_codel = {"codel", "controlled delay, RFC 8289 (target, interval)", codelInit, fifoFree,
+			      fifoEnqueue, codelQDequeue, fifoPop, fifoPeek, codelSetParam, codelPrint};
+static qdisc_t qdisc_pie = {"pie", "proportional integral enhanced, RFC 8033 (target, tupdate, burst)",
+			    pieInit, fifoFree, pieEnqueue, pieDequeue, fifoPop, fifoPeek, pieSetParam, piePrint};
+static qdisc_t qdisc_fq_codel = {"fq_codel", "flow queues with CoDel, RFC 8290 (target, interval, quantum)",
+				 fqInit, fqFree, fqEnqueue, fqDequeue, fqPop, fqPeek, fqSetParam, fqPrint};
+
+static qdisc_t *qdiscs[] = {&qdisc_fifo, &qdisc_red, &qdisc_codel, &qdisc_pie, &qdisc_fq_codel, NULL};
+
+
+qdisc_t *findQdisc(char *name)
+{
+	int i;
+
+	for (i = 0; qdiscs[i] != NULL; i++)
+		if (!strcmp(qdiscs[i]->name, name))
+			return qdiscs[i];
+	return NULL;
+}
+
+
+int qdiscAttach(simplequeue_t *q, char *name)
+{
+	qdisc_t *ops;
+
+	if ((ops = findQdisc(name)) == NULL)
+	{
+		error("[qdiscAttach]:: unknown queuing discipline %s ", name);
+		return EXIT_FAILURE;
+	}
+	if (ops->init(q) == EXIT_FAILURE)
+	{
+		error("[qdiscAttach]:: unable to allocate memory for %s ", name);
+		return EXIT_FAILURE;
+	}
+	q->qops = ops;
+	strcpy(q->qdisc, name);
+	return EXIT_SUCCESS;
+}
+
+
+/*
+ * move the packets of the queue to a new discipline. they keep their
+ * order (as the old discipline would send them) and their enqueue times.
+ */
+int qdiscChange(simplequeue_t *q, char *name)
+{
+	qdisc_t *old = q->qops;
+	gpacket_t **pkts;
+	int *lens, i, n = 0, status = EXIT_SUCCESS;
+
+	if (findQdisc(name) == NULL)
+	{
+		error("[qdiscChange]:: unknown queuing discipline %s ", name);
+		return EXIT_FAILURE;
+	}
+	pkts = (gpacket_t **)malloc(q->maxsize * sizeof(gpacket_t *));
+	lens = (int *)malloc(q->maxsize * sizeof(int));
+	if ((pkts == NULL) || (lens == NULL))
+	{
+		error("[qdiscChange]:: unable to allocate memory to move the packets ");
+		free(pkts);
+		free(lens);
+		return EXIT_FAILURE;
+	}
+	while ((n < q->maxsize) && ((pkts[n] = old->pop(q, &(lens[n]))) != NULL))
+		n++;
+	old->free(q);
+	if (qdiscAttach(q, name) == EXIT_FAILURE)
+	{
+		// fall back to the old discipline
+		old->init(q);
+		q->qops = old;
+		status = EXIT_FAILURE;
+	}
+	for (i = 0; i < n; i++)
+		q->qops->enqueue(q, pkts[i], lens[i], 0);
+	free(pkts);
+	free(lens);
+	return status;
+}
+
+
+// drop the packets still queued and free the state of the discipline
+void qdiscDetach(simplequeue_t *q)
+{
+	gpacket_t *pkt;
+	int len;
+
+	if (q->qops == NULL)
+		return;
+	while ((pkt = q->qops->pop(q, &len)) != NULL)
+		releasePacket(pkt);
+	q->qops->free(q);
+	q->qops = NULL;
+}
+
+
+int qdiscSetParam(simplequeue_t *q, char *param, double value)
+{
+	return q->qops->setparam(q, param, value);
+}
+
+
+void qdiscPrint(simplequeue_t *q)
+{
+	printf("%-16s%-10s%d packets, %d bytes, delay %.0f us \n", q->name, q->qops->name,
+	       q->cursize, q->bytesleft, q->delay_us);
+	q->qops->print(q);
+}
+
+
+void qdiscPrintAll(void)
+{
+	int i;
+
+	for (i = 0; qdiscs[i] != NULL; i++)
+		printf("  %-10s%s \n", qdiscs[i]->name, qdiscs[i]->desc);
+}
@@ -0,0 +1,195 @@
+/*
+ * reactor.c (I/O reactor for the interfaces)
+ *
+ * With io-threads set to N > 0, the Ethernet interfaces brought up
+ * afterwards are not given a receive thread of their own. Instead each
+ * is attached to one of N reactor threads (the least loaded one). A
+ * reactor thread waits on its epoll instance for any of its sockets to
+ * become readable (edge triggered) and reads the waiting frames in
+ * batches without blocking (pollEthernetDev). An interface that still
+ * has frames after REACTOR_BUDGET batches is kept on a ready list and
+ * served again after the other ready interfaces, so one busy interface
+ * cannot starve the rest.
+ *
+ * Interfaces are removed without cancelling threads: the interface is
+ * taken out of the epoll set and the caller waits until the thread has
+ * finished the round it was in (at most REACTOR_TIMEOUT_MS).
+ */
+
+#include <slack/err.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include "reactor.h"
+#include "ethernet.h"
+#include "stats.h"
+#include "cpu.h"
+
+extern router_config rconfig;
+
+reactor_t reactors[MAX_REACTOR_THREADS];
+int nreactors = 0;                                    // reactor threads started
+pthread_mutex_t reactor_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+void *reactorThread(void *arg)
+{
+	reactor_t *r = (reactor_t *)arg;
+	struct epoll_event events[MAX_INTERFACES];
+	interface_t *ready[MAX_INTERFACES];
+	interface_t *iface;
+	rxbatch_t rx;
+	char tname[STATS_NAME_LEN];
+	int nready = 0, n, i, j;
+
+	bzero(&rx, sizeof(rxbatch_t));
+	sprintf(tname, "reactor %d", r->id);
+	statsThreadRegister(tname);
+	cpuThreadRegister(CPU_ROLE_REACTOR, r->id, tname);
+	while (1)
+	{
+		// do not sleep while interfaces still have frames waiting
+		n = epoll_wait(r->epfd, events, MAX_INTERFACES, (nready > 0) ? 0 : REACTOR_TIMEOUT_MS);
+		if ((n < 0) && (errno != EINTR))
+			error("[reactorThread]:: epoll_wait failed on reactor %d ", r->id);
+		if (n > 0)
+			r->wakeups++;
+
+		for (i = 0; i < n; i++)
+		{
+			iface = (interface_t *)events[i].data.ptr;
+			for (j = 0; (j < nready) && (ready[j] != iface); j++)
+				;
+			if ((j == nready) && (nready < MAX_INTERFACES))
+				ready[nready++] = iface;
+		}
+
+		for (i = j = 0; i < nready; i++)
+		{
+			iface = ready[i];
+			if (iface->reactor != r)
+				continue;                      // removed while it was ready
+			r->polls++;
+			if (pollEthernetDev(iface, &rx, REACTOR_BUDGET) == TRUE)
+				ready[j++] = iface;
+		}
+		nready = j;
+		r->rounds++;
+	}
+	return NULL;
+}
+
+
+/*
+ * start the reactor threads up to io-threads; returns the least loaded
+ * one or NULL if none could be started
+ */
+static reactor_t *reactorPick(void)
+{
+	reactor_t *r, *best = NULL;
+	int i, nthreads = rconfig.iothreads;
+
+	if (nthreads > MAX_REACTOR_THREADS)
+		nthreads = MAX_REACTOR_THREADS;
+	for (; nreactors < nthreads; nreactors++)
+	{
+		r = &(reactors[nreactors]);
+		bzero(r, sizeof(reactor_t));
+		r->id = nreactors;
+		if ((r->epfd = epoll_create(MAX_INTERFACES)) < 0)
+		{
+			error("[reactorPick]:: unable to create the epoll instance.. ");
+			break;
+		}
+		if (pthread_create(&(r->threadid), NULL, reactorThread, (void *)r) != 0)
+		{
+			error("[reactorPick]:: unable to create the reactor thread.. ");
+			close(r->epfd);
+			break;
+		}
+	}
+
+	for (i = 0; (i < nreactors) && (i < nthreads); i++)
+		if ((best == NULL) || (reactors[i].ninterfaces < best->ninterfaces))
+			best = &(reactors[i]);
+	return best;
+}
+
+
+/*
+ * serve the interface from a reactor thread instead of a receive thread
+ */
+int reactorAdd(interface_t *iface)
+{
+	struct epoll_event ev;
+	reactor_t *r;
+
+	pthread_mutex_lock(&reactor_lock);
+	if ((r = reactorPick()) == NULL)
+	{
+		pthread_mutex_unlock(&reactor_lock);
+		return EXIT_FAILURE;
+	}
+
+	bzero(&ev, sizeof(struct epoll_event));
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.ptr = iface;
+	iface->reactor = r;
+	if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, iface->iface_fd, &ev) < 0)
+	{
+		error("[reactorAdd]:: unable to add interface %d to reactor %d ", iface->interface_id, r->id);
+		iface->reactor = NULL;
+		pthread_mutex_unlock(&reactor_lock);
+		return EXIT_FAILURE;
+	}
+	r->ninterfaces++;
+	pthread_mutex_unlock(&reactor_lock);
+
+	verbose(2, "[reactorAdd]:: interface %d served by reactor %d ", iface->interface_id, r->id);
+	return EXIT_SUCCESS;
+}
+
+
+/*
+ * stop serving the interface; on return the reactor thread no longer
+ * touches it
+ */
+int reactorDel(interface_t *iface)
+{
+	reactor_t *r = (reactor_t *)iface->reactor;
+	unsigned long rounds;
+
+	if (r == NULL)
+		return EXIT_FAILURE;
+
+	pthread_mutex_lock(&reactor_lock);
+	// fails harmlessly if the socket was already closed
+	epoll_ctl(r->epfd, EPOLL_CTL_DEL, iface->iface_fd, NULL);
+	iface->reactor = NULL;
+	r->ninterfaces--;
+	pthread_mutex_unlock(&reactor_lock);
+
+	// the round in progress may still hold the interface; the one after
+	// it started when the interface was already out
+	if (!pthread_equal(pthread_self(), r->threadid))
+	{
+		rounds = r->rounds;
+		while (r->rounds < rounds + 2)
+			usleep(1000);
+	}
+	return EXIT_SUCCESS;
+}
+
+
+void reactorPrint(void)
+{
+	int i;
+
+	if (nreactors == 0)
+		return;
+	printf("Reactor\tInterfaces\tWakeups\t\tPolls\n");
+	for (i = 0; i < nreactors; i++)
+		printf("%d\t%d\t\t%lu\t\t%lu\n", reactors[i].id, reactors[i].ninterfaces,
+		       reactors[i].wakeups, reactors[i].polls);
+}
@@ -0,0 +1,501 @@
+/*
+ * reassembly.c (reassembly of the IP datagrams sent to the router)
+ *
+ * The fragments of a datagram are held (with a reference on each) in an
+ * entry of a table hashed on (source, destination, identification,
+ * protocol) until they cover the datagram. What is still missing is a
+ * list of holes (RFC 815): a datagram starts as one hole from 0 to
+ * infinity, a fragment takes the part of every hole it covers and
+ * leaves at most two smaller ones, and the last fragment (MF clear)
+ * cuts off the hole that goes on to infinity. When no hole is left, the
+ * data is copied into one buffer behind the headers of the first
+ * fragment. A fragment that brings no new data is dropped.
+ *
+ * The fragments may hold at most reasm_memory bytes of buffers; the
+ * oldest datagrams are dropped to make room for new fragments. The
+ * timer (reassemblyTimer) drops a datagram that is not complete within
+ * reasm_timeout seconds and, if its first fragment arrived, sends an
+ * ICMP time exceeded (reassembly) to the source (RFC 1122).
+ */
+
+#include "message.h"
+#include "grouter.h"
+#include "protocols.h"
+#include "ip.h"
+#include "icmp.h"
+#include "fragment.h"
+#include "packetpool.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <slack/err.h>
+#include <netinet/in.h>
+
+reasm_entry_t reasm_tbl[MAX_REASM_PENDING];              // datagrams being reassembled
+int reasm_hash[REASM_HASH_SIZE];                        // key -> reasm_tbl entry, chained
+int reasm_free;                                         // first free reasm_tbl entry
+int reasm_mem;                                          // bytes of buffers held by the fragments
+int reasm_timeout = DEFAULT_REASM_TIMEOUT;              // seconds
+int reasm_memory = DEFAULT_REASM_MEMORY;                // limit of reasm_mem
+pthread_t reasm_timer;
+pthread_mutex_t reasm_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static inline int reasmHash(uchar *src, uchar *dst, ushort id, uchar prot)
+{
+	unsigned int h;
+
+	h = (src[0] << 24) | (src[1] << 16) | (src[2] << 8) | src[3];
+	h ^= ((dst[0] << 24) | (dst[1] << 16) | (dst[2] << 8) | dst[3]) * 0x9e3779b1;
+	h ^= ((id << 8) | prot) * 0x85ebca6b;
+	h ^= h >> 16;
+	return h % REASM_HASH_SIZE;
+}
+
+
+/*
+ * find the entry of a datagram, unlink it from the hash chain if
+ * unlink is TRUE. reasm_lock must be held.
+ */
+static int reasmFind(uchar *src, uchar *dst, ushort id, uchar prot, int unlink)
+{
+	int *link = &(reasm_hash[reasmHash(src, dst, id, prot)]);
+	int i;
+
+	while ((i = *link) >= 0)
+	{
+		if ((reasm_tbl[i].id == id) && (reasm_tbl[i].prot == prot) &&
+		    (COMPARE_IP(reasm_tbl[i].src, src) == 0) && (COMPARE_IP(reasm_tbl[i].dst, dst) == 0))
+		{
+			if (unlink)
+				*link = reasm_tbl[i].hnext;
+			return i;
+		}
+		link = &(reasm_tbl[i].hnext);
+	}
+	return -1;
+}
+
+
+/*
+ * drop the datagram of entry i and return the entry to the free list.
+ * the fragments are released, but for the first one if keepfirst is
+ * TRUE: it is returned with its reference (NULL if it did not arrive).
+ * reasm_lock must be held.
+ */
+static gpacket_t *reasmDrop(int i, int keepfirst)
+{
+	reasm_entry_t *re = &(reasm_tbl[i]);
+	gpacket_t *first = NULL;
+	int j;
+
+	reasmFind(re->src, re->dst, re->id, re->prot, TRUE);
+	for (j = 0; j < re->nfrags; j++)
+		if (keepfirst && (first == NULL) && (re->frags[j].off == 0))
+			first = re->frags[j].pkt;
+		else
+			releasePacket(re->frags[j].pkt);
+	reasm_mem -= re->mem;
+	re->is_empty = TRUE;
+	re->nfrags = 0;
+	re->hnext = reasm_free;
+	reasm_free = i;
+	return first;
+}
+
+
+/*
+ * the datagram that waited longest, other than entry except
+ */
+static int reasmOldest(int except)
+{
+	int i, oldest = -1;
+
+	for (i = 0; i < MAX_REASM_PENDING; i++)
+		if ((reasm_tbl[i].is_empty == FALSE) && (i != except) &&
+		    ((oldest < 0) || (reasm_tbl[i].created < reasm_tbl[oldest].created)))
+			oldest = i;
+	return oldest;
+}
+
+
+/*
+ * drop the oldest datagrams other than entry keep until the fragments
+ * hold no more than reasm_memory bytes. reasm_lock must be held.
+ */
+static void reasmTrim(int keep)
+{
+	int i;
+
+	while ((reasm_mem > reasm_memory) && ((i = reasmOldest(keep)) >= 0))
+	{
+		verbose(2, "[reasmTrim]:: over %d bytes, datagram %d dropped ", reasm_memory, ntohs(reasm_tbl[i].id));
+		reasmDrop(i, FALSE);
+		fragstats.evicted++;
+		fragstats.fails++;
+	}
+}
+
+
+/*
+ * an entry for the datagram of the fragment; when the table is full
+ * the oldest datagram makes room. reasm_lock must be held.
+ */
+static int reasmNew(ip_packet_t *ip_pkt, unsigned long long now)
+{
+	reasm_entry_t *re;
+	int i, h;
+
+	if (reasm_free < 0)
+	{
+		reasmDrop(reasmOldest(-1), FALSE);
+		fragstats.evicted++;
+		fragstats.fails++;
+	}
+	i = reasm_free;
+	re = &(reasm_tbl[i]);
+	reasm_free = re->hnext;
+
+	re->is_empty = FALSE;
+	COPY_IP(re->src, ip_pkt->ip_src);
+	COPY_IP(re->dst, ip_pkt->ip_dst);
+	re->id = ip_pkt->ip_identifier;
+	re->prot = ip_pkt->ip_prot;
+	re->total = -1;
+	re->maxend = 0;
+	re->mem = 0;
+	re->created = now;
+	re->nholes = 1;
+	re->holes[0].first = 0;
+	re->holes[0].last = REASM_MAX_LEN;
+	re->nfrags = 0;
+
+	h = reasmHash(re->src, re->dst, re->id, re->prot);
+	re->hnext = reasm_hash[h];
+	reasm_hash[h] = i;
+	return i;
+}
+
+
+/*
+ * fill bytes first to last of the data into the holes of the datagram
+ * (RFC 815). the last fragment (mf FALSE) ends the data: no hole is left
+ * after it. RETURNS the number of bytes that went into holes, -1 if
+ * the datagram would have too many holes (it is left as it was).
+ */
+static int reasmFillHoles(reasm_entry_t *re, int first, int last, int mf)
+{
+	reasm_hole_t holes[2 * MAX_REASM_HOLES];
+	reasm_hole_t *h;
+	int i, n = 0, filled = 0;
+
+	for (i = 0; i < re->nholes; i++)
+	{
+		h = &(re->holes[i]);
+		if (!mf && (h->first > last))
+			continue;
+		if ((first > h->last) || (last < h->first))
+		{
+			holes[n++] = *h;
+			continue;
+		}
+		filled += min(last, h->last) - max(first, h->first) + 1;
+		if (first > h->first)
+		{
+			holes[n].first = h->first;
+			holes[n++].last = first - 1;
+		}
+		if ((last < h->last) && mf)
+		{
+			holes[n].first = last + 1;
+			holes[n++].last = h->last;
+		}
+	}
+	if (n > MAX_REASM_HOLES)
+		return -1;
+
+	memcpy(re->holes, holes, n * sizeof(reasm_hole_t));
+	re->nholes = n;
+	return filled;
+}
+
+
+/*
+ * bytes of the buffers that hold a packet
+ */
+static int reasmTruesize(gpacket_t *pkt)
+{
+	int i, size = pkt->size;
+
+	for (i = 0; i < pkt->nsegs; i++)
+		size += pkt->segs[i].owner->size;
+	return size;
+}
+
+
+/*
+ * the datagram of entry i is complete: copy it into a packet of its
+ * own and drop the entry. the headers are those of the first fragment.
+ * RETURNS the packet (NULL if no buffer holds it). reasm_lock must be held.
+ */
+static gpacket_t *reasmComplete(int i)
+{
+	reasm_entry_t *re = &(reasm_tbl[i]);
+	gpacket_t *first = NULL, *pkt;
+	ip_packet_t *ip_pkt;
+	uchar *data;
+	int j, hlen;
+
+	for (j = 0; (j < re->nfrags) && (first == NULL); j++)
+		if (re->frags[j].off == 0)
+			first = re->frags[j].pkt;
+	hlen = ((ip_packet_t *)GPKT_PAYLOAD(first))->ip_hdr_len * 4;
+
+	if (ETHER_HEADER_LEN + hlen + re->total > MAX_FRAME_LEN)
+	{
+		verbose(2, "[reasmComplete]:: datagram of %d bytes does not fit a buffer ", hlen + re->total);
+		reasmDrop(i, FALSE);
+		fragstats.toobig++;
+		fragstats.fails++;
+		return NULL;
+	}
+	if ((pkt = newPacketSize(ETHER_HEADER_LEN + hlen + re->total)) == NULL)
+	{
+		reasmDrop(i, FALSE);
+		fragstats.fails++;
+		return NULL;
+	}
+
+	memcpy(&(pkt->frame), &(first->frame), sizeof(pkt_frame_t));
+	pkt->frame.refcnt = 1;
+	data = gpktPut(pkt, ETHER_HEADER_LEN + hlen + re->total);
+	memcpy(data, first->data, ETHER_HEADER_LEN + hlen);
+	data += ETHER_HEADER_LEN + hlen;
+	for (j = 0; j < re->nfrags; j++)
+		gpktCopyOut(re->frags[j].pkt,
+			    ETHER_HEADER_LEN + ((ip_packet_t *)GPKT_PAYLOAD(re->frags[j].pkt))->ip_hdr_len * 4,
+			    data + re->frags[j].off, re->frags[j].len);
+
+	ip_pkt = (ip_packet_t *)GPKT_PAYLOAD(pkt);
+	ip_pkt->ip_pkt_len = htons(hlen + re->total);
+	ip_pkt->ip_frag_off &= htons(IP_DF);
+	ip_pkt->ip_cksum = 0;
+	ip_pkt->ip_cksum = htons(checksum((uchar *)ip_pkt, hlen / 2));
+
+	reasmDrop(i, FALSE);
+	fragstats.oks++;
+	return pkt;
+}
+
+
+/*
+ * add a fragment sent to the router to its datagram; the datagram holds
+ * a reference on it. RETURNS the datagram in a packet of its own if the
+ * fragment completed it (the caller releases it), NULL otherwise.
+ */
+gpacket_t *reassembleIPPacket(gpacket_t *in_pkt)
+{
+	ip_packet_t *ip_pkt = (ip_packet_t *)GPKT_PAYLOAD(in_pkt);
+	int hlen = ip_pkt->ip_hdr_len * 4;
+	int off = (ntohs(ip_pkt->ip_frag_off) & IP_OFFMASK) * 8;
+	int mf = ntohs(ip_pkt->ip_frag_off) & IP_MF;
+	int len = ntohs(ip_pkt->ip_pkt_len) - hlen;
+	int end = off + len;
+	gpacket_t *pkt = NULL;
+	reasm_entry_t *re;
+	reasm_frag_t *rf;
+	int i, filled, size;
+
+	pthread_mutex_lock(&reasm_lock);
+	fragstats.reqds++;
+	if ((i = reasmFind(ip_pkt->ip_src, ip_pkt->ip_dst, ip_pkt->ip_identifier, ip_pkt->ip_prot, FALSE)) < 0)
+		i = reasmNew(ip_pkt, getTimeNanos());
+	re = &(reasm_tbl[i]);
+
+	// a fragment that cannot belong to the datagram gives it up
+	if ((len <= 0) || (mf && (len & 7)) || (hlen + end > REASM_MAX_LEN) ||
+	    (gpktLength(in_pkt) < ETHER_HEADER_LEN + hlen + len) ||
+	    (!mf && (((re->total >= 0) && (re->total != end)) || (end < re->maxend))) ||
+	    (mf && (re->total >= 0) && (end > re->total)) || (re->nfrags == MAX_REASM_FRAGS) ||
+	    ((filled = reasmFillHoles(re, off, end - 1, mf)) < 0))
+	{
+		verbose(2, "[reassembleIPPacket]:: bad fragment (offset %d length %d), datagram %d dropped ",
+			off, len, ntohs(re->id));
+		reasmDrop(i, FALSE);
+		fragstats.invalid++;
+		fragstats.fails++;
+		pthread_mutex_unlock(&reasm_lock);
+		return NULL;
+	}
+	if (filled == 0)
+	{
+		fragstats.duplicates++;
+		pthread_mutex_unlock(&reasm_lock);
+		return NULL;
+	}
+	if (filled < len)
+		fragstats.overlaps++;
+
+	rf = &(re->frags[re->nfrags++]);
+	rf->pkt = holdPacket(in_pkt);
+	rf->off = off;
+	rf->len = len;
+	size = reasmTruesize(in_pkt);
+	re->mem += size;
+	reasm_mem += size;
+	if (!mf)
+		re->total = end;
+	re->maxend = max(re->maxend, end);
+
+	if (re->nholes == 0)
+		pkt = reasmComplete(i);
+	else
+	{
+		reasmTrim(i);
+		// the datagram alone is over the limit
+		if (reasm_mem > reasm_memory)
+		{
+			reasmDrop(i, FALSE);
+			fragstats.evicted++;
+			fragstats.fails++;
+		}
+	}
+	pthread_mutex_unlock(&reasm_lock);
+	return pkt;
+}
+
+
+/*
+ * initialize the table and start the timer
+ */
+void reassemblyInit(void)
+{
+	int i;
+
+	for (i = 0; i < MAX_REASM_PENDING; i++)
+	{
+		reasm_tbl[i].is_empty = TRUE;
+		reasm_tbl[i].nfrags = 0;
+		reasm_tbl[i].hnext = (i + 1 < MAX_REASM_PENDING) ? i + 1 : -1;
+	}
+	for (i = 0; i < REASM_HASH_SIZE; i++)
+		reasm_hash[i] = -1;
+	reasm_free = 0;
+
+	if (pthread_create(&reasm_timer, NULL, reassemblyTimer, NULL) != 0)
+		error("[reassemblyInit]:: unable to start the reassembly timer ");
+	verbose(2, "[reassemblyInit]:: reassembly table initialized");
+}
+
+
+void *reassemblyTimer(void *arg)
+{
+	gpacket_t *expired[MAX_REASM_PENDING];
+	unsigned long long now;
+	int i, nexpired;
+
+	while (1)
+	{
+		usleep(REASM_TIMER_INTERVAL * 1000);
+		nexpired = 0;
+
+		// read the time under the lock: a datagram started after an
+		// earlier reading would look created in the future
+		pthread_mutex_lock(&reasm_lock);
+		now = getTimeNanos();
+		for (i = 0; i < MAX_REASM_PENDING; i++)
+		{
+			if ((reasm_tbl[i].is_empty == TRUE) ||
+			    (reasm_tbl[i].created + reasm_timeout * 1000000000ULL > now))
+				continue;
+			verbose(2, "[reassemblyTimer]:: datagram %d not complete in %d seconds, dropped ",
+				ntohs(reasm_tbl[i].id), reasm_timeout);
+			if ((expired[nexpired] = reasmDrop(i, TRUE)) != NULL)
+				nexpired++;
+			fragstats.timeouts++;
+			fragstats.fails++;
+		}
+		pthread_mutex_unlock(&reasm_lock);
+
+		// the source is told if the first fragment arrived
+		for (i = 0; i < nexpired; i++)
+		{
+			ICMPProcessFragTimeExceeded(expired[i]);
+			releasePacket(expired[i]);
+		}
+	}
+	return NULL;
+}
+
+
+int setReassemblyTimeout(int secs)
+{
+	if (secs <= 0)
+	{
+		error("[setReassemblyTimeout]:: timeout must be at least a second ");
+		return EXIT_FAILURE;
+	}
+	reasm_timeout = secs;
+	return EXIT_SUCCESS;
+}
+
+
+/*
+ * set the bytes of buffers the fragments may hold; the oldest datagrams
+ * are dropped at once if they hold more
+ */
+int setReassemblyMemory(int bytes)
+{
+	if (bytes <= 0)
+	{
+		error("[setReassemblyMemory]:: memory limit must be positive ");
+		return EXIT_FAILURE;
+	}
+	pthread_mutex_lock(&reasm_lock);
+	reasm_memory = bytes;
+	reasmTrim(-1);
+	pthread_mutex_unlock(&reasm_lock);
+	return EXIT_SUCCESS;
+}
+
+
+/*
+ * print the datagrams being reassembled and the fragmentation and
+ * reassembly counters
+ */
+void printFragStats(void)
+{
+	unsigned long long now;
+	reasm_entry_t *re;
+	int i, count = 0;
+	char tmpbuf[MAX_TMPBUF_LEN];
+
+	printf("-----------------------------------------------------------\n");
+	printf("      R E A S S E M B L Y \n");
+	printf("-----------------------------------------------------------\n");
+	printf("Source\t\tDestination\tId\tProt\tFragments\tBytes\tHoles\tAge (ms) \n");
+
+	pthread_mutex_lock(&reasm_lock);
+	now = getTimeNanos();
+	for (i = 0; i < MAX_REASM_PENDING; i++)
+	{
+		re = &(reasm_tbl[i]);
+		if (re->is_empty == TRUE)
+			continue;
+		printf("%-16s", IP2Dot(tmpbuf, gNtohl((tmpbuf + 20), re->src)));
+		printf("%-16s%d\t%d\t%d\t\t%d\t%d\t%llu\n", IP2Dot(tmpbuf, gNtohl((tmpbuf + 20), re->dst)),
+		       ntohs(re->id), re->prot, re->nfrags, re->maxend, re->nholes, (now - re->created) / 1000000ULL);
+		count++;
+	}
+	printf("-----------------------------------------------------------\n");
+	printf("      %d pending, %d of %d bytes held, timeout %d s \n", count, reasm_mem, reasm_memory, reasm_timeout);
+	printf("      reassembly: fragments %lu, datagrams %lu, failed %lu (timeout %lu, evicted %lu, too big %lu, invalid %lu) \n",
+	       fragstats.reqds, fragstats.oks, fragstats.fails, fragstats.timeouts, fragstats.evicted,
+	       fragstats.toobig, fragstats.invalid);
+	printf("      duplicate fragments %lu, overlapping %lu \n", fragstats.duplicates, fragstats.overlaps);
+	pthread_mutex_unlock(&reasm_lock);
+	printf("      fragmentation: datagrams %lu, fragments %lu (shared %lu), failed %lu \n",
+	       fragstats.fragoks, fragstats.fragcreates, fragstats.fragshared, fragstats.fragfails);
+}
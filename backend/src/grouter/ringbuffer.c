@@ -0,0 +1,164 @@
+/*
+ * ringbuffer.c (bounded lock-free ring buffer)
+ *
+ * A fixed capacity multi-producer/multi-consumer ring of (data, size)
+ * pairs. Each slot carries a sequence number that tells the producers
+ * and consumers whose turn it is: a slot at position pos is free for
+ * writing when seq == pos and holds an element when seq == pos + 1.
+ * Producers and consumers claim positions with a compare-and-swap on
+ * head and tail respectively, so no locks and no per-element memory
+ * allocation are needed. The ring never blocks; blocking is layered on
+ * top of it by the simple queue (simplequeue.c).
+ */
+
+#include <slack/std.h>
+#include <slack/err.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "ringbuffer.h"
+
+
+ringbuffer_t *createRingBuffer(int nslots)
+{
+	ringbuffer_t *rb;
+	unsigned long i, cap, pagesize = sysconf(_SC_PAGESIZE);
+	size_t size;
+
+	if ((nslots <= 0) || (nslots > MAX_RING_SIZE))
+	{
+		error("[createRingBuffer]:: invalid ring size %d ", nslots);
+		return NULL;
+	}
+
+	// round the capacity up to a power of two so positions map to slots with a mask
+	for (cap = 1; cap < nslots; cap <<= 1);
+
+	// the ring and its slots take a block of whole pages of their own,
+	// so that the block can be moved to the NUMA node of the thread
+	// draining the ring (see cpu.c)
+	size = (sizeof(ringbuffer_t) + cap * sizeof(ringslot_t) + pagesize - 1) & ~(pagesize - 1);
+	if (posix_memalign((void **)&rb, pagesize, size) != 0)
+	{
+		fatal("[createRingBuffer]:: Could not allocate memory for ring buffer ");
+		return NULL;
+	}
+	rb->slots = (ringslot_t *)(rb + 1);
+	rb->memsize = size;
+
+	for (i = 0; i < cap; i++)
+	{
+		rb->slots[i].seq = i;
+		rb->slots[i].size = 0;
+		rb->slots[i].data = NULL;
+	}
+	rb->mask = cap - 1;
+	rb->head = 0;
+	rb->tail = 0;
+
+	return rb;
+}
+
+
+void destroyRingBuffer(ringbuffer_t *rb)
+{
+	if (rb == NULL)
+		return;
+	free(rb);
+}
+
+
+/*
+ * RETURNS EXIT_FAILURE if the ring is full, EXIT_SUCCESS otherwise.
+ */
+int ringPush(ringbuffer_t *rb, void *data, int size)
+{
+	ringslot_t *slot;
+	unsigned long pos;
+	long dif;
+
+	pos = rb->head;
+	while (1)
+	{
+		slot = &(rb->slots[pos & rb->mask]);
+		dif = (long)slot->seq - (long)pos;
+		if (dif == 0)
+		{
+			if (__sync_bool_compare_and_swap(&(rb->head), pos, pos + 1))
+				break;
+		} else if (dif < 0)
+			return EXIT_FAILURE;          // the slot still holds an unread element
+		pos = rb->head;
+	}
+
+	slot->data = data;
+	slot->size = size;
+	__sync_synchronize();
+	slot->seq = pos + 1;                  // publish the element
+	return EXIT_SUCCESS;
+}
+
+
+/*
+ * RETURNS EXIT_FAILURE if the ring is empty, EXIT_SUCCESS otherwise.
+ */
+int ringPop(ringbuffer_t *rb, void **data, int *size)
+{
+	ringslot_t *slot;
+	unsigned long pos;
+	long dif;
+
+	pos = rb->tail;
+	while (1)
+	{
+		slot = &(rb->slots[pos & rb->mask]);
+		dif = (long)slot->seq - (long)(pos + 1);
+		if (dif == 0)
+		{
+			if (__sync_bool_compare_and_swap(&(rb->tail), pos, pos + 1))
+				break;
+		} else if (dif < 0)
+			return EXIT_FAILURE;          // nothing written at this position yet
+		pos = rb->tail;
+	}
+
+	*data = slot->data;
+	*size = slot->size;
+	__sync_synchronize();
+	slot->seq = pos + rb->mask + 1;       // hand the slot back to the producers
+	return EXIT_SUCCESS;
+}
+
+
+/*
+ * look at the oldest element without removing it. the result is only
+ * stable when the caller is the sole consumer of the ring.
+ */
+int ringPeek(ringbuffer_t *rb, void **data, int *size)
+{
+	ringslot_t *slot;
+	unsigned long pos;
+
+	pos = rb->tail;
+	slot = &(rb->slots[pos & rb->mask]);
+	if (slot->seq != pos + 1)
+		return EXIT_FAILURE;
+	__sync_synchronize();
+	*data = slot->data;
+	*size = slot->size;
+	return EXIT_SUCCESS;
+}
+
+
+int ringCapacity(ringbuffer_t *rb)
+{
+	return (int)(rb->mask + 1);
+}
+
+
+// approximate when producers or consumers are active
+int ringCount(ringbuffer_t *rb)
+{
+	long cnt = (long)(rb->head - rb->tail);
+
+	return (cnt < 0) ? 0 : (int)cnt;
+}
@@ -1,108 +1,121 @@
 #include <slack/std.h>
-#include <slack/map.h>
-#include <slack/list.h>
 #include <pthread.h>
-#include "protocols.h"
-#include "packetcore.h"
-#include "message.h"
 #include "grouter.h"
+#include "pktsched.h"
 
 /*
- * Roundrobin scheduler implementation -- when the roundrobin scheme is used, we need to use
- * the corresponding "queuer" as well.
+ * Round robin schedulers (see sched.c). The backlogged queues are kept
+ * on a circular list of scheduler slots (prev, next) with drrhead the
+ * queue whose turn it is. A queue goes to the tail when it has used up
+ * its credit for the turn and leaves the list when it runs empty.
+ *
+ * drr is deficit round robin: a queue gets weight * SCHED_QUANTUM bytes
+ * of credit per turn and sends while its head packet fits in its
+ * credit, so queues share the output in proportion to their weights
+ * whatever their packet sizes. rr is the same list with every packet
+ * costing 1 and a credit of 1 per turn (one packet per queue per round).
  */
 
-extern router_config rconfig; 
 
-void *roundRobinScheduler(void *pc)
+static void drrAppend(sched_t *s, schedq_t *sq)
 {
-	pktcore_t *pcore = (pktcore_t *)pc;
-	List *keylst;
-	int nextqid, qcount, rstatus, pktsize;
-	char *nextqkey;
-	gpacket_t *in_pkt;
-	simplequeue_t *nextq;
-	
-
-	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
-	while (1)
+	int id = sq - s->queues, tail;
+
+	if (s->drrhead < 0)
 	{
-		verbose(2, "[roundRobinScheduler]:: Round robin scheduler processing... ");
-		keylst = map_keys(pcore->queues);
-		nextqid = pcore->lastqid;
-		qcount = list_length(keylst);
-
-		pthread_mutex_lock(&(pcore->qlock));
-		if (pcore->packetcnt == 0)
-			pthread_cond_wait(&(pcore->schwaiting), &(pcore->qlock));	
-		pthread_mutex_unlock(&(pcore->qlock));
-
-		pthread_testcancel();
-		do 
-		{
-			nextqid = (1 + nextqid) % qcount;
-			nextqkey = list_item(keylst, nextqid);
-			// get the queue..
-			nextq = map_get(pcore->queues, nextqkey);
-			// read the queue..
-			rstatus = readQueue(nextq, (void **)&in_pkt, &pktsize);
-
-			if (rstatus == EXIT_SUCCESS)
-			{
-				pcore->lastqid = nextqid;
-				writeQueue(pcore->workQ, in_pkt, pktsize);
-			} 
-
-		} while (nextqid != pcore->lastqid && rstatus == EXIT_FAILURE);
-		list_release(keylst);
-
-		pthread_mutex_lock(&(pcore->qlock));
-		if (rstatus == EXIT_SUCCESS)
-			pcore->packetcnt--;
-		pthread_mutex_unlock(&(pcore->qlock));
-
-		usleep(rconfig.schedcycle);
+		sq->prev = sq->next = id;
+		s->drrhead = id;
+		return;
 	}
+	tail = s->queues[s->drrhead].prev;
+	sq->prev = tail;
+	sq->next = s->drrhead;
+	s->queues[tail].next = id;
+	s->queues[s->drrhead].prev = id;
 }
-	
 
 
-int roundRobinQueuer(pktcore_t *pcore, gpacket_t *in_pkt, int pktsize, char *qkey)
+static void drrUnlink(sched_t *s, schedq_t *sq)
 {
-	simplequeue_t *thisq, *nxtq;
-	double minftime, minstime, tweight;
-	List *keylst;
-	char *nxtkey, *savekey;
-
-	verbose(2, "[roundRobinQueuer]:: Round robin queuing scheme.. a very simple queuer invoked..");
-	if (prog_verbosity_level() >= 3)
-		printGPacket(in_pkt, 6, "QUEUER");
-
-	pthread_mutex_lock(&(pcore->qlock));
+	int id = sq - s->queues;
 
-	thisq = map_get(pcore->queues, qkey);
-	if (thisq == NULL)
+	if (sq->next == id)
+		s->drrhead = -1;
+	else
 	{
-		fatal("[roundRobinQueuer]:: Invalid %s key presented for queue addition", qkey);
-		pthread_mutex_unlock(&(pcore->qlock));
-		free(in_pkt);
-		return EXIT_FAILURE;             // packet dropped..
+		s->queues[sq->prev].next = sq->next;
+		s->queues[sq->next].prev = sq->prev;
+		if (s->drrhead == id)
+			s->drrhead = sq->next;
 	}
+	sq->prev = sq->next = -1;
+	sq->deficit = sq->fresh = 0;
+}
+
 
-	if (thisq->cursize < thisq->maxsize)
+static void drrActivate(sched_t *s, schedq_t *sq, int len)
+{
+	sq->deficit = sq->fresh = 0;
+	drrAppend(s, sq);
+}
+
+
+/*
+ * the first queue, from the head, with enough credit for its head packet.
+ * with bytes == 0 every packet costs 1.
+ */
+static schedq_t *drrPick(sched_t *s, int bytes)
+{
+	schedq_t *sq;
+	int quantum;
+
+	while (1)
 	{
-		pcore->packetcnt++;
-		if (pcore->packetcnt == 1) 		
-			pthread_cond_signal(&(pcore->schwaiting)); // wake up scheduler if it was waiting..
-		pthread_mutex_unlock(&(pcore->qlock));
-		verbose(2, "[roundRobinQueuer]:: Adding packet.. ");
-		writeQueue(thisq, in_pkt, pktsize);
-		return EXIT_SUCCESS;
-	} else {
-		verbose(2, "[roundRobinQueuer]:: Packet dropped.. Queue for [%s] is full.. cursize %d..  ", qkey, thisq->cursize);
-		free(in_pkt);
-		pthread_mutex_unlock(&(pcore->qlock));
-		return EXIT_FAILURE;
+		sq = &(s->queues[s->drrhead]);
+		if (!sq->fresh)
+		{
+			// a new turn: give the credit of one round
+			quantum = 1;
+			if (bytes)
+				quantum = max((int)(sq->q->weight * SCHED_QUANTUM), SCHED_MIN_QUANTUM);
+			sq->deficit += quantum;
+			sq->fresh = 1;
+		}
+		if (sq->deficit >= (bytes ? schedHeadLen(sq) : 1))
+			return sq;
+		sq->fresh = 0;
+		s->drrhead = sq->next;
 	}
 }
 
+
+static schedq_t *drrSelect(sched_t *s)
+{
+	return drrPick(s, 1);
+}
+
+
+static schedq_t *rrSelect(sched_t *s)
+{
+	return drrPick(s, 0);
+}
+
+
+static void drrServed(sched_t *s, schedq_t *sq, int len, int nextlen)
+{
+	sq->deficit -= len;
+	if (nextlen == 0)
+		drrUnlink(s, sq);
+}
+
+
+static void rrServed(sched_t *s, schedq_t *sq, int len, int nextlen)
+{
+	drrServed(s, sq, 1, nextlen);
+}
+
+
+schedpolicy_t sched_rr = {"rr", "round robin, one packet per queue per round",
+			  drrActivate, rrSelect, rrServed, drrUnlink};
+schedpolicy_t sched_drr = {"drr", "deficit round robin, weight x 1514 bytes per queue per round",
+			   drrActivate, drrSelect, drrServed, drrUnlink};
@@ -6,10 +6,14 @@
 
 #include "routetable.h"
 #include "gnet.h"
+#include "trace.h"
+#include "flowcache.h"
+#include "epoch.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <slack/err.h>
+#include <slack/prog.h>
 
 
 
@@ -18,111 +22,710 @@
  *-------------------------------------------------------------------------*/
 
 /*
- * These route table functions are not very efficient.. I guess because
- * of the small topologies that are targeted here... efficiency is not
- * a major concern...
+ * The routes are stored in an array that grows as needed; the index of
+ * a route is its route number in the CLI. Forwarding lookups do not scan
+ * the array. They go through a multibit trie with strides 16-8-8: the
+ * top 16 bits of the address index the first level directly and the
+ * remaining bits go through at most two 256 slot chunks. Prefixes that
+ * do not end on a stride boundary are expanded over all the slots they
+ * cover (controlled prefix expansion). Every slot remembers the length
+ * of the prefix that owns it, so a longer prefix always wins and a
+ * deleted prefix hands its slots back to the longest covering prefix.
+ * A lookup is at most three memory accesses regardless of the table size.
+ *
+ * An exact (network, length) hash is used for duplicate detection and
+ * for finding the covering prefix when a route is deleted.
+ *
+ * The lookups take no lock: they read the current snapshot of the table
+ * inside an epoch section. A change copies the snapshot, is made to the
+ * copy and swaps it in (see epoch.h); the writers are serialised by the
+ * lock of the table. A route file is loaded into a single copy.
  */
 
 
-int rtbl_replace_indx;         // indicate which entry in routing table should be replaced
+static inline uint32_t ip2Int(uchar *ip_addr)
+{
+	return ((uint32_t)ip_addr[3] << 24) | ((uint32_t)ip_addr[2] << 16) |
+		((uint32_t)ip_addr[1] << 8) | (uint32_t)ip_addr[0];
+}
+
+
+static inline void int2IP(uchar *ip_addr, uint32_t val)
+{
+	ip_addr[3] = val >> 24;
+	ip_addr[2] = (val >> 16) & 0xFF;
+	ip_addr[1] = (val >> 8) & 0xFF;
+	ip_addr[0] = val & 0xFF;
+}
+
+
+static inline uint32_t len2Mask(int len)
+{
+	return (len == 0) ? 0 : (0xFFFFFFFF << (32 - len));
+}
 
 
 /*
- * Find an interface corresponding to an IP address
- * Result stored in pbNhop and ppsInterfaceRet
- * Returns NO_ERROR if match found, ERROR if no match found
+ * RETURNS the prefix length of the netmask or -1 if the mask is not contiguous
  */
-int findRouteEntry(route_entry_t route_tbl[], uchar *ip_addr, uchar *nhop, int *ixface)
+static int mask2Len(uchar *nmask)
 {
-	int icount;
-	uchar null_ip_addr[] = {0, 0, 0, 0};
-	char tmpbuf[MAX_TMPBUF_LEN];
+	uint32_t mask = ip2Int(nmask), inv = ~mask;
+	int len = 0;
 
-	// Try getting data
-	for (icount = 0; icount < MAX_ROUTES; icount++)
+	if (inv & (inv + 1))
+		return -1;
+	while (mask)
 	{
-		if (route_tbl[icount].is_empty == TRUE) continue;
-		verbose(2, "[findRouteEntry]:: Testing the route entry.. g %s at RT[%d], net %s netmask %s nexthop %s int %d",
-			       IP2Dot(tmpbuf, ip_addr), icount, IP2Dot(tmpbuf+15, route_tbl[icount].network),
-			       IP2Dot(tmpbuf+30, route_tbl[icount].netmask), IP2Dot(tmpbuf+45, route_tbl[icount].nexthop),
-			       route_tbl[icount].interface);
-		if (compareIPUsingMask(ip_addr, route_tbl[icount].network, route_tbl[icount].netmask) == 0)
+		len++;
+		mask <<= 1;
+	}
+	return len;
+}
+
+
+/*-------------------------------------------------------------------------
+ *                   prefix hash and entry allocation
+ *-------------------------------------------------------------------------*/
+
+static inline int rtHashIndex(rt_snapshot_t *rs, uint32_t net, int len)
+{
+	return ((net * 0x9e3779b1) ^ (len * 0x85ebca6b)) & (rs->hashsize - 1);
+}
+
+
+static int rtHashFind(rt_snapshot_t *rs, uint32_t net, int len)
+{
+	int i;
+
+	for (i = rs->hash[rtHashIndex(rs, net, len)]; i >= 0; i = rs->entries[i].hnext)
+		if ((rs->entries[i].prefixlen == len) && (ip2Int(rs->entries[i].network) == net))
+			return i;
+	return -1;
+}
+
+
+static void rtHashInsert(rt_snapshot_t *rs, int i)
+{
+	int h = rtHashIndex(rs, ip2Int(rs->entries[i].network), rs->entries[i].prefixlen);
+
+	rs->entries[i].hnext = rs->hash[h];
+	rs->hash[h] = i;
+}
+
+
+static void rtHashRemove(rt_snapshot_t *rs, int i)
+{
+	int *link = &(rs->hash[rtHashIndex(rs, ip2Int(rs->entries[i].network), rs->entries[i].prefixlen)]);
+
+	while (*link >= 0)
+	{
+		if (*link == i)
 		{
-			verbose(2, "[findRouteEntry]:: Found a route for %s at RT[%d], net %s netmask %s nexthop %s int %d",
-			       IP2Dot(tmpbuf, ip_addr), icount, IP2Dot(tmpbuf+15, route_tbl[icount].network),
-			       IP2Dot(tmpbuf+30, route_tbl[icount].netmask), IP2Dot(tmpbuf+45, route_tbl[icount].nexthop),
-			       route_tbl[icount].interface);
+			*link = rs->entries[i].hnext;
+			return;
+		}
+		link = &(rs->entries[*link].hnext);
+	}
+}
 
-			if (COMPARE_IP(route_tbl[icount].nexthop, null_ip_addr) == 0)
-				COPY_IP(nhop, ip_addr);
-			else
-				COPY_IP(nhop, route_tbl[icount].nexthop);
 
-			*ixface = route_tbl[icount].interface;
+static int rtHashResize(rt_snapshot_t *rs, int hashsize)
+{
+	int *hash, i;
+
+	if ((hash = malloc(hashsize * sizeof(int))) == NULL)
+		return EXIT_FAILURE;
+	for (i = 0; i < hashsize; i++)
+		hash[i] = -1;
+	free(rs->hash);
+	rs->hash = hash;
+	rs->hashsize = hashsize;
+
+	for (i = 0; i < rs->size; i++)
+		if (rs->entries[i].is_empty == FALSE)
+			rtHashInsert(rs, i);
+	return EXIT_SUCCESS;
+}
+
+
+static int rtAllocEntry(rt_snapshot_t *rs)
+{
+	route_entry_t *entries;
+	int i, newsize;
 
-			return EXIT_SUCCESS;
+	if (rs->freelist < 0)
+	{
+		newsize = rs->size * 2;
+		if ((entries = realloc(rs->entries, newsize * sizeof(route_entry_t))) == NULL)
+			return -1;
+		for (i = rs->size; i < newsize; i++)
+		{
+			entries[i].is_empty = TRUE;
+			entries[i].hnext = (i + 1 < newsize) ? i + 1 : -1;
 		}
+		rs->freelist = rs->size;
+		rs->entries = entries;
+		rs->size = newsize;
+	}
+
+	i = rs->freelist;
+	rs->freelist = rs->entries[i].hnext;
+	return i;
+}
+
+
+static void rtFreeEntry(rt_snapshot_t *rs, int i)
+{
+	rs->entries[i].is_empty = TRUE;
+	rs->entries[i].hnext = rs->freelist;
+	rs->freelist = i;
+}
+
+
+/*-------------------------------------------------------------------------
+ *                   multibit trie
+ *-------------------------------------------------------------------------*/
+
+/*
+ * allocate a chunk with all slots set to the given route. the chunk
+ * array may move, so callers must not keep chunk pointers across this.
+ */
+static int rtAllocChunk(rt_snapshot_t *rs, uint32_t val, uchar depth)
+{
+	rt_chunk_t *chunks;
+	int c, newsize;
+
+	if (rs->freechunk < 0)
+	{
+		newsize = (rs->nchunks == 0) ? 16 : rs->nchunks * 2;
+		if ((chunks = realloc(rs->chunks, newsize * sizeof(rt_chunk_t))) == NULL)
+			return -1;
+		for (c = rs->nchunks; c < newsize; c++)
+			chunks[c].val[0] = (c + 1 < newsize) ? c + 1 : -1;
+		rs->freechunk = rs->nchunks;
+		rs->chunks = chunks;
+		rs->nchunks = newsize;
+	}
+
+	c = rs->freechunk;
+	rs->freechunk = (int)rs->chunks[c].val[0];
+	for (newsize = 0; newsize < RT_CHUNK_SIZE; newsize++)
+	{
+		rs->chunks[c].val[newsize] = val;
+		rs->chunks[c].depth[newsize] = depth;
+	}
+	rs->usedchunks++;
+	return c;
+}
+
+
+static void rtFreeChunk(rt_snapshot_t *rs, int c)
+{
+	rs->chunks[c].val[0] = rs->freechunk;
+	rs->freechunk = c;
+	rs->usedchunks--;
+}
+
+
+/*
+ * RETURNS the chunk holding the next level of the given slot, creating
+ * it (filled with the route of the slot) if the slot is a route.
+ */
+static int rtExpandSlot(rt_snapshot_t *rs, uint32_t *val, uchar *depth, int *c)
+{
+	if (!(*val & RT_CHUNK_FLAG))
+	{
+		if ((*c = rtAllocChunk(rs, *val, *depth)) < 0)
+			return EXIT_FAILURE;
+		*val = RT_CHUNK_FLAG | *c;
 	}
+	*c = *val & ~RT_CHUNK_FLAG;
+	return EXIT_SUCCESS;
+}
+
 
-	verbose(2, "[findRouteEntry]:: No match for %s in route table", IP2Dot(tmpbuf, ip_addr));
-	return EXIT_FAILURE;
+static void rtInsertSlot(rt_snapshot_t *rs, uint32_t *val, uchar *depth, uint32_t nval, int len)
+{
+	int c, i;
+
+	if (*val & RT_CHUNK_FLAG)
+	{
+		c = *val & ~RT_CHUNK_FLAG;
+		for (i = 0; i < RT_CHUNK_SIZE; i++)
+			rtInsertSlot(rs, &(rs->chunks[c].val[i]), &(rs->chunks[c].depth[i]), nval, len);
+	} else if (*depth <= len)
+	{
+		*val = nval;
+		*depth = len;
+	}
+}
+
+
+static void rtRemoveSlot(rt_snapshot_t *rs, uint32_t *val, uchar *depth, uint32_t oval,
+			 uint32_t nval, int ndepth)
+{
+	int c, i;
+
+	if (*val & RT_CHUNK_FLAG)
+	{
+		c = *val & ~RT_CHUNK_FLAG;
+		for (i = 0; i < RT_CHUNK_SIZE; i++)
+			rtRemoveSlot(rs, &(rs->chunks[c].val[i]), &(rs->chunks[c].depth[i]), oval, nval, ndepth);
+	} else if (*val == oval)
+	{
+		*val = nval;
+		*depth = ndepth;
+	}
 }
 
 
 /*
- * Add a route entry to the table, if entry found update, else fill in an empty one,
- * if no empty entry, overwrite a used one, indicated by rtbl_replace_indx
+ * a chunk whose slots all hold the same route, owned by a prefix no
+ * longer than the bits above the chunk, can be folded into its parent slot.
  */
-void addRouteEntry(route_entry_t route_tbl[], uchar* nwork, uchar* nmask, uchar* nhop, int interface)
+static int rtChunkUniform(rt_chunk_t *chunk, int maxdepth)
 {
 	int i;
-	int ifree = -1;
 
-	// First check if the entry is already in the table, if it is, update it
-	for (i = 0; i < MAX_ROUTES; i++)
+	if ((chunk->val[0] & RT_CHUNK_FLAG) || (chunk->depth[0] > maxdepth))
+		return FALSE;
+	for (i = 1; i < RT_CHUNK_SIZE; i++)
+		if ((chunk->val[i] != chunk->val[0]) || (chunk->depth[i] != chunk->depth[0]))
+			return FALSE;
+	return TRUE;
+}
+
+
+static int rtTrieInsert(rt_snapshot_t *rs, uint32_t net, int len, uint32_t nval)
+{
+	int i1 = net >> 16, i2 = (net >> 8) & 0xFF, i3 = net & 0xFF;
+	int c2, c3, s;
+
+	if (len <= 16)
 	{
-		if (route_tbl[i].is_empty == TRUE)
-		{
-			if (ifree < 0) ifree = i;
+		for (s = i1; s < i1 + (1 << (16 - len)); s++)
+			rtInsertSlot(rs, &(rs->l1val[s]), &(rs->l1depth[s]), nval, len);
+		return EXIT_SUCCESS;
+	}
+
+	if (rtExpandSlot(rs, &(rs->l1val[i1]), &(rs->l1depth[i1]), &c2) == EXIT_FAILURE)
+		return EXIT_FAILURE;
+	if (len <= 24)
+	{
+		for (s = i2; s < i2 + (1 << (24 - len)); s++)
+			rtInsertSlot(rs, &(rs->chunks[c2].val[s]), &(rs->chunks[c2].depth[s]), nval, len);
+		return EXIT_SUCCESS;
+	}
 
-		} else if ((COMPARE_IP(nwork, route_tbl[i].network)) == 0)
+	if (!(rs->chunks[c2].val[i2] & RT_CHUNK_FLAG))
+	{
+		if ((c3 = rtAllocChunk(rs, rs->chunks[c2].val[i2], rs->chunks[c2].depth[i2])) < 0)
+			return EXIT_FAILURE;
+		rs->chunks[c2].val[i2] = RT_CHUNK_FLAG | c3;
+	}
+	c3 = rs->chunks[c2].val[i2] & ~RT_CHUNK_FLAG;
+	for (s = i3; s < i3 + (1 << (32 - len)); s++)
+		rtInsertSlot(rs, &(rs->chunks[c3].val[s]), &(rs->chunks[c3].depth[s]), nval, len);
+	return EXIT_SUCCESS;
+}
+
+
+static void rtTrieRemove(rt_snapshot_t *rs, uint32_t net, int len, uint32_t oval,
+			 uint32_t nval, int ndepth)
+{
+	int i1 = net >> 16, i2 = (net >> 8) & 0xFF, i3 = net & 0xFF;
+	int c2, c3, s;
+
+	if (len <= 16)
+	{
+		for (s = i1; s < i1 + (1 << (16 - len)); s++)
+			rtRemoveSlot(rs, &(rs->l1val[s]), &(rs->l1depth[s]), oval, nval, ndepth);
+		return;
+	}
+
+	// a prefix longer than 16 bits always lives in a chunk
+	if (!(rs->l1val[i1] & RT_CHUNK_FLAG))
+		return;
+	c2 = rs->l1val[i1] & ~RT_CHUNK_FLAG;
+	if (len <= 24)
+	{
+		for (s = i2; s < i2 + (1 << (24 - len)); s++)
+			rtRemoveSlot(rs, &(rs->chunks[c2].val[s]), &(rs->chunks[c2].depth[s]), oval, nval, ndepth);
+	} else if (rs->chunks[c2].val[i2] & RT_CHUNK_FLAG)
+	{
+		c3 = rs->chunks[c2].val[i2] & ~RT_CHUNK_FLAG;
+		for (s = i3; s < i3 + (1 << (32 - len)); s++)
+			rtRemoveSlot(rs, &(rs->chunks[c3].val[s]), &(rs->chunks[c3].depth[s]), oval, nval, ndepth);
+
+		if (rtChunkUniform(&(rs->chunks[c3]), 24))
 		{
-			if ((COMPARE_IP(nmask, route_tbl[i].netmask)) == 0)
-			{
-				// match
-				COPY_IP(route_tbl[i].nexthop, nhop);
-				route_tbl[i].interface = interface;
-
-				verbose(2, "[addRouteEntry]:: updated route table entry #%d", i);
-				return;
-			}
+			rs->chunks[c2].val[i2] = rs->chunks[c3].val[0];
+			rs->chunks[c2].depth[i2] = rs->chunks[c3].depth[0];
+			rtFreeChunk(rs, c3);
 		}
 	}
 
-	if (ifree < 0)
+	if (rtChunkUniform(&(rs->chunks[c2]), 16))
 	{
-		ifree = rtbl_replace_indx;
-		rtbl_replace_indx = (rtbl_replace_indx + 1) % MAX_ROUTES;
+		rs->l1val[i1] = rs->chunks[c2].val[0];
+		rs->l1depth[i1] = rs->chunks[c2].depth[0];
+		rtFreeChunk(rs, c2);
 	}
+}
 
-	COPY_IP(route_tbl[ifree].network, nwork);
-	COPY_IP(route_tbl[ifree].netmask, nmask);
-	COPY_IP(route_tbl[ifree].nexthop, nhop);
-	route_tbl[ifree].interface = interface;
-	route_tbl[ifree].is_empty = FALSE;
 
-	verbose(2, "[addRouteEntry]:: overwrote route entry #%d", rtbl_replace_indx);
-	return;
+/*
+ * RETURNS the route index + 1 of the longest prefix matching addr, 0 if none
+ */
+static inline uint32_t rtLookup(rt_snapshot_t *rs, uint32_t addr)
+{
+	uint32_t val = rs->l1val[addr >> 16];
+
+	if (val & RT_CHUNK_FLAG)
+	{
+		val = rs->chunks[val & ~RT_CHUNK_FLAG].val[(addr >> 8) & 0xFF];
+		if (val & RT_CHUNK_FLAG)
+			val = rs->chunks[val & ~RT_CHUNK_FLAG].val[addr & 0xFF];
+	}
+	return val;
+}
+
+
+/*-------------------------------------------------------------------------
+ *                   route add and delete (on an unpublished snapshot)
+ *-------------------------------------------------------------------------*/
+
+static int rtAdd(rt_snapshot_t *rs, uchar *nwork, int len, uchar *nhop, int interface)
+{
+	uint32_t net = ip2Int(nwork) & len2Mask(len);
+	int i;
+
+	// First check if the entry is already in the table, if it is, update it
+	if ((i = rtHashFind(rs, net, len)) >= 0)
+	{
+		COPY_IP(rs->entries[i].nexthop, nhop);
+		rs->entries[i].interface = interface;
+		verbose(2, "[addRouteEntry]:: updated route table entry #%d", i);
+		return EXIT_SUCCESS;
+	}
+
+	if ((i = rtAllocEntry(rs)) < 0)
+	{
+		error("[addRouteEntry]:: unable to grow the route table ");
+		return EXIT_FAILURE;
+	}
+	int2IP(rs->entries[i].network, net);
+	int2IP(rs->entries[i].netmask, len2Mask(len));
+	COPY_IP(rs->entries[i].nexthop, nhop);
+	rs->entries[i].interface = interface;
+	rs->entries[i].prefixlen = len;
+
+	if (rtTrieInsert(rs, net, len, i + 1) == EXIT_FAILURE)
+	{
+		error("[addRouteEntry]:: unable to allocate memory for the route trie ");
+		rtFreeEntry(rs, i);
+		return EXIT_FAILURE;
+	}
+	rs->entries[i].is_empty = FALSE;
+	rtHashInsert(rs, i);
+	if (++rs->nroutes > rs->hashsize)
+		rtHashResize(rs, rs->hashsize * 2);
+
+	verbose(2, "[addRouteEntry]:: added route table entry #%d", i);
+	return EXIT_SUCCESS;
+}
+
+
+static void rtDelete(rt_snapshot_t *rs, int i)
+{
+	uint32_t net = ip2Int(rs->entries[i].network);
+	int len = rs->entries[i].prefixlen, l, r = -1;
+
+	rtHashRemove(rs, i);
+
+	// the slots of the route go back to the longest prefix covering it
+	for (l = len - 1; (l >= 0) && (r < 0); l--)
+		r = rtHashFind(rs, net & len2Mask(l), l);
+	if (r >= 0)
+		rtTrieRemove(rs, net, len, i + 1, r + 1, rs->entries[r].prefixlen);
+	else
+		rtTrieRemove(rs, net, len, i + 1, 0, 0);
+
+	rtFreeEntry(rs, i);
+	rs->nroutes--;
+}
+
+
+/*-------------------------------------------------------------------------
+ *                   snapshots
+ *-------------------------------------------------------------------------*/
+
+static void rtFreeSnapshot(void *arg)
+{
+	rt_snapshot_t *rs = (rt_snapshot_t *)arg;
+
+	free(rs->entries);
+	free(rs->hash);
+	free(rs->l1val);
+	free(rs->l1depth);
+	free(rs->chunks);
+	free(rs);
+}
+
+
+/*
+ * a private copy of a snapshot for a writer to change. the arrays are
+ * copied as they are, with their free lists.
+ */
+static rt_snapshot_t *rtCopySnapshot(rt_snapshot_t *from)
+{
+	rt_snapshot_t *rs;
+
+	if ((rs = malloc(sizeof(rt_snapshot_t))) == NULL)
+		return NULL;
+	*rs = *from;
+	rs->entries = malloc(from->size * sizeof(route_entry_t));
+	rs->hash = malloc(from->hashsize * sizeof(int));
+	rs->l1val = malloc(RT_L1_SIZE * sizeof(uint32_t));
+	rs->l1depth = malloc(RT_L1_SIZE * sizeof(uchar));
+	rs->chunks = (from->nchunks > 0) ? malloc(from->nchunks * sizeof(rt_chunk_t)) : NULL;
+	if ((rs->entries == NULL) || (rs->hash == NULL) || (rs->l1val == NULL) || (rs->l1depth == NULL) ||
+	    ((from->nchunks > 0) && (rs->chunks == NULL)))
+	{
+		rtFreeSnapshot(rs);
+		return NULL;
+	}
+	memcpy(rs->entries, from->entries, from->size * sizeof(route_entry_t));
+	memcpy(rs->hash, from->hash, from->hashsize * sizeof(int));
+	memcpy(rs->l1val, from->l1val, RT_L1_SIZE * sizeof(uint32_t));
+	memcpy(rs->l1depth, from->l1depth, RT_L1_SIZE * sizeof(uchar));
+	if (from->nchunks > 0)
+		memcpy(rs->chunks, from->chunks, from->nchunks * sizeof(rt_chunk_t));
+	return rs;
+}
+
+
+/*
+ * start a change: take the writer lock and return a copy of the
+ * current snapshot, NULL (lock released) if there is no memory for it
+ */
+static rt_snapshot_t *rtBeginChange(route_table_t *rtbl, char *caller)
+{
+	rt_snapshot_t *rs;
+
+	pthread_mutex_lock(&(rtbl->lock));
+	if ((rs = rtCopySnapshot(rtbl->snap)) == NULL)
+	{
+		pthread_mutex_unlock(&(rtbl->lock));
+		error("[%s]:: unable to copy the route table ", caller);
+	}
+	return rs;
+}
+
+
+/*
+ * end a change: swap the new snapshot in (or drop it if nothing was
+ * changed) and release the writer lock
+ */
+static void rtEndChange(route_table_t *rtbl, rt_snapshot_t *rs, int changed)
+{
+	if (changed)
+	{
+		epochRetire(rtFreeSnapshot, epochPublish((void * volatile *)&(rtbl->snap), rs));
+		rtbl->version++;
+	} else
+		rtFreeSnapshot(rs);
+	pthread_mutex_unlock(&(rtbl->lock));
+	if (changed)
+		flowInvalidate();
+}
+
+
+/*-------------------------------------------------------------------------
+ *                   route table API
+ *-------------------------------------------------------------------------*/
+
+/*
+ * create an empty route table
+ */
+route_table_t *createRouteTable(void)
+{
+	route_table_t *rtbl;
+	rt_snapshot_t *rs;
+	int i;
+
+	if (((rtbl = calloc(1, sizeof(route_table_t))) == NULL) ||
+	    ((rs = calloc(1, sizeof(rt_snapshot_t))) == NULL))
+	{
+		fatal("[createRouteTable]:: unable to allocate memory for the route table ");
+		return NULL;
+	}
+
+	pthread_mutex_init(&(rtbl->lock), NULL);
+	rs->size = MIN_ROUTES;
+	rs->entries = malloc(MIN_ROUTES * sizeof(route_entry_t));
+	rs->hashsize = MIN_ROUTES;
+	rs->hash = malloc(MIN_ROUTES * sizeof(int));
+	rs->l1val = calloc(RT_L1_SIZE, sizeof(uint32_t));
+	rs->l1depth = calloc(RT_L1_SIZE, sizeof(uchar));
+	if ((rs->entries == NULL) || (rs->hash == NULL) || (rs->l1val == NULL) || (rs->l1depth == NULL))
+	{
+		fatal("[createRouteTable]:: unable to allocate memory for the route table ");
+		return NULL;
+	}
+
+	for (i = 0; i < MIN_ROUTES; i++)
+	{
+		rs->entries[i].is_empty = TRUE;
+		rs->entries[i].hnext = (i + 1 < MIN_ROUTES) ? i + 1 : -1;
+		rs->hash[i] = -1;
+	}
+	rs->freelist = 0;
+	rs->freechunk = -1;
+	rtbl->snap = rs;
+
+	verbose(2, "[createRouteTable]:: table initialized");
+	return rtbl;
+}
+
+
+/*
+ * Find the longest prefix route for an IP address
+ * Result stored in nhop (the destination itself for a direct route) and ixface
+ * Returns EXIT_SUCCESS if match found, EXIT_FAILURE if no match found
+ */
+int findRouteEntry(route_table_t *rtbl, uchar *ip_addr, uchar *nhop, int *ixface)
+{
+	rt_snapshot_t *rs;
+	route_entry_t *rentry;
+	uint32_t val;
+	int indx;
+	char tmpbuf[MAX_TMPBUF_LEN];
+
+	epochEnter();
+	rs = rtbl->snap;
+	if ((val = rtLookup(rs, ip2Int(ip_addr))) == 0)
+	{
+		epochExit();
+		VERBOSE(2, "[findRouteEntry]:: No match for %s in route table", IP2Dot(tmpbuf, ip_addr));
+		TRACE(TRACE_NOROUTE, traceIP(ip_addr), 0, 0);
+		return EXIT_FAILURE;
+	}
+
+	indx = val - 1;
+	rentry = &(rs->entries[indx]);
+	if ((rentry->nexthop[0] | rentry->nexthop[1] | rentry->nexthop[2] | rentry->nexthop[3]) == 0)
+		COPY_IP(nhop, ip_addr);
+	else
+		COPY_IP(nhop, rentry->nexthop);
+	*ixface = rentry->interface;
+	epochExit();
+
+	VERBOSE(2, "[findRouteEntry]:: Found a route for %s at RT[%d], nexthop %s int %d",
+		IP2Dot(tmpbuf, ip_addr), indx, IP2Dot(tmpbuf+20, nhop), *ixface);
+	TRACE(TRACE_ROUTE, traceIP(ip_addr), traceIP(nhop), *ixface);
+	return EXIT_SUCCESS;
 }
 
 
+/*
+ * copy the longest prefix route for an IP address into rentry
+ */
+int findRoute(route_table_t *rtbl, uchar *ip_addr, route_entry_t *rentry)
+{
+	rt_snapshot_t *rs;
+	uint32_t val;
+
+	epochEnter();
+	rs = rtbl->snap;
+	if ((val = rtLookup(rs, ip2Int(ip_addr))) != 0)
+		*rentry = rs->entries[val - 1];
+	epochExit();
+
+	return (val != 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/*
+ * copy route number indx into rentry
+ */
+int getRouteEntry(route_table_t *rtbl, int indx, route_entry_t *rentry)
+{
+	rt_snapshot_t *rs;
+	int status = EXIT_FAILURE;
+
+	epochEnter();
+	rs = rtbl->snap;
+	if ((indx >= 0) && (indx < rs->size) && (rs->entries[indx].is_empty == FALSE))
+	{
+		*rentry = rs->entries[indx];
+		status = EXIT_SUCCESS;
+	}
+	epochExit();
+
+	return status;
+}
+
+
+/*
+ * RETURNS the number of route entries (route numbers run below it)
+ */
+int getRouteTableSize(route_table_t *rtbl)
+{
+	int size;
+
+	epochEnter();
+	size = rtbl->snap->size;
+	epochExit();
+	return size;
+}
+
+
+/*
+ * Add a route entry to the table, if an entry for the same network and
+ * netmask exists it is updated, else a new entry is added (the table grows
+ * as needed)
+ */
+int addRouteEntry(route_table_t *rtbl, uchar *nwork, uchar *nmask, uchar *nhop, int interface)
+{
+	rt_snapshot_t *rs;
+	char tmpbuf[MAX_TMPBUF_LEN];
+	int len, status;
+
+	if ((len = mask2Len(nmask)) < 0)
+	{
+		error("[addRouteEntry]:: netmask %s is not contiguous ", IP2Dot(tmpbuf, nmask));
+		return EXIT_FAILURE;
+	}
+
+	if ((rs = rtBeginChange(rtbl, "addRouteEntry")) == NULL)
+		return EXIT_FAILURE;
+	status = rtAdd(rs, nwork, len, nhop, interface);
+	rtEndChange(rtbl, rs, (status == EXIT_SUCCESS));
+
+	return status;
+}
+
 
 /*
  * delete route table entry by argument index i
  */
-void deleteRouteEntryByIndex(route_entry_t route_tbl[], int i)
+void deleteRouteEntryByIndex(route_table_t *rtbl, int i)
 {
-	route_tbl[i].is_empty = TRUE;
+	rt_snapshot_t *rs;
+
+	if ((rs = rtBeginChange(rtbl, "deleteRouteEntryByIndex")) == NULL)
+		return;
+	if ((i < 0) || (i >= rs->size) || (rs->entries[i].is_empty == TRUE))
+	{
+		rtEndChange(rtbl, rs, FALSE);
+		verbose(1, "[deleteRouteEntryByIndex]:: no route entry #%d", i);
+		return;
+	}
+	rtDelete(rs, i);
+	rtEndChange(rtbl, rs, TRUE);
+
 	verbose(2, "[deleteRouteEntryByIndex]:: route entry #%d deleted", i);
 	return;
 }
@@ -132,14 +735,21 @@ void deleteRouteEntryByIndex(route_entry_t route_tbl[], int i)
  * delete route table entries related to
  * interface specified by argument indx
  */
-void deleteRouteEntryByInterface(route_entry_t route_tbl[], int interface)
+void deleteRouteEntryByInterface(route_table_t *rtbl, int interface)
 {
-	int i;
-
-	for (i = 0; i < MAX_ROUTES; i++)
-		if ((route_tbl[i].is_empty == FALSE) &&
-		    (route_tbl[i].interface == interface))
-			deleteRouteEntryByIndex(route_tbl, i);
+	rt_snapshot_t *rs;
+	int i, ndeleted = 0;
+
+	if ((rs = rtBeginChange(rtbl, "deleteRouteEntryByInterface")) == NULL)
+		return;
+	for (i = 0; i < rs->size; i++)
+		if ((rs->entries[i].is_empty == FALSE) &&
+		    (rs->entries[i].interface == interface))
+		{
+			rtDelete(rs, i);
+			ndeleted++;
+		}
+	rtEndChange(rtbl, rs, (ndeleted > 0));
 
 	verbose(2, "[deleteRouteEntryByInterface]:: table cleared of references to interface: %d", interface);
 	return;
@@ -147,27 +757,86 @@ void deleteRouteEntryByInterface(route_entry_t route_tbl[], int interface)
 
 
 /*
- * initialize the route table to be empty
+ * load routes from a file, one route per line:
+ *     network/prefixlen interface [gateway]
+ * e.g. "10.1.0.0/16 eth1 192.168.2.1". empty lines and lines starting
+ * with # are skipped. the routes are added to one copy of the table,
+ * which replaces the table at the end: forwarding goes on with the old
+ * routes while a large table is loaded and then switches to all the new
+ * ones at once.
+ * RETURNS the number of routes loaded or -1 if the file cannot be read.
  */
-void RouteTableInit(route_entry_t route_tbl[])
+int loadRouteFile(route_table_t *rtbl, char *fname)
 {
-	int i;
+	FILE *fp;
+	rt_snapshot_t *rs;
+	char line[MAX_TMPBUF_LEN], prefix[MAX_TMPBUF_LEN], dev[MAX_TMPBUF_LEN], gw[MAX_TMPBUF_LEN];
+	char *slash, *p;
+	uchar net_addr[4], nxth_addr[4];
+	int lineno = 0, nloaded = 0, nerrors = 0, nfields, len;
+
+	if ((fp = fopen(fname, "r")) == NULL)
+	{
+		error("[loadRouteFile]:: unable to open route file %s ", fname);
+		return -1;
+	}
 
-	rtbl_replace_indx = 0;
+	if ((rs = rtBeginChange(rtbl, "loadRouteFile")) == NULL)
+	{
+		fclose(fp);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		lineno++;
+		for (p = line; (*p == ' ') || (*p == '\t'); p++);
+		if ((*p == '#') || (*p == '\n') || (*p == '\r') || (*p == '\0'))
+			continue;
 
-	for(i = 0; i < MAX_ROUTES; i++)
-		route_tbl[i].is_empty = TRUE;
-	verbose(2, "[initRouteTable]:: table initialized");
+		nfields = sscanf(p, "%255s %255s %255s", prefix, dev, gw);
+		if (nfields < 2)
+		{
+			verbose(1, "[loadRouteFile]:: %s:%d: missing interface ", fname, lineno);
+			nerrors++;
+			continue;
+		}
 
-	return;
+		len = 32;
+		if ((slash = strchr(prefix, '/')) != NULL)
+		{
+			*slash = '\0';
+			len = atoi(slash + 1);
+		}
+		if ((len < 0) || (len > 32))
+		{
+			verbose(1, "[loadRouteFile]:: %s:%d: bad prefix length ", fname, lineno);
+			nerrors++;
+			continue;
+		}
+		Dot2IP(prefix, net_addr);
+		bzero(nxth_addr, 4);
+		if (nfields == 3)
+			Dot2IP(gw, nxth_addr);
+
+		if (rtAdd(rs, net_addr, len, nxth_addr, gAtoi(dev)) == EXIT_SUCCESS)
+			nloaded++;
+		else
+			nerrors++;
+	}
+	rtEndChange(rtbl, rs, (nloaded > 0));
+	fclose(fp);
+
+	printf("Loaded %d routes from %s (%d errors) \n", nloaded, fname, nerrors);
+	return nloaded;
 }
 
 
 /*
  * print the route table
  */
-void printRouteTable(route_entry_t route_tbl[])
+void printRouteTable(route_table_t *rtbl)
 {
+	rt_snapshot_t *rs;
 	int i, rcount = 0;
 	char tmpbuf[MAX_TMPBUF_LEN];
 	interface_t *iface;
@@ -177,16 +846,31 @@ void printRouteTable(route_entry_t route_tbl[])
 	printf("-----------------------------------------------------------------\n");
 	printf("Index\tNetwork\t\tNetmask\t\tNexthop\t\tInterface \n");
 
-	for (i = 0; i < MAX_ROUTES; i++)
-		if (route_tbl[i].is_empty != TRUE)
+	epochEnter();
+	rs = rtbl->snap;
+	for (i = 0; i < rs->size; i++)
+		if (rs->entries[i].is_empty != TRUE)
 		{
-			iface = findInterface(route_tbl[i].interface);
-			printf("[%d]\t%s\t%s\t%s\t\t%s\n", i, IP2Dot(tmpbuf, route_tbl[i].network),
-			       IP2Dot((tmpbuf+20), route_tbl[i].netmask), IP2Dot((tmpbuf+40), route_tbl[i].nexthop), iface->device_name);
+			iface = findInterface(rs->entries[i].interface);
+			printf("[%d]\t%s\t%s\t%s\t\t%s\n", i, IP2Dot(tmpbuf, rs->entries[i].network),
+			       IP2Dot((tmpbuf+20), rs->entries[i].netmask), IP2Dot((tmpbuf+40), rs->entries[i].nexthop),
+			       (iface != NULL) ? iface->device_name : "-");
 			rcount++;
 		}
+	epochExit();
 	printf("-----------------------------------------------------------------\n");
 	printf("      %d number of routes found. \n", rcount);
 	return;
 }
 
+
+void printRouteTableVersion(route_table_t *rtbl)
+{
+	rt_snapshot_t *rs;
+
+	epochEnter();
+	rs = rtbl->snap;
+	printf("Route table\tversion %lu\t%d routes, %d of %d trie chunks used \n",
+	       rtbl->version, rs->nroutes, rs->usedchunks, rs->nchunks);
+	epochExit();
+}
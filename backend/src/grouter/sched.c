@@ -0,0 +1,553 @@
+/*
+ * sched.c (packet scheduler engine)
+ *
+ * Each class queue of the packet core owns a slot of the scheduler
+ * array. The packets stay in the class queue (a ring): the scheduler
+ * only tracks which queues are backlogged and orders them with the
+ * policy in use:
+ *
+ *   rr     one packet per backlogged queue per round (roundrobin.c)
+ *   drr    deficit round robin, weight * SCHED_QUANTUM bytes per round
+ *          (roundrobin.c)
+ *   wfq    WF2Q+, worst-case fair weighted fair queuing (wfq.c)
+ *   prio   strict priority, round robin within a priority (below)
+ *
+ * The heaps hold slot numbers; a queue records where it sits in its
+ * heap (hindex) so it can be taken out in O(log Q) when it is deleted.
+ * The packets go through the queuing discipline of the queue (qdisc.c),
+ * which keeps the length given to schedEnqueue (the frame length) with
+ * each packet, so the policies see the size of the head packet without
+ * touching it. The discipline may drop packets at either end; the
+ * engine counts the backlog from the queue lengths it leaves.
+ *
+ * schedEnqueue stamps each packet with the time it is queued. A queue
+ * with a delay sits on the timer heap until its head packet is due
+ * (queued delay_us before) and only then goes to the policy (READY), so
+ * the policies never see a packet that may not leave yet. A queue whose
+ * class has no tokens (htb.c) waits there too, until it has; the policy
+ * may still pick a queue whose parent was drained by a sibling since it
+ * became ready, so the class is asked again before it sends.
+ */
+
+#include <slack/err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pktsched.h"
+#include "qdisc.h"
+#include "packetpool.h"
+#include "stats.h"
+
+static schedpolicy_t *sched_policies[] = {&sched_rr, &sched_drr, &sched_wf2q, &sched_prio, NULL};
+
+
+/*
+ * min-heaps of slot numbers, ordered by key and then by insertion
+ */
+static int schedBefore(sched_t *s, int a, int b)
+{
+	schedq_t *qa = &(s->queues[a]), *qb = &(s->queues[b]);
+
+	if (qa->key != qb->key)
+		return (qa->key < qb->key);
+	return (qa->seq < qb->seq);
+}
+
+
+static void schedHeapSet(sched_t *s, int h, int pos, int id)
+{
+	s->heap[h][pos] = id;
+	s->queues[id].hindex = pos;
+}
+
+
+static void schedHeapUp(sched_t *s, int h, int pos)
+{
+	int id = s->heap[h][pos], parent;
+
+	while (pos > 0)
+	{
+		parent = (pos - 1) / 2;
+		if (!schedBefore(s, id, s->heap[h][parent]))
+			break;
+		schedHeapSet(s, h, pos, s->heap[h][parent]);
+		pos = parent;
+	}
+	schedHeapSet(s, h, pos, id);
+}
+
+
+static void schedHeapDown(sched_t *s, int h, int pos)
+{
+	int id = s->heap[h][pos], child, n = s->heapsize[h];
+
+	while ((child = 2 * pos + 1) < n)
+	{
+		if ((child + 1 < n) && schedBefore(s, s->heap[h][child + 1], s->heap[h][child]))
+			child++;
+		if (!schedBefore(s, s->heap[h][child], id))
+			break;
+		schedHeapSet(s, h, pos, s->heap[h][child]);
+		pos = child;
+	}
+	schedHeapSet(s, h, pos, id);
+}
+
+
+void schedHeapPush(sched_t *s, int heap, schedq_t *sq, double key)
+{
+	int h = heap - 1;
+
+	sq->key = key;
+	sq->seq = s->seq++;
+	sq->heap = heap;
+	schedHeapSet(s, h, s->heapsize[h]++, sq - s->queues);
+	schedHeapUp(s, h, sq->hindex);
+}
+
+
+schedq_t *schedHeapTop(sched_t *s, int heap)
+{
+	if (s->heapsize[heap - 1] == 0)
+		return NULL;
+	return &(s->queues[s->heap[heap - 1][0]]);
+}
+
+
+void schedHeapRemove(sched_t *s, schedq_t *sq)
+{
+	int h = sq->heap - 1, pos = sq->hindex, last;
+
+	if (sq->heap == SCHED_HEAP_NONE)
+		return;
+	sq->heap = SCHED_HEAP_NONE;
+	last = s->heap[h][--s->heapsize[h]];
+	if (pos == s->heapsize[h])
+		return;
+	schedHeapSet(s, h, pos, last);
+	schedHeapUp(s, h, pos);
+	schedHeapDown(s, h, s->queues[last].hindex);
+}
+
+
+/*
+ * length of the packet at the head of the queue, 0 if it is empty
+ */
+int schedHeadLen(schedq_t *sq)
+{
+	unsigned long long qtime;
+	int len;
+
+	if (sq->q->qops->peek(sq->q, &len, &qtime) == EXIT_FAILURE)
+		return 0;
+	return len;
+}
+
+
+// bring the backlog in line with the packets the discipline kept
+static void schedCount(sched_t *s, schedq_t *sq)
+{
+	s->backlog += sq->q->cursize - sq->qlen;
+	sq->qlen = sq->q->cursize;
+}
+
+
+/*
+ * place an idle queue: with the policy if its head packet may leave at
+ * now, on the timer heap if it is held by the delay of the queue or by
+ * its shaper
+ */
+static void schedWake(sched_t *s, schedq_t *sq, unsigned long long now)
+{
+	unsigned long long qtime, release, shaped;
+	int len;
+
+	if (sq->q->qops->peek(sq->q, &len, &qtime) == EXIT_FAILURE)
+		return;
+	release = qtime + (unsigned long long)(sq->q->delay_us * 1000.0);
+	if ((shaped = htbRelease(s, sq, now)) > max(release, now))
+	{
+		release = shaped;
+		sq->htb.nheld++;
+	}
+	if (release > now)
+	{
+		sq->state = SCHED_Q_GATED;
+		schedHeapPush(s, SCHED_HEAP_TIMER, sq, (double)release);
+		// held again before it could borrow: it keeps its turn among
+		// the queues due at the same time (borrowers of one parent)
+		if (sq->waitseq != 0)
+		{
+			sq->seq = sq->waitseq - 1;
+			schedHeapUp(s, SCHED_HEAP_TIMER - 1, sq->hindex);
+		} else
+			sq->waitseq = sq->seq + 1;
+		return;
+	}
+	sq->state = SCHED_Q_READY;
+	s->nready++;
+	s->policy->activate(s, sq, len);
+}
+
+
+// take a queue away from the policy or the timer heap
+static void schedSleep(sched_t *s, schedq_t *sq)
+{
+	if (sq->state == SCHED_Q_READY)
+	{
+		s->policy->remove(s, sq);
+		s->nready--;
+	} else if (sq->state == SCHED_Q_GATED)
+		schedHeapRemove(s, sq);
+	sq->state = SCHED_Q_IDLE;
+}
+
+
+/*
+ * the packets, delay or priority of the queue changed behind the back
+ * of the engine (change of discipline, queue mod): place it again
+ */
+void schedQueueChanged(sched_t *s, simplequeue_t *q, unsigned long long now)
+{
+	schedq_t *sq = &(s->queues[q->schedid]);
+
+	schedSleep(s, sq);
+	schedCount(s, sq);
+	schedWake(s, sq, now);
+}
+
+
+/*
+ * the shaper of a class changed: the queues held for tokens are placed
+ * again, as the new rates may let them go earlier
+ */
+static void schedReplace(sched_t *s, unsigned long long now)
+{
+	int i;
+
+	for (i = 0; i < s->nslots; i++)
+		if ((s->queues[i].q != NULL) && (s->queues[i].state == SCHED_Q_GATED))
+		{
+			schedSleep(s, &(s->queues[i]));
+			schedWake(s, &(s->queues[i]), now);
+		}
+}
+
+
+/*
+ * set the rate and ceil (kbps) and burst (bytes) of the class of the
+ * queue; a negative value leaves that one as it is (htbSetRate)
+ */
+int schedSetShaper(sched_t *s, simplequeue_t *q, double ratekbps, double ceilkbps, int burst, unsigned long long now)
+{
+	if (htbSetRate(s, &(s->queues[q->schedid]), ratekbps, ceilkbps, burst, now) == EXIT_FAILURE)
+		return EXIT_FAILURE;
+	schedReplace(s, now);
+	return EXIT_SUCCESS;
+}
+
+
+/*
+ * the class of parent (NULL for none) lends to the class of the queue
+ */
+int schedSetParent(sched_t *s, simplequeue_t *q, simplequeue_t *parent, unsigned long long now)
+{
+	if (htbSetParent(s, &(s->queues[q->schedid]), (parent == NULL) ? -1 : parent->schedid) == EXIT_FAILURE)
+		return EXIT_FAILURE;
+	schedReplace(s, now);
+	return EXIT_SUCCESS;
+}
+
+
+/*
+ * strict priority: the backlogged queues are on the ready heap keyed by
+ * their priority; a queue that is served goes back behind the others of
+ * its priority
+ */
+static void prioActivate(sched_t *s, schedq_t *sq, int len)
+{
+	schedHeapPush(s, SCHED_HEAP_READY, sq, sq->q->prio);
+}
+
+
+static schedq_t *prioSelect(sched_t *s)
+{
+	return schedHeapTop(s, SCHED_HEAP_READY);
+}
+
+
+static void prioServed(sched_t *s, schedq_t *sq, int len, int nextlen)
+{
+	schedHeapRemove(s, sq);
+	if (nextlen > 0)
+		schedHeapPush(s, SCHED_HEAP_READY, sq, sq->q->prio);
+}
+
+
+schedpolicy_t sched_prio = {"prio", "strict priority (0 first), round robin within a priority",
+			    prioActivate, prioSelect, prioServed, schedHeapRemove};
+
+
+sched_t *createScheduler(char *policy)
+{
+	sched_t *s;
+
+	if ((s = (sched_t *)calloc(1, sizeof(sched_t))) == NULL)
+	{
+		error("[createScheduler]:: unable to allocate memory for the scheduler ");
+		return NULL;
+	}
+	s->drrhead = -1;
+	if ((s->policy = findSchedPolicy(policy)) == NULL)
+	{
+		error("[createScheduler]:: unknown scheduling policy %s, using rr ", policy);
+		s->policy = &sched_rr;
+	}
+	return s;
+}
+
+
+schedpolicy_t *findSchedPolicy(char *name)
+{
+	int i;
+
+	for (i = 0; sched_policies[i] != NULL; i++)
+		if (!strcmp(sched_policies[i]->name, name))
+			return sched_policies[i];
+	return NULL;
+}
+
+
+/*
+ * switch to another policy: the backlogged queues are handed to the new
+ * policy in slot order, with new virtual times
+ */
+int schedSetPolicy(sched_t *s, char *name)
+{
+	schedpolicy_t *policy;
+	int i;
+
+	if ((policy = findSchedPolicy(name)) == NULL)
+		return EXIT_FAILURE;
+
+	for (i = 0; i < s->nslots; i++)
+		if ((s->queues[i].q != NULL) && (s->queues[i].state == SCHED_Q_READY))
+			s->policy->remove(s, &(s->queues[i]));
+	s->policy = policy;
+	s->vtime = s->bweight = 0.0;
+	s->epoch++;
+	for (i = 0; i < s->nslots; i++)
+		if ((s->queues[i].q != NULL) && (s->queues[i].state == SCHED_Q_READY))
+			s->policy->activate(s, &(s->queues[i]), schedHeadLen(&(s->queues[i])));
+	return EXIT_SUCCESS;
+}
+
+
+int schedAddQueue(sched_t *s, simplequeue_t *q)
+{
+	schedq_t *sq;
+	int i;
+
+	for (i = 0; (i < s->nslots) && (s->queues[i].q != NULL); i++)
+		;
+	if (i == MAX_SCHED_QUEUES)
+	{
+		error("[schedAddQueue]:: no scheduler slot left for queue %s ", q->name);
+		return EXIT_FAILURE;
+	}
+	if (i == s->nslots)
+		s->nslots++;
+
+	sq = &(s->queues[i]);
+	bzero(sq, sizeof(schedq_t));
+	htbInitClass(&(sq->htb));
+	sq->q = q;
+	sq->prev = sq->next = -1;
+	sq->state = SCHED_Q_IDLE;
+	q->schedid = i;
+	return EXIT_SUCCESS;
+}
+
+
+/*
+ * take the queue out of the scheduler; the packets still in it are
+ * released
+ */
+void schedDelQueue(sched_t *s, simplequeue_t *q)
+{
+	schedq_t *sq = &(s->queues[q->schedid]);
+	gpacket_t *pkt;
+	int len;
+
+	schedSleep(s, sq);
+	while ((pkt = q->qops->pop(q, &len)) != NULL)
+		releasePacket(pkt);
+	schedCount(s, sq);
+	htbDelClass(s, sq);
+	sq->q = NULL;
+	q->schedid = -1;
+}
+
+
+/*
+ * add a packet of len bytes, queued at now, to the queue. returns
+ * EXIT_FAILURE if the discipline dropped it.
+ */
+int schedEnqueue(sched_t *s, simplequeue_t *q, gpacket_t *pkt, int len, unsigned long long now)
+{
+	schedq_t *sq = &(s->queues[q->schedid]);
+	int status;
+
+	pkt->frame.qtime = now;
+	status = q->qops->enqueue(q, pkt, len, now);
+	if ((status == EXIT_SUCCESS) && (q->qstats != NULL))
+		statsQueueEnqueue(q->qstats, len, q->cursize);
+	schedCount(s, sq);
+	if (sq->state == SCHED_Q_IDLE)
+		schedWake(s, sq, now);
+	return status;
+}
+
+
+/*
+ * remove the next packet to send at now; NULL if no queue has a packet
+ * that may leave (see schedNextRelease)
+ */
+gpacket_t *schedDequeue(sched_t *s, int *len, unsigned long long now)
+{
+	unsigned long long qtime;
+	schedq_t *sq;
+	gpacket_t *pkt;
+	int nextlen;
+
+	// queues whose head packet is due
+	while (((sq = schedHeapTop(s, SCHED_HEAP_TIMER)) != NULL) && (sq->key <= now))
+	{
+		schedHeapRemove(s, sq);
+		sq->state = SCHED_Q_IDLE;
+		schedWake(s, sq, now);
+	}
+
+	pkt = NULL;
+	while ((pkt == NULL) && (s->nready > 0))
+	{
+		sq = s->policy->select(s);
+		if (htbRelease(s, sq, now) > now)
+		{
+			// out of tokens since it became ready
+			schedSleep(s, sq);
+			schedWake(s, sq, now);
+			continue;
+		}
+		pkt = sq->q->qops->dequeue(sq->q, len, now);
+		schedCount(s, sq);
+		if (pkt == NULL)
+		{
+			// the discipline dropped what was left
+			s->policy->served(s, sq, 0, 0);
+			s->nready--;
+			sq->state = SCHED_Q_IDLE;
+			continue;
+		}
+		sq->npackets++;
+		sq->nbytes += *len;
+		if (sq->q->qstats != NULL)
+			statsQueueDequeue(sq->q->qstats, *len, now - pkt->frame.qtime, sq->q->cursize);
+		// a borrower goes behind the others waiting for the tokens of its parent
+		if (htbCharge(s, sq, *len, now) || (sq->q->cursize == 0))
+			sq->waitseq = 0;
+		if ((sq->q->qops->peek(sq->q, &nextlen, &qtime) == EXIT_FAILURE) ||
+		    (qtime + (unsigned long long)(sq->q->delay_us * 1000.0) > now) ||
+		    (htbRelease(s, sq, now) > now))
+		{
+			// empty, or the next packet is held (delay, tokens): off the policy
+			s->policy->served(s, sq, *len, 0);
+			s->nready--;
+			sq->state = SCHED_Q_IDLE;
+			schedWake(s, sq, now);
+		} else
+			s->policy->served(s, sq, *len, nextlen);
+	}
+
+	// no queue left with the policy: the next busy period starts with new virtual times
+	if (s->nready == 0)
+	{
+		s->vtime = s->bweight = 0.0;
+		s->epoch++;
+	}
+	return pkt;
+}
+
+
+/*
+ * when the first queue held by its delay is due, 0 if none is
+ */
+unsigned long long schedNextRelease(sched_t *s)
+{
+	schedq_t *sq;
+
+	if ((sq = schedHeapTop(s, SCHED_HEAP_TIMER)) == NULL)
+		return 0;
+	return (unsigned long long)sq->key;
+}
+
+
+/*
+ * fill stats with the classes (at most max of them), RETURNS how many
+ */
+int schedClassStats(sched_t *s, schedclassstats_t *stats, int max, unsigned long long now)
+{
+	schedq_t *sq;
+	int i, n = 0;
+
+	for (i = 0; (i < s->nslots) && (n < max); i++)
+	{
+		sq = &(s->queues[i]);
+		if (sq->q == NULL)
+			continue;
+		bzero(&(stats[n]), sizeof(schedclassstats_t));
+		strcpy(stats[n].name, sq->q->name);
+		if (sq->htb.parent >= 0)
+			strcpy(stats[n].parent, s->queues[sq->htb.parent].q->name);
+		stats[n].rate = sq->htb.rate;
+		stats[n].ceil = (sq->htb.ceil > 0.0) ? sq->htb.ceil : sq->htb.rate;
+		stats[n].sendrate = htbEstRate(&(sq->htb), now);
+		stats[n].backlog = sq->q->cursize;
+		stats[n].backlogbytes = sq->q->bytesleft;
+		stats[n].tokens = sq->htb.tokens;
+		stats[n].ctokens = sq->htb.ctokens;
+		stats[n].npackets = sq->npackets;
+		stats[n].nbytes = sq->nbytes;
+		stats[n].borrowed = sq->htb.borrowed;
+		n++;
+	}
+	return n;
+}
+
+
+void schedPrintPolicies(sched_t *s)
+{
+	int i;
+
+	for (i = 0; sched_policies[i] != NULL; i++)
+		printf("%c %-6s %s \n", (sched_policies[i] == s->policy) ? '*' : ' ',
+		       sched_policies[i]->name, sched_policies[i]->desc);
+}
+
+
+void schedPrint(sched_t *s)
+{
+	schedq_t *sq;
+	int i;
+
+	printf("Policy: %s, %d packets queued, %d queues ready \n", s->policy->name, s->backlog, s->nready);
+	printf("Queue\t\tWeight\tPrio\tQdisc\t\tQueued\tPackets\t\tBytes\n");
+	for (i = 0; i < s->nslots; i++)
+	{
+		sq = &(s->queues[i]);
+		if (sq->q == NULL)
+			continue;
+		printf("%-16s%.2f\t%d\t%-16s%d\t%-12lu\t%lu\n", sq->q->name, sq->q->weight, sq->q->prio,
+		       sq->q->qdisc, sq->q->cursize, sq->npackets, sq->nbytes);
+	}
+}
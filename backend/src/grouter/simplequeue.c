@@ -14,12 +14,15 @@
 #include <time.h>
 #include <sys/time.h>
 #include "simplequeue.h"
+#include "cpu.h"
 
-// For unbounded queues, set maxsize to 0.
+// For unbounded queues, set maxsize to INFINITE_Q_SIZE.
 // For bounded queues, blockonwrite could be true or false. If true,
 // a write waits if the queue is full. Otherwise, the write returns failed.
 // Similarly, if blockonread is true, a read on an empty queue blocks.
 // For unbounded queue, blockonwrite is meaningless.
+// Bounded queues of up to MAX_RING_SIZE elements are backed by a lock-free
+// ring (ringbuffer.c); larger queues use a libslack List under qlock.
 simplequeue_t *createSimpleQueue(char *name, int maxsize, int blockonwrite,
 				 int blockonread)
 {
@@ -35,15 +38,34 @@ simplequeue_t *createSimpleQueue(char *name, int maxsize, int blockonwrite,
 	msgqueue->cursize = 0;
 	msgqueue->bytesleft = 0;
 	msgqueue->avgbyterate = 0.0;
-	msgqueue->prevaccesstime = (long)time(NULL);
+	msgqueue->nbytesread = msgqueue->prevbytesread = 0;
+	msgqueue->prevaccesstime = getTimeNanos();
+	msgqueue->qstats = NULL;
 	msgqueue->blockonwrite = blockonwrite;
 	msgqueue->blockonread = blockonread;
+	msgqueue->weight = 1.0;
+	msgqueue->prio = 0;
+	msgqueue->schedid = -1;
+	msgqueue->qdisc[0] = 0;
+	msgqueue->qops = NULL;
+	msgqueue->qdata = NULL;
+	msgqueue->delay_us = 0.0;
 
 	pthread_mutex_init(&(msgqueue->qlock), NULL);
 	pthread_cond_init(&(msgqueue->qfull), NULL);
 	pthread_cond_init(&(msgqueue->qempty), NULL);
+	msgqueue->rwaiting = msgqueue->wwaiting = 0;
+	msgqueue->queue = NULL;
+	msgqueue->ring = NULL;
 
-	if (!(msgqueue->queue = list_create(NULL)))
+	if ((maxsize > 0) && (maxsize <= MAX_RING_SIZE))
+	{
+		if ((msgqueue->ring = createRingBuffer(maxsize)) == NULL)
+		{
+			fatal("[createSimpleQueue]:: Could not create the message ring..");
+			return NULL;
+		}
+	} else if (!(msgqueue->queue = list_create(NULL)))
 	{
 		fatal("[createSimpleQueue]:: Could not create the message list..");
 		return NULL;
@@ -61,8 +83,11 @@ int destroySimpleQueue(simplequeue_t *msgqueue)
   verbose(2,"[destroySimpleQueue]:: Deleting the queue %s .. ", msgqueue->name);
   if (msgqueue != NULL)
   {
+	  cpuQueueUnregister(msgqueue);
 	  if (msgqueue->queue != NULL)
 		  list_release(msgqueue->queue);
+	  if (msgqueue->ring != NULL)
+		  destroyRingBuffer(msgqueue->ring);
 	  free(msgqueue);
   }
   verbose(4, "[destroySimpleQueue]:: released all the simple queue data structures.. ");
@@ -77,11 +102,16 @@ void printSimpleQueue(simplequeue_t *msgqueue)
 	printf("Queue name: %s\n", msgqueue->name);
 	printf("Queuing discipline: %s\n", msgqueue->qdisc);
 	printf("Queue weight: %f\n", msgqueue->weight);
+	printf("Queue priority: %d\n", msgqueue->prio);
 	printf("Queuing delay: %f\n", msgqueue->delay_us);
 	if (msgqueue->maxsize == 0)
 		printf("Queue size (maximum): Unlimited \n");
 	else
 		printf("Queue size (maximum): %d \n", msgqueue->maxsize);
+	if (msgqueue->ring != NULL)
+		printf("Queue backend: ring (%d slots) \n", ringCapacity(msgqueue->ring));
+	else
+		printf("Queue backend: list \n");
 
 //	printf("Block on write: %s\n", msgqueue->blockonwrite ? "enabled" : "not enabled");
 //	printf("Block on read: %s\n", msgqueue->blockonread ? "enabled" : "not enabled");
@@ -89,8 +119,8 @@ void printSimpleQueue(simplequeue_t *msgqueue)
 	printf("Found %d elements in the queue \n", msgqueue->cursize);
 	printf("The queue has %d bytes in it \n", msgqueue->bytesleft);
 
-	printf("Previous access time: %f\n", msgqueue->prevaccesstime);
-	printf("Average byte rate: %f\n", msgqueue->avgbyterate);
+	printf("Bytes read so far: %llu\n", msgqueue->nbytesread);
+	printf("Average byte rate: %f\n", getAvgByteRate(msgqueue));
 }
 
 
@@ -111,10 +141,97 @@ int copy2Queue(simplequeue_t *msgqueue, void *data, int size)
 }
 
 
+/*
+ * Ring backend: the ring itself is lock-free, qlock and the condition
+ * variables are only touched by a thread that has to sleep (empty ring
+ * on a blocking read, full ring on a blocking write) and by the thread
+ * that wakes it. The waiter counts are published with full barriers on
+ * both sides, so either the sleeper sees the new state of the ring or
+ * the waker sees the sleeper -- a wakeup cannot be lost.
+ */
+static int tryRingWrite(simplequeue_t *msgqueue, void *data, int size)
+{
+	if (msgqueue->cursize >= msgqueue->maxsize)
+		return EXIT_FAILURE;
+	return ringPush(msgqueue->ring, data, size);
+}
+
+
+static int writeRingQueue(simplequeue_t *msgqueue, void *data, int size)
+{
+	if (tryRingWrite(msgqueue, data, size) == EXIT_FAILURE)
+	{
+		if (!msgqueue->blockonwrite)
+			return EXIT_FAILURE;
+
+		pthread_mutex_lock(&(msgqueue->qlock));
+		__sync_fetch_and_add(&(msgqueue->wwaiting), 1);
+		while (tryRingWrite(msgqueue, data, size) == EXIT_FAILURE)
+			pthread_cond_wait(&(msgqueue->qfull), &(msgqueue->qlock));
+		__sync_fetch_and_sub(&(msgqueue->wwaiting), 1);
+		pthread_mutex_unlock(&(msgqueue->qlock));
+	}
+	__sync_fetch_and_add(&(msgqueue->cursize), 1);
+	__sync_fetch_and_add(&(msgqueue->bytesleft), size);
+
+	// wake up a reader only if one went to sleep on the empty ring
+	if (msgqueue->rwaiting > 0)
+	{
+		pthread_mutex_lock(&(msgqueue->qlock));
+		pthread_cond_signal(&(msgqueue->qempty));
+		pthread_mutex_unlock(&(msgqueue->qlock));
+	}
+	return EXIT_SUCCESS;
+}
+
+
+// account for an element taken from the ring
+static void ringQueuePopped(simplequeue_t *msgqueue, int size)
+{
+	__sync_fetch_and_sub(&(msgqueue->cursize), 1);
+	__sync_fetch_and_sub(&(msgqueue->bytesleft), size);
+
+	// wake up a writer only if one went to sleep on the full ring
+	if (msgqueue->wwaiting > 0)
+	{
+		pthread_mutex_lock(&(msgqueue->qlock));
+		pthread_cond_signal(&(msgqueue->qfull));
+		pthread_mutex_unlock(&(msgqueue->qlock));
+	}
+	__sync_fetch_and_add(&(msgqueue->nbytesread), size);
+}
+
+
+static int readRingQueue(simplequeue_t *msgqueue, void **data, int *size)
+{
+	if (ringPop(msgqueue->ring, data, size) == EXIT_FAILURE)
+	{
+		if (!msgqueue->blockonread)
+		{
+			*data = NULL;
+			*size = 0;
+			return EXIT_FAILURE;
+		}
+
+		pthread_mutex_lock(&(msgqueue->qlock));
+		__sync_fetch_and_add(&(msgqueue->rwaiting), 1);
+		while (ringPop(msgqueue->ring, data, size) == EXIT_FAILURE)
+			pthread_cond_wait(&(msgqueue->qempty), &(msgqueue->qlock));
+		__sync_fetch_and_sub(&(msgqueue->rwaiting), 1);
+		pthread_mutex_unlock(&(msgqueue->qlock));
+	}
+	ringQueuePopped(msgqueue, *size);
+	return EXIT_SUCCESS;
+}
+
+
 int writeQueue(simplequeue_t *msgqueue, void *data, int size)
 {
 	simplewrapper_t *swrap;
 
+	if (msgqueue->ring != NULL)
+		return writeRingQueue(msgqueue, data, size);
+
 	if ((swrap = (simplewrapper_t *)malloc(sizeof(simplewrapper_t))) == NULL)
 	{
 		fatal("[writeQueue]:: unable to allocate memory for packet wrapper ");
@@ -157,6 +274,9 @@ int readQueue(simplequeue_t *msgqueue, void **data, int *size)
 	simplewrapper_t *swrap;
 	int rvalue;
 
+	if (msgqueue->ring != NULL)
+		return readRingQueue(msgqueue, data, size);
+
 	pthread_mutex_lock(&(msgqueue->qlock));
 	if (msgqueue->cursize <= 0)
 	{
@@ -169,6 +289,7 @@ int readQueue(simplequeue_t *msgqueue, void **data, int *size)
 			swrap->data = NULL;
 			msgqueue->cursize--;
 			msgqueue->bytesleft -= *size;
+			msgqueue->nbytesread += *size;
 			rvalue = EXIT_SUCCESS;
 		} else
 		{
@@ -185,6 +306,7 @@ int readQueue(simplequeue_t *msgqueue, void **data, int *size)
 		*data = swrap->data;
 		swrap->data = NULL;
 		msgqueue->bytesleft -= *size;
+		msgqueue->nbytesread += *size;
 		if ((msgqueue->blockonwrite) && (msgqueue->cursize >= (msgqueue->maxsize-1)))
 			pthread_cond_signal(&(msgqueue->qfull));
 		rvalue = EXIT_SUCCESS;
@@ -192,51 +314,93 @@ int readQueue(simplequeue_t *msgqueue, void **data, int *size)
 	pthread_mutex_unlock(&(msgqueue->qlock));
 	if (rvalue == EXIT_SUCCESS)
 		free(swrap);
-
-	if (rvalue == EXIT_SUCCESS)
-		computeAvgByteRate(msgqueue, *size);
 	return rvalue;
 }
 
 
-void computeAvgByteRate(simplequeue_t *sq, int size)
-{
-	double curraccesstime, tinterval, mfactor;
-	struct timeval tval;
-
-	gettimeofday(&tval, NULL);
-	curraccesstime = tval.tv_usec * 0.000001;
-	curraccesstime += tval.tv_sec;
-	tinterval = curraccesstime - sq->prevaccesstime;
-	sq->prevaccesstime = curraccesstime;
-	mfactor = exp(-1.0 * tinterval);
-	sq->avgbyterate = (1 - mfactor)* (size/tinterval) + mfactor * sq->avgbyterate;
-}
-
-
+/*
+ * the readers only bump nbytesread, the exponentially weighted byte rate
+ * is brought up to date here, when somebody asks for it. the weight of
+ * the old average decays by a factor e every second, as before.
+ */
 double getAvgByteRate(simplequeue_t *sq)
 {
-	double curraccesstime;
-	struct timeval tval;
+	unsigned long long now, nbytes;
+	double tinterval, mfactor;
 
-	gettimeofday(&tval, NULL);
-	curraccesstime = tval.tv_usec * 0.000001;
-	curraccesstime += tval.tv_sec;
-	if ((curraccesstime - sq->prevaccesstime) > 1.0)
-		computeAvgByteRate(sq, 0);
+	now = getTimeNanos();
+	tinterval = (now - sq->prevaccesstime) * 1e-9;
+	if (tinterval < 0.001)
+		return sq->avgbyterate;
 
+	nbytes = sq->nbytesread;
+	mfactor = exp(-1.0 * tinterval);
+	sq->avgbyterate = (1 - mfactor) * ((nbytes - sq->prevbytesread) / tinterval) + mfactor * sq->avgbyterate;
+	sq->prevbytesread = nbytes;
+	sq->prevaccesstime = now;
 	return sq->avgbyterate;
 }
 
 
 
+// get the next element without actually removing it from the queeue.
+/*
+ * read an element if one is present. never blocks, even on a queue
+ * that blocks on read: returns EXIT_FAILURE if the queue is empty.
+ */
+int tryReadQueue(simplequeue_t *msgqueue, void **data, int *size)
+{
+	simplewrapper_t *swrap;
+
+	if (msgqueue->ring != NULL)
+	{
+		if (ringPop(msgqueue->ring, data, size) == EXIT_FAILURE)
+		{
+			*data = NULL;
+			*size = 0;
+			return EXIT_FAILURE;
+		}
+		ringQueuePopped(msgqueue, *size);
+		return EXIT_SUCCESS;
+	}
+
+	pthread_mutex_lock(&(msgqueue->qlock));
+	if (msgqueue->cursize <= 0)
+	{
+		pthread_mutex_unlock(&(msgqueue->qlock));
+		*data = NULL;
+		*size = 0;
+		return EXIT_FAILURE;
+	}
+	msgqueue->cursize--;
+	swrap = list_shift(msgqueue->queue);
+	*size = swrap->size;
+	*data = swrap->data;
+	msgqueue->bytesleft -= *size;
+	msgqueue->nbytesread += *size;
+	if ((msgqueue->blockonwrite) && (msgqueue->cursize >= (msgqueue->maxsize-1)))
+		pthread_cond_signal(&(msgqueue->qfull));
+	pthread_mutex_unlock(&(msgqueue->qlock));
+
+	swrap->data = NULL;
+	free(swrap);
+	return EXIT_SUCCESS;
+}
 
 
-// get the next element without actually removing it from the queeue.
 int peekQueue(simplequeue_t *msgqueue, void **data, int *size)
 {
 	simplewrapper_t *swrap;
 
+	if (msgqueue->ring != NULL)
+	{
+		if (ringPeek(msgqueue->ring, data, size) == EXIT_SUCCESS)
+			return EXIT_SUCCESS;
+		*size = 0;
+		*data = NULL;
+		return EXIT_FAILURE;
+	}
+
 	pthread_mutex_lock(&(msgqueue->qlock));
 
 	if (msgqueue->cursize <= 0)
@@ -249,7 +413,7 @@ int peekQueue(simplequeue_t *msgqueue, void **data, int *size)
 	{
 		swrap = list_shift(msgqueue->queue);
 		*size = swrap->size;
-		*data = &(swrap->data);
+		*data = swrap->data;
 		list_unshift(msgqueue->queue, swrap);
 		pthread_mutex_unlock(&(msgqueue->qlock));
 		return EXIT_SUCCESS;
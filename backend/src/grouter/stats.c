@@ -0,0 +1,259 @@
+/*
+ * stats.c (statistics segment of the gRouter)
+ *
+ * The datapath counters are kept in a memory mapped file under the
+ * configuration directory (see stats.h for the layout) instead of the
+ * structures of the threads and queues. The router writes them without
+ * locks or atomic operations: a thread block is only written by the
+ * thread it belongs to, a queue block only by the thread holding the
+ * packet core lock. External programs map the file and read it at any
+ * rate; "queue stats" renders the same blocks.
+ */
+
+#include <slack/err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "stats.h"
+
+
+__thread statsthread_t *tstats = NULL;
+
+static stats_header_t *stats_hdr = NULL;
+static statsthread_t *stats_threads;
+static statsqueue_t *stats_queues;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static char stats_path[MAX_NAME_LEN];
+
+
+/*
+ * map the statistics segment <rpath>/<rname>.stats. if the file cannot
+ * be created the counters are kept in anonymous memory: the CLI still
+ * shows them but no other program can.
+ */
+void statsInit(char *rpath, char *rname)
+{
+	size_t size;
+	void *seg = MAP_FAILED;
+	int fd;
+
+	size = sizeof(stats_header_t) + STATS_MAX_THREADS * sizeof(statsthread_t) +
+		STATS_MAX_QUEUES * sizeof(statsqueue_t);
+
+	sprintf(stats_path, "%s/%s.%s", rpath, rname, "stats");
+	if ((fd = open(stats_path, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) == -1)
+		error("[statsInit]:: unable to create the statistics segment %s ", stats_path);
+	else
+	{
+		if (ftruncate(fd, size) == 0)
+			seg = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (seg == MAP_FAILED)
+			error("[statsInit]:: unable to map the statistics segment %s ", stats_path);
+		close(fd);
+	}
+	if (seg == MAP_FAILED)
+	{
+		stats_path[0] = 0;
+		if ((seg = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+		{
+			fatal("[statsInit]:: unable to allocate memory for the statistics ");
+			return;
+		}
+	}
+
+	stats_hdr = (stats_header_t *)seg;
+	stats_hdr->version = STATS_VERSION;
+	stats_hdr->size = size;
+	stats_hdr->hist_sub_bits = STATS_HIST_SUB_BITS;
+	stats_hdr->hist_max_bits = STATS_HIST_MAX_BITS;
+	stats_hdr->hist_buckets = STATS_HIST_BUCKETS;
+	stats_hdr->max_threads = STATS_MAX_THREADS;
+	stats_hdr->max_queues = STATS_MAX_QUEUES;
+	stats_hdr->thread_size = sizeof(statsthread_t);
+	stats_hdr->queue_size = sizeof(statsqueue_t);
+	stats_hdr->pid = getpid();
+	stats_hdr->thread_offset = sizeof(stats_header_t);
+	stats_hdr->queue_offset = sizeof(stats_header_t) + STATS_MAX_THREADS * sizeof(statsthread_t);
+	stats_hdr->started = time(NULL);
+	strncpy(stats_hdr->router, rname, STATS_NAME_LEN - 1);
+	stats_threads = (statsthread_t *)((char *)seg + stats_hdr->thread_offset);
+	stats_queues = (statsqueue_t *)((char *)seg + stats_hdr->queue_offset);
+
+	// readers check the magic before anything else
+	__sync_synchronize();
+	stats_hdr->magic = STATS_MAGIC;
+	verbose(2, "[statsInit]:: statistics segment %s (%d bytes) ", stats_path, (int)size);
+}
+
+
+/*
+ * get the block for the thread called name: the one it had before
+ * (a restarted thread keeps counting) or a free one. NULL if none is
+ * left or there is no segment.
+ */
+statsthread_t *statsThreadAlloc(char *name)
+{
+	statsthread_t *st = NULL;
+	int i;
+
+	if (stats_hdr == NULL)
+		return NULL;
+
+	pthread_mutex_lock(&stats_lock);
+	for (i = 0; i < STATS_MAX_THREADS; i++)
+		if (!strncmp(stats_threads[i].name, name, STATS_NAME_LEN - 1))
+		{
+			st = &(stats_threads[i]);
+			break;
+		}
+	for (i = 0; (st == NULL) && (i < STATS_MAX_THREADS); i++)
+		if (stats_threads[i].name[0] == 0)
+		{
+			st = &(stats_threads[i]);
+			st->packets = st->bytes = st->drops = 0;
+			st->tid = 0;
+			__sync_synchronize();
+			strncpy(st->name, name, STATS_NAME_LEN - 1);
+		}
+	pthread_mutex_unlock(&stats_lock);
+
+	if (st == NULL)
+		verbose(1, "[statsThreadAlloc]:: no statistics block left for thread %s ", name);
+	return st;
+}
+
+
+// make st the counters of the calling thread
+void statsThreadSet(statsthread_t *st)
+{
+	tstats = st;
+	if (st != NULL)
+		st->tid = syscall(SYS_gettid);
+}
+
+
+statsthread_t *statsThreadRegister(char *name)
+{
+	statsThreadSet(statsThreadAlloc(name));
+	return tstats;
+}
+
+
+/*
+ * get a cleared block for the packet core queue called name, NULL if
+ * none is left or there is no segment.
+ */
+statsqueue_t *statsQueueAlloc(char *name)
+{
+	statsqueue_t *qs = NULL;
+	int i;
+
+	if (stats_hdr == NULL)
+		return NULL;
+
+	pthread_mutex_lock(&stats_lock);
+	for (i = 0; i < STATS_MAX_QUEUES; i++)
+		if (stats_queues[i].name[0] == 0)
+		{
+			qs = &(stats_queues[i]);
+			memset((char *)qs + STATS_NAME_LEN, 0, sizeof(statsqueue_t) - STATS_NAME_LEN);
+			__sync_synchronize();
+			strncpy(qs->name, name, STATS_NAME_LEN - 1);
+			break;
+		}
+	pthread_mutex_unlock(&stats_lock);
+
+	if (qs == NULL)
+		verbose(1, "[statsQueueAlloc]:: no statistics block left for queue %s ", name);
+	return qs;
+}
+
+
+void statsQueueFree(statsqueue_t *qs)
+{
+	if (qs == NULL)
+		return;
+	pthread_mutex_lock(&stats_lock);
+	memset(qs->name, 0, STATS_NAME_LEN);
+	pthread_mutex_unlock(&stats_lock);
+}
+
+
+/*
+ * the queue hooks, called by the scheduler engine under the packet
+ * core lock
+ */
+void statsQueueEnqueue(statsqueue_t *qs, int len, int backlog)
+{
+	qs->enqueued++;
+	qs->enqbytes += len;
+	qs->backlog = backlog;
+}
+
+
+void statsQueueDequeue(statsqueue_t *qs, int len, unsigned long long sojourn, int backlog)
+{
+	qs->dequeued++;
+	qs->deqbytes += len;
+	qs->backlog = backlog;
+	qs->sojourn_sum += sojourn;
+	if (sojourn > qs->sojourn_max)
+		qs->sojourn_max = sojourn;
+	qs->hist[histIndex(sojourn)]++;
+}
+
+
+/*
+ * one line for a queue block: the histogram is copied first so that the
+ * percentiles come from one consistent count, the datapath keeps going.
+ */
+void statsPrintQueue(statsqueue_t *qs)
+{
+	uint64_t hist[STATS_HIST_BUCKETS], count = 0, max;
+	char name[STATS_NAME_LEN];
+	int i;
+
+	memcpy(name, qs->name, STATS_NAME_LEN);
+	name[STATS_NAME_LEN - 1] = 0;
+	for (i = 0; i < STATS_HIST_BUCKETS; i++)
+		count += (hist[i] = qs->hist[i]);
+	max = qs->sojourn_max;
+
+#define PCT(P)	(min(histPercentile(hist, count, P), max) / 1000.0)
+	printf("%-12s %10llu %10llu %8llu %7llu %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n", name,
+	       (unsigned long long)qs->enqueued, (unsigned long long)qs->dequeued,
+	       (unsigned long long)qs->drops, (unsigned long long)qs->backlog,
+	       (count > 0) ? qs->sojourn_sum / 1000.0 / count : 0.0,
+	       PCT(50.0), PCT(90.0), PCT(99.0), PCT(99.9), max / 1000.0);
+#undef PCT
+}
+
+
+void statsPrintThreads(void)
+{
+	statsthread_t *st;
+	int i;
+
+	if (stats_hdr == NULL)
+		return;
+
+	printf("\nThread           TID       Packets           Bytes      Drops \n");
+	for (i = 0; i < STATS_MAX_THREADS; i++)
+	{
+		st = &(stats_threads[i]);
+		if (st->name[0] == 0)
+			continue;
+		printf("%-12s %7u %13llu %15llu %10llu\n", st->name, st->tid,
+		       (unsigned long long)st->packets, (unsigned long long)st->bytes,
+		       (unsigned long long)st->drops);
+	}
+	if (stats_path[0] != 0)
+		printf("\nSegment: %s \n", stats_path);
+}
@@ -12,10 +12,15 @@
 #include "filter.h"
 #include "protocols.h"
 #include "message.h"
+#include "packetpool.h"
 #include "gnet.h"
 #include "arp.h"
 #include "ip.h"
 #include "ethernet.h"
+#include "tapio.h"
+#include "stats.h"
+#include "cpu.h"
+#include "epoch.h"
 #include <netinet/in.h>
 #include <stdlib.h>
 
@@ -41,27 +46,29 @@ void *toTapDev(void *arg)
 	interface_t *iface;
 	arp_packet_t *apkt;
 	char tmpbuf[MAX_TMPBUF_LEN];
-	int pkt_size;
+	struct iovec iov[VPL_MAX_IOV];
+	int niov;
 
 	verbose(2, "[toTapDev]:: entering the function.. ");
 	// find the outgoing interface and device...
 	if ((iface = findInterface(inpkt->frame.dst_interface)) != NULL)
 	{
 		/* send IP packet or ARP reply */
-		if (inpkt->data.header.prot == htons(ARP_PROTOCOL))
+		if (GPKT_ETH(inpkt)->header.prot == htons(ARP_PROTOCOL))
 		{
-			apkt = (arp_packet_t *) inpkt->data.data;
+			apkt = (arp_packet_t *)GPKT_PAYLOAD(inpkt);
 			COPY_MAC(apkt->src_hw_addr, iface->mac_addr);
 			COPY_IP(apkt->src_ip_addr, gHtonl(tmpbuf, iface->ip_addr));
 		}
-		pkt_size = findPacketSize(&(inpkt->data));
+		niov = gpktIovec(inpkt, iov, findPacketSize(inpkt));
 
-		verbose(2, "[toTapDev]:: tap_sendto called for interface %d.. ", iface->interface_id);
-		tap_sendto(iface->vpl_data, &(inpkt->data), pkt_size);
-		free(inpkt);          // finally destroy the memory allocated to the packet..
+		verbose(2, "[toTapDev]:: tap_sendv called for interface %d.. ", iface->interface_id);
+		tap_sendv(iface->vpl_data, iov, niov);
 	} else
 		error("[toTapDev]:: ERROR!! Could not find outgoing interface ...");
 
+	releasePacket(inpkt);          // finally drop the reference held by the output queue..
+
 	// this is just a dummy return -- return value not used.
 	return arg;
 }
@@ -77,31 +84,43 @@ void* fromTapDev(void *arg)
 	uchar bcast_mac[] = MAC_BCAST_ADDR;
 	char *pkttag;
 	gpacket_t *in_pkt;
+	char tname[STATS_NAME_LEN];
 	int pktsize;
 
 	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);		// die as soon as cancelled
+	sprintf(tname, "rx %d", iface->interface_id);
+	statsThreadRegister(tname);
+	cpuThreadRegister(CPU_ROLE_RX, iface->interface_id, tname);
 	while (1)
 	{
 		verbose(2, "[fromTapDev]:: Receiving a packet ...");
-		if ((in_pkt = (gpacket_t *)malloc(sizeof(gpacket_t))) == NULL)
+		// a buffer for the largest frame at the MTU of the interface
+		if ((in_pkt = newPacketSize(ETHER_HEADER_LEN + max(iface->device_mtu, DEFAULT_MTU))) == NULL)
 		{
 			fatal("[fromTapDev]:: unable to allocate memory for packet.. ");
 			return NULL;
 		}
 
-		bzero(in_pkt, sizeof(gpacket_t));
-		pktsize = tap_recvfrom(iface->vpl_data, &(in_pkt->data), sizeof(pkt_data_t));
+		pktsize = tap_recvfrom(iface->vpl_data, in_pkt->data, GPKT_ROOM(in_pkt));
 		pthread_testcancel();
+		if (pktsize <= 0)
+		{
+			releasePacket(in_pkt);
+			continue;
+		}
+		in_pkt->len = pktsize;
+		STATS_COUNT(1, pktsize);
 
 		// check whether the incoming packet is a layer 2 broadcast or
 		// meant for this node... otherwise should be thrown..
 		// TODO: fix for promiscuous mode packet snooping.
 
-		if ((COMPARE_MAC(in_pkt->data.header.dst, iface->mac_addr) != 0) &&
-			(COMPARE_MAC(in_pkt->data.header.dst, bcast_mac) != 0))
+		if ((COMPARE_MAC(GPKT_ETH(in_pkt)->header.dst, iface->mac_addr) != 0) &&
+			(COMPARE_MAC(GPKT_ETH(in_pkt)->header.dst, bcast_mac) != 0))
 		{
 			verbose(1, "[fromTapDev]:: Packet[%d] dropped .. not for this router!? ", pktsize);
-			free(in_pkt);
+			STATS_DROP(1);
+			releasePacket(in_pkt);
 			continue;
 		}
 
@@ -110,25 +129,22 @@ void* fromTapDev(void *arg)
 		COPY_MAC(in_pkt->frame.src_hw_addr, iface->mac_addr);
 		COPY_IP(in_pkt->frame.src_ip_addr, iface->ip_addr);
 
-		// check for filtering.. if the it should be filtered.. then drop
-		if (filteredPacket(filter, in_pkt))
+		// one classification pass gives the filter verdict and the packet
+		// tag.. if the packet should be filtered.. then drop. at the very
+		// minimum, we get the "default" tag!
+		epochEnter();
+		if (classifyPacket(pcore, in_pkt, &pkttag) == FALSE)
 		{
+			epochExit();
 			verbose(2, "[fromTapDev]:: Packet filtered..!");
-			free(in_pkt);
+			STATS_DROP(1);
+			releasePacket(in_pkt);
 			continue;   // skip the rest of the loop
 		}
-
-		// invoke the packet core classifier to get the packet tag
-		// at the very minimum, we get the "default" tag!
-		verbose(2, "[fromTapDev]:: Calling the classifier..");
-		pkttag = tagPacket(pcore, in_pkt);
 		verbose(2, "[fromTapDev]:: Packet tagged as %s ", pkttag);
-		if (!strcmp(rconfig.schedpolicy, "rr"))
-			roundRobinQueuer(pcore, in_pkt, sizeof(gpacket_t), pkttag);
-		else if (!strcmp(rconfig.schedpolicy, "wfq"))
-			weightedFairQueuer(pcore, in_pkt, sizeof(gpacket_t), pkttag);
-		else
-			fatal("[fromTapDev]:: Unknown queuer specification! %s \n", rconfig.schedpolicy);
+		if (PktCoreEnqueue(pcore, in_pkt, pkttag) == EXIT_FAILURE)
+			STATS_DROP(1);
+		epochExit();
 
 	}
 }
@@ -19,6 +19,7 @@
 #include <slack/std.h>
 #include <slack/fio.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -46,7 +47,7 @@ vpl_data_t *tap_connect(char *sock_name)
 
 	verbose(2, "[vpl_connect]:: starting connection.. ");
 	vpl_data_t *pri = (vpl_data_t *)malloc(sizeof(vpl_data_t));
-	bzero(pri, sizeof(sizeof(vpl_data_t)));
+	bzero(pri, sizeof(vpl_data_t));
 
 	// initialize the vpl_data structure.. much of it is unused here.
 	// we are reusing vpl_data_t to minimize the changes for other code.
@@ -93,44 +94,55 @@ vpl_data_t *tap_connect(char *sock_name)
 int tap_recvfrom(vpl_data_t *vpl, void *buf, int len)
 {
 	int n;
-	uchar localbuf[MAX_MESSAGE_SIZE];
-
-	while (((n = read(vpl->data, localbuf, len)) < 0) && (errno == EINTR))
+	uchar pi[4];
+	struct iovec iov[2];
+
+	// the 4 bytes prepended to the packet go to pi..
+	iov[0].iov_base = pi;
+	iov[0].iov_len = sizeof(pi);
+	iov[1].iov_base = buf;
+	iov[1].iov_len = len;
+	while (((n = readv(vpl->data, iov, 2)) < 0) && (errno == EINTR))
 		;
+	vpl->rx_calls++;
 
 	if (n < 0) {
 		if (errno == EAGAIN)
 			return (0);
 		return (-errno);
-	} else if (n == 0)
+	} else if (n <= 4)
 		return (-ENOTCONN);
 
-	// strip the 4 bytes prepended to the packet..
-	bcopy((localbuf+4), buf, n-4);
-
+	vpl->rx_frames++;
 	return (n-4);
 }
 
 
 /*
- * Send packet through the tap interface pointed by the vpl data structure..
+ * Send a packet through the tap interface pointed by the vpl data structure..
+ * the frame is gathered from the niov pieces in iov (at most VPL_MAX_IOV).
  */
 
-int tap_sendto(vpl_data_t *vpl, void *buf, int len)
+int tap_sendv(vpl_data_t *vpl, struct iovec *iov, int niov)
 {
 	int n;
-	uchar localbuf[MAX_MESSAGE_SIZE];
+	uchar pi[4];
+	struct iovec piov[VPL_MAX_IOV + 1];
 
-	bzero(localbuf, MAX_MESSAGE_SIZE);
-	bcopy(buf, (localbuf+4), len);
+	bzero(pi, sizeof(pi));
+	piov[0].iov_base = pi;
+	piov[0].iov_len = sizeof(pi);
+	memcpy(&(piov[1]), iov, niov * sizeof(struct iovec));
 
-	while(((n = write(vpl->data, localbuf, len+4)) < 0) && (errno == EINTR)) ;
+	while(((n = writev(vpl->data, piov, niov+1)) < 0) && (errno == EINTR)) ;
+	vpl->tx_calls++;
 	if(n < 0)
 	{
 		if(errno == EAGAIN) return(0);
 		return(-errno);
 	}
 	else if(n == 0) return(-ENOTCONN);
+	vpl->tx_frames++;
 	return(n);
 }
 
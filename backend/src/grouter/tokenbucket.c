@@ -0,0 +1,111 @@
+/*
+ * tokenbucket.c (token bucket rate limiter)
+ *
+ * Tokens are counted in bytes and refilled lazily from a monotonic
+ * clock whenever the bucket is consulted, so an idle bucket costs
+ * nothing. A bucket with rate 0 is unlimited and never delays.
+ */
+
+#include <slack/std.h>
+#include <slack/err.h>
+#include <pthread.h>
+#include <time.h>
+#include "grouter.h"
+#include "tokenbucket.h"
+
+
+#define MIN_BURST_BYTES             1514          // always allow one full frame
+
+
+static double burstBytes(int ratekbps, int burst)
+{
+	// default burst: 10 milliseconds worth of traffic
+	if (burst <= 0)
+		burst = (int)(ratekbps * 1000.0 / 8.0 / 100.0);
+	if (burst < MIN_BURST_BYTES)
+		burst = MIN_BURST_BYTES;
+	return (double)burst;
+}
+
+
+void initTokenBucket(tokenbucket_t *tb, int ratekbps, int burst)
+{
+	pthread_mutex_init(&(tb->tblock), NULL);
+	tb->rate = ratekbps * 1000.0 / 8.0;
+	tb->burst = burstBytes(ratekbps, burst);
+	tb->tokens = tb->burst;
+	tb->last = getTimeNanos();
+}
+
+
+/*
+ * change the rate and burst of a bucket that may be in use by
+ * the scheduler. the bucket is refilled to the new burst size.
+ */
+void setTokenBucket(tokenbucket_t *tb, int ratekbps, int burst)
+{
+	pthread_mutex_lock(&(tb->tblock));
+	tb->rate = ratekbps * 1000.0 / 8.0;
+	tb->burst = burstBytes(ratekbps, burst);
+	tb->tokens = tb->burst;
+	tb->last = getTimeNanos();
+	pthread_mutex_unlock(&(tb->tblock));
+}
+
+
+/*
+ * try to take size bytes worth of tokens from the bucket.
+ * RETURNS 0 if the tokens were taken, otherwise the number of
+ * microseconds the caller should wait before trying again.
+ */
+long tokenBucketDelay(tokenbucket_t *tb, int size)
+{
+	unsigned long long now;
+	double need;
+	long waitus;
+
+	pthread_mutex_lock(&(tb->tblock));
+	if (tb->rate <= 0.0)
+	{
+		pthread_mutex_unlock(&(tb->tblock));
+		return 0;
+	}
+
+	now = getTimeNanos();
+	tb->tokens += (now - tb->last) * tb->rate / 1e9;
+	if (tb->tokens > tb->burst)
+		tb->tokens = tb->burst;
+	tb->last = now;
+
+	// a frame bigger than the burst goes out on a full bucket and
+	// leaves it in debt, otherwise it would never be released
+	need = (size > tb->burst) ? tb->burst : size;
+	if (tb->tokens >= need)
+	{
+		tb->tokens -= size;
+		waitus = 0;
+	} else
+		waitus = (long)((need - tb->tokens) * 1e6 / tb->rate) + 1;
+	pthread_mutex_unlock(&(tb->tblock));
+
+	return waitus;
+}
+
+
+/*
+ * block the caller until size bytes worth of tokens are available
+ * and take them. the sleep is computed from the token deficit, so
+ * the caller wakes up exactly when the packet is allowed to leave.
+ */
+void tokenBucketWait(tokenbucket_t *tb, int size)
+{
+	long waitus;
+	struct timespec ts;
+
+	while ((waitus = tokenBucketDelay(tb, size)) > 0)
+	{
+		ts.tv_sec = waitus / 1000000;
+		ts.tv_nsec = (waitus % 1000000) * 1000;
+		nanosleep(&ts, NULL);
+	}
+}
@@ -0,0 +1,371 @@
+/*
+ * trace.c (binary trace rings)
+ *
+ * Every thread that hits an enabled trace point gets its own ring of
+ * TRACE_RING_SIZE records the first time, so recording takes no lock
+ * and shares no cache line with other threads. A ring keeps the last
+ * records written (flight recorder). The reader (trace command) copies
+ * the records and drops the ones the writer may have overwritten while
+ * they were copied; records from all rings are merged by time stamp.
+ */
+
+#include <slack/err.h>
+#include <slack/prog.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "trace.h"
+
+
+volatile long trace_level = 1;
+volatile unsigned long trace_mask = 0;
+
+tracering_t *trace_rings[MAX_TRACE_RINGS];
+volatile int trace_nrings = 0;
+
+static __thread tracering_t *trace_ring = NULL;
+static __thread int trace_noring = 0;
+
+traceevent_t trace_events[TRACE_NEVENTS] =
+{
+	{"rx", {TRACE_ARG_INT, TRACE_ARG_INT, TRACE_ARG_NONE}},
+	{"tx", {TRACE_ARG_INT, TRACE_ARG_INT, TRACE_ARG_NONE}},
+	{"drop", {TRACE_ARG_INT, TRACE_ARG_INT, TRACE_ARG_NONE}},
+	{"route", {TRACE_ARG_IP, TRACE_ARG_IP, TRACE_ARG_INT}},
+	{"noroute", {TRACE_ARG_IP, TRACE_ARG_NONE, TRACE_ARG_NONE}},
+	{"arp-hit", {TRACE_ARG_IP, TRACE_ARG_INT, TRACE_ARG_INT}},
+	{"arp-miss", {TRACE_ARG_IP, TRACE_ARG_NONE, TRACE_ARG_NONE}},
+	{"ip-local", {TRACE_ARG_NIP, TRACE_ARG_NONE, TRACE_ARG_NONE}},
+	{"ip-forward", {TRACE_ARG_NIP, TRACE_ARG_NIP, TRACE_ARG_INT}}
+};
+
+
+/*
+ * the verbosity level is read on every VERBOSE trace point: keep a
+ * copy that does not need a call to libslack
+ */
+void traceSetVerbosity(long level)
+{
+	prog_set_verbosity_level(level);
+	trace_level = level;
+}
+
+
+static tracering_t *traceNewRing(void)
+{
+	tracering_t *r;
+	int id;
+
+	if ((trace_nrings >= MAX_TRACE_RINGS) ||
+	    ((id = __sync_fetch_and_add(&trace_nrings, 1)) >= MAX_TRACE_RINGS))
+		return NULL;
+	if ((r = (tracering_t *)calloc(1, sizeof(tracering_t))) == NULL)
+	{
+		error("[traceNewRing]:: unable to allocate memory for the trace ring ");
+		return NULL;
+	}
+	r->id = id;
+	r->threadid = pthread_self();
+	__sync_synchronize();
+	trace_rings[id] = r;
+	return r;
+}
+
+
+void traceRecord(int event, uint32_t a0, uint32_t a1, uint32_t a2)
+{
+	tracering_t *r = trace_ring;
+	tracerec_t *rec;
+
+	if (r == NULL)
+	{
+		if (trace_noring || ((r = trace_ring = traceNewRing()) == NULL))
+		{
+			trace_noring = 1;              // out of rings, this thread does not record
+			return;
+		}
+	}
+
+	rec = &(r->rec[r->head & (TRACE_RING_SIZE - 1)]);
+	rec->ts = getTimeNanos();
+	rec->event = event;
+	rec->ring = r->id;
+	rec->arg[0] = a0;
+	rec->arg[1] = a1;
+	rec->arg[2] = a2;
+	__sync_synchronize();
+	r->head++;
+}
+
+
+/*
+ * enable or disable an event by name ("all" for every event)
+ */
+int traceSetEvent(char *name, int on)
+{
+	unsigned long bits = 0;
+	int i;
+
+	if (!strcmp(name, "all"))
+		bits = TRACE_BIT(TRACE_NEVENTS) - 1;
+	else
+		for (i = 0; i < TRACE_NEVENTS; i++)
+			if (!strcmp(name, trace_events[i].name))
+				bits = TRACE_BIT(i);
+	if (bits == 0)
+		return EXIT_FAILURE;
+
+	if (on)
+		__sync_fetch_and_or(&trace_mask, bits);
+	else
+		__sync_fetch_and_and(&trace_mask, ~bits);
+	return EXIT_SUCCESS;
+}
+
+
+void traceClear(void)
+{
+	int i;
+
+	for (i = 0; (i < trace_nrings) && (i < MAX_TRACE_RINGS); i++)
+		if (trace_rings[i] != NULL)
+			trace_rings[i]->start = trace_rings[i]->head;
+}
+
+
+static int traceCompare(const void *a, const void *b)
+{
+	const tracerec_t *ra = a, *rb = b;
+
+	if (ra->ts < rb->ts)
+		return -1;
+	return (ra->ts > rb->ts);
+}
+
+
+/*
+ * copy the records of all rings into a new array, oldest first.
+ * returns the number of records.
+ */
+static int traceCollect(tracerec_t **recs)
+{
+	tracering_t *r;
+	tracerec_t *out;
+	unsigned long head, now, pos, first, valid, skip;
+	int i, n = 0, nrings = trace_nrings;
+
+	if (nrings > MAX_TRACE_RINGS)
+		nrings = MAX_TRACE_RINGS;
+	if ((out = (tracerec_t *)malloc((nrings * TRACE_RING_SIZE + 1) * sizeof(tracerec_t))) == NULL)
+	{
+		error("[traceCollect]:: unable to allocate memory for the trace records ");
+		*recs = NULL;
+		return 0;
+	}
+
+	for (i = 0; i < nrings; i++)
+	{
+		if ((r = trace_rings[i]) == NULL)
+			continue;
+		head = r->head;
+		first = (head > TRACE_RING_SIZE) ? head - TRACE_RING_SIZE : 0;
+		if (first < r->start)
+			first = r->start;
+		for (pos = first; pos < head; pos++)
+			out[n + pos - first] = r->rec[pos & (TRACE_RING_SIZE - 1)];
+		__sync_synchronize();
+
+		// the writer may have overwritten the oldest records meanwhile:
+		// while it writes record now, record now - TRACE_RING_SIZE is gone
+		now = r->head;
+		valid = (now >= TRACE_RING_SIZE) ? now - TRACE_RING_SIZE + 1 : 0;
+		skip = (valid > first) ? valid - first : 0;
+		if (skip > head - first)
+			skip = head - first;
+		memmove(&out[n], &out[n + skip], (head - first - skip) * sizeof(tracerec_t));
+		n += head - first - skip;
+	}
+
+	qsort(out, n, sizeof(tracerec_t), traceCompare);
+	*recs = out;
+	return n;
+}
+
+
+static char *traceDropReason(uint32_t reason)
+{
+	switch (reason)
+	{
+	case TRACE_DROP_FILTER:
+		return "filter";
+	case TRACE_DROP_TXQ:
+		return "txq-full";
+	case TRACE_DROP_TTL:
+		return "ttl";
+	case TRACE_DROP_QUEUE:
+		return "queue-full";
+	case TRACE_DROP_AQM:
+		return "aqm";
+	}
+	return "?";
+}
+
+
+static void tracePrintRecord(tracerec_t *rec, traceevent_t *events, int nevents, unsigned long long t0)
+{
+	char tmpbuf[MAX_TMPBUF_LEN];
+	uchar ip[4], tmpip[4];
+	int i;
+
+	printf("%14.3f  %3d  %-10s", (rec->ts - t0) / 1000.0, rec->ring,
+	       (rec->event < nevents) ? events[rec->event].name : "?");
+	for (i = 0; (rec->event < nevents) && (i < TRACE_MAX_ARGS); i++)
+	{
+		if ((rec->event == TRACE_DROP) && (i == 0))
+		{
+			printf("  %-15s", traceDropReason(rec->arg[0]));
+			continue;
+		}
+		switch (events[rec->event].kind[i])
+		{
+		case TRACE_ARG_INT:
+			printf("  %-15u", rec->arg[i]);
+			break;
+		case TRACE_ARG_HEX:
+			printf("  0x%-13x", rec->arg[i]);
+			break;
+		case TRACE_ARG_IP:
+			memcpy(ip, &(rec->arg[i]), 4);
+			printf("  %-15s", IP2Dot(tmpbuf, ip));
+			break;
+		case TRACE_ARG_NIP:
+			memcpy(ip, &(rec->arg[i]), 4);
+			printf("  %-15s", IP2Dot(tmpbuf, gNtohl(tmpip, ip)));
+			break;
+		}
+	}
+	printf("\n");
+}
+
+
+static void tracePrintRecords(tracerec_t *recs, int n, int count, traceevent_t *events, int nevents)
+{
+	int i;
+
+	if (count <= 0)
+		count = TRACE_DEFAULT_SHOW;
+	printf("%d records, the last %d: \n", n, (count < n) ? count : n);
+	printf("%14s  %3s  %-10s  %s\n", "Time (us)", "Thr", "Event", "Arguments");
+	for (i = (n > count) ? n - count : 0; i < n; i++)
+		tracePrintRecord(&recs[i], events, nevents, recs[0].ts);
+}
+
+
+/*
+ * print the last count records of all threads, oldest first. times are
+ * relative to the oldest record kept.
+ */
+void traceShow(int count)
+{
+	tracerec_t *recs;
+	int n;
+
+	n = traceCollect(&recs);
+	if (n == 0)
+		printf("No trace records \n");
+	else
+		tracePrintRecords(recs, n, count, trace_events, TRACE_NEVENTS);
+	free(recs);
+}
+
+
+void traceList(void)
+{
+	tracering_t *r;
+	int i;
+
+	printf("Event\t\tState \n");
+	for (i = 0; i < TRACE_NEVENTS; i++)
+		printf("%-16s%s \n", trace_events[i].name, (trace_mask & TRACE_BIT(i)) ? "on" : "off");
+	printf("Thread\tRecords written \n");
+	for (i = 0; (i < trace_nrings) && (i < MAX_TRACE_RINGS); i++)
+		if ((r = trace_rings[i]) != NULL)
+			printf("%d\t%lu \n", r->id, r->head - r->start);
+#ifdef NO_TRACE
+	printf("Trace points are not compiled in (NO_TRACE) \n");
+#endif
+}
+
+
+/*
+ * write the records (with the event table needed to decode them) to a file
+ */
+int traceDump(char *fname)
+{
+	tracefile_t hdr;
+	tracerec_t *recs;
+	FILE *fp;
+	int n, status = EXIT_SUCCESS;
+
+	if ((fp = fopen(fname, "wb")) == NULL)
+	{
+		error("[traceDump]:: unable to open %s ", fname);
+		return EXIT_FAILURE;
+	}
+	n = traceCollect(&recs);
+	hdr.magic = TRACE_FILE_MAGIC;
+	hdr.version = TRACE_FILE_VERSION;
+	hdr.nevents = TRACE_NEVENTS;
+	hdr.nrecs = n;
+	if ((fwrite(&hdr, sizeof(tracefile_t), 1, fp) != 1) ||
+	    (fwrite(trace_events, sizeof(traceevent_t), TRACE_NEVENTS, fp) != TRACE_NEVENTS) ||
+	    (fwrite(recs, sizeof(tracerec_t), n, fp) != n))
+	{
+		error("[traceDump]:: unable to write %s ", fname);
+		status = EXIT_FAILURE;
+	}
+	fclose(fp);
+	free(recs);
+	if (status == EXIT_SUCCESS)
+		printf("%d records written to %s \n", n, fname);
+	return status;
+}
+
+
+/*
+ * print the last count records of a file written by traceDump
+ */
+int traceDecode(char *fname, int count)
+{
+	tracefile_t hdr;
+	traceevent_t *events = NULL;
+	tracerec_t *recs = NULL;
+	FILE *fp;
+	int status = EXIT_FAILURE;
+
+	if ((fp = fopen(fname, "rb")) == NULL)
+	{
+		error("[traceDecode]:: unable to open %s ", fname);
+		return EXIT_FAILURE;
+	}
+	if ((fread(&hdr, sizeof(tracefile_t), 1, fp) != 1) ||
+	    (hdr.magic != TRACE_FILE_MAGIC) || (hdr.version != TRACE_FILE_VERSION))
+		error("[traceDecode]:: %s is not a trace file ", fname);
+	else if (((events = calloc(hdr.nevents + 1, sizeof(traceevent_t))) == NULL) ||
+		 ((recs = calloc(hdr.nrecs + 1, sizeof(tracerec_t))) == NULL))
+		error("[traceDecode]:: unable to allocate memory for the trace ");
+	else if ((fread(events, sizeof(traceevent_t), hdr.nevents, fp) != hdr.nevents) ||
+		 (fread(recs, sizeof(tracerec_t), hdr.nrecs, fp) != hdr.nrecs))
+		error("[traceDecode]:: %s is truncated ", fname);
+	else
+	{
+		if (hdr.nrecs == 0)
+			printf("No trace records \n");
+		else
+			tracePrintRecords(recs, hdr.nrecs, count, events, hdr.nevents);
+		status = EXIT_SUCCESS;
+	}
+	free(events);
+	free(recs);
+	fclose(fp);
+	return status;
+}
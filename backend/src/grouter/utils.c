@@ -148,31 +148,6 @@ void redefineSignalHandler(int sigid, void (*my_func)(int signum))
 
 
 
-/*
- * compute the checksum of a buffer, by adding 2-byte words
- * and returning their one's complement
- */
-ushort checksum(uchar *buf, int iwords)
-{
-	unsigned long cksum = 0;
-	int i;
-
-	for(i = 0; i < iwords; i++)
-	{
-		cksum += buf[0] << 8;
-		cksum += buf[1];
-		buf += 2;
-	}
-
-	// add in all carries
-	while (cksum >> 16)
-		cksum = (cksum & 0xFFFF) + (cksum >> 16);
-
-	verbose(2, "[checksum]:: computed %x ..", ~cksum);
-
-	return (unsigned short) (~cksum);
-}
-
 double subTimeVal(struct timeval *v2, struct timeval *v1)
 {
 	double val2, val1;
@@ -190,6 +165,20 @@ void printTimeVal(struct timeval *v)
 }
 
 
+/*
+ * return a monotonic time stamp in nanoseconds. unlike gettimeofday()
+ * this does not jump when the wall clock is adjusted, so it is safe
+ * to use for rate computations inside the packet core.
+ */
+unsigned long long getTimeNanos()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
 
 
 
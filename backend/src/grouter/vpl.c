@@ -11,6 +11,7 @@
  * Licensed under the GPL.
  */
 
+#define _GNU_SOURCE                   // recvmmsg, sendmmsg
 #include "grouter.h"
 #include "vpl.h"
 #include "simplequeue.h"
@@ -21,7 +22,7 @@
 #include <slack/std.h>
 #include <slack/fio.h>
 #include <sys/stat.h>
-#include "gpcap.h"
+#include "capture.h"
 
 /*
  * Some global variables! These global variables are used for visualizing the
@@ -30,8 +31,6 @@
  */
 int consoleid;                        // FIFO id
 char consolepath[MAX_NAME_LEN];
-pthread_t console_threadid;
-simplequeue_t *consoleq;
 int infoid;
 char infopath[MAX_NAME_LEN];
 pthread_t info_threadid;
@@ -94,7 +93,7 @@ vpl_data_t *vpl_connect(char *vsock_name)
 
 	verbose(2, "[vpl_connect]:: starting connection.. ");
 	vpl_data_t *pri = (vpl_data_t *)malloc(sizeof(vpl_data_t));
-	bzero(pri, sizeof(sizeof(vpl_data_t)));
+	bzero(pri, sizeof(vpl_data_t));
 	pri->sock_type = "unix";
 	pri->ctl_sock = strdup(vsock_name);
 	pri->ctl_addr = new_addr(pri->ctl_sock,
@@ -197,6 +196,7 @@ vpl_data_t *vpl_create_server(char *name)
 		verbose(2, "[vpl_create_server]:: memory allocation error ");
 		return NULL;
 	}
+	bzero(vdata, sizeof(vpl_data_t));
 	vdata->sock_type = "unix";
 	vdata->ctl_sock = strdup(name);
 	vdata->data_addr = NULL;
@@ -324,17 +324,22 @@ int vpl_accept_connect(vpl_data_t *v)
  */
 int vpl_recvfrom(vpl_data_t *vpl, void *buf, int len)
 {
+        struct iovec iov;
         int n;
 
         while(((n = recvfrom(vpl->data,  buf,  len, 0, NULL, NULL)) < 0) &&
               (errno == EINTR)) ;
 
+        vpl->rx_calls++;
         if(n < 0){
                 if(errno == EAGAIN) return(0);
                 return(-errno);
         }
         else if(n == 0) return(-ENOTCONN);
-		copy2Queue(consoleq, buf, n);
+		vpl->rx_frames++;
+		iov.iov_base = buf;
+		iov.iov_len = n;
+		captureFrame(&iov, 1, n, CAPTURE_RX);
         return(n);
 }
 
@@ -342,12 +347,125 @@ int vpl_recvfrom(vpl_data_t *vpl, void *buf, int len)
 int vpl_sendto(vpl_data_t *vpl, void *buf, int len)
 {
 	struct sockaddr_un *data_addr = vpl->data_addr;
+	struct iovec iov;
 
-	copy2Queue(consoleq, buf, len);
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	captureFrame(&iov, 1, len, CAPTURE_TX);
+	vpl->tx_calls++;
+	vpl->tx_frames++;
 	return(__vpl_sendto(vpl->data, buf, len, data_addr, sizeof(*data_addr)));
 }
 
 
+/*
+ * Receive up to nbufs frames with one system call. Frame i is scattered
+ * over the niov buffers iovs[i * niov] to iovs[i * niov + niov - 1]
+ * (at most VPL_MAX_IOV); lens gets the size of each frame. Returns the
+ * number of frames received, or 0/-errno like vpl_recvfrom.
+ */
+static int __vpl_recvmmsg(vpl_data_t *vpl, struct iovec *iovs, int niov, int *lens, int nbufs, int flags)
+{
+	struct mmsghdr msgs[VPL_MAX_BATCH];
+	int i, n;
+
+	if (nbufs > VPL_MAX_BATCH)
+		nbufs = VPL_MAX_BATCH;
+	bzero(msgs, nbufs * sizeof(struct mmsghdr));
+	for (i = 0; i < nbufs; i++)
+	{
+		msgs[i].msg_hdr.msg_iov = &(iovs[i * niov]);
+		msgs[i].msg_hdr.msg_iovlen = niov;
+	}
+
+	while (((n = recvmmsg(vpl->data, msgs, nbufs, flags, NULL)) < 0) &&
+	       (errno == EINTR))
+		;
+
+	vpl->rx_calls++;
+	if (n < 0)
+	{
+		if (errno == EAGAIN) return 0;
+		return -errno;
+	} else if (n == 0)
+		return -ENOTCONN;
+
+	vpl->rx_frames += n;
+	for (i = 0; i < n; i++)
+	{
+		lens[i] = msgs[i].msg_len;
+		captureFrame(&(iovs[i * niov]), niov, lens[i], CAPTURE_RX);
+	}
+	return n;
+}
+
+
+/*
+ * Blocks until the first frame arrives and then takes the frames that
+ * are already waiting.
+ */
+int vpl_recvmmsg(vpl_data_t *vpl, struct iovec *iovs, int niov, int *lens, int nbufs)
+{
+	return __vpl_recvmmsg(vpl, iovs, niov, lens, nbufs, MSG_WAITFORONE);
+}
+
+
+/*
+ * Takes the frames that are waiting without blocking; returns 0 if
+ * there are none (used by the I/O reactor, see reactor.c).
+ */
+int vpl_tryrecvmmsg(vpl_data_t *vpl, struct iovec *iovs, int niov, int *lens, int nbufs)
+{
+	return __vpl_recvmmsg(vpl, iovs, niov, lens, nbufs, MSG_DONTWAIT);
+}
+
+
+/*
+ * Send nbufs frames with as few system calls as possible. Frame i is
+ * gathered from the next niovs[i] buffers of iovs. Returns the number
+ * of frames sent, or -errno if the first call fails.
+ */
+int vpl_sendmmsg(vpl_data_t *vpl, struct iovec *iovs, int *niovs, int nbufs)
+{
+	struct mmsghdr msgs[VPL_MAX_BATCH];
+	struct sockaddr_un *data_addr = vpl->data_addr;
+	int i, j, n, len, sent = 0;
+
+	if (nbufs > VPL_MAX_BATCH)
+		nbufs = VPL_MAX_BATCH;
+	bzero(msgs, nbufs * sizeof(struct mmsghdr));
+	for (i = 0; i < nbufs; i++)
+	{
+		for (j = 0, len = 0; j < niovs[i]; j++)
+			len += iovs[j].iov_len;
+		captureFrame(iovs, niovs[i], len, CAPTURE_TX);
+		msgs[i].msg_hdr.msg_name = data_addr;
+		msgs[i].msg_hdr.msg_namelen = sizeof(*data_addr);
+		msgs[i].msg_hdr.msg_iov = iovs;
+		msgs[i].msg_hdr.msg_iovlen = niovs[i];
+		iovs += niovs[i];
+	}
+
+	// a datagram socket may take fewer messages than given; send the rest
+	while (sent < nbufs)
+	{
+		while (((n = sendmmsg(vpl->data, msgs + sent, nbufs - sent, 0)) < 0) &&
+		       (errno == EINTR))
+			;
+		vpl->tx_calls++;
+		if (n <= 0)
+		{
+			if (sent > 0) break;
+			if ((n < 0) && (errno != EAGAIN)) return -errno;
+			return 0;
+		}
+		sent += n;
+	}
+	vpl->tx_frames += sent;
+	return sent;
+}
+
+
 
 /*
  * Cast the address in appropriate format for the socket.
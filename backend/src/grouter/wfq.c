@@ -1,164 +1,93 @@
 #include <slack/std.h>
-#include <slack/map.h>
-#include <slack/list.h>
 #include <pthread.h>
-#include "protocols.h"
-#include "packetcore.h"
-#include "message.h"
 #include "grouter.h"
+#include "pktsched.h"
+
+/*
+ * WF2Q+ (worst-case fair weighted fair queuing, Bennett and Zhang): one
+ * part of the scheduler engine (see sched.c).
+ *
+ * Each backlogged queue has the virtual start (stime) and finish time
+ * (ftime) of its head packet; the head packet of a queue of weight w
+ * takes len / w of virtual time. A queue is eligible once its start
+ * time is not after the system virtual time (vtime), and the eligible
+ * queue with the smallest finish time sends. Eligible queues are on the
+ * ready heap keyed by finish time, the others on the wait heap keyed by
+ * start time, so a decision is O(log Q).
+ *
+ * The virtual time advances by len / (weight of the backlogged queues)
+ * per packet sent and jumps to the smallest start time when no queue is
+ * eligible. Virtual times start from 0 again with each busy period (the
+ * epoch of a queue tells whether its finish time is from this one).
+ */
+
+#define WF2Q_MIN_WEIGHT             0.001
+
+
+static void wf2qPlace(sched_t *s, schedq_t *sq)
+{
+	if (sq->stime <= s->vtime)
+		schedHeapPush(s, SCHED_HEAP_READY, sq, sq->ftime);
+	else
+		schedHeapPush(s, SCHED_HEAP_WAIT, sq, sq->stime);
+}
 
-// WCWeightedFairScheduler: is one part of the W+FQ scheduler.
-// It picks the appropriate job from the system of queues.
-// If no job in packet core.. the thread waits.
-// If there is job, select a Queue and then the job at the head of the Queue
-// for running. Update the algorithm parameters and store them back on the queue
-// datastructure: start, finish times for the queue and virtual time for the system.
 
-// TODO: Debug this function..
+static void wf2qActivate(sched_t *s, schedq_t *sq, int len)
+{
+	if (sq->epoch != s->epoch)
+	{
+		sq->ftime = 0.0;
+		sq->epoch = s->epoch;
+	}
+	// weight changes (queue mod) apply from the next busy period of the queue
+	sq->weight = max(sq->q->weight, WF2Q_MIN_WEIGHT);
+	sq->stime = max(s->vtime, sq->ftime);
+	sq->ftime = sq->stime + len / sq->weight;
+	s->bweight += sq->weight;
+	wf2qPlace(s, sq);
+}
 
-extern router_config rconfig;
 
-void *weightedFairScheduler(void *pc)
+static schedq_t *wf2qSelect(sched_t *s)
 {
-	pktcore_t *pcore = (pktcore_t *)pc;
-	List *keylst;
-	simplequeue_t *nxtq, *thisq;
-	char *nxtkey, *savekey;
-	double minftime, minstime, tweight;
-	int pktsize, npktsize;
-	gpacket_t *in_pkt, *nxt_pkt;
+	schedq_t *sq;
 
-	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);       // die as soon as cancelled
 	while (1)
 	{
-		verbose(2, "[weightedFairScheduler]:: Worst-case weighted fair queuing scheduler processing..");
-
-		pthread_mutex_lock(&(pcore->qlock));
-		if (pcore->packetcnt == 0)
-			pthread_cond_wait(&(pcore->schwaiting), &(pcore->qlock));
-		pthread_mutex_unlock(&(pcore->qlock));
-
-		pthread_testcancel();
-
-		keylst = map_keys(pcore->queues);
-		while (list_has_next(keylst) == 1)
-		{
-			nxtkey = list_next(keylst);
-			nxtq = map_get(pcore->queues, nxtkey);
-			if (nxtq->cursize == 0)
-				continue;
-			if ((nxtq->stime <= pcore->vclock) && (nxtq->ftime < minftime))
-			{
-				savekey = nxtkey;
-				minftime = nxtq->ftime;
-			}
-		}
-		list_release(keylst);
-
-		// if savekey is NULL then release the lock..
-		if (savekey == NULL)
-			continue;
-		else
+		// queues that became eligible since the virtual time advanced
+		while (((sq = schedHeapTop(s, SCHED_HEAP_WAIT)) != NULL) && (sq->stime <= s->vtime))
 		{
-			thisq = map_get(pcore->queues, savekey);
-			readQueue(thisq, (void **)&in_pkt, &pktsize);
-			writeQueue(pcore->workQ, in_pkt, pktsize);
-			pthread_mutex_lock(&(pcore->qlock));
-			pcore->packetcnt--;
-			pthread_mutex_unlock(&(pcore->qlock));
-
-			peekQueue(thisq, (void **)&nxt_pkt, &npktsize);
-			if (npktsize)
-			{
-				thisq->stime = thisq->ftime;
-				thisq->ftime = thisq->stime + npktsize/thisq->weight;
-			}
-
-			minstime = thisq->stime;
-			tweight = 0.0;
-		
-			keylst = map_keys(pcore->queues);
-			while (list_has_next(keylst) == 1)
-			{
-				nxtkey = list_next(keylst);
-				nxtq = map_get(pcore->queues, nxtkey);
-				tweight += nxtq->weight;
-				if ((nxtq->cursize > 0) && (nxtq->stime < minstime))
-					minstime = nxtq->stime;
-			}
-			list_release(keylst);
-			pcore->vclock = max(minstime, (pcore->vclock + ((double)pktsize)/tweight));
+			schedHeapRemove(s, sq);
+			schedHeapPush(s, SCHED_HEAP_READY, sq, sq->ftime);
 		}
+		if ((sq = schedHeapTop(s, SCHED_HEAP_READY)) != NULL)
+			return sq;
+		s->vtime = schedHeapTop(s, SCHED_HEAP_WAIT)->stime;
 	}
 }
 
 
-
-
-// WCWeightFairQueuer: function called by the classifier to enqueue
-// the packets.. 
-// TODO: Debug this function...
-int weightedFairQueuer(pktcore_t *pcore, gpacket_t *in_pkt, int pktsize, char *qkey)
+static void wf2qServed(sched_t *s, schedq_t *sq, int len, int nextlen)
 {
-	simplequeue_t *thisq, *nxtq;
-	double minftime, minstime, tweight;
-	List *keylst;
-	char *nxtkey, *savekey;
-
-	verbose(2, "[weightedFairQueuer]:: Worst-case weighted fair queuing scheduler processing..");
-
-	pthread_mutex_lock(&(pcore->qlock));
-
-	thisq = map_get(pcore->queues, qkey);
-	if (thisq == NULL)
-	{
-		fatal("[weightedFairQueuer]:: Invalid %s key presented for queue addition", qkey);
-		pthread_mutex_unlock(&(pcore->qlock));
-		return EXIT_FAILURE;             // packet dropped..
-	}
-
-	printf("Checking the queue size \n");
-	if (thisq->cursize == 0)
+	schedHeapRemove(s, sq);
+	s->vtime += len / s->bweight;
+	if (nextlen > 0)
 	{
-		verbose(2, "[weightedFairQueuer]:: inserting the first element.. ");
-		thisq->stime = max(pcore->vclock, thisq->ftime);
-		thisq->ftime = thisq->stime + pktsize/thisq->weight;
+		sq->stime = sq->ftime;
+		sq->ftime = sq->stime + nextlen / sq->weight;
+		wf2qPlace(s, sq);
+	} else
+		s->bweight -= sq->weight;
+}
 
-		minstime = thisq->stime;
 
-		keylst = map_keys(pcore->queues);
-		
-		while (list_has_next(keylst) == 1)
-		{
-			nxtkey = list_next(keylst);
-
-			nxtq = map_get(pcore->queues, nxtkey);
-			
-			if ((nxtq->cursize > 0) && (nxtq->stime < minstime))
-				minstime = nxtq->stime;
-		}
-		list_release(keylst);
+static void wf2qRemove(sched_t *s, schedq_t *sq)
+{
+	schedHeapRemove(s, sq);
+	s->bweight -= sq->weight;
+}
 
-		pcore->vclock = max(minstime, pcore->vclock);
-		// insert the packet... and increment variables..
-		writeQueue(thisq, in_pkt, pktsize);
-		pcore->packetcnt++;
 
-		// wake up scheduler if it was waiting..
-		if (pcore->packetcnt == 1)
-			pthread_cond_signal(&(pcore->schwaiting));
-		pthread_mutex_unlock(&(pcore->qlock));
-		return EXIT_SUCCESS;
-	} else if (thisq->cursize < thisq->maxsize)
-	{
-		// insert packet and setup variables..
-		writeQueue(thisq, in_pkt, pktsize);
-		pcore->packetcnt++;
-		pthread_mutex_unlock(&(pcore->qlock));
-		return EXIT_SUCCESS;
-	} else {
-		verbose(2, "[weightedFairQueuer]:: Packet dropped.. Queue for %s is full ", qkey);
-		pthread_mutex_unlock(&(pcore->qlock));
-		return EXIT_SUCCESS;
-	}
-}
+schedpolicy_t sched_wf2q = {"wfq", "WF2Q+ weighted fair queuing, by queue weight",
+			    wf2qActivate, wf2qSelect, wf2qServed, wf2qRemove};